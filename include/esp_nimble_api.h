@@ -2,6 +2,10 @@
 
 #include <esp_err.h>
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/event_groups.h>
 #include <nimble/nimble_port.h>
 #include <nimble/nimble_port_freertos.h>
 #include <host/ble_gap.h>
@@ -12,26 +16,303 @@
 
 #define ESP_NIMBLE_API_TAG "NimBLE API"
 
-#define MAX_SUBSCRIPTIONS_PER_CONN 10
+#define MAX_SUBSCRIBED_ATTRS 16 /* Must be a power of two */
+#define CONN_HANDLE_MAP_SIZE 64  /* Must be a power of two, at least twice CONFIG_BT_NIMBLE_MAX_CONNECTIONS */
 #define BLE_GAP_APPEARANCE_GENERIC_TAG 0x0200
 #define BLE_GAP_LE_ROLE_PERIPHERAL 0x00
+#define LINK_PROFILE_MAX_RETRIES 3
+#define EXT_ADV_MAX_SETS (MYNEWT_VAL(BLE_MULTI_ADV_INSTANCES) + 1)
+#define METRICS_ERROR_CODES 32        /* NimBLE return codes 0..30, the last bucket counts all others */
+#define METRICS_DISCONNECT_REASONS 64 /* HCI error codes 0..62, the last bucket counts all others */
+#define METRICS_LATENCY_BUCKETS 8
+#define COC_DEFAULT_MTU 512 /* SDU size accepted from the peer when nimble_peripheral_coc_config_t.mtu is 0 */
+
+_Static_assert(CONFIG_BT_NIMBLE_MAX_CONNECTIONS <= 32, "nimble_peripheral_conn_mask_t holds one bit per connection slot");
+_Static_assert((MAX_SUBSCRIBED_ATTRS & (MAX_SUBSCRIBED_ATTRS - 1)) == 0, "MAX_SUBSCRIBED_ATTRS must be a power of two");
+_Static_assert((CONN_HANDLE_MAP_SIZE & (CONN_HANDLE_MAP_SIZE - 1)) == 0 && CONN_HANDLE_MAP_SIZE >= 2 * CONFIG_BT_NIMBLE_MAX_CONNECTIONS, "CONN_HANDLE_MAP_SIZE must be a power of two of at least twice the connection count");
+
+/**
+ * @brief Bitmap of connection slots, bit N refers to peripheral_conn[N]
+ */
+typedef uint32_t nimble_peripheral_conn_mask_t;
+
+/**
+ * @brief Link parameters negotiated after connect
+ *
+ * NIMBLE_PERIPHERAL_LINK_PROFILE_DEFAULT leaves PHY, data length and connection
+ * parameters to the central.
+ */
+typedef enum
+{
+    NIMBLE_PERIPHERAL_LINK_PROFILE_DEFAULT = 0,
+    NIMBLE_PERIPHERAL_LINK_PROFILE_THROUGHPUT, /* 2M PHY, 251-byte PDUs, 7.5-15 ms interval */
+    NIMBLE_PERIPHERAL_LINK_PROFILE_BALANCED,   /* 2M or 1M PHY, 251-byte PDUs, 30-50 ms interval */
+    NIMBLE_PERIPHERAL_LINK_PROFILE_LOW_POWER,  /* 1M PHY, 27-byte PDUs, 100-200 ms interval, latency 4 */
+} nimble_peripheral_link_profile_t;
 
 /**
  * @brief BLE connection context storage
  *
- * Tracks active connection state including subscribed characteristics
+ * Tracks active connection state; which characteristics the peer is subscribed
+ * to is kept in the subscriber index of nimble_peripheral_handle_t.
+ *
+ * Slots never move while a connection is active, so a conn_index handed to a
+ * callback keeps referring to the same peer until it disconnects. generation is
+ * bumped every time the slot is reused and lets applications detect stale indexes.
+ * After a disconnect the slot contents stay readable until a later connection
+ * reuses it; free slots are reused in round-robin order.
  */
 typedef struct
 {
+    bool in_use;
+    uint16_t generation;
     uint16_t conn_handle;
     uint8_t conn_addr_val[6];
     char conn_addr_str[18];
-    uint16_t notify_subscriptions[MAX_SUBSCRIPTIONS_PER_CONN];
+    uint16_t mtu;
+    nimble_peripheral_link_profile_t link_profile;
+    uint8_t link_retries;
+    uint8_t tx_phy;
+    uint8_t rx_phy;
+    uint16_t max_tx_octets;
+    uint16_t max_rx_octets;
+    uint16_t conn_itvl;
+    uint16_t conn_latency;
+    uint16_t supervision_timeout;
     int notify_subscription_count;
-    uint16_t indicate_subscriptions[MAX_SUBSCRIPTIONS_PER_CONN];
     int indicate_subscription_count;
+    uint16_t coc_mtu; /* Largest SDU the peer accepts on the CoC channel; 0 while no channel is open */
 } nimble_peripheral_conn_t;
 
+/**
+ * @brief Streaming send progress callback
+ *
+ * Runs on the NimBLE host task after every chunk handed to the stack and once more
+ * when the stream ends.
+ *
+ * @param conn_index Connection slot the stream belongs to
+ * @param bytes_sent Bytes handed to the stack so far
+ * @param total_len Total stream length
+ * @param status ESP_ERR_NOT_FINISHED while in progress, ESP_OK on completion,
+ *               ESP_ERR_INVALID_STATE if the peer disconnected, ESP_FAIL if the stack
+ *               rejected a chunk
+ * @param arg User argument passed to nimble_peripheral_stream_send()
+ */
+typedef void (*nimble_peripheral_stream_cb_t)(int conn_index, size_t bytes_sent, size_t total_len, esp_err_t status, void *arg);
+
+/**
+ * @brief One characteristic value of a nimble_peripheral_notify_batch() call
+ */
+typedef struct
+{
+    uint16_t attr_handle; /* Characteristic value handle */
+    const void *data;     /* Payload, may contain zero bytes; copied before the call returns */
+    size_t len;           /* Payload length in bytes (at most BLE_ATT_ATTR_MAX_LEN) */
+} nimble_peripheral_notify_entry_t;
+
+/**
+ * @brief Extended advertising set description
+ *
+ * Payloads are raw AD structures (length, type, value) and are copied when the set is
+ * configured, so they do not need to outlive the call. Extended (non-legacy) sets can
+ * be connectable or scannable but not both; scannable sets need a scan response.
+ */
+typedef struct
+{
+    bool connectable;
+    bool scannable;
+    bool legacy_pdu;
+    uint8_t primary_phy;   /* BLE_HCI_LE_PHY_1M or BLE_HCI_LE_PHY_CODED */
+    uint8_t secondary_phy; /* BLE_HCI_LE_PHY_1M, BLE_HCI_LE_PHY_2M or BLE_HCI_LE_PHY_CODED */
+    uint32_t itvl_min;     /* 0.625 ms units */
+    uint32_t itvl_max;     /* 0.625 ms units */
+    int8_t tx_power;       /* dBm, 127 lets the controller choose */
+    uint8_t sid;
+    int duration_ms;       /* 0 advertises until stopped */
+    int max_events;        /* 0 for no limit */
+    const uint8_t *adv_data;
+    uint16_t adv_data_len;
+    const uint8_t *rsp_data;
+    uint16_t rsp_data_len;
+} nimble_peripheral_ext_adv_set_t;
+
+/**
+ * @brief Indication completion callback
+ *
+ * Runs on the NimBLE host task exactly once per queued indication.
+ *
+ * @param conn_index Connection slot the indication was queued for
+ * @param attr_handle Characteristic value handle
+ * @param status ESP_OK when the client confirmed it, ESP_ERR_TIMEOUT if no confirmation
+ *               arrived within the ATT transaction timeout, ESP_ERR_INVALID_STATE if the
+ *               peer disconnected or unsubscribed first, ESP_FAIL if the stack rejected it
+ * @param arg User argument passed when queueing
+ */
+typedef void (*nimble_peripheral_indicate_cb_t)(int conn_index, uint16_t attr_handle, esp_err_t status, void *arg);
+
+/**
+ * @brief Subscriber index entry
+ *
+ * Maps a characteristic value handle to the connection slots subscribed to it
+ */
+typedef struct
+{
+    uint16_t attr_handle;
+    nimble_peripheral_conn_mask_t notify_conn_mask;
+    nimble_peripheral_conn_mask_t indicate_conn_mask;
+} nimble_peripheral_subscribers_t;
+
+/**
+ * @brief Per-connection counters
+ *
+ * Reset when a new connection takes the slot. latency_hist counts notifications by the
+ * time from being queued to BLE_GAP_EVENT_NOTIFY_TX, with bucket upper bounds of
+ * 1, 2, 5, 10, 20, 50 and 100 ms; the last bucket holds everything slower.
+ */
+typedef struct
+{
+    uint32_t tx_bytes;
+    uint32_t tx_pdus;
+    uint32_t rx_bytes;
+    uint32_t rx_pdus;
+    uint32_t mbuf_alloc_failures;
+    uint32_t notify_errors[METRICS_ERROR_CODES];
+    uint32_t latency_hist[METRICS_LATENCY_BUCKETS];
+    uint32_t latency_max_us;
+    uint32_t disconnect_reason;
+} nimble_peripheral_conn_metrics_t;
+
+/**
+ * @brief Component-wide metrics
+ *
+ * Every member is a uint32_t updated with relaxed atomics; read it through
+ * nimble_peripheral_metrics_snapshot() for a consistent copy of each counter.
+ */
+typedef struct
+{
+    nimble_peripheral_conn_metrics_t conn[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+    uint32_t mbuf_alloc_failures; /* Allocations not tied to a single connection */
+    uint32_t disconnect_reasons[METRICS_DISCONNECT_REASONS];
+} nimble_peripheral_metrics_t;
+
+/**
+ * @brief Cached attribute value served by nimble_peripheral_attr_access()
+ *
+ * Declare one per characteristic with NIMBLE_PERIPHERAL_ATTR_INIT(), then set
+ * access_cb to nimble_peripheral_attr_access, arg to the attribute and val_handle
+ * to &attr.val_handle in its ble_gatt_chr_def. Fields are owned by the component
+ * once registered; use the nimble_peripheral_attr_* functions to access the value.
+ */
+typedef struct
+{
+    uint8_t *value;      /* Storage of max_len bytes provided by the application */
+    uint16_t max_len;
+    uint16_t len;
+    uint16_t val_handle; /* Filled in by NimBLE through ble_gatt_chr_def.val_handle */
+    portMUX_TYPE lock;
+} nimble_peripheral_attr_t;
+
+#define NIMBLE_PERIPHERAL_ATTR_INIT(storage, initial_len) {.value = (storage), .max_len = sizeof(storage), .len = (initial_len), .val_handle = 0, .lock = portMUX_INITIALIZER_UNLOCKED}
+
+/**
+ * @brief Advertising phases reported through nimble_peripheral_on_adv_phase_cb
+ */
+typedef enum
+{
+    NIMBLE_PERIPHERAL_ADV_PHASE_PAUSED = 0, /* Not advertising: before sync or at the connection limit */
+    NIMBLE_PERIPHERAL_ADV_PHASE_FAST,       /* Burst at fast_itvl_ms after sync or a disconnect */
+    NIMBLE_PERIPHERAL_ADV_PHASE_SLOW,       /* Back-off at slow_itvl_ms once the burst has ended */
+} nimble_peripheral_adv_phase_t;
+
+/**
+ * @brief Advertising schedule
+ *
+ * After sync and after every disconnect, legacy advertising runs at fast_itvl_ms
+ * for fast_duration_ms and then steps down to slow_itvl_ms until a central
+ * connects. An all-zero schedule advertises at the controller's default interval
+ * without a burst. Advertising pauses while max_connections peers are connected.
+ * With CONFIG_BT_NIMBLE_EXT_ADV the sets keep their own intervals, so only the
+ * pausing applies: connectable sets stop at the limit, non-connectable sets keep
+ * running, and the phase is only reported as SLOW or PAUSED.
+ */
+typedef struct
+{
+    uint16_t fast_itvl_ms;     /* 0 uses the controller default */
+    uint32_t fast_duration_ms; /* 0 skips the burst */
+    uint16_t slow_itvl_ms;     /* 0 uses the controller default */
+    uint8_t max_connections;   /* 0 means CONFIG_BT_NIMBLE_MAX_CONNECTIONS */
+} nimble_peripheral_adv_schedule_t;
+
+/**
+ * @brief Occupancy of the dedicated notification mbuf pool
+ */
+typedef struct
+{
+    uint16_t blocks;     /* Pool size in blocks */
+    uint16_t free;       /* Blocks currently free */
+    uint16_t high_water; /* Most blocks ever in use at once */
+} nimble_peripheral_tx_pool_stats_t;
+
+/**
+ * @brief L2CAP connection-oriented channel server
+ *
+ * With a non-zero psm, an LE credit-based server is registered at init and each
+ * connection may open one channel next to its GATT traffic. The channel follows the
+ * connection slot: conn_index is the same as for GATT and the channel is closed when
+ * the peer disconnects.
+ *
+ * Received SDUs are handed over without copying. nimble_peripheral_on_coc_data_cb is
+ * required when psm is set: the callback owns the SDU and returns it with
+ * nimble_peripheral_coc_rx_release(); once CONFIG_ESP_NIMBLE_API_COC_RX_HELD SDUs are
+ * held, no receive buffer is posted and the peer runs out of credits. SDUs never go
+ * through the receive ring, which stays reserved for GATT and NUS writes.
+ */
+typedef struct
+{
+    uint16_t psm; /* 0 disables the server; dynamic PSMs are 0x0080-0x00FF */
+    uint16_t mtu; /* Largest SDU accepted from the peer; 0 uses COC_DEFAULT_MTU */
+    void (*nimble_peripheral_on_coc_connect_cb)(int conn_index, uint16_t peer_mtu, void *arg);
+    void (*nimble_peripheral_on_coc_disconnect_cb)(int conn_index, void *arg);
+    void (*nimble_peripheral_on_coc_data_cb)(int conn_index, struct os_mbuf *sdu, void *arg); /* Required with psm; runs on the host task */
+    void *arg;
+} nimble_peripheral_coc_config_t;
+
+/**
+ * @brief Delivery of connection callbacks from a worker task
+ *
+ * With enabled set, the connect, disconnect, subscribe, unsubscribe and link update
+ * callbacks no longer run on the NimBLE host task. The host task copies each event
+ * into a lock-free queue of CONFIG_ESP_NIMBLE_API_DISPATCH_QUEUE_SIZE records and a
+ * worker task calls the callbacks in order, so a slow callback only delays later
+ * callbacks, not GATT or GAP traffic. The event pointer refers to a copy that is valid
+ * for the duration of the callback. Component state such as peripheral_conn[] and
+ * the subscriber index is still updated on the host task, so it can be ahead of the
+ * event being delivered. A subscribe and unsubscribe of the same characteristic and
+ * connection that are both still queued cancel out and neither is delivered. Events
+ * arriving while the queue is full are dropped and counted.
+ */
+typedef struct
+{
+    bool enabled;
+    uint8_t task_priority;    /* 0 uses CONFIG_ESP_NIMBLE_API_DISPATCH_TASK_PRIORITY */
+    uint16_t task_stack_size; /* 0 uses CONFIG_ESP_NIMBLE_API_DISPATCH_TASK_STACK_SIZE */
+    bool pin_to_core;         /* Pin the worker to task_core instead of letting it run on any core */
+    uint8_t task_core;
+} nimble_peripheral_dispatch_config_t;
+
+/**
+ * @brief Counters of the callback dispatch queue, updated with relaxed atomics
+ */
+typedef struct
+{
+    uint16_t depth;      /* Records waiting for or being delivered by the worker */
+    uint16_t high_water; /* Largest depth seen */
+    uint32_t queued;
+    uint32_t delivered;
+    uint32_t dropped;    /* Lost because the queue was full */
+    uint32_t coalesced;  /* Subscribe and unsubscribe pairs cancelled before delivery */
+} nimble_peripheral_dispatch_stats_t;
+
 /**
  * @brief NimBLE peripheral configuration parameters
  *
@@ -47,18 +328,41 @@ typedef struct
     bool sm_random_address;
     bool sm_resolve_peer_address;
     struct ble_gatt_svc_def *ble_gatt_services;
+    nimble_peripheral_link_profile_t link_profile;
+    bool tx_pool;                   /* Allocate notification and indication payloads from the CONFIG_ESP_NIMBLE_API_TX_POOL pool */
+    bool fast_reconnect;            /* Advertise to bonded peers first (directed, then accept list); requires sm_bonding, legacy advertising only */
+    const uint8_t *adv_mfg_data;    /* Company ID followed by the initial manufacturer data */
+    uint8_t adv_mfg_data_len;
+    const uint8_t *adv_svc_data;    /* 16-bit service UUID followed by the initial service data */
+    uint8_t adv_svc_data_len;
+    const nimble_peripheral_ext_adv_set_t *ext_adv_sets;
+    uint8_t ext_adv_set_count;
+    nimble_peripheral_adv_schedule_t adv_schedule;
+    nimble_peripheral_coc_config_t coc;
+    nimble_peripheral_dispatch_config_t dispatch;
     void (*nimble_peripheral_on_connect_cb)(struct ble_gap_event *event, void *arg, int conn_index);
-    void (*nimble_peripheral_on_disconnect_cb)(struct ble_gap_event *event, void *arg, nimble_peripheral_conn_t peripheral_conn);
+    void (*nimble_peripheral_on_disconnect_cb)(struct ble_gap_event *event, void *arg, int conn_index);
     void (*nimble_peripheral_on_subscribe_notify_cb)(struct ble_gap_event *event, void *arg, int conn_index);
     void (*nimble_peripheral_on_unsubscribe_notify_cb)(struct ble_gap_event *event, void *arg, int conn_index);
     void (*nimble_peripheral_on_subscribe_indicate_cb)(struct ble_gap_event *event, void *arg, int conn_index);
     void (*nimble_peripheral_on_unsubscribe_indicate_cb)(struct ble_gap_event *event, void *arg, int conn_index);
+    void (*nimble_peripheral_on_link_update_cb)(struct ble_gap_event *event, void *arg, int conn_index);
+    void (*nimble_peripheral_on_adv_phase_cb)(nimble_peripheral_adv_phase_t phase);
+    void (*nimble_peripheral_on_ready_cb)(esp_err_t status); /* ESP_OK once advertising, ESP_FAIL if the host could not sync */
 } nimble_peripheral_config_t;
 
 /**
  * @brief Active peripheral state container
  *
- * Maintains runtime BLE connection information and device addressing
+ * Maintains runtime BLE connection information and device addressing.
+ *
+ * Only the NimBLE host task writes the connection table, the handle map and the
+ * subscriber index, and it publishes every change through a sequence counter.
+ * The notify, indicate, stream and lookup functions take a consistent snapshot
+ * without a lock, so any task on either core may call them at the same time. Queue
+ * operations lock only the target connection's slot, and producers sending to
+ * different peers never contend. Application code reading these fields directly
+ * from another task may see a connection that is being set up or torn down.
  */
 typedef struct
 {
@@ -67,7 +371,12 @@ typedef struct
     uint8_t peripheral_addr_str[18];
     uint16_t peripheral_conn_handle;
     int peripheral_conn_active_count;
+    nimble_peripheral_conn_mask_t peripheral_conn_active_mask;
     nimble_peripheral_conn_t peripheral_conn[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+    nimble_peripheral_subscribers_t subscribers[MAX_SUBSCRIBED_ATTRS];
+    uint8_t conn_handle_map[CONN_HANDLE_MAP_SIZE];
+    nimble_peripheral_metrics_t metrics;
+    int64_t time_to_ready_us; /* From init, restart or controller reset until advertising started */
 } nimble_peripheral_handle_t;
 
 /**
@@ -80,37 +389,820 @@ void ble_store_config_init(void);
 /**
  * @brief Initialize NimBLE peripheral stack
  *
+ * Returns once the host task is started. Host sync, address setup and the start of
+ * advertising follow asynchronously; wait for them with nimble_peripheral_wait_ready()
+ * or nimble_peripheral_on_ready_cb.
+ *
  * @param nimble_peripheral_config Configuration parameters struct
  * @param nimble_peripheral Handle for peripheral state management
  * @return esp_err_t
  *  - ESP_OK: Success
- *  - ESP_ERR_INVALID_ARG: Null parameters
- *  - ESP_FAIL: GATT service registration failed
+ *  - ESP_ERR_INVALID_ARG: Null parameters, fast_reconnect without sm_bonding, or coc.psm
+ *    without nimble_peripheral_on_coc_data_cb
+ *  - ESP_ERR_INVALID_STATE: Already initialized
+ *  - ESP_ERR_NOT_SUPPORTED: tx_pool is set but CONFIG_ESP_NIMBLE_API_TX_POOL is disabled,
+ *    fast_reconnect is set with CONFIG_BT_NIMBLE_EXT_ADV enabled, coc.psm is set but
+ *    CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM is 0, or dispatch.enabled is set
+ *    but CONFIG_ESP_NIMBLE_API_DISPATCH_QUEUE_SIZE is 0
+ *  - ESP_ERR_NO_MEM: The dispatch worker task could not be created
+ *  - ESP_FAIL: GATT service registration or CoC server creation failed
  */
 esp_err_t nimble_peripheral_init(nimble_peripheral_config_t *nimble_peripheral_config, nimble_peripheral_handle_t *nimble_peripheral);
 
+/**
+ * @brief Wait until the host has synced and advertising has started
+ *
+ * Covers init, nimble_peripheral_restart() and recovery from a controller reset.
+ * Returns at once when the peripheral is already ready. The time it took is kept
+ * in nimble_peripheral_handle_t.time_to_ready_us.
+ *
+ * @param ticks_to_wait Maximum time to wait
+ * @return esp_err_t
+ *  - ESP_OK: Advertising
+ *  - ESP_ERR_INVALID_STATE: Component not initialized
+ *  - ESP_ERR_TIMEOUT: Not ready within ticks_to_wait
+ *  - ESP_FAIL: The host synced but address setup or advertising failed
+ */
+esp_err_t nimble_peripheral_wait_ready(TickType_t ticks_to_wait);
+
+/**
+ * @brief Stop the host and sync it again without rebooting
+ *
+ * All peers are disconnected and the normal disconnect callbacks run. The
+ * controller, the registered GATT tables, the host task and all component state
+ * are reused, so this is much faster than deinit and init. Completion is
+ * signalled like init. Must not be called from a NimBLE callback.
+ *
+ * @return esp_err_t
+ *  - ESP_OK: Restart started
+ *  - ESP_ERR_INVALID_STATE: Not initialized, or a restart or deinit is in progress
+ *  - ESP_FAIL: The host could not be stopped
+ */
+esp_err_t nimble_peripheral_restart(void);
+
+/**
+ * @brief Stop the host task and release the NimBLE stack
+ *
+ * Peers are disconnected, coalescing is disabled and the handle is released.
+ * nimble_peripheral_init() can then be called again, with the same or a new
+ * configuration. Must not be called from a NimBLE callback.
+ *
+ * @return esp_err_t
+ *  - ESP_OK: Success
+ *  - ESP_ERR_INVALID_STATE: Not initialized, or a restart or deinit is in progress
+ *  - ESP_FAIL: The host could not be stopped
+ */
+esp_err_t nimble_peripheral_deinit(void);
+
 /**
  * @brief Send BLE notification to subscribed clients
  *
+ * String convenience wrapper around nimble_peripheral_notify(). Binary payloads
+ * that may contain zero bytes must use nimble_peripheral_notify() instead.
+ *
  * @param attr_handle Characteristic handle for notification
- * @param buffer Pre-allocated output buffer
- * @param buffer_size Buffer capacity
+ * @param buffer Unused, kept for source compatibility
+ * @param buffer_size Maximum message length, including the terminating null character
  * @param message Null-terminated string to send
  * @return esp_err_t
  *  - ESP_OK: Notification queued
- *  - ESP_FAIL: No subscriptions or allocation failure
+ *  - ESP_FAIL: No active connections, message not null-terminated or allocation failure
  */
 esp_err_t nimble_peripheral_notificate(uint16_t attr_handle, char *buffer, size_t buffer_size, const char *message);
 
+/**
+ * @brief Queue a binary BLE notification for every client subscribed to a characteristic
+ *
+ * The payload is copied into an mbuf once; additional subscribers receive duplicates
+ * of that mbuf instead of a fresh copy of the flat buffer. Each subscriber has its own
+ * bounded TX queue that the NimBLE host task drains round-robin, keeping at most
+ * CONFIG_ESP_NIMBLE_API_TX_CREDITS notifications per connection in flight. A
+ * subscriber whose queue is at CONFIG_ESP_NIMBLE_API_TX_QUEUE_WATERMARK is skipped
+ * without holding back the others.
+ *
+ * @param attr_handle Characteristic value handle
+ * @param data Payload to send, may contain zero bytes
+ * @param len Payload length in bytes (at most BLE_ATT_ATTR_MAX_LEN)
+ * @return esp_err_t
+ *  - ESP_OK: Notification queued for every subscriber
+ *  - ESP_ERR_INVALID_ARG: Null data with a non-zero length
+ *  - ESP_ERR_INVALID_SIZE: Payload exceeds BLE_ATT_ATTR_MAX_LEN
+ *  - ESP_ERR_NOT_FOUND: No client is subscribed to attr_handle
+ *  - ESP_ERR_TIMEOUT: At least one subscriber's queue is at its watermark and was skipped
+ *  - ESP_ERR_NO_MEM: mbuf allocation failed for at least one subscriber
+ */
+esp_err_t nimble_peripheral_notify(uint16_t attr_handle, const void *data, size_t len);
+
+/**
+ * @brief Queue a binary BLE notification, waiting for room in the subscribers' TX queues
+ *
+ * Same as nimble_peripheral_notify(), but blocks for up to ticks_to_wait until every
+ * subscriber's queue is below its watermark. Subscribers that are still full when the
+ * timeout expires are skipped; the others receive the notification.
+ *
+ * @param attr_handle Characteristic value handle
+ * @param data Payload to send, may contain zero bytes
+ * @param len Payload length in bytes (at most BLE_ATT_ATTR_MAX_LEN)
+ * @param ticks_to_wait Maximum time to wait for queue space
+ * @return esp_err_t Same as nimble_peripheral_notify()
+ */
+esp_err_t nimble_peripheral_notify_wait(uint16_t attr_handle, const void *data, size_t len, TickType_t ticks_to_wait);
+
+/**
+ * @brief Queue an application-built mbuf as a BLE notification for every subscribed client
+ *
+ * Ownership of the mbuf is always transferred, including on error. The mbuf itself is
+ * queued for the last subscriber; the others receive duplicates of it. Allocate it with
+ * ble_hs_mbuf_att_pkt() so the stack can prepend its headers without reallocating.
+ *
+ * @param attr_handle Characteristic value handle
+ * @param om Payload mbuf chain
+ * @return esp_err_t
+ *  - ESP_OK: Notification queued for every subscriber
+ *  - ESP_ERR_INVALID_ARG: Null mbuf
+ *  - ESP_ERR_INVALID_SIZE: Payload exceeds BLE_ATT_ATTR_MAX_LEN
+ *  - ESP_ERR_NOT_FOUND: No client is subscribed to attr_handle
+ *  - ESP_ERR_TIMEOUT: At least one subscriber's queue is at its watermark and was skipped
+ *  - ESP_ERR_NO_MEM: mbuf duplication failed for at least one subscriber
+ */
+esp_err_t nimble_peripheral_notify_mbuf(uint16_t attr_handle, struct os_mbuf *om);
+
+/**
+ * @brief Queue an application-built mbuf as a notification, waiting for TX queue space
+ *
+ * @param attr_handle Characteristic value handle
+ * @param om Payload mbuf chain, always consumed
+ * @param ticks_to_wait Maximum time to wait for queue space
+ * @return esp_err_t Same as nimble_peripheral_notify_mbuf()
+ */
+esp_err_t nimble_peripheral_notify_mbuf_wait(uint16_t attr_handle, struct os_mbuf *om, TickType_t ticks_to_wait);
+
+/**
+ * @brief Queue notifications for several characteristics at once
+ *
+ * Subscribers of every entry are resolved in one pass, and each subscriber gets all of
+ * its entries queued together or none of them. When NimBLE is built with
+ * BLE_GATT_NOTIFY_MULTIPLE, the host task packs consecutive entries of a batch into ATT
+ * Multiple Handle Value Notifications for peers that announced support in their Client
+ * Supported Features, as many as fit in the connection's MTU and TX credits; tx_pdus in
+ * the metrics counts each packed PDU once. Other peers, and builds without that option, receive back-to-back single
+ * notifications. Pending coalesced records of an entry's characteristic are flushed
+ * first, and the entry itself is not coalesced. If they cannot be allocated, the batch
+ * is not sent and the records stay pending.
+ *
+ * @param entries Values to send, in the order the peer receives them
+ * @param count Number of entries (at most CONFIG_ESP_NIMBLE_API_TX_QUEUE_WATERMARK)
+ * @param ticks_to_wait Maximum time to wait until every subscriber's queue has room for its entries
+ * @return esp_err_t
+ *  - ESP_OK: Every entry queued for every subscriber
+ *  - ESP_ERR_INVALID_ARG: Null entries, count of 0, or an entry with null data and a non-zero length
+ *  - ESP_ERR_INVALID_SIZE: count exceeds the watermark or a payload exceeds BLE_ATT_ATTR_MAX_LEN
+ *  - ESP_ERR_NOT_FOUND: No client is subscribed to any of the characteristics
+ *  - ESP_ERR_TIMEOUT: At least one subscriber's queue had no room for its entries and was skipped
+ *  - ESP_ERR_NO_MEM: mbuf allocation failed for at least one subscriber, which was skipped,
+ *    or for pending coalesced records, in which case nothing was sent
+ */
+esp_err_t nimble_peripheral_notify_batch(const nimble_peripheral_notify_entry_t *entries, size_t count, TickType_t ticks_to_wait);
+
+/**
+ * @brief Switch a characteristic to coalescing mode
+ *
+ * Once enabled, nimble_peripheral_notify(), nimble_peripheral_notify_wait() and
+ * nimble_peripheral_notificate() append their payload to a buffer instead of sending
+ * it. Each record is a 16-bit little-endian length followed by the payload, the
+ * framing read back by nimble_peripheral_rx_read_frame(). The buffer is sent as one
+ * notification when the next record would not fit in the smallest subscriber MTU,
+ * when max_delay_ms has passed since its first record, or on
+ * nimble_peripheral_notify_flush(). The mbuf variants flush pending records and then
+ * send their mbuf unchanged. Calling this again updates max_delay_ms.
+ *
+ * @param attr_handle Characteristic value handle
+ * @param max_delay_ms Longest time a record may wait in the buffer, 0 to flush only when full or on request
+ * @return esp_err_t
+ *  - ESP_OK: Coalescing enabled
+ *  - ESP_ERR_INVALID_ARG: attr_handle is 0
+ *  - ESP_ERR_INVALID_STATE: Component not initialized
+ *  - ESP_ERR_NO_MEM: All CONFIG_ESP_NIMBLE_API_COALESCE_CHARACTERISTICS buffers are in use
+ *  - ESP_ERR_NOT_SUPPORTED: Coalescing is compiled out
+ */
+esp_err_t nimble_peripheral_coalesce_enable(uint16_t attr_handle, uint32_t max_delay_ms);
+
+/**
+ * @brief Flush pending records and return a characteristic to immediate notifications
+ *
+ * Must not race with producers sending to attr_handle.
+ *
+ * @param attr_handle Characteristic value handle
+ * @return esp_err_t
+ *  - ESP_OK: Coalescing disabled
+ *  - ESP_ERR_INVALID_STATE: attr_handle is not coalesced
+ *  - ESP_ERR_TIMEOUT / ESP_ERR_NO_MEM: The final flush failed as in nimble_peripheral_notify()
+ *  - ESP_ERR_NOT_SUPPORTED: Coalescing is compiled out
+ */
+esp_err_t nimble_peripheral_coalesce_disable(uint16_t attr_handle);
+
+/**
+ * @brief Send the records buffered for a coalesced characteristic now
+ *
+ * For latency-critical messages: call it right after the nimble_peripheral_notify()
+ * that must not wait for the buffer to fill.
+ *
+ * @param attr_handle Characteristic value handle
+ * @return esp_err_t
+ *  - ESP_OK: Nothing pending, or pending records queued for every subscriber
+ *  - ESP_ERR_INVALID_STATE: attr_handle is not coalesced
+ *  - ESP_ERR_NOT_FOUND: No client is subscribed anymore; the records were dropped
+ *  - ESP_ERR_TIMEOUT: At least one subscriber's queue is at its watermark and was skipped
+ *  - ESP_ERR_NO_MEM: mbuf allocation failed; the records stay buffered
+ *  - ESP_ERR_NOT_SUPPORTED: Coalescing is compiled out
+ */
+esp_err_t nimble_peripheral_notify_flush(uint16_t attr_handle);
+
+/**
+ * @brief Stream an arbitrarily large buffer to one connection as MTU-sized notifications
+ *
+ * The buffer is cut into chunks of (ATT MTU - 3) bytes on the NimBLE host task as the
+ * connection's TX queue drains, so only a few chunks are held in mbufs at any time.
+ * The chunk size follows MTU changes made during the transfer. One stream can be
+ * active per connection.
+ *
+ * @param conn_index Connection slot index
+ * @param attr_handle Characteristic value handle the peer is subscribed to
+ * @param data Buffer to send; must remain valid until the final callback
+ * @param len Buffer length in bytes
+ * @param cb Progress and completion callback, may be NULL
+ * @param arg User argument passed to cb
+ * @return esp_err_t
+ *  - ESP_OK: Stream started
+ *  - ESP_ERR_INVALID_ARG: Invalid connection index, null data or zero length
+ *  - ESP_ERR_NOT_FOUND: The connection is not subscribed to attr_handle
+ *  - ESP_ERR_INVALID_STATE: Connection not active or a stream is already running on it
+ */
+esp_err_t nimble_peripheral_stream_send(int conn_index, uint16_t attr_handle, const void *data, size_t len, nimble_peripheral_stream_cb_t cb, void *arg);
+
+/**
+ * @brief Replace the manufacturer data of the running advertisement
+ *
+ * Patches the cached advertising payload in place and hands it to the controller,
+ * without re-encoding the other fields or restarting advertising. The length is fixed
+ * by adv_mfg_data_len in nimble_peripheral_config_t. Call from a single task.
+ *
+ * @param data Company ID followed by the manufacturer data
+ * @param len Must equal adv_mfg_data_len
+ * @return esp_err_t
+ *  - ESP_OK: Advertising data updated
+ *  - ESP_ERR_INVALID_SIZE: Null data or length differs from adv_mfg_data_len
+ *  - ESP_ERR_INVALID_STATE: No manufacturer data configured, host not synced yet, or
+ *    advertising uses application-defined extended sets
+ *  - ESP_FAIL: The host rejected the new payload
+ */
+esp_err_t nimble_peripheral_adv_mfg_data_update(const uint8_t *data, uint8_t len);
+
+/**
+ * @brief Replace the 16-bit UUID service data of the running advertisement
+ *
+ * Same as nimble_peripheral_adv_mfg_data_update(), for the service data region
+ * reserved by adv_svc_data_len.
+ *
+ * @param data 16-bit service UUID followed by the service data
+ * @param len Must equal adv_svc_data_len
+ * @return esp_err_t
+ *  - ESP_OK: Advertising data updated
+ *  - ESP_ERR_INVALID_SIZE: Null data or length differs from adv_svc_data_len
+ *  - ESP_ERR_INVALID_STATE: No service data configured, host not synced yet, or
+ *    advertising uses application-defined extended sets
+ *  - ESP_FAIL: The host rejected the new payload
+ */
+esp_err_t nimble_peripheral_adv_svc_data_update(const uint8_t *data, uint8_t len);
+
+/**
+ * @brief Queue an application-built mbuf as an indication to one connection
+ *
+ * Indications are queued per connection and sent one at a time, each as soon as the
+ * previous one is confirmed, so a slow client only delays its own queue. The mbuf is
+ * consumed in every case.
+ *
+ * @param conn_index Connection slot index
+ * @param attr_handle Characteristic value handle
+ * @param om Indication payload
+ * @param cb Completion callback, may be NULL
+ * @param arg User argument passed to cb
+ * @return esp_err_t
+ *  - ESP_OK: Indication queued; cb reports the outcome
+ *  - ESP_ERR_INVALID_ARG: Null mbuf or invalid connection index
+ *  - ESP_ERR_INVALID_SIZE: Payload exceeds BLE_ATT_ATTR_MAX_LEN
+ *  - ESP_ERR_INVALID_STATE: Connection slot not active
+ *  - ESP_ERR_NOT_FOUND: Connection not subscribed to indications on attr_handle
+ *  - ESP_ERR_NO_MEM: Connection's indication queue is full
+ */
+esp_err_t nimble_peripheral_indicate_mbuf(int conn_index, uint16_t attr_handle, struct os_mbuf *om, nimble_peripheral_indicate_cb_t cb, void *arg);
+
+/**
+ * @brief Queue an indication to one connection
+ *
+ * @param conn_index Connection slot index
+ * @param attr_handle Characteristic value handle
+ * @param data Payload, copied before the call returns
+ * @param len Payload length
+ * @param cb Completion callback, may be NULL
+ * @param arg User argument passed to cb
+ * @return esp_err_t
+ *  - ESP_OK: Indication queued; cb reports the outcome
+ *  - ESP_ERR_NO_MEM: No mbuf available or indication queue full
+ *  - Other errors as nimble_peripheral_indicate_mbuf()
+ */
+esp_err_t nimble_peripheral_indicate(int conn_index, uint16_t attr_handle, const void *data, size_t len, nimble_peripheral_indicate_cb_t cb, void *arg);
+
+/**
+ * @brief Queue an indication to every connection subscribed to a characteristic
+ *
+ * The payload is copied once and duplicated for the other subscribers. Each
+ * subscriber's queue advances independently; cb is called once per connection the
+ * indication was queued for. A failure for one subscriber does not stop the others.
+ *
+ * @param attr_handle Characteristic value handle
+ * @param data Payload, copied before the call returns
+ * @param len Payload length
+ * @param cb Completion callback, may be NULL
+ * @param arg User argument passed to cb
+ * @return esp_err_t
+ *  - ESP_OK: Queued for every subscriber
+ *  - ESP_ERR_INVALID_ARG: Null data with non-zero length
+ *  - ESP_ERR_INVALID_SIZE: Payload exceeds BLE_ATT_ATTR_MAX_LEN
+ *  - ESP_ERR_NOT_FOUND: No subscribers for attr_handle
+ *  - ESP_ERR_NO_MEM: No mbuf for the payload, or the first skipped subscriber had no
+ *    mbuf or a full queue
+ *  - ESP_ERR_INVALID_STATE: The first skipped subscriber disconnected during the call
+ */
+esp_err_t nimble_peripheral_indicate_all(uint16_t attr_handle, const void *data, size_t len, nimble_peripheral_indicate_cb_t cb, void *arg);
+
+/**
+ * @brief Copy the current metrics
+ *
+ * Requires CONFIG_ESP_NIMBLE_API_METRICS; counters stay zero otherwise.
+ *
+ * @param out Destination
+ * @return esp_err_t
+ *  - ESP_OK: Metrics copied
+ *  - ESP_ERR_INVALID_ARG: Null destination
+ *  - ESP_ERR_INVALID_STATE: Component not initialized
+ */
+esp_err_t nimble_peripheral_metrics_snapshot(nimble_peripheral_metrics_t *out);
+
+/**
+ * @brief Read the occupancy of the dedicated notification mbuf pool
+ *
+ * With tx_pool set in nimble_peripheral_config_t, payloads built by the notify,
+ * indicate, stream and coalescing functions come from a pool of
+ * CONFIG_ESP_NIMBLE_API_TX_POOL_BLOCKS blocks instead of msys. An empty pool makes
+ * those calls return ESP_ERR_NO_MEM at once. Size the pool from high_water.
+ *
+ * @param out Destination for the pool counters
+ * @return esp_err_t
+ *  - ESP_OK: Success
+ *  - ESP_ERR_INVALID_ARG: Null out
+ *  - ESP_ERR_INVALID_STATE: The dedicated pool is not in use
+ */
+esp_err_t nimble_peripheral_tx_pool_stats(nimble_peripheral_tx_pool_stats_t *out);
+
+/**
+ * @brief Read the counters of the callback dispatch queue
+ *
+ * @param out Destination for the counters
+ * @return esp_err_t
+ *  - ESP_OK: Success
+ *  - ESP_ERR_INVALID_ARG: Null out
+ *  - ESP_ERR_INVALID_STATE: dispatch.enabled is not set or the component is not initialized
+ */
+esp_err_t nimble_peripheral_dispatch_stats(nimble_peripheral_dispatch_stats_t *out);
+
+/**
+ * @brief Read the current advertising phase
+ *
+ * With CONFIG_BT_NIMBLE_EXT_ADV enabled, the sets keep their own intervals and the
+ * phase only switches between NIMBLE_PERIPHERAL_ADV_PHASE_SLOW and
+ * NIMBLE_PERIPHERAL_ADV_PHASE_PAUSED.
+ *
+ * @return nimble_peripheral_adv_phase_t Phase last reported through nimble_peripheral_on_adv_phase_cb
+ */
+nimble_peripheral_adv_phase_t nimble_peripheral_adv_phase_get(void);
+
+/**
+ * @brief List the bonded peer identities kept in RAM
+ *
+ * The list is read from the bond store once and then maintained from connection
+ * and encryption events, so it can be polled without touching NVS. With
+ * fast_reconnect set in nimble_peripheral_config_t, advertising after every
+ * connection change starts with high duty cycle directed advertising to the
+ * first peer in this list, continues with advertising restricted to the listed
+ * peers for CONFIG_ESP_NIMBLE_API_RECONNECT_ACCEPT_LIST_MS, and then opens up.
+ *
+ * @param out_peers Destination for the identity addresses, most recent peer first
+ * @param out_count Number of addresses written
+ * @param max_peers Capacity of out_peers
+ * @return esp_err_t
+ *  - ESP_OK: Success
+ *  - ESP_ERR_INVALID_ARG: Null pointer or negative max_peers
+ *  - ESP_ERR_INVALID_STATE: Component not initialized
+ */
+esp_err_t nimble_peripheral_bonded_peers(ble_addr_t *out_peers, int *out_count, int max_peers);
+
+/**
+ * @brief Drop the RAM copy of the bonded peer list
+ *
+ * Call after deleting or adding bonds through the ble_store API directly; the
+ * list is read again from the store the next time it is needed.
+ */
+void nimble_peripheral_bonds_invalidate(void);
+
+/**
+ * @brief Zero metrics counters
+ *
+ * @param conn_index Connection slot to reset, or -1 to reset everything
+ * @return esp_err_t
+ *  - ESP_OK: Counters reset
+ *  - ESP_ERR_INVALID_ARG: Invalid connection index
+ *  - ESP_ERR_INVALID_STATE: Component not initialized
+ */
+esp_err_t nimble_peripheral_metrics_reset(int conn_index);
+
+/**
+ * @brief Configure an extended advertising set
+ *
+ * Requires CONFIG_BT_NIMBLE_EXT_ADV. Sets listed in nimble_peripheral_config_t are
+ * configured on instances 0..ext_adv_set_count-1 and started on every host sync; this
+ * function adds or replaces one at runtime. A running set is stopped first.
+ *
+ * @param instance Advertising instance, below EXT_ADV_MAX_SETS
+ * @param set Set description
+ * @return esp_err_t
+ *  - ESP_OK: Set configured
+ *  - ESP_ERR_INVALID_ARG: Invalid instance, parameters or payload size
+ *  - ESP_ERR_NOT_SUPPORTED: Extended advertising disabled in NimBLE
+ *  - ESP_FAIL: The host rejected the configuration
+ */
+esp_err_t nimble_peripheral_ext_adv_configure(uint8_t instance, const nimble_peripheral_ext_adv_set_t *set);
+
+/**
+ * @brief Replace the advertising or scan response payload of a configured set
+ *
+ * Can be called while the set is advertising.
+ *
+ * @param instance Advertising instance
+ * @param data Raw AD structures
+ * @param len Payload length, at most CONFIG_BT_NIMBLE_EXT_ADV_MAX_SIZE
+ * @param scan_response true to replace the scan response instead of the advertising data
+ * @return esp_err_t
+ *  - ESP_OK: Payload updated
+ *  - ESP_ERR_INVALID_ARG: Invalid instance or payload size
+ *  - ESP_ERR_INVALID_STATE: Set not configured
+ *  - ESP_ERR_NO_MEM: No mbuf available for the payload
+ *  - ESP_ERR_NOT_SUPPORTED: Extended advertising disabled in NimBLE
+ *  - ESP_FAIL: The host rejected the payload
+ */
+esp_err_t nimble_peripheral_ext_adv_set_data(uint8_t instance, const uint8_t *data, uint16_t len, bool scan_response);
+
+/**
+ * @brief Start a configured extended advertising set
+ *
+ * Connectable sets are restarted automatically after a connection drops; while all
+ * connection slots are taken they are held back.
+ *
+ * @param instance Advertising instance
+ * @return esp_err_t
+ *  - ESP_OK: Set started, or deferred until a connection slot frees up
+ *  - ESP_ERR_INVALID_ARG: Invalid instance
+ *  - ESP_ERR_INVALID_STATE: Set not configured
+ *  - ESP_ERR_NOT_SUPPORTED: Extended advertising disabled in NimBLE
+ *  - ESP_FAIL: The host refused to start the set
+ */
+esp_err_t nimble_peripheral_ext_adv_start(uint8_t instance);
+
+/**
+ * @brief Stop an extended advertising set
+ *
+ * @param instance Advertising instance
+ * @return esp_err_t
+ *  - ESP_OK: Set stopped
+ *  - ESP_ERR_INVALID_ARG: Invalid instance
+ *  - ESP_ERR_NOT_SUPPORTED: Extended advertising disabled in NimBLE
+ *  - ESP_FAIL: The host refused to stop the set
+ */
+esp_err_t nimble_peripheral_ext_adv_stop(uint8_t instance);
+
+/**
+ * @brief Look up the connection slot of an active connection
+ *
+ * @param conn_handle NimBLE connection handle
+ * @return Connection slot index, or -1 if the handle is not tracked
+ */
+int nimble_peripheral_conn_find(uint16_t conn_handle);
+
+/**
+ * @brief Check that a connection slot still holds the connection it was captured for
+ *
+ * @param conn_index Connection slot index
+ * @param generation Value of peripheral_conn[conn_index].generation when the index was captured
+ * @return true if the slot is active and has not been reused since
+ */
+bool nimble_peripheral_conn_is_current(int conn_index, uint16_t generation);
+
+/**
+ * @brief Read the generation of a connection slot
+ *
+ * Pairs with nimble_peripheral_conn_find() for code that only sees a conn_handle,
+ * such as GATT access callbacks, and wants to check the slot later with
+ * nimble_peripheral_conn_is_current().
+ *
+ * @param conn_index Connection slot index
+ * @return Current value of peripheral_conn[conn_index].generation, or 0 for an invalid index
+ */
+uint16_t nimble_peripheral_conn_generation(int conn_index);
+
+/**
+ * @brief Renegotiate PHY, data length and connection parameters of a connection
+ *
+ * The profile configured in nimble_peripheral_config_t is applied on connect; this
+ * switches an active connection to another one, e.g. THROUGHPUT for a bulk transfer
+ * and back to LOW_POWER afterwards. A rejected connection parameter update is
+ * retried with a wider interval window up to LINK_PROFILE_MAX_RETRIES times.
+ * Negotiated values are stored in peripheral_conn[conn_index] and reported through
+ * nimble_peripheral_on_link_update_cb.
+ *
+ * @param conn_index Connection slot index
+ * @param profile Link profile to request
+ * @return esp_err_t
+ *  - ESP_OK: Negotiation started
+ *  - ESP_ERR_INVALID_ARG: Invalid profile
+ *  - ESP_ERR_INVALID_STATE: Connection slot not active
+ *  - ESP_FAIL: The controller refused every request
+ */
+esp_err_t nimble_peripheral_link_profile_set(int conn_index, nimble_peripheral_link_profile_t profile);
+
+/**
+ * @brief Check whether a connection is subscribed to a characteristic
+ *
+ * @param conn_index Connection slot index
+ * @param attr_handle Characteristic value handle
+ * @param indicate true to check the indication subscription, false for notifications
+ * @return true if the connection is subscribed
+ */
+bool nimble_peripheral_is_subscribed(int conn_index, uint16_t attr_handle, bool indicate);
+
+/**
+ * @brief GATT access callback that serves a characteristic or descriptor from its cache
+ *
+ * Reads are answered from the nimble_peripheral_attr_t passed as arg without calling
+ * into the application; NimBLE slices the value for Read Blob requests, so long
+ * values need no extra handling. Writes of up to max_len bytes replace the cached
+ * value without notifying.
+ *
+ * @param conn_handle Connection handle of the request
+ * @param attr_handle Attribute handle of the request
+ * @param ctxt Access context
+ * @param arg nimble_peripheral_attr_t of the attribute
+ * @return 0 on success, or a BLE_ATT_ERR_* code
+ */
+int nimble_peripheral_attr_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg);
+
+/**
+ * @brief Update a cached attribute value and notify its subscribers when it changed
+ *
+ * A value equal to the cached one is ignored without sending anything. Otherwise the
+ * cache is updated and the new value goes to every client subscribed to
+ * attr->val_handle, as with nimble_peripheral_notify(). Callable from any task.
+ *
+ * @param attr Cached attribute
+ * @param data New value
+ * @param len New value length in bytes
+ * @return esp_err_t
+ *  - ESP_OK: Cache updated, or the value was unchanged; subscribers, if any, notified
+ *  - ESP_ERR_INVALID_ARG: Null attr or storage, or null data with a non-zero length
+ *  - ESP_ERR_INVALID_SIZE: len exceeds attr->max_len
+ *  - ESP_ERR_TIMEOUT / ESP_ERR_NO_MEM: Cache updated but the notification failed as in nimble_peripheral_notify()
+ */
+esp_err_t nimble_peripheral_attr_set_value(nimble_peripheral_attr_t *attr, const void *data, size_t len);
+
+/**
+ * @brief Copy a cached attribute value, e.g. after a client wrote it
+ *
+ * @param attr Cached attribute
+ * @param out Destination buffer
+ * @param out_size Capacity of out
+ * @param out_len Length of the copied value
+ * @return esp_err_t
+ *  - ESP_OK: Value copied
+ *  - ESP_ERR_INVALID_ARG: Null parameters
+ *  - ESP_ERR_INVALID_SIZE: The value is longer than out_size
+ */
+esp_err_t nimble_peripheral_attr_get_value(nimble_peripheral_attr_t *attr, void *out, size_t out_size, size_t *out_len);
+
 /**
  * @brief Process received data from Nordic UART Service (NUS)
  *
+ * Copies the whole mbuf chain, so writes longer than the first mbuf arrive intact.
+ *
  * @param om Received data mbuf
  * @param buffer Destination buffer for processed data
- * @param buffer_size Buffer capacity
+ * @param buffer_size Buffer capacity, including room for the terminating null character
  * @return esp_err_t
  *  - ESP_OK: Data copied successfully
  *  - ESP_ERR_INVALID_ARG: Null parameters
  *  - ESP_ERR_INVALID_SIZE: Data exceeds buffer
  */
-esp_err_t nus_process_rx_data(struct os_mbuf *om, char *buffer, size_t buffer_size);
\ No newline at end of file
+esp_err_t nus_process_rx_data(struct os_mbuf *om, char *buffer, size_t buffer_size);
+
+/**
+ * @brief Segment visitor for nus_process_rx_segments()
+ *
+ * @param data Segment data, valid only for the duration of the call
+ * @param len Segment length in bytes
+ * @param arg User argument
+ * @return 0 to continue with the next segment, non-zero to stop
+ */
+typedef int (*nus_rx_segment_cb_t)(const uint8_t *data, uint16_t len, void *arg);
+
+/**
+ * @brief Visit every segment of a received mbuf chain without copying it
+ *
+ * @param om Received data mbuf
+ * @param cb Segment visitor
+ * @param arg User argument passed to cb
+ * @return esp_err_t
+ *  - ESP_OK: All segments visited
+ *  - ESP_ERR_INVALID_ARG: Null parameters
+ *  - ESP_ERR_NOT_FINISHED: The visitor stopped early
+ */
+esp_err_t nus_process_rx_segments(const struct os_mbuf *om, nus_rx_segment_cb_t cb, void *arg);
+
+/**
+ * @brief Append a received write to the connection's receive ring
+ *
+ * Intended to be called from a GATT access callback: the chain is copied segment by
+ * segment into a lock-free single-producer/single-consumer ring, and the application
+ * task drains it with the nimble_peripheral_rx_* reader functions. A write is either
+ * stored whole or rejected; the ring is reset when a new connection takes the slot.
+ *
+ * @param conn_handle Connection handle the write came from
+ * @param om Received data mbuf chain, not consumed
+ * @return esp_err_t
+ *  - ESP_OK: Data stored
+ *  - ESP_ERR_INVALID_ARG: Null mbuf
+ *  - ESP_ERR_NOT_FOUND: Unknown connection handle
+ *  - ESP_ERR_NO_MEM: Not enough free space in the ring; reply BLE_ATT_ERR_INSUFFICIENT_RES
+ *  - ESP_ERR_NOT_SUPPORTED: CONFIG_ESP_NIMBLE_API_RX_RING_SIZE is 0
+ */
+esp_err_t nimble_peripheral_rx_push(uint16_t conn_handle, const struct os_mbuf *om);
+
+/**
+ * @brief Number of bytes waiting in a connection's receive ring
+ *
+ * @param conn_index Connection slot index
+ * @return Bytes available to read
+ */
+size_t nimble_peripheral_rx_available(int conn_index);
+
+/**
+ * @brief Copy bytes from the receive ring without consuming them
+ *
+ * @param conn_index Connection slot index
+ * @param buffer Destination buffer
+ * @param len Maximum bytes to copy
+ * @return Bytes copied
+ */
+size_t nimble_peripheral_rx_peek(int conn_index, void *buffer, size_t len);
+
+/**
+ * @brief Discard bytes from the receive ring
+ *
+ * @param conn_index Connection slot index
+ * @param len Maximum bytes to discard
+ * @return Bytes discarded
+ */
+size_t nimble_peripheral_rx_consume(int conn_index, size_t len);
+
+/**
+ * @brief Read and consume bytes from the receive ring
+ *
+ * @param conn_index Connection slot index
+ * @param buffer Destination buffer
+ * @param len Maximum bytes to read
+ * @return Bytes read
+ */
+size_t nimble_peripheral_rx_read(int conn_index, void *buffer, size_t len);
+
+/**
+ * @brief Read one delimiter-terminated record from the receive ring
+ *
+ * @param conn_index Connection slot index
+ * @param delimiter Record terminator, included in the output
+ * @param buffer Destination buffer
+ * @param buffer_size Buffer capacity
+ * @param out_len Record length including the delimiter
+ * @return esp_err_t
+ *  - ESP_OK: Record read
+ *  - ESP_ERR_NOT_FOUND: No complete record buffered yet
+ *  - ESP_ERR_INVALID_SIZE: Record does not fit in buffer and was left in the ring, or the
+ *    ring is full without a delimiter and the record can never complete; consume data
+ *    with nimble_peripheral_rx_read() to recover
+ */
+esp_err_t nimble_peripheral_rx_read_until(int conn_index, uint8_t delimiter, void *buffer, size_t buffer_size, size_t *out_len);
+
+/**
+ * @brief Read one length-prefixed frame from the receive ring
+ *
+ * Frames carry a 16-bit little-endian payload length followed by the payload;
+ * only the payload is copied out.
+ *
+ * @param conn_index Connection slot index
+ * @param buffer Destination buffer
+ * @param buffer_size Buffer capacity
+ * @param out_len Payload length
+ * @return esp_err_t
+ *  - ESP_OK: Frame read
+ *  - ESP_ERR_NOT_FOUND: No complete frame buffered yet
+ *  - ESP_ERR_INVALID_SIZE: Frame does not fit in buffer and was left in the ring, or its
+ *    header announces more than CONFIG_ESP_NIMBLE_API_RX_RING_SIZE bytes and it can never
+ *    complete; consume data with nimble_peripheral_rx_read() to recover
+ */
+esp_err_t nimble_peripheral_rx_read_frame(int conn_index, void *buffer, size_t buffer_size, size_t *out_len);
+
+/**
+ * @brief Block until the receive ring holds data
+ *
+ * Only one task may wait on a given connection at a time.
+ *
+ * @param conn_index Connection slot index
+ * @param ticks_to_wait Maximum time to wait
+ * @return Bytes available when the call returns
+ */
+size_t nimble_peripheral_rx_wait(int conn_index, TickType_t ticks_to_wait);
+
+/**
+ * @brief Queue an SDU on a connection's CoC channel without copying it
+ *
+ * The host task hands queued SDUs to NimBLE one at a time, which cuts them into
+ * K-frames and sends them as the peer grants credits. Ownership of the mbuf is
+ * always transferred, including on error.
+ *
+ * @param conn_index Connection slot index
+ * @param sdu SDU mbuf chain, at most the connection's coc_mtu bytes
+ * @return esp_err_t
+ *  - ESP_OK: SDU queued
+ *  - ESP_ERR_INVALID_ARG: Null mbuf or conn_index out of range
+ *  - ESP_ERR_INVALID_SIZE: Empty SDU, or longer than the peer's coc_mtu
+ *  - ESP_ERR_INVALID_STATE: No CoC channel open on the connection
+ *  - ESP_ERR_TIMEOUT: CONFIG_ESP_NIMBLE_API_COC_TX_QUEUE_DEPTH SDUs already queued
+ *  - ESP_ERR_NOT_SUPPORTED: CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM is 0
+ */
+esp_err_t nimble_peripheral_coc_send_mbuf(int conn_index, struct os_mbuf *sdu);
+
+/**
+ * @brief Stream a buffer over a connection's CoC channel
+ *
+ * The data is cut into SDUs of the peer's coc_mtu, each copied into its own mbuf
+ * and queued as with nimble_peripheral_coc_send_mbuf(). While the queue is full the
+ * call waits for the host task to drain it, up to ticks_to_wait in total.
+ *
+ * @param conn_index Connection slot index
+ * @param data Data to send
+ * @param len Length of data
+ * @param ticks_to_wait Maximum time to wait for queue space
+ * @param out_sent Bytes queued, also on error; may be NULL
+ * @return esp_err_t
+ *  - ESP_OK: All data queued
+ *  - ESP_ERR_INVALID_ARG: Null data, zero length or conn_index out of range
+ *  - ESP_ERR_INVALID_STATE: No CoC channel open, or it closed while waiting
+ *  - ESP_ERR_TIMEOUT: The queue stayed full; out_sent tells how far the stream got
+ *  - ESP_ERR_NO_MEM: mbuf allocation failed
+ *  - ESP_ERR_NOT_SUPPORTED: CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM is 0
+ */
+esp_err_t nimble_peripheral_coc_send(int conn_index, const void *data, size_t len, TickType_t ticks_to_wait, size_t *out_sent);
+
+/**
+ * @brief Return an SDU received through nimble_peripheral_on_coc_data_cb
+ *
+ * Frees the SDU and lets the host task post a new receive buffer, which grants the
+ * peer credits again. May be called from any task.
+ *
+ * @param conn_index Connection slot the SDU arrived on
+ * @param sdu SDU passed to the callback
+ * @return esp_err_t
+ *  - ESP_OK: Released
+ *  - ESP_ERR_INVALID_ARG: Null SDU or conn_index out of range
+ *  - ESP_ERR_NOT_SUPPORTED: CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM is 0
+ */
+esp_err_t nimble_peripheral_coc_rx_release(int conn_index, struct os_mbuf *sdu);
+
+/**
+ * @brief Close a connection's CoC channel, keeping the connection
+ *
+ * @param conn_index Connection slot index
+ * @return esp_err_t
+ *  - ESP_OK: Disconnection started; nimble_peripheral_on_coc_disconnect_cb follows
+ *  - ESP_ERR_INVALID_ARG: conn_index out of range
+ *  - ESP_ERR_INVALID_STATE: No CoC channel open on the connection
+ *  - ESP_ERR_NOT_SUPPORTED: CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM is 0
+ *  - ESP_FAIL: The stack rejected the request
+ */
+esp_err_t nimble_peripheral_coc_disconnect(int conn_index);
\ No newline at end of file
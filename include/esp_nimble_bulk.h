@@ -0,0 +1,120 @@
+#pragma once
+
+#include <esp_nimble_api.h>
+
+#define BULK_DEFAULT_BLOCK_SIZE 4096 /* Bytes covered by one CRC, one flash sector */
+#define BULK_DEFAULT_WINDOW 16       /* Chunks the client may send past the last acknowledgement */
+#define BULK_HEADER_LEN 4            /* Offset prefix of every data chunk */
+
+/* Control characteristic opcodes, first byte of every control write and notification. */
+#define NIMBLE_BULK_OP_START 0x01     /* Client: u32 transfer_id, u32 total_len */
+#define NIMBLE_BULK_OP_BLOCK_END 0x02 /* Client: u32 CRC-32 of the block just sent */
+#define NIMBLE_BULK_OP_ABORT 0x03     /* Client: no payload */
+#define NIMBLE_BULK_OP_START_RSP 0x81 /* Server: u8 status, u32 offset, u16 block_size, u8 window, u8 ack_every */
+#define NIMBLE_BULK_OP_ACK 0x82       /* Server: u32 received, u32 verified */
+#define NIMBLE_BULK_OP_NAK 0x83       /* Server: u32 offset to resend from */
+#define NIMBLE_BULK_OP_DONE 0x84      /* Server: u8 status */
+
+/**
+ * @brief Status byte of START_RSP and DONE notifications
+ */
+typedef enum
+{
+    NIMBLE_BULK_STATUS_OK = 0,
+    NIMBLE_BULK_STATUS_BUSY,     /* Another connection owns the running transfer */
+    NIMBLE_BULK_STATUS_REJECTED, /* Zero length, or refused by nimble_bulk_on_begin_cb */
+    NIMBLE_BULK_STATUS_PROTOCOL, /* A chunk crossed a block boundary or the end of the transfer */
+    NIMBLE_BULK_STATUS_SINK,     /* The data or block callback returned an error */
+    NIMBLE_BULK_STATUS_ABORTED,  /* The client sent ABORT */
+} nimble_bulk_status_t;
+
+/**
+ * @brief Bulk transfer sink
+ *
+ * All callbacks run on the NimBLE host task from the GATT access callback, so the
+ * next chunk is not processed until they return. nimble_bulk_on_data_cb gets the
+ * payload straight from the received mbuf, one call per contiguous segment; the
+ * pointer is only valid during the call. Bytes after the last verified block can be
+ * delivered again after a CRC failure or a resume, always in increasing offset order
+ * from a block boundary, so a sink writing to flash can erase each block when its
+ * first byte arrives.
+ */
+typedef struct
+{
+    uint16_t block_size; /* Bytes per CRC block; 0 uses BULK_DEFAULT_BLOCK_SIZE */
+    uint8_t window;      /* Chunks in flight past the last ACK; 0 uses BULK_DEFAULT_WINDOW */
+    uint8_t ack_every;   /* Chunks per ACK notification; 0 uses half the window */
+    /* Accept a transfer starting or resuming at offset; any error rejects it. */
+    esp_err_t (*nimble_bulk_on_begin_cb)(int conn_index, uint32_t transfer_id, uint32_t total_len, uint32_t offset, void *arg);
+    esp_err_t (*nimble_bulk_on_data_cb)(uint32_t offset, const uint8_t *data, size_t len, void *arg);
+    /* Optional: the block at offset passed its CRC and will not be sent again. */
+    esp_err_t (*nimble_bulk_on_block_cb)(uint32_t offset, uint32_t len, void *arg);
+    /*
+     * ESP_OK when every block is verified, ESP_ERR_INVALID_STATE when the client
+     * aborts or starts a different transfer, ESP_ERR_INVALID_SIZE when a chunk
+     * crosses a block boundary, or the error returned by a callback.
+     */
+    void (*nimble_bulk_on_end_cb)(uint32_t transfer_id, esp_err_t status, void *arg);
+    void *arg;
+} nimble_bulk_config_t;
+
+/**
+ * @brief Bulk transfer counters, updated with relaxed atomics
+ */
+typedef struct
+{
+    uint32_t transfers;    /* Started from offset 0 */
+    uint32_t resumes;      /* Continued from a verified offset */
+    uint32_t completed;
+    uint32_t bytes;        /* Payload passed to nimble_bulk_on_data_cb */
+    uint32_t crc_errors;   /* Blocks sent again after a CRC mismatch */
+    uint32_t out_of_order; /* Chunks dropped because their offset was not the next one expected */
+} nimble_bulk_stats_t;
+
+extern const ble_uuid128_t nimble_bulk_svc_uuid;
+extern const struct ble_gatt_chr_def nimble_bulk_characteristics[];
+
+/**
+ * @brief Service definition to place in nimble_peripheral_config_t.ble_gatt_services
+ *
+ * The service has a control characteristic (write, write without response, notify)
+ * and a data characteristic (write without response). A client:
+ *  1. Subscribes to control notifications and writes START with a transfer ID and the
+ *     total length. START_RSP returns the offset to send from, which is past the last
+ *     verified block when the same transfer was interrupted, and the block size,
+ *     window and ACK interval to use.
+ *  2. Writes chunks of up to MTU - 3 bytes to the data characteristic, each prefixed
+ *     with its little-endian u32 offset and none crossing a block boundary, keeping at
+ *     most window chunks past the last ACK.
+ *  3. Writes BLOCK_END with the CRC-32 of each block (IEEE, as esp_rom_crc32_le(0, ...))
+ *     after its last chunk. A verified block is acknowledged at once; a mismatch or a
+ *     missing chunk gets a NAK with the offset to resend from.
+ * DONE follows the last verified block. After a disconnect, START with the same ID
+ * and length on any connection resumes the transfer.
+ */
+#define NIMBLE_BULK_SERVICE {.type = BLE_GATT_SVC_TYPE_PRIMARY, .uuid = &nimble_bulk_svc_uuid.u, .characteristics = nimble_bulk_characteristics}
+
+/**
+ * @brief Set the sink of the bulk transfer service
+ *
+ * Call before nimble_peripheral_init(). One transfer runs at a time across all
+ * connections; a START from another connection is answered with BUSY while the
+ * owner is connected. The transfer state, including the offset of an interrupted
+ * transfer, is dropped.
+ *
+ * @param config Block size, window and callbacks; copied
+ * @return esp_err_t
+ *  - ESP_OK: Success
+ *  - ESP_ERR_INVALID_ARG: Null config or data callback, or ack_every larger than the window
+ */
+esp_err_t nimble_bulk_register(const nimble_bulk_config_t *config);
+
+/**
+ * @brief Copy the bulk transfer counters
+ *
+ * @param out Destination for the counters
+ * @return esp_err_t
+ *  - ESP_OK: Success
+ *  - ESP_ERR_INVALID_ARG: Null out
+ */
+esp_err_t nimble_bulk_stats(nimble_bulk_stats_t *out);
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <esp_nimble_api.h>
+
+#define OBSERVER_MAX_UUIDS16 4 /* 16-bit service UUIDs kept per report, extra ones are ignored */
+#define OBSERVER_PROBE_LIMIT 8 /* Dedup cache slots searched per address before evicting the oldest */
+
+_Static_assert(CONFIG_ESP_NIMBLE_API_OBSERVER_CACHE_SIZE == 0 || (CONFIG_ESP_NIMBLE_API_OBSERVER_CACHE_SIZE & (CONFIG_ESP_NIMBLE_API_OBSERVER_CACHE_SIZE - 1)) == 0, "CONFIG_ESP_NIMBLE_API_OBSERVER_CACHE_SIZE must be a power of two");
+
+/**
+ * @brief Advertising report decoded by the observer
+ *
+ * Filled in place from the controller report without allocating. The data, name,
+ * mfg_data and svc_data pointers point into the report and are only valid for the
+ * duration of the callback; copy what has to be kept.
+ */
+typedef struct
+{
+    ble_addr_t addr;
+    int8_t rssi;
+    int8_t tx_power;     /* BLE_HS_ADV_TX_PWR_LVL_AUTO when not advertised */
+    uint8_t event_type;  /* BLE_HCI_ADV_RPT_EVTYPE_* */
+    uint8_t flags;       /* 0 when not advertised */
+    uint8_t uuid16_count;
+    uint16_t uuids16[OBSERVER_MAX_UUIDS16];
+    bool has_uuid128;
+    uint8_t uuid128[16]; /* First 128-bit service UUID, little-endian */
+    bool has_mfg_data;
+    uint16_t company_id;
+    const uint8_t *mfg_data; /* Manufacturer data after the company ID */
+    uint8_t mfg_data_len;
+    uint16_t svc_data_uuid16;
+    const uint8_t *svc_data; /* Service data after the 16-bit UUID */
+    uint8_t svc_data_len;
+    const uint8_t *name;     /* Complete or shortened local name, not null-terminated */
+    uint8_t name_len;
+    const uint8_t *data;     /* Raw AD structures */
+    uint8_t data_len;
+} nimble_observer_report_t;
+
+/**
+ * @brief Filters applied on the host task before a report reaches the application
+ *
+ * Every enabled filter must match. A report matches the UUID filter when any of
+ * its 16-bit service UUIDs, its service data UUID or its 128-bit service UUID is
+ * in uuids. The arrays must stay valid while scanning.
+ */
+typedef struct
+{
+    int8_t rssi_min;               /* Drop weaker reports; 0 disables */
+    const ble_uuid_any_t *uuids;   /* 16 and 128-bit UUIDs; NULL disables */
+    uint8_t uuid_count;
+    const uint16_t *company_ids;   /* Manufacturer data company IDs; NULL disables */
+    uint8_t company_id_count;
+} nimble_observer_filter_t;
+
+/**
+ * @brief Observer configuration
+ *
+ * Reports from an address are delivered again when their payload changes or
+ * dedup_ttl_ms after the last delivery. Advertising and scan response payloads
+ * are tracked separately.
+ */
+typedef struct
+{
+    uint16_t itvl_ms;      /* Scan interval; 0 uses the NimBLE default */
+    uint16_t window_ms;    /* Scan window; 0 uses the NimBLE default */
+    bool active;           /* Send scan requests and report scan responses */
+    uint32_t dedup_ttl_ms; /* 0 delivers every report */
+    nimble_observer_filter_t filter;
+    void (*nimble_observer_on_report_cb)(const nimble_observer_report_t *report, void *arg);
+    void *arg;
+} nimble_observer_config_t;
+
+/**
+ * @brief Observer counters, updated with relaxed atomics
+ */
+typedef struct
+{
+    uint32_t reports;    /* Received from the controller */
+    uint32_t malformed;  /* Dropped because the AD structures overran the report */
+    uint32_t filtered;   /* Dropped by the RSSI, UUID or company filters */
+    uint32_t duplicates; /* Dropped by the dedup cache */
+    uint32_t delivered;  /* Passed to nimble_observer_on_report_cb */
+    uint32_t evictions;  /* Live cache entries replaced to make room */
+} nimble_observer_stats_t;
+
+/**
+ * @brief Start scanning with ble_gap_disc()
+ *
+ * Runs next to the peripheral role on the same host. Parsing, filtering and
+ * deduplication run on the NimBLE host task in constant time per report, and only
+ * reports that pass reach the callback, which also runs on the host task and
+ * must return quickly. Controller duplicate filtering is left off so RSSI and
+ * payload changes are still seen. The counters are reset.
+ *
+ * @param config Scan parameters, filters and callback; copied, but the filter arrays are referenced
+ * @param duration_ms Scan duration, or BLE_HS_FOREVER
+ * @return esp_err_t
+ *  - ESP_OK: Scanning
+ *  - ESP_ERR_INVALID_ARG: Null config or callback
+ *  - ESP_ERR_INVALID_STATE: Already scanning, or the host has not synced
+ *  - ESP_ERR_NOT_SUPPORTED: CONFIG_BT_NIMBLE_ROLE_OBSERVER is disabled
+ *  - ESP_FAIL: The host rejected the scan parameters
+ */
+esp_err_t nimble_observer_start(const nimble_observer_config_t *config, int32_t duration_ms);
+
+/**
+ * @brief Stop scanning
+ *
+ * @return esp_err_t
+ *  - ESP_OK: Stopped
+ *  - ESP_ERR_INVALID_STATE: Not scanning
+ *  - ESP_ERR_NOT_SUPPORTED: CONFIG_BT_NIMBLE_ROLE_OBSERVER is disabled
+ */
+esp_err_t nimble_observer_stop(void);
+
+/**
+ * @brief Copy the observer counters
+ *
+ * @param out Destination for the counters
+ * @return esp_err_t
+ *  - ESP_OK: Success
+ *  - ESP_ERR_INVALID_ARG: Null out
+ */
+esp_err_t nimble_observer_stats(nimble_observer_stats_t *out);
+
+/**
+ * @brief Decode the AD structures of an advertising report
+ *
+ * Only the payload fields of out are written; addr, rssi and event_type are left
+ * to the caller. Used by the observer, and usable on reports obtained elsewhere.
+ *
+ * @param data AD structures
+ * @param len Length of data
+ * @param out Destination report
+ * @return esp_err_t
+ *  - ESP_OK: Success
+ *  - ESP_ERR_INVALID_ARG: Null out, or null data with a non-zero length
+ *  - ESP_ERR_INVALID_SIZE: An AD structure runs past len
+ */
+esp_err_t nimble_observer_parse(const uint8_t *data, uint8_t len, nimble_observer_report_t *out);
@@ -3,6 +3,279 @@
 static uint8_t esp_uri[] = {0x17, '/', '/', 'e', 's', 'p', 'r', 'e', 's', 's', 'i', 'f', '.', 'c', 'o', 'm'};
 static nimble_peripheral_config_t *g_nimble_peripheral_config = NULL;
 static nimble_peripheral_handle_t *g_nimble_peripheral = NULL;
+static int g_nimble_peripheral_conn_cursor = 0;
+
+#define NIMBLE_PERIPHERAL_TX_SPACE_BIT (1 << 0)
+#define NIMBLE_PERIPHERAL_COALESCE_IDLE_BIT (1 << 1)
+#define NIMBLE_PERIPHERAL_READY_BIT (1 << 0)
+#define NIMBLE_PERIPHERAL_SYNC_FAILED_BIT (1 << 1)
+
+#if CONFIG_ESP_NIMBLE_API_METRICS
+#define NIMBLE_PERIPHERAL_METRIC_ADD(counter, n) __atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED)
+#else
+#define NIMBLE_PERIPHERAL_METRIC_ADD(counter, n) ((void)(counter), (void)(n))
+#endif
+
+#if CONFIG_ESP_NIMBLE_API_TRACE
+#define NIMBLE_PERIPHERAL_TRACE(format, ...) ESP_LOGI(ESP_NIMBLE_API_TAG, format, ##__VA_ARGS__)
+#else
+#define NIMBLE_PERIPHERAL_TRACE(format, ...) \
+    do                                        \
+    {                                         \
+    } while (0)
+#endif
+
+#define NIMBLE_PERIPHERAL_CL_SUP_FEAT_MULTI_NTF (1 << 2) /* Client Supported Features bit for Multiple Handle Value Notifications */
+#define NIMBLE_PERIPHERAL_METRIC_ERROR_INDEX(rc) ((rc) >= 0 && (rc) < METRICS_ERROR_CODES - 1 ? (rc) : METRICS_ERROR_CODES - 1)
+
+typedef struct
+{
+    struct os_mbuf *om;
+    uint16_t attr_handle;
+    uint16_t stream_len;
+    bool packed; /* Queued by nimble_peripheral_notify_batch(), may share a PDU with the next packed entry */
+    uint32_t enqueued_us;
+} nimble_peripheral_tx_entry_t;
+
+typedef struct
+{
+    nimble_peripheral_tx_entry_t entries[CONFIG_ESP_NIMBLE_API_TX_QUEUE_DEPTH];
+    uint8_t head;
+    uint8_t count;
+    uint8_t in_flight;
+    uint8_t in_flight_head;
+    uint32_t in_flight_enqueued_us[CONFIG_ESP_NIMBLE_API_TX_CREDITS];
+} nimble_peripheral_tx_queue_t;
+
+typedef struct
+{
+    bool active;
+    const uint8_t *data;
+    size_t len;
+    size_t queued;
+    size_t sent;
+    uint16_t attr_handle;
+    uint8_t chunks_queued;
+    nimble_peripheral_stream_cb_t cb;
+    void *arg;
+} nimble_peripheral_stream_t;
+
+/* entries[head] stays queued while it is in flight so its callback survives until the confirmation. */
+typedef struct
+{
+    struct os_mbuf *om;
+    uint16_t attr_handle;
+    nimble_peripheral_indicate_cb_t cb;
+    void *arg;
+} nimble_peripheral_indicate_entry_t;
+
+typedef struct
+{
+    nimble_peripheral_indicate_entry_t entries[CONFIG_ESP_NIMBLE_API_INDICATE_QUEUE_DEPTH];
+    uint8_t head;
+    uint8_t count;
+    bool in_flight;
+} nimble_peripheral_indicate_queue_t;
+
+static nimble_peripheral_tx_queue_t g_nimble_peripheral_tx_queue[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+static nimble_peripheral_indicate_queue_t g_nimble_peripheral_indicate_queue[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+static nimble_peripheral_stream_t g_nimble_peripheral_stream[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+/* One lock per connection slot, so producers sending to different peers never contend. */
+static portMUX_TYPE g_nimble_peripheral_conn_lock[CONFIG_BT_NIMBLE_MAX_CONNECTIONS] = {[0 ... CONFIG_BT_NIMBLE_MAX_CONNECTIONS - 1] = portMUX_INITIALIZER_UNLOCKED};
+/* Sequence counter of the connection table, handle map and subscriber index; odd while the host task updates them. */
+static uint32_t g_nimble_peripheral_state_seq = 0;
+static portMUX_TYPE g_nimble_peripheral_state_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct ble_npl_event g_nimble_peripheral_tx_event;
+static struct ble_npl_callout g_nimble_peripheral_tx_retry;
+static StaticEventGroup_t g_nimble_peripheral_tx_event_group_buffer;
+static EventGroupHandle_t g_nimble_peripheral_tx_event_group = NULL;
+static int g_nimble_peripheral_tx_cursor = 0;
+static StaticEventGroup_t g_nimble_peripheral_ready_event_group_buffer;
+static EventGroupHandle_t g_nimble_peripheral_ready_event_group = NULL;
+/* Start of the current init, restart or controller reset, for time_to_ready_us. */
+static int64_t g_nimble_peripheral_ready_start_us = 0;
+/* Set while the host is being stopped, so the disconnects it causes do not restart advertising. */
+static volatile bool g_nimble_peripheral_stopping = false;
+static struct ble_npl_event g_nimble_peripheral_start_event;
+static struct ble_hs_stop_listener g_nimble_peripheral_stop_listener;
+
+/* Same headroom as ble_hs_mbuf_att_pkt(): ACL and L2CAP headers plus the largest ATT header. */
+#define NIMBLE_PERIPHERAL_TX_LEADING_SPACE (BLE_HCI_DATA_HDR_SZ + BLE_L2CAP_HDR_SZ + 5)
+
+#if CONFIG_ESP_NIMBLE_API_TX_POOL
+static os_membuf_t g_nimble_peripheral_tx_pool_mem[OS_MEMPOOL_SIZE(CONFIG_ESP_NIMBLE_API_TX_POOL_BLOCKS, CONFIG_ESP_NIMBLE_API_TX_POOL_BLOCK_SIZE)];
+static struct os_mempool g_nimble_peripheral_tx_mempool;
+static struct os_mbuf_pool g_nimble_peripheral_tx_mbuf_pool;
+#endif
+/* Pool for outgoing notification and indication payloads; NULL to take them from msys. */
+static struct os_mbuf_pool *g_nimble_peripheral_tx_pool = NULL;
+
+#if CONFIG_ESP_NIMBLE_API_COALESCE_CHARACTERISTICS > 0
+/* Records are a 16-bit little-endian length followed by the payload; attr_handle 0 marks a free entry. */
+typedef struct
+{
+    uint16_t attr_handle;
+    uint16_t len;
+    uint32_t max_delay_ms;
+    portMUX_TYPE lock;
+    struct ble_npl_callout deadline;
+    uint8_t active; /* Buffer producers append to; the other one belongs to the flush */
+    bool flushing;  /* A flush is copying the other buffer into an mbuf */
+    uint8_t buf[2][BLE_ATT_ATTR_MAX_LEN];
+} nimble_peripheral_coalescer_t;
+
+static nimble_peripheral_coalescer_t g_nimble_peripheral_coalescer[CONFIG_ESP_NIMBLE_API_COALESCE_CHARACTERISTICS];
+static portMUX_TYPE g_nimble_peripheral_coalescer_lock = portMUX_INITIALIZER_UNLOCKED;
+#endif
+
+#if CONFIG_ESP_NIMBLE_API_RX_RING_SIZE > 0
+_Static_assert((CONFIG_ESP_NIMBLE_API_RX_RING_SIZE & (CONFIG_ESP_NIMBLE_API_RX_RING_SIZE - 1)) == 0, "CONFIG_ESP_NIMBLE_API_RX_RING_SIZE must be a power of two");
+
+/* head is only written by the producer (host task), tail only by the consumer. */
+typedef struct
+{
+    uint32_t head;
+    uint32_t tail;
+    TaskHandle_t waiter;
+    uint8_t data[CONFIG_ESP_NIMBLE_API_RX_RING_SIZE];
+} nimble_peripheral_rx_ring_t;
+
+static nimble_peripheral_rx_ring_t g_nimble_peripheral_rx_ring[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+#endif
+
+#if MYNEWT_VAL(BLE_L2CAP_COC_MAX_NUM) > 0
+/* Producers append to tx under the slot lock; everything else belongs to the host task, except rx_held which releases decrement. */
+typedef struct
+{
+    struct ble_l2cap_chan *chan;
+    bool tx_stalled;              /* NimBLE holds an SDU until BLE_L2CAP_EVENT_COC_TX_UNSTALLED */
+    bool rx_posted;               /* A receive buffer is with NimBLE, so the peer can be granted credits */
+    uint8_t rx_held;              /* SDUs passed to nimble_peripheral_on_coc_data_cb and not released */
+    uint8_t tx_head;
+    uint8_t tx_count;
+    struct os_mbuf *tx[CONFIG_ESP_NIMBLE_API_COC_TX_QUEUE_DEPTH];
+} nimble_peripheral_coc_t;
+
+static nimble_peripheral_coc_t g_nimble_peripheral_coc[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+#endif
+
+/* Application callbacks that dispatch.enabled moves off the host task. */
+typedef enum
+{
+    NIMBLE_PERIPHERAL_EVENT_CONNECT,
+    NIMBLE_PERIPHERAL_EVENT_DISCONNECT,
+    NIMBLE_PERIPHERAL_EVENT_SUBSCRIBE_NOTIFY,
+    NIMBLE_PERIPHERAL_EVENT_UNSUBSCRIBE_NOTIFY,
+    NIMBLE_PERIPHERAL_EVENT_SUBSCRIBE_INDICATE,
+    NIMBLE_PERIPHERAL_EVENT_UNSUBSCRIBE_INDICATE,
+    NIMBLE_PERIPHERAL_EVENT_LINK_UPDATE,
+} nimble_peripheral_event_kind_t;
+
+typedef void (*nimble_peripheral_event_cb_t)(struct ble_gap_event *event, void *arg, int conn_index);
+
+#if CONFIG_ESP_NIMBLE_API_DISPATCH_QUEUE_SIZE > 0
+_Static_assert((CONFIG_ESP_NIMBLE_API_DISPATCH_QUEUE_SIZE & (CONFIG_ESP_NIMBLE_API_DISPATCH_QUEUE_SIZE - 1)) == 0, "CONFIG_ESP_NIMBLE_API_DISPATCH_QUEUE_SIZE must be a power of two");
+
+#define NIMBLE_PERIPHERAL_DISPATCH_EXIT_BIT (1 << 2)
+
+/* A queued record is claimed exactly once: by the worker to deliver it, or by the host task to cancel it. */
+typedef enum
+{
+    NIMBLE_PERIPHERAL_DISPATCH_READY,
+    NIMBLE_PERIPHERAL_DISPATCH_TAKEN,
+    NIMBLE_PERIPHERAL_DISPATCH_CANCELLED,
+} nimble_peripheral_dispatch_state_t;
+
+typedef struct
+{
+    uint8_t state;
+    uint8_t kind;
+    int8_t conn_index;
+    void *arg;
+    struct ble_gap_event event;
+} nimble_peripheral_dispatch_record_t;
+
+/* head is only written by the host task, tail only by the worker. */
+typedef struct
+{
+    uint32_t head;
+    uint32_t tail;
+    nimble_peripheral_dispatch_record_t records[CONFIG_ESP_NIMBLE_API_DISPATCH_QUEUE_SIZE];
+} nimble_peripheral_dispatch_queue_t;
+
+static nimble_peripheral_dispatch_queue_t g_nimble_peripheral_dispatch_queue;
+static nimble_peripheral_dispatch_stats_t g_nimble_peripheral_dispatch_stats;
+static TaskHandle_t g_nimble_peripheral_dispatch_task = NULL;
+static volatile bool g_nimble_peripheral_dispatch_stop = false;
+#endif
+
+typedef struct
+{
+    uint8_t phy_mask;
+    uint16_t tx_octets;
+    uint16_t tx_time;
+    struct ble_gap_upd_params conn_params;
+} nimble_peripheral_link_params_t;
+
+/* Intervals in 1.25 ms units, supervision timeouts in 10 ms units. */
+static const nimble_peripheral_link_params_t g_nimble_peripheral_link_params[] = {
+    [NIMBLE_PERIPHERAL_LINK_PROFILE_THROUGHPUT] = {BLE_GAP_LE_PHY_2M_MASK, 251, 2120, {6, 12, 0, 400, 0, 0}},
+    [NIMBLE_PERIPHERAL_LINK_PROFILE_BALANCED] = {BLE_GAP_LE_PHY_2M_MASK | BLE_GAP_LE_PHY_1M_MASK, 251, 2120, {24, 40, 0, 400, 0, 0}},
+    [NIMBLE_PERIPHERAL_LINK_PROFILE_LOW_POWER] = {BLE_GAP_LE_PHY_1M_MASK, 27, 328, {80, 160, 4, 600, 0, 0}},
+};
+
+/* Encoded payloads, built once per host sync; offsets point at the value of a patchable AD structure, 0 if absent. */
+typedef struct
+{
+    bool valid;
+    uint8_t adv_data[BLE_HS_ADV_MAX_SZ];
+    uint8_t adv_data_len;
+    uint8_t rsp_data[BLE_HS_ADV_MAX_SZ];
+    uint8_t rsp_data_len;
+    uint8_t mfg_data_offset;
+    uint8_t svc_data_offset;
+} nimble_peripheral_adv_cache_t;
+
+static nimble_peripheral_adv_cache_t g_nimble_peripheral_adv_cache;
+
+/* Fast reconnect runs these stages in order after every connection change; each ends on an ADV_COMPLETE timeout. */
+typedef enum
+{
+    NIMBLE_PERIPHERAL_RECONNECT_DIRECTED,
+    NIMBLE_PERIPHERAL_RECONNECT_ACCEPT_LIST,
+    NIMBLE_PERIPHERAL_RECONNECT_OPEN,
+} nimble_peripheral_reconnect_stage_t;
+
+/* RAM copy of the bond store's peer identities, loaded lazily and dropped when the store changes behind our back. */
+typedef struct
+{
+    bool loaded;
+    int count;
+    int last;
+    ble_addr_t peers[CONFIG_BT_NIMBLE_MAX_BONDS];
+} nimble_peripheral_bonds_t;
+
+static nimble_peripheral_bonds_t g_nimble_peripheral_bonds;
+static portMUX_TYPE g_nimble_peripheral_bonds_lock = portMUX_INITIALIZER_UNLOCKED;
+static nimble_peripheral_reconnect_stage_t g_nimble_peripheral_reconnect_stage = NIMBLE_PERIPHERAL_RECONNECT_DIRECTED;
+
+/* Set on sync and disconnect, cleared when the fast burst times out; the phase itself is derived on each restart. */
+static bool g_nimble_peripheral_adv_burst;
+static nimble_peripheral_adv_phase_t g_nimble_peripheral_adv_phase = NIMBLE_PERIPHERAL_ADV_PHASE_PAUSED;
+
+#if MYNEWT_VAL(BLE_EXT_ADV)
+/* enabled records the application's intent; the set is restarted whenever it is enabled but idle. */
+typedef struct
+{
+    bool configured;
+    bool enabled;
+    bool connectable;
+    int duration_ms;
+    int max_events;
+} nimble_peripheral_ext_adv_state_t;
+
+static nimble_peripheral_ext_adv_state_t g_nimble_peripheral_ext_adv[EXT_ADV_MAX_SETS];
+#endif
 
 static esp_err_t ble_app_set_addr()
 {
@@ -34,596 +307,4289 @@ static esp_err_t ble_app_set_addr()
     return ESP_OK;
 }
 
-static void nimble_peripheral_advertise(void);
-static void nimble_peripheral_ext_advertise(void);
+/* Only the host task writes; the critical section keeps it from being preempted, so readers on its core never see an odd count. */
+static void nimble_peripheral_state_write_begin(void)
+{
+    portENTER_CRITICAL(&g_nimble_peripheral_state_lock);
+    __atomic_store_n(&g_nimble_peripheral_state_seq, g_nimble_peripheral_state_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
 
-static int nimble_peripheral_gap_event_cb(struct ble_gap_event *event, void *arg)
+static void nimble_peripheral_state_write_end(void)
 {
-    int rc = 0;
-    esp_err_t err;
-    uint16_t conn_handle;
-    int conn_index;
+    __atomic_store_n(&g_nimble_peripheral_state_seq, g_nimble_peripheral_state_seq + 1, __ATOMIC_RELEASE);
+    portEXIT_CRITICAL(&g_nimble_peripheral_state_lock);
+}
 
-    switch (event->type)
+static uint32_t nimble_peripheral_state_read_begin(void)
+{
+    uint32_t seq;
+    while ((seq = __atomic_load_n(&g_nimble_peripheral_state_seq, __ATOMIC_ACQUIRE)) & 1)
     {
-    case BLE_GAP_EVENT_CONNECT:
-        conn_handle = event->connect.conn_handle;
-        if (event->connect.status == 0)
-        {
-            struct ble_gap_conn_desc desc;
-            rc = ble_gap_conn_find(conn_handle, &desc);
-            if (rc != 0)
-            {
-                ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to find connection descriptor (handle %d)", conn_handle);
-                break;
-            }
+    }
+    return seq;
+}
 
-            if (g_nimble_peripheral->peripheral_conn_active_count >= CONFIG_BT_NIMBLE_MAX_CONNECTIONS)
-            {
-                ESP_LOGW(ESP_NIMBLE_API_TAG, "Maximum connections reached; cannot register connection handle %d", conn_handle);
-                break;
-            }
+static bool nimble_peripheral_state_read_retry(uint32_t seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&g_nimble_peripheral_state_seq, __ATOMIC_RELAXED) != seq;
+}
 
-            conn_index = g_nimble_peripheral->peripheral_conn_active_count;
-            nimble_peripheral_conn_t *peripheral_conn = &g_nimble_peripheral->peripheral_conn[conn_index];
+/* Fails at once when the pool is empty: no fallback to msys, which stays reserved for RX and the host. */
+static struct os_mbuf *nimble_peripheral_tx_mbuf_from_flat(const void *data, uint16_t len)
+{
+    if (!g_nimble_peripheral_tx_pool)
+    {
+        return ble_hs_mbuf_from_flat(data, len);
+    }
 
-            peripheral_conn->conn_handle = event->connect.conn_handle;
-            memcpy(peripheral_conn->conn_addr_val, desc.peer_id_addr.val, sizeof(peripheral_conn->conn_addr_val));
-            sprintf(peripheral_conn->conn_addr_str, "%02X:%02X:%02X:%02X:%02X:%02X", desc.peer_id_addr.val[5], desc.peer_id_addr.val[4], desc.peer_id_addr.val[3], desc.peer_id_addr.val[2], desc.peer_id_addr.val[1], desc.peer_id_addr.val[0]);
-            memset(peripheral_conn->notify_subscriptions, 0, sizeof(peripheral_conn->notify_subscriptions));
-            memset(peripheral_conn->indicate_subscriptions, 0, sizeof(peripheral_conn->indicate_subscriptions));
-            peripheral_conn->notify_subscription_count = 0;
-            peripheral_conn->indicate_subscription_count = 0;
+    struct os_mbuf *om = os_mbuf_get_pkthdr(g_nimble_peripheral_tx_pool, 0);
+    if (!om)
+    {
+        return NULL;
+    }
 
-            g_nimble_peripheral->peripheral_conn_active_count++;
+    om->om_data += NIMBLE_PERIPHERAL_TX_LEADING_SPACE;
+    if (os_mbuf_append(om, data, len) != 0)
+    {
+        os_mbuf_free_chain(om);
+        return NULL;
+    }
 
-            if (g_nimble_peripheral_config->nimble_peripheral_on_connect_cb)
-            {
-                g_nimble_peripheral_config->nimble_peripheral_on_connect_cb(event, arg, conn_index);
-            }
-        }
-        else
+    return om;
+}
+
+static uint32_t nimble_peripheral_conn_map_home(uint16_t conn_handle)
+{
+    return conn_handle & (CONN_HANDLE_MAP_SIZE - 1);
+}
+
+static void nimble_peripheral_conn_map_insert(uint16_t conn_handle, int conn_index)
+{
+    uint32_t slot = nimble_peripheral_conn_map_home(conn_handle);
+
+    while (g_nimble_peripheral->conn_handle_map[slot] != 0)
+    {
+        slot = (slot + 1) & (CONN_HANDLE_MAP_SIZE - 1);
+    }
+    g_nimble_peripheral->conn_handle_map[slot] = conn_index + 1;
+}
+
+static void nimble_peripheral_conn_map_remove(uint16_t conn_handle)
+{
+    uint8_t *map = g_nimble_peripheral->conn_handle_map;
+    uint32_t hole = nimble_peripheral_conn_map_home(conn_handle);
+
+    for (int probe = 0; probe < CONN_HANDLE_MAP_SIZE; probe++)
+    {
+        if (map[hole] == 0)
         {
-            if (g_nimble_peripheral->peripheral_conn_active_count < CONFIG_BT_NIMBLE_MAX_CONNECTIONS)
-            {
-                nimble_peripheral_advertise();
-            }
+            return;
         }
-        break;
-    case BLE_GAP_EVENT_DISCONNECT:
-        conn_handle = event->disconnect.conn.conn_handle;
-        bool found = false;
-        int foundIndex;
-        nimble_peripheral_conn_t peripheral_conn;
-
-        for (int i = 0; i < g_nimble_peripheral->peripheral_conn_active_count; i++)
+        if (g_nimble_peripheral->peripheral_conn[map[hole] - 1].conn_handle == conn_handle)
         {
-            if (g_nimble_peripheral->peripheral_conn[i].conn_handle == conn_handle)
-            {
-                foundIndex = i;
-                peripheral_conn = g_nimble_peripheral->peripheral_conn[i];
-                found = true;
-                break;
-            }
+            break;
         }
+        hole = (hole + 1) & (CONN_HANDLE_MAP_SIZE - 1);
+    }
 
-        if (!found)
+    /* Backward-shift deletion keeps every probe sequence intact without tombstones. */
+    uint32_t next = hole;
+    while (true)
+    {
+        next = (next + 1) & (CONN_HANDLE_MAP_SIZE - 1);
+        if (map[next] == 0)
         {
-            ESP_LOGW(ESP_NIMBLE_API_TAG, "Disconnect event for unknown connection: Handle=%d", conn_handle);
             break;
         }
 
-        int last_index = g_nimble_peripheral->peripheral_conn_active_count - 1;
-        if (foundIndex != last_index)
+        uint32_t home = nimble_peripheral_conn_map_home(g_nimble_peripheral->peripheral_conn[map[next] - 1].conn_handle);
+        if (((next - home) & (CONN_HANDLE_MAP_SIZE - 1)) >= ((next - hole) & (CONN_HANDLE_MAP_SIZE - 1)))
         {
-            g_nimble_peripheral->peripheral_conn[foundIndex] = g_nimble_peripheral->peripheral_conn[last_index];
+            map[hole] = map[next];
+            hole = next;
         }
-        memset(&g_nimble_peripheral->peripheral_conn[last_index], 0, sizeof(nimble_peripheral_conn_t));
-        g_nimble_peripheral->peripheral_conn_active_count--;
+    }
+    map[hole] = 0;
+}
 
-        if (g_nimble_peripheral_config->nimble_peripheral_on_disconnect_cb)
+static int nimble_peripheral_conn_alloc(void)
+{
+    for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++)
+    {
+        int conn_index = (g_nimble_peripheral_conn_cursor + i) % CONFIG_BT_NIMBLE_MAX_CONNECTIONS;
+        if (!g_nimble_peripheral->peripheral_conn[conn_index].in_use)
         {
-            g_nimble_peripheral_config->nimble_peripheral_on_disconnect_cb(event, arg, peripheral_conn);
+            g_nimble_peripheral_conn_cursor = (conn_index + 1) % CONFIG_BT_NIMBLE_MAX_CONNECTIONS;
+            return conn_index;
         }
+    }
+
+    return -1;
+}
 
-        if (g_nimble_peripheral->peripheral_conn_active_count < CONFIG_BT_NIMBLE_MAX_CONNECTIONS)
+static nimble_peripheral_subscribers_t *nimble_peripheral_subscribers_find(uint16_t attr_handle, bool create)
+{
+    uint32_t slot = attr_handle & (MAX_SUBSCRIBED_ATTRS - 1);
+
+    for (int probe = 0; probe < MAX_SUBSCRIBED_ATTRS; probe++)
+    {
+        nimble_peripheral_subscribers_t *entry = &g_nimble_peripheral->subscribers[slot];
+        if (entry->attr_handle == attr_handle)
         {
-            nimble_peripheral_advertise();
+            return entry;
         }
-        break;
-    case BLE_GAP_EVENT_CONN_UPDATE:
-        break;
-    case BLE_GAP_EVENT_ADV_COMPLETE:
-        ESP_LOGI(ESP_NIMBLE_API_TAG, "Advertise complete; reason=%d, readvertising...", event->adv_complete.reason);
-        nimble_peripheral_advertise();
-        break;
-    case BLE_GAP_EVENT_NOTIFY_TX:
-        if ((event->notify_tx.status != 0) && (event->notify_tx.status != BLE_HS_EDONE))
+        if (entry->attr_handle == 0)
         {
-            ESP_LOGI(ESP_NIMBLE_API_TAG, "Notify event; conn_handle=%d attr_handle=%d status=%d is_indication=%d", event->notify_tx.conn_handle, event->notify_tx.attr_handle, event->notify_tx.status, event->notify_tx.indication);
+            if (!create)
+            {
+                return NULL;
+            }
+            entry->attr_handle = attr_handle;
+            return entry;
         }
-        break;
-    case BLE_GAP_EVENT_SUBSCRIBE:
-        conn_handle = event->subscribe.conn_handle;
-        bool found_conn = false;
-        int conn_index;
+        slot = (slot + 1) & (MAX_SUBSCRIBED_ATTRS - 1);
+    }
+
+    return NULL;
+}
+
+static bool nimble_peripheral_subscribers_update(nimble_peripheral_conn_mask_t *conn_mask, int conn_index, bool subscribed)
+{
+    nimble_peripheral_conn_mask_t bit = (nimble_peripheral_conn_mask_t)1 << conn_index;
+    bool was_subscribed = (*conn_mask & bit) != 0;
+
+    nimble_peripheral_state_write_begin();
+    if (subscribed)
+    {
+        *conn_mask |= bit;
+    }
+    else
+    {
+        *conn_mask &= ~bit;
+    }
+    nimble_peripheral_state_write_end();
+
+    return was_subscribed != subscribed;
+}
+
+static void nimble_peripheral_subscribers_clear(int conn_index)
+{
+    nimble_peripheral_conn_mask_t bit = (nimble_peripheral_conn_mask_t)1 << conn_index;
+
+    for (int i = 0; i < MAX_SUBSCRIBED_ATTRS; i++)
+    {
+        g_nimble_peripheral->subscribers[i].notify_conn_mask &= ~bit;
+        g_nimble_peripheral->subscribers[i].indicate_conn_mask &= ~bit;
+    }
+}
+
+/* Consistent copy of the slots subscribed to attr_handle and of their generations, readable from any task. */
+static nimble_peripheral_conn_mask_t nimble_peripheral_subscribers_snapshot(uint16_t attr_handle, bool indicate, uint16_t *generations)
+{
+    nimble_peripheral_conn_mask_t conn_mask;
+    uint32_t seq;
 
-        for (int i = 0; i < g_nimble_peripheral->peripheral_conn_active_count; i++)
+    do
+    {
+        seq = nimble_peripheral_state_read_begin();
+        nimble_peripheral_subscribers_t *subscribers = nimble_peripheral_subscribers_find(attr_handle, false);
+        conn_mask = 0;
+        if (subscribers)
         {
-            if (g_nimble_peripheral->peripheral_conn[i].conn_handle == conn_handle)
-            {
-                conn_index = i;
-                found_conn = true;
-                break;
-            }
+            conn_mask = __atomic_load_n(indicate ? &subscribers->indicate_conn_mask : &subscribers->notify_conn_mask, __ATOMIC_RELAXED);
         }
 
-        if (!found_conn)
+        for (nimble_peripheral_conn_mask_t pending = generations ? conn_mask : 0; pending; pending &= pending - 1)
         {
-            ESP_LOGE(ESP_NIMBLE_API_TAG, "Subscribe event connection handle %d not found", conn_handle);
-            break;
+            int conn_index = __builtin_ctz(pending);
+            generations[conn_index] = __atomic_load_n(&g_nimble_peripheral->peripheral_conn[conn_index].generation, __ATOMIC_RELAXED);
         }
+    } while (nimble_peripheral_state_read_retry(seq));
 
-        nimble_peripheral_conn_t *conn = &g_nimble_peripheral->peripheral_conn[conn_index];
+    return conn_mask;
+}
 
-        if (event->subscribe.prev_notify != event->subscribe.cur_notify)
-        {
-            if (event->subscribe.cur_notify)
-            {
-                if (conn->notify_subscription_count < MAX_SUBSCRIPTIONS_PER_CONN)
-                {
-                    conn->notify_subscriptions[conn->notify_subscription_count] = event->subscribe.attr_handle;
-                    conn->notify_subscription_count++;
-                }
-                else
-                {
-                    ESP_LOGW(ESP_NIMBLE_API_TAG, "Max notification subscriptions reached on connection %d", conn_handle);
-                }
+/* Checked under the slot's lock by every producer, so nothing is queued for a connection that replaced the captured one. */
+static bool nimble_peripheral_conn_matches(int conn_index, uint16_t generation)
+{
+    nimble_peripheral_conn_t *conn = &g_nimble_peripheral->peripheral_conn[conn_index];
+    return __atomic_load_n(&conn->in_use, __ATOMIC_RELAXED) && __atomic_load_n(&conn->generation, __ATOMIC_RELAXED) == generation;
+}
 
-                if (g_nimble_peripheral_config->nimble_peripheral_on_subscribe_notify_cb)
-                {
-                    g_nimble_peripheral_config->nimble_peripheral_on_subscribe_notify_cb(event, arg, conn_index);
-                }
-            }
-            else
-            {
-                for (int j = 0; j < conn->notify_subscription_count; j++)
-                {
-                    if (conn->notify_subscriptions[j] == event->subscribe.attr_handle)
-                    {
-                        for (int k = j; k < conn->notify_subscription_count - 1; k++)
-                        {
-                            conn->notify_subscriptions[k] = conn->notify_subscriptions[k + 1];
-                        }
-                        conn->notify_subscription_count--;
-                        break;
-                    }
-                }
+static esp_err_t nimble_peripheral_tx_queue_push(int conn_index, uint16_t generation, uint16_t attr_handle, struct os_mbuf *om, uint16_t stream_len)
+{
+    nimble_peripheral_tx_queue_t *queue = &g_nimble_peripheral_tx_queue[conn_index];
+    uint32_t now_us = (uint32_t)esp_timer_get_time();
+    esp_err_t err = ESP_OK;
 
-                if (g_nimble_peripheral_config->nimble_peripheral_on_unsubscribe_notify_cb)
-                {
-                    g_nimble_peripheral_config->nimble_peripheral_on_unsubscribe_notify_cb(event, arg, conn_index);
-                }
-            }
-        }
+    portENTER_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
+    if (!nimble_peripheral_conn_matches(conn_index, generation))
+    {
+        err = ESP_ERR_INVALID_STATE;
+    }
+    else if (queue->count >= CONFIG_ESP_NIMBLE_API_TX_QUEUE_WATERMARK)
+    {
+        err = ESP_ERR_TIMEOUT;
+    }
+    else
+    {
+        nimble_peripheral_tx_entry_t *entry = &queue->entries[(queue->head + queue->count) % CONFIG_ESP_NIMBLE_API_TX_QUEUE_DEPTH];
+        entry->om = om;
+        entry->attr_handle = attr_handle;
+        entry->stream_len = stream_len;
+        entry->packed = false;
+        entry->enqueued_us = now_us;
+        __atomic_store_n(&queue->count, queue->count + 1, __ATOMIC_RELAXED);
+    }
+    portEXIT_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
 
-        if (event->subscribe.prev_indicate != event->subscribe.cur_indicate)
-        {
-            if (event->subscribe.cur_indicate)
-            {
-                if (conn->indicate_subscription_count < MAX_SUBSCRIPTIONS_PER_CONN)
-                {
-                    conn->indicate_subscriptions[conn->indicate_subscription_count] = event->subscribe.attr_handle;
-                    conn->indicate_subscription_count++;
-                }
-                else
-                {
-                    ESP_LOGW(ESP_NIMBLE_API_TAG, "Max indication subscriptions reached on connection %d", conn_handle);
-                }
-                if (g_nimble_peripheral_config->nimble_peripheral_on_subscribe_indicate_cb)
-                {
-                    g_nimble_peripheral_config->nimble_peripheral_on_subscribe_indicate_cb(event, arg, conn_index);
-                }
-            }
-            else
-            {
-                for (int j = 0; j < conn->indicate_subscription_count; j++)
-                {
-                    if (conn->indicate_subscriptions[j] == event->subscribe.attr_handle)
-                    {
-                        for (int k = j; k < conn->indicate_subscription_count - 1; k++)
-                        {
-                            conn->indicate_subscriptions[k] = conn->indicate_subscriptions[k + 1];
-                        }
-                        conn->indicate_subscription_count--;
-                        break;
-                    }
-                }
+    return err;
+}
 
-                if (g_nimble_peripheral_config->nimble_peripheral_on_unsubscribe_indicate_cb)
-                {
-                    g_nimble_peripheral_config->nimble_peripheral_on_unsubscribe_indicate_cb(event, arg, conn_index);
-                }
-            }
+/* All or nothing, so a batch stays contiguous in the queue and other producers cannot split it. */
+static esp_err_t nimble_peripheral_tx_queue_push_batch(int conn_index, uint16_t generation, const uint16_t *attr_handles, struct os_mbuf **oms, int count)
+{
+    nimble_peripheral_tx_queue_t *queue = &g_nimble_peripheral_tx_queue[conn_index];
+    uint32_t now_us = (uint32_t)esp_timer_get_time();
+    esp_err_t err = ESP_OK;
+
+    portENTER_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
+    if (!nimble_peripheral_conn_matches(conn_index, generation))
+    {
+        err = ESP_ERR_INVALID_STATE;
+    }
+    else if (queue->count + count > CONFIG_ESP_NIMBLE_API_TX_QUEUE_WATERMARK)
+    {
+        err = ESP_ERR_TIMEOUT;
+    }
+    else
+    {
+        for (int i = 0; i < count; i++)
+        {
+            nimble_peripheral_tx_entry_t *entry = &queue->entries[(queue->head + queue->count + i) % CONFIG_ESP_NIMBLE_API_TX_QUEUE_DEPTH];
+            entry->om = oms[i];
+            entry->attr_handle = attr_handles[i];
+            entry->stream_len = 0;
+            entry->packed = true;
+            entry->enqueued_us = now_us;
         }
-        break;
-    case BLE_GAP_EVENT_MTU:
-        ESP_LOGI(ESP_NIMBLE_API_TAG, "mtu update event; conn_handle=%d cid=%d mtu=%d", event->mtu.conn_handle, event->mtu.channel_id, event->mtu.value);
-        break;
+        __atomic_store_n(&queue->count, queue->count + count, __ATOMIC_RELAXED);
     }
+    portEXIT_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
 
-    return rc;
+    return err;
 }
 
-static void nimble_peripheral_advertise(void)
+static bool nimble_peripheral_tx_queue_pop(int conn_index, nimble_peripheral_tx_entry_t *out_entry)
 {
-    ESP_LOGI(ESP_NIMBLE_API_TAG, "Starting advertising...");
+    nimble_peripheral_tx_queue_t *queue = &g_nimble_peripheral_tx_queue[conn_index];
+    bool popped = false;
 
-    struct ble_hs_adv_fields adv_fields = {0};
-    struct ble_gap_adv_params adv_params = {0};
-    struct ble_hs_adv_fields rsp_fields = {0};
+    portENTER_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
+    if (queue->count > 0 && queue->in_flight < CONFIG_ESP_NIMBLE_API_TX_CREDITS)
+    {
+        *out_entry = queue->entries[queue->head];
+        queue->head = (queue->head + 1) % CONFIG_ESP_NIMBLE_API_TX_QUEUE_DEPTH;
+        queue->count--;
+        queue->in_flight_enqueued_us[(queue->in_flight_head + queue->in_flight) % CONFIG_ESP_NIMBLE_API_TX_CREDITS] = out_entry->enqueued_us;
+        queue->in_flight++;
+        popped = true;
+    }
+    portEXIT_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
+
+    return popped;
+}
+
+#if MYNEWT_VAL(BLE_GATT_NOTIFY_MULTIPLE)
+/* Pops the head entry only if it is packed and its value fits in the room left in the PDU. */
+static bool nimble_peripheral_tx_queue_pop_packed(int conn_index, uint16_t room, nimble_peripheral_tx_entry_t *out_entry)
+{
+    nimble_peripheral_tx_queue_t *queue = &g_nimble_peripheral_tx_queue[conn_index];
+    bool popped = false;
 
-    adv_fields.flags = BLE_HS_ADV_F_DISC_GEN | BLE_HS_ADV_F_BREDR_UNSUP;
+    portENTER_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
+    nimble_peripheral_tx_entry_t *entry = &queue->entries[queue->head];
+    if (queue->count > 0 && queue->in_flight < CONFIG_ESP_NIMBLE_API_TX_CREDITS && entry->packed && OS_MBUF_PKTLEN(entry->om) + 4 <= room)
+    {
+        *out_entry = *entry;
+        queue->head = (queue->head + 1) % CONFIG_ESP_NIMBLE_API_TX_QUEUE_DEPTH;
+        queue->count--;
+        queue->in_flight_enqueued_us[(queue->in_flight_head + queue->in_flight) % CONFIG_ESP_NIMBLE_API_TX_CREDITS] = out_entry->enqueued_us;
+        queue->in_flight++;
+        popped = true;
+    }
+    portEXIT_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
+
+    return popped;
+}
+#endif
+
+static void nimble_peripheral_tx_queue_flush(int conn_index)
+{
+    nimble_peripheral_tx_queue_t *queue = &g_nimble_peripheral_tx_queue[conn_index];
+    nimble_peripheral_tx_entry_t entries[CONFIG_ESP_NIMBLE_API_TX_QUEUE_DEPTH];
+    int count;
+
+    portENTER_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
+    count = queue->count;
+    for (int i = 0; i < count; i++)
+    {
+        entries[i] = queue->entries[(queue->head + i) % CONFIG_ESP_NIMBLE_API_TX_QUEUE_DEPTH];
+    }
+    queue->head = 0;
+    queue->count = 0;
+    queue->in_flight = 0;
+    queue->in_flight_head = 0;
+    portEXIT_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
+
+    g_nimble_peripheral_stream[conn_index].chunks_queued = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        os_mbuf_free_chain(entries[i].om);
+    }
+
+    if (g_nimble_peripheral_tx_event_group)
+    {
+        xEventGroupSetBits(g_nimble_peripheral_tx_event_group, NIMBLE_PERIPHERAL_TX_SPACE_BIT);
+    }
+}
+
+static bool nimble_peripheral_tx_release_credit(int conn_index, uint32_t *out_enqueued_us)
+{
+    nimble_peripheral_tx_queue_t *queue = &g_nimble_peripheral_tx_queue[conn_index];
+    bool released = false;
+
+    portENTER_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
+    if (queue->in_flight > 0)
+    {
+        *out_enqueued_us = queue->in_flight_enqueued_us[queue->in_flight_head];
+        queue->in_flight_head = (queue->in_flight_head + 1) % CONFIG_ESP_NIMBLE_API_TX_CREDITS;
+        queue->in_flight--;
+        released = true;
+    }
+    portEXIT_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
+
+    return released;
+}
+
+static void nimble_peripheral_metrics_latency(int conn_index, uint32_t enqueued_us)
+{
+#if CONFIG_ESP_NIMBLE_API_METRICS
+    static const uint32_t bucket_bounds_us[METRICS_LATENCY_BUCKETS - 1] = {1000, 2000, 5000, 10000, 20000, 50000, 100000};
+    nimble_peripheral_conn_metrics_t *metrics = &g_nimble_peripheral->metrics.conn[conn_index];
+    uint32_t latency_us = (uint32_t)esp_timer_get_time() - enqueued_us;
+
+    int bucket = 0;
+    while (bucket < METRICS_LATENCY_BUCKETS - 1 && latency_us >= bucket_bounds_us[bucket])
+    {
+        bucket++;
+    }
+    NIMBLE_PERIPHERAL_METRIC_ADD(metrics->latency_hist[bucket], 1);
+
+    /* Only the host task writes the maximum, so a plain compare is enough. */
+    if (latency_us > metrics->latency_max_us)
+    {
+        __atomic_store_n(&metrics->latency_max_us, latency_us, __ATOMIC_RELAXED);
+    }
+#endif
+}
+
+static void nimble_peripheral_tx_complete(int conn_index)
+{
+    uint32_t enqueued_us;
+    if (nimble_peripheral_tx_release_credit(conn_index, &enqueued_us))
+    {
+        nimble_peripheral_metrics_latency(conn_index, enqueued_us);
+    }
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &g_nimble_peripheral_tx_event);
+}
+
+static void nimble_peripheral_stream_finish(int conn_index, esp_err_t status)
+{
+    nimble_peripheral_stream_t *stream = &g_nimble_peripheral_stream[conn_index];
+    if (!stream->active)
+    {
+        return;
+    }
+
+    stream->active = false;
+    if (stream->cb)
+    {
+        stream->cb(conn_index, stream->sent, stream->len, status, stream->arg);
+    }
+}
+
+/* Cuts the next chunks of a stream into the connection's queue, keeping at most one credit window queued. */
+static void nimble_peripheral_stream_refill(int conn_index)
+{
+    nimble_peripheral_stream_t *stream = &g_nimble_peripheral_stream[conn_index];
+    uint16_t chunk_max = g_nimble_peripheral->peripheral_conn[conn_index].mtu - 3;
+    if (chunk_max > BLE_ATT_ATTR_MAX_LEN)
+    {
+        chunk_max = BLE_ATT_ATTR_MAX_LEN;
+    }
+
+    while (stream->active && stream->queued < stream->len && stream->chunks_queued < CONFIG_ESP_NIMBLE_API_TX_CREDITS)
+    {
+        size_t remaining = stream->len - stream->queued;
+        uint16_t chunk_len = remaining < chunk_max ? remaining : chunk_max;
+
+        struct os_mbuf *om = nimble_peripheral_tx_mbuf_from_flat(stream->data + stream->queued, chunk_len);
+        if (!om)
+        {
+            NIMBLE_PERIPHERAL_METRIC_ADD(g_nimble_peripheral->metrics.conn[conn_index].mbuf_alloc_failures, 1);
+            /* Retried on the next pump pass, which the pending credits guarantee. */
+            break;
+        }
+
+        if (nimble_peripheral_tx_queue_push(conn_index, g_nimble_peripheral->peripheral_conn[conn_index].generation, stream->attr_handle, om, chunk_len) != ESP_OK)
+        {
+            os_mbuf_free_chain(om);
+            break;
+        }
+
+        stream->queued += chunk_len;
+        stream->chunks_queued++;
+    }
+}
+
+static esp_err_t nimble_peripheral_indicate_queue_push(int conn_index, uint16_t generation, uint16_t attr_handle, struct os_mbuf *om, nimble_peripheral_indicate_cb_t cb, void *arg)
+{
+    nimble_peripheral_indicate_queue_t *queue = &g_nimble_peripheral_indicate_queue[conn_index];
+    esp_err_t err = ESP_OK;
+
+    portENTER_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
+    if (!nimble_peripheral_conn_matches(conn_index, generation))
+    {
+        err = ESP_ERR_INVALID_STATE;
+    }
+    else if (queue->count >= CONFIG_ESP_NIMBLE_API_INDICATE_QUEUE_DEPTH)
+    {
+        err = ESP_ERR_NO_MEM;
+    }
+    else
+    {
+        nimble_peripheral_indicate_entry_t *entry = &queue->entries[(queue->head + queue->count) % CONFIG_ESP_NIMBLE_API_INDICATE_QUEUE_DEPTH];
+        entry->om = om;
+        entry->attr_handle = attr_handle;
+        entry->cb = cb;
+        entry->arg = arg;
+        queue->count++;
+    }
+    portEXIT_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
+
+    return err;
+}
+
+/* Takes the head entry for sending; its om is handed over and the slot stays queued until completion. */
+static bool nimble_peripheral_indicate_queue_start(int conn_index, nimble_peripheral_indicate_entry_t *out_entry)
+{
+    nimble_peripheral_indicate_queue_t *queue = &g_nimble_peripheral_indicate_queue[conn_index];
+    bool started = false;
+
+    portENTER_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
+    if (queue->count > 0 && !queue->in_flight)
+    {
+        *out_entry = queue->entries[queue->head];
+        queue->entries[queue->head].om = NULL;
+        queue->in_flight = true;
+        started = true;
+    }
+    portEXIT_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
+
+    return started;
+}
+
+static void nimble_peripheral_indicate_complete(int conn_index, esp_err_t status)
+{
+    nimble_peripheral_indicate_queue_t *queue = &g_nimble_peripheral_indicate_queue[conn_index];
+    nimble_peripheral_indicate_entry_t entry;
+    bool completed = false;
+
+    portENTER_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
+    if (queue->in_flight)
+    {
+        entry = queue->entries[queue->head];
+        queue->head = (queue->head + 1) % CONFIG_ESP_NIMBLE_API_INDICATE_QUEUE_DEPTH;
+        queue->count--;
+        queue->in_flight = false;
+        completed = true;
+    }
+    portEXIT_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
+
+    if (completed && entry.cb)
+    {
+        entry.cb(conn_index, entry.attr_handle, status, entry.arg);
+    }
+}
+
+static void nimble_peripheral_indicate_queue_flush(int conn_index)
+{
+    nimble_peripheral_indicate_queue_t *queue = &g_nimble_peripheral_indicate_queue[conn_index];
+    nimble_peripheral_indicate_entry_t entries[CONFIG_ESP_NIMBLE_API_INDICATE_QUEUE_DEPTH];
+    int count;
+
+    portENTER_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
+    count = queue->count;
+    for (int i = 0; i < count; i++)
+    {
+        entries[i] = queue->entries[(queue->head + i) % CONFIG_ESP_NIMBLE_API_INDICATE_QUEUE_DEPTH];
+    }
+    queue->head = 0;
+    queue->count = 0;
+    queue->in_flight = false;
+    portEXIT_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
+
+    for (int i = 0; i < count; i++)
+    {
+        if (entries[i].om)
+        {
+            os_mbuf_free_chain(entries[i].om);
+        }
+        if (entries[i].cb)
+        {
+            entries[i].cb(conn_index, entries[i].attr_handle, ESP_ERR_INVALID_STATE, entries[i].arg);
+        }
+    }
+}
+
+/* Sends the head indication of every idle connection; the next one follows its confirmation. */
+static void nimble_peripheral_indicate_pump(void)
+{
+    for (int conn_index = 0; conn_index < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; conn_index++)
+    {
+        nimble_peripheral_indicate_entry_t entry;
+        while (nimble_peripheral_indicate_queue_start(conn_index, &entry))
+        {
+            if (!nimble_peripheral_is_subscribed(conn_index, entry.attr_handle, true))
+            {
+                os_mbuf_free_chain(entry.om);
+                nimble_peripheral_indicate_complete(conn_index, ESP_ERR_INVALID_STATE);
+                continue;
+            }
+
+            nimble_peripheral_conn_metrics_t *metrics = &g_nimble_peripheral->metrics.conn[conn_index];
+            uint16_t conn_handle = g_nimble_peripheral->peripheral_conn[conn_index].conn_handle;
+            uint16_t len = OS_MBUF_PKTLEN(entry.om);
+            int rc = ble_gatts_indicate_custom(conn_handle, entry.attr_handle, entry.om);
+            if (rc == 0)
+            {
+                NIMBLE_PERIPHERAL_METRIC_ADD(metrics->tx_pdus, 1);
+                NIMBLE_PERIPHERAL_METRIC_ADD(metrics->tx_bytes, len);
+                NIMBLE_PERIPHERAL_TRACE("Indication sent: conn_handle=%d, attr_handle=%d, len=%d", conn_handle, entry.attr_handle, len);
+                break;
+            }
+
+            NIMBLE_PERIPHERAL_METRIC_ADD(metrics->notify_errors[NIMBLE_PERIPHERAL_METRIC_ERROR_INDEX(rc)], 1);
+
+            /* The host may already have reported the failure through NOTIFY_TX, which completes the entry. */
+            ESP_LOGE(ESP_NIMBLE_API_TAG, "Indication failed: conn_handle=%d, attr_handle=%d, error=%d", conn_handle, entry.attr_handle, rc);
+            nimble_peripheral_indicate_complete(conn_index, ESP_FAIL);
+        }
+    }
+}
+
+#if MYNEWT_VAL(BLE_L2CAP_COC_MAX_NUM) > 0
+static uint16_t nimble_peripheral_coc_mtu(void)
+{
+    return g_nimble_peripheral_config->coc.mtu ? g_nimble_peripheral_config->coc.mtu : COC_DEFAULT_MTU;
+}
+
+/* Posting a receive buffer is what grants the peer credits, so holding it back is the receive-side flow control. */
+static void nimble_peripheral_coc_rx_refill(int conn_index)
+{
+    nimble_peripheral_coc_t *coc = &g_nimble_peripheral_coc[conn_index];
+    if (!coc->chan || coc->rx_posted)
+    {
+        return;
+    }
+
+    if (__atomic_load_n(&coc->rx_held, __ATOMIC_RELAXED) >= CONFIG_ESP_NIMBLE_API_COC_RX_HELD)
+    {
+        return;
+    }
+
+    struct os_mbuf *sdu = os_msys_get_pkthdr(nimble_peripheral_coc_mtu(), 0);
+    if (!sdu)
+    {
+        NIMBLE_PERIPHERAL_METRIC_ADD(g_nimble_peripheral->metrics.conn[conn_index].mbuf_alloc_failures, 1);
+        ble_npl_callout_reset(&g_nimble_peripheral_tx_retry, ble_npl_time_ms_to_ticks32(10));
+        return;
+    }
+
+    int rc = ble_l2cap_recv_ready(coc->chan, sdu);
+    if (rc != 0)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to post CoC receive buffer, error code: %d", rc);
+        os_mbuf_free_chain(sdu);
+        return;
+    }
+    coc->rx_posted = true;
+}
+
+/* Runs on the host task when the channel or the whole connection goes away; safe to call twice. */
+static void nimble_peripheral_coc_close(int conn_index)
+{
+    nimble_peripheral_coc_t *coc = &g_nimble_peripheral_coc[conn_index];
+    struct os_mbuf *tx[CONFIG_ESP_NIMBLE_API_COC_TX_QUEUE_DEPTH];
+    int count;
+
+    portENTER_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
+    bool was_open = coc->chan != NULL;
+    coc->chan = NULL;
+    count = coc->tx_count;
+    for (int i = 0; i < count; i++)
+    {
+        tx[i] = coc->tx[(coc->tx_head + i) % CONFIG_ESP_NIMBLE_API_COC_TX_QUEUE_DEPTH];
+    }
+    coc->tx_head = 0;
+    coc->tx_count = 0;
+    portEXIT_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
+
+    for (int i = 0; i < count; i++)
+    {
+        os_mbuf_free_chain(tx[i]);
+    }
+    coc->tx_stalled = false;
+    coc->rx_posted = false;
+    g_nimble_peripheral->peripheral_conn[conn_index].coc_mtu = 0;
+
+    if (!was_open)
+    {
+        return;
+    }
+
+    if (g_nimble_peripheral_tx_event_group)
+    {
+        xEventGroupSetBits(g_nimble_peripheral_tx_event_group, NIMBLE_PERIPHERAL_TX_SPACE_BIT);
+    }
+    if (g_nimble_peripheral_config->coc.nimble_peripheral_on_coc_disconnect_cb)
+    {
+        g_nimble_peripheral_config->coc.nimble_peripheral_on_coc_disconnect_cb(conn_index, g_nimble_peripheral_config->coc.arg);
+    }
+}
+
+/* Hands each channel's next SDU to NimBLE, round-robin; a stalled channel waits for its unstall event. */
+static void nimble_peripheral_coc_pump(void)
+{
+    bool progress = true;
+
+    while (progress)
+    {
+        progress = false;
+
+        for (int conn_index = 0; conn_index < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; conn_index++)
+        {
+            nimble_peripheral_coc_t *coc = &g_nimble_peripheral_coc[conn_index];
+            nimble_peripheral_coc_rx_refill(conn_index);
+            if (!coc->chan || coc->tx_stalled || __atomic_load_n(&coc->tx_count, __ATOMIC_RELAXED) == 0)
+            {
+                continue;
+            }
+
+            /* Only the host task removes entries, so the head stays put while it is being sent. */
+            struct os_mbuf *sdu = coc->tx[coc->tx_head];
+            uint16_t len = OS_MBUF_PKTLEN(sdu);
+            int rc = ble_l2cap_send(coc->chan, sdu);
+            if (rc == BLE_HS_EBUSY)
+            {
+                coc->tx_stalled = true;
+                continue;
+            }
+
+            portENTER_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
+            coc->tx_head = (coc->tx_head + 1) % CONFIG_ESP_NIMBLE_API_COC_TX_QUEUE_DEPTH;
+            coc->tx_count--;
+            portEXIT_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
+            progress = true;
+
+            nimble_peripheral_conn_metrics_t *metrics = &g_nimble_peripheral->metrics.conn[conn_index];
+            if (rc == 0 || rc == BLE_HS_ESTALLED)
+            {
+                /* A stalled SDU is kept by NimBLE and finished as the peer grants credits. */
+                coc->tx_stalled = rc == BLE_HS_ESTALLED;
+                NIMBLE_PERIPHERAL_METRIC_ADD(metrics->tx_pdus, 1);
+                NIMBLE_PERIPHERAL_METRIC_ADD(metrics->tx_bytes, len);
+                NIMBLE_PERIPHERAL_TRACE("CoC SDU sent: conn_index=%d, len=%d, stalled=%d", conn_index, len, rc != 0);
+            }
+            else
+            {
+                NIMBLE_PERIPHERAL_METRIC_ADD(metrics->notify_errors[NIMBLE_PERIPHERAL_METRIC_ERROR_INDEX(rc)], 1);
+                ESP_LOGE(ESP_NIMBLE_API_TAG, "CoC send failed: conn_index=%d, len=%d, error=%d", conn_index, len, rc);
+                os_mbuf_free_chain(sdu);
+            }
+        }
+    }
+}
+
+static int nimble_peripheral_l2cap_event_cb(struct ble_l2cap_event *event, void *arg)
+{
+    nimble_peripheral_coc_t *coc;
+    int conn_index;
+
+    switch (event->type)
+    {
+    case BLE_L2CAP_EVENT_COC_ACCEPT:
+        /* One channel per connection; the first receive buffer must be posted before accepting. */
+        conn_index = nimble_peripheral_conn_find(event->accept.conn_handle);
+        if (conn_index < 0 || g_nimble_peripheral_coc[conn_index].chan || g_nimble_peripheral_coc[conn_index].rx_posted)
+        {
+            return BLE_HS_ENOMEM;
+        }
+
+        struct os_mbuf *sdu = os_msys_get_pkthdr(nimble_peripheral_coc_mtu(), 0);
+        if (!sdu)
+        {
+            NIMBLE_PERIPHERAL_METRIC_ADD(g_nimble_peripheral->metrics.conn[conn_index].mbuf_alloc_failures, 1);
+            return BLE_HS_ENOMEM;
+        }
+        if (ble_l2cap_recv_ready(event->accept.chan, sdu) != 0)
+        {
+            os_mbuf_free_chain(sdu);
+            return BLE_HS_ENOMEM;
+        }
+        g_nimble_peripheral_coc[conn_index].rx_posted = true;
+        __atomic_store_n(&g_nimble_peripheral_coc[conn_index].rx_held, 0, __ATOMIC_RELAXED);
+        return 0;
+    case BLE_L2CAP_EVENT_COC_CONNECTED:
+        conn_index = nimble_peripheral_conn_find(event->connect.conn_handle);
+        if (conn_index < 0)
+        {
+            break;
+        }
+
+        coc = &g_nimble_peripheral_coc[conn_index];
+        if (event->connect.status != 0)
+        {
+            /* NimBLE frees the buffer posted on accept together with the channel. */
+            coc->rx_posted = false;
+            ESP_LOGW(ESP_NIMBLE_API_TAG, "CoC connection failed; conn_handle=%d status=%d", event->connect.conn_handle, event->connect.status);
+            break;
+        }
+
+        struct ble_l2cap_chan_info info;
+        if (ble_l2cap_get_chan_info(event->connect.chan, &info) != 0)
+        {
+            ble_l2cap_disconnect(event->connect.chan);
+            break;
+        }
+
+        portENTER_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
+        coc->chan = event->connect.chan;
+        portEXIT_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
+        g_nimble_peripheral->peripheral_conn[conn_index].coc_mtu = info.peer_coc_mtu;
+        ESP_LOGI(ESP_NIMBLE_API_TAG, "CoC connected; conn_handle=%d psm=0x%04x our_mtu=%d peer_mtu=%d", event->connect.conn_handle, info.psm, info.our_coc_mtu, info.peer_coc_mtu);
+
+        if (g_nimble_peripheral_config->coc.nimble_peripheral_on_coc_connect_cb)
+        {
+            g_nimble_peripheral_config->coc.nimble_peripheral_on_coc_connect_cb(conn_index, info.peer_coc_mtu, g_nimble_peripheral_config->coc.arg);
+        }
+        break;
+    case BLE_L2CAP_EVENT_COC_DISCONNECTED:
+        conn_index = nimble_peripheral_conn_find(event->disconnect.conn_handle);
+        if (conn_index >= 0 && g_nimble_peripheral_coc[conn_index].chan == event->disconnect.chan)
+        {
+            ESP_LOGI(ESP_NIMBLE_API_TAG, "CoC disconnected; conn_handle=%d", event->disconnect.conn_handle);
+            nimble_peripheral_coc_close(conn_index);
+        }
+        break;
+    case BLE_L2CAP_EVENT_COC_DATA_RECEIVED:
+        conn_index = nimble_peripheral_conn_find(event->receive.conn_handle);
+        if (conn_index < 0 || g_nimble_peripheral_coc[conn_index].chan != event->receive.chan)
+        {
+            os_mbuf_free_chain(event->receive.sdu_rx);
+            break;
+        }
+
+        coc = &g_nimble_peripheral_coc[conn_index];
+        coc->rx_posted = false;
+        NIMBLE_PERIPHERAL_METRIC_ADD(g_nimble_peripheral->metrics.conn[conn_index].rx_pdus, 1);
+        NIMBLE_PERIPHERAL_METRIC_ADD(g_nimble_peripheral->metrics.conn[conn_index].rx_bytes, OS_MBUF_PKTLEN(event->receive.sdu_rx));
+        __atomic_fetch_add(&coc->rx_held, 1, __ATOMIC_RELAXED);
+        g_nimble_peripheral_config->coc.nimble_peripheral_on_coc_data_cb(conn_index, event->receive.sdu_rx, g_nimble_peripheral_config->coc.arg);
+        nimble_peripheral_coc_rx_refill(conn_index);
+        break;
+    case BLE_L2CAP_EVENT_COC_TX_UNSTALLED:
+        conn_index = nimble_peripheral_conn_find(event->tx_unstalled.conn_handle);
+        if (conn_index >= 0)
+        {
+            g_nimble_peripheral_coc[conn_index].tx_stalled = false;
+            ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &g_nimble_peripheral_tx_event);
+        }
+        break;
+    }
+
+    return 0;
+}
+#endif
+
+static bool nimble_peripheral_tx_has_room(nimble_peripheral_conn_mask_t conn_mask)
+{
+    while (conn_mask)
+    {
+        int conn_index = __builtin_ctz(conn_mask);
+        conn_mask &= conn_mask - 1;
+        if (__atomic_load_n(&g_nimble_peripheral_tx_queue[conn_index].count, __ATOMIC_RELAXED) >= CONFIG_ESP_NIMBLE_API_TX_QUEUE_WATERMARK)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+#if MYNEWT_VAL(BLE_GATT_NOTIFY_MULTIPLE)
+/*
+ * Sends first together with the packed entries behind it in one Multiple Handle Value
+ * Notification, or alone when the peer does not support them. Every value still takes
+ * a credit, since the host reports each handle with its own BLE_GAP_EVENT_NOTIFY_TX.
+ */
+static int nimble_peripheral_tx_send_packed(int conn_index, nimble_peripheral_tx_entry_t *first, uint16_t *out_len)
+{
+    nimble_peripheral_conn_t *conn = &g_nimble_peripheral->peripheral_conn[conn_index];
+    uint8_t features = 0;
+    if (ble_gatts_peer_cl_sup_feat_get(conn->conn_handle, &features, 1) != 0 || !(features & NIMBLE_PERIPHERAL_CL_SUP_FEAT_MULTI_NTF))
+    {
+        return ble_gatts_notify_custom(conn->conn_handle, first->attr_handle, first->om);
+    }
+
+    /* One opcode byte, then a handle and a length ahead of every value. */
+    struct ble_gatt_notif tuples[CONFIG_ESP_NIMBLE_API_TX_CREDITS] = {{.handle = first->attr_handle, .value = first->om}};
+    size_t count = 1;
+    int room = (int)conn->mtu - 1 - 4 - OS_MBUF_PKTLEN(first->om);
+    nimble_peripheral_tx_entry_t entry;
+    while (room >= 4 && nimble_peripheral_tx_queue_pop_packed(conn_index, (uint16_t)room, &entry))
+    {
+        if (!nimble_peripheral_is_subscribed(conn_index, entry.attr_handle, false))
+        {
+            uint32_t enqueued_us;
+            os_mbuf_free_chain(entry.om);
+            nimble_peripheral_tx_release_credit(conn_index, &enqueued_us);
+            continue;
+        }
+        room -= 4 + OS_MBUF_PKTLEN(entry.om);
+        *out_len += OS_MBUF_PKTLEN(entry.om);
+        tuples[count].handle = entry.attr_handle;
+        tuples[count].value = entry.om;
+        count++;
+    }
+
+    if (count == 1)
+    {
+        return ble_gatts_notify_custom(conn->conn_handle, first->attr_handle, first->om);
+    }
+    return ble_gatts_notify_multiple_custom(conn->conn_handle, count, tuples);
+}
+#endif
+
+/* Runs on the NimBLE host task: serves connection queues round-robin, one PDU per connection per pass. */
+static void nimble_peripheral_tx_pump(struct ble_npl_event *ev)
+{
+    bool progress = true;
+
+    nimble_peripheral_indicate_pump();
+#if MYNEWT_VAL(BLE_L2CAP_COC_MAX_NUM) > 0
+    nimble_peripheral_coc_pump();
+#endif
+
+    while (progress)
+    {
+        progress = false;
+
+        for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++)
+        {
+            if (os_msys_num_free() < CONFIG_ESP_NIMBLE_API_TX_MSYS_RESERVE)
+            {
+                ble_npl_callout_reset(&g_nimble_peripheral_tx_retry, ble_npl_time_ms_to_ticks32(10));
+                progress = false;
+                break;
+            }
+
+            int conn_index = (g_nimble_peripheral_tx_cursor + i) % CONFIG_BT_NIMBLE_MAX_CONNECTIONS;
+            nimble_peripheral_stream_t *stream = &g_nimble_peripheral_stream[conn_index];
+            nimble_peripheral_stream_refill(conn_index);
+
+            nimble_peripheral_tx_entry_t entry;
+            if (!nimble_peripheral_tx_queue_pop(conn_index, &entry))
+            {
+                continue;
+            }
+            progress = true;
+
+            if (entry.stream_len)
+            {
+                stream->chunks_queued--;
+                if (!stream->active)
+                {
+                    uint32_t enqueued_us;
+                    os_mbuf_free_chain(entry.om);
+                    nimble_peripheral_tx_release_credit(conn_index, &enqueued_us);
+                    continue;
+                }
+            }
+            else if (!nimble_peripheral_is_subscribed(conn_index, entry.attr_handle, false))
+            {
+                /* The peer unsubscribed after the producer took its snapshot. */
+                uint32_t enqueued_us;
+                os_mbuf_free_chain(entry.om);
+                nimble_peripheral_tx_release_credit(conn_index, &enqueued_us);
+                continue;
+            }
+
+            nimble_peripheral_conn_metrics_t *metrics = &g_nimble_peripheral->metrics.conn[conn_index];
+            uint16_t conn_handle = g_nimble_peripheral->peripheral_conn[conn_index].conn_handle;
+            uint16_t len = OS_MBUF_PKTLEN(entry.om);
+#if MYNEWT_VAL(BLE_GATT_NOTIFY_MULTIPLE)
+            int rc = entry.packed ? nimble_peripheral_tx_send_packed(conn_index, &entry, &len) : ble_gatts_notify_custom(conn_handle, entry.attr_handle, entry.om);
+#else
+            int rc = ble_gatts_notify_custom(conn_handle, entry.attr_handle, entry.om);
+#endif
+            if (rc != 0)
+            {
+                NIMBLE_PERIPHERAL_METRIC_ADD(metrics->notify_errors[NIMBLE_PERIPHERAL_METRIC_ERROR_INDEX(rc)], 1);
+                NIMBLE_PERIPHERAL_TRACE("Notification failed: conn_handle=%d, attr_handle=%d, error=%d", conn_handle, entry.attr_handle, rc);
+            }
+            else
+            {
+                NIMBLE_PERIPHERAL_METRIC_ADD(metrics->tx_pdus, 1);
+                NIMBLE_PERIPHERAL_METRIC_ADD(metrics->tx_bytes, len);
+                NIMBLE_PERIPHERAL_TRACE("Notification sent: conn_handle=%d, attr_handle=%d, len=%d", conn_handle, entry.attr_handle, len);
+            }
+
+            if (entry.stream_len)
+            {
+                if (rc != 0)
+                {
+                    nimble_peripheral_stream_finish(conn_index, ESP_FAIL);
+                    continue;
+                }
+
+                stream->sent += entry.stream_len;
+                if (stream->sent == stream->len)
+                {
+                    nimble_peripheral_stream_finish(conn_index, ESP_OK);
+                }
+                else if (stream->cb)
+                {
+                    stream->cb(conn_index, stream->sent, stream->len, ESP_ERR_NOT_FINISHED, stream->arg);
+                }
+            }
+        }
+
+        g_nimble_peripheral_tx_cursor = (g_nimble_peripheral_tx_cursor + 1) % CONFIG_BT_NIMBLE_MAX_CONNECTIONS;
+    }
+
+    xEventGroupSetBits(g_nimble_peripheral_tx_event_group, NIMBLE_PERIPHERAL_TX_SPACE_BIT);
+}
+
+static int nimble_peripheral_link_update_params(int conn_index)
+{
+    nimble_peripheral_conn_t *conn = &g_nimble_peripheral->peripheral_conn[conn_index];
+    struct ble_gap_upd_params params = g_nimble_peripheral_link_params[conn->link_profile].conn_params;
+
+    /* Every retry doubles the acceptable interval window. */
+    for (int i = 0; i < conn->link_retries; i++)
+    {
+        params.itvl_max = params.itvl_max * 2 > 3200 ? 3200 : params.itvl_max * 2;
+    }
+    /* The supervision timeout must exceed (1 + latency) * itvl_max * 2. */
+    uint32_t min_timeout = ((1 + params.latency) * params.itvl_max * 125 * 2) / 1000 + 1;
+    if (params.supervision_timeout < min_timeout)
+    {
+        params.supervision_timeout = min_timeout > 3200 ? 3200 : min_timeout;
+    }
+
+    int rc = ble_gap_update_params(conn->conn_handle, &params);
+    if (rc != 0)
+    {
+        ESP_LOGW(ESP_NIMBLE_API_TAG, "Connection parameter update request failed; conn_handle=%d rc=%d", conn->conn_handle, rc);
+    }
+    return rc;
+}
+
+static esp_err_t nimble_peripheral_link_apply(int conn_index)
+{
+    nimble_peripheral_conn_t *conn = &g_nimble_peripheral->peripheral_conn[conn_index];
+    if (conn->link_profile == NIMBLE_PERIPHERAL_LINK_PROFILE_DEFAULT)
+    {
+        return ESP_OK;
+    }
+
+    const nimble_peripheral_link_params_t *params = &g_nimble_peripheral_link_params[conn->link_profile];
+    int failures = 0;
+
+    int rc = ble_gap_set_prefered_le_phy(conn->conn_handle, params->phy_mask, params->phy_mask, BLE_GAP_LE_PHY_CODED_ANY);
+    if (rc != 0)
+    {
+        ESP_LOGW(ESP_NIMBLE_API_TAG, "PHY update request failed; conn_handle=%d rc=%d", conn->conn_handle, rc);
+        failures++;
+    }
+
+    rc = ble_gap_set_data_len(conn->conn_handle, params->tx_octets, params->tx_time);
+    if (rc != 0)
+    {
+        ESP_LOGW(ESP_NIMBLE_API_TAG, "Data length update request failed; conn_handle=%d rc=%d", conn->conn_handle, rc);
+        failures++;
+    }
+
+    conn->link_retries = 0;
+    if (nimble_peripheral_link_update_params(conn_index) != 0)
+    {
+        failures++;
+    }
+
+    return failures == 3 ? ESP_FAIL : ESP_OK;
+}
+
+static nimble_peripheral_event_cb_t nimble_peripheral_event_cb(nimble_peripheral_event_kind_t kind)
+{
+    switch (kind)
+    {
+    case NIMBLE_PERIPHERAL_EVENT_CONNECT:
+        return g_nimble_peripheral_config->nimble_peripheral_on_connect_cb;
+    case NIMBLE_PERIPHERAL_EVENT_DISCONNECT:
+        return g_nimble_peripheral_config->nimble_peripheral_on_disconnect_cb;
+    case NIMBLE_PERIPHERAL_EVENT_SUBSCRIBE_NOTIFY:
+        return g_nimble_peripheral_config->nimble_peripheral_on_subscribe_notify_cb;
+    case NIMBLE_PERIPHERAL_EVENT_UNSUBSCRIBE_NOTIFY:
+        return g_nimble_peripheral_config->nimble_peripheral_on_unsubscribe_notify_cb;
+    case NIMBLE_PERIPHERAL_EVENT_SUBSCRIBE_INDICATE:
+        return g_nimble_peripheral_config->nimble_peripheral_on_subscribe_indicate_cb;
+    case NIMBLE_PERIPHERAL_EVENT_UNSUBSCRIBE_INDICATE:
+        return g_nimble_peripheral_config->nimble_peripheral_on_unsubscribe_indicate_cb;
+    case NIMBLE_PERIPHERAL_EVENT_LINK_UPDATE:
+        return g_nimble_peripheral_config->nimble_peripheral_on_link_update_cb;
+    }
+
+    return NULL;
+}
+
+#if CONFIG_ESP_NIMBLE_API_DISPATCH_QUEUE_SIZE > 0
+static nimble_peripheral_event_kind_t nimble_peripheral_dispatch_opposite(nimble_peripheral_event_kind_t kind)
+{
+    switch (kind)
+    {
+    case NIMBLE_PERIPHERAL_EVENT_SUBSCRIBE_NOTIFY:
+        return NIMBLE_PERIPHERAL_EVENT_UNSUBSCRIBE_NOTIFY;
+    case NIMBLE_PERIPHERAL_EVENT_UNSUBSCRIBE_NOTIFY:
+        return NIMBLE_PERIPHERAL_EVENT_SUBSCRIBE_NOTIFY;
+    case NIMBLE_PERIPHERAL_EVENT_SUBSCRIBE_INDICATE:
+        return NIMBLE_PERIPHERAL_EVENT_UNSUBSCRIBE_INDICATE;
+    case NIMBLE_PERIPHERAL_EVENT_UNSUBSCRIBE_INDICATE:
+        return NIMBLE_PERIPHERAL_EVENT_SUBSCRIBE_INDICATE;
+    default:
+        return kind;
+    }
+}
+
+/* Cancels the newest queued record of the opposite subscription change, unless the connection changed in between. */
+static bool nimble_peripheral_dispatch_coalesce(nimble_peripheral_event_kind_t kind, const struct ble_gap_event *event, int conn_index)
+{
+    nimble_peripheral_dispatch_queue_t *queue = &g_nimble_peripheral_dispatch_queue;
+    nimble_peripheral_event_kind_t opposite = nimble_peripheral_dispatch_opposite(kind);
+    uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    for (uint32_t pos = queue->head; pos != tail; pos--)
+    {
+        nimble_peripheral_dispatch_record_t *record = &queue->records[(pos - 1) & (CONFIG_ESP_NIMBLE_API_DISPATCH_QUEUE_SIZE - 1)];
+        if (record->conn_index != conn_index)
+        {
+            continue;
+        }
+        if (record->kind == NIMBLE_PERIPHERAL_EVENT_CONNECT || record->kind == NIMBLE_PERIPHERAL_EVENT_DISCONNECT)
+        {
+            return false;
+        }
+        if ((record->kind == kind || record->kind == opposite) && record->event.subscribe.attr_handle == event->subscribe.attr_handle)
+        {
+            uint8_t expected = NIMBLE_PERIPHERAL_DISPATCH_READY;
+            return record->kind == opposite &&
+                   __atomic_compare_exchange_n(&record->state, &expected, NIMBLE_PERIPHERAL_DISPATCH_CANCELLED, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+        }
+    }
+
+    return false;
+}
+
+static void nimble_peripheral_dispatch_push(nimble_peripheral_event_kind_t kind, struct ble_gap_event *event, void *arg, int conn_index)
+{
+    nimble_peripheral_dispatch_queue_t *queue = &g_nimble_peripheral_dispatch_queue;
+    if (nimble_peripheral_dispatch_opposite(kind) != kind && nimble_peripheral_dispatch_coalesce(kind, event, conn_index))
+    {
+        __atomic_fetch_add(&g_nimble_peripheral_dispatch_stats.coalesced, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    uint32_t head = queue->head;
+    uint32_t depth = head - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    if (depth >= CONFIG_ESP_NIMBLE_API_DISPATCH_QUEUE_SIZE)
+    {
+        __atomic_fetch_add(&g_nimble_peripheral_dispatch_stats.dropped, 1, __ATOMIC_RELAXED);
+        ESP_LOGW(ESP_NIMBLE_API_TAG, "Dispatch queue full; event %d for conn_index %d dropped", kind, conn_index);
+        return;
+    }
+
+    nimble_peripheral_dispatch_record_t *record = &queue->records[head & (CONFIG_ESP_NIMBLE_API_DISPATCH_QUEUE_SIZE - 1)];
+    record->state = NIMBLE_PERIPHERAL_DISPATCH_READY;
+    record->kind = kind;
+    record->conn_index = conn_index;
+    record->arg = arg;
+    record->event = *event;
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+
+    __atomic_fetch_add(&g_nimble_peripheral_dispatch_stats.queued, 1, __ATOMIC_RELAXED);
+    if (depth + 1 > __atomic_load_n(&g_nimble_peripheral_dispatch_stats.high_water, __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(&g_nimble_peripheral_dispatch_stats.high_water, depth + 1, __ATOMIC_RELAXED);
+    }
+    xTaskNotifyGive(g_nimble_peripheral_dispatch_task);
+}
+
+/* Drains the queue on every wake-up; on stop it finishes what the host queued before exiting. */
+static void nimble_peripheral_dispatch_task(void *param)
+{
+    nimble_peripheral_dispatch_queue_t *queue = &g_nimble_peripheral_dispatch_queue;
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        bool stop = g_nimble_peripheral_dispatch_stop;
+
+        uint32_t tail = queue->tail;
+        while (tail != __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE))
+        {
+            nimble_peripheral_dispatch_record_t *record = &queue->records[tail & (CONFIG_ESP_NIMBLE_API_DISPATCH_QUEUE_SIZE - 1)];
+            uint8_t expected = NIMBLE_PERIPHERAL_DISPATCH_READY;
+            if (__atomic_compare_exchange_n(&record->state, &expected, NIMBLE_PERIPHERAL_DISPATCH_TAKEN, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            {
+                nimble_peripheral_event_cb_t cb = nimble_peripheral_event_cb(record->kind);
+                if (cb)
+                {
+                    cb(&record->event, record->arg, record->conn_index);
+                }
+                __atomic_fetch_add(&g_nimble_peripheral_dispatch_stats.delivered, 1, __ATOMIC_RELAXED);
+            }
+            __atomic_store_n(&queue->tail, ++tail, __ATOMIC_RELEASE);
+        }
+
+        if (stop)
+        {
+            break;
+        }
+    }
+
+    xEventGroupSetBits(g_nimble_peripheral_ready_event_group, NIMBLE_PERIPHERAL_DISPATCH_EXIT_BIT);
+    vTaskDelete(NULL);
+}
+
+static esp_err_t nimble_peripheral_dispatch_start(void)
+{
+    const nimble_peripheral_dispatch_config_t *dispatch = &g_nimble_peripheral_config->dispatch;
+    memset(&g_nimble_peripheral_dispatch_queue, 0, sizeof(g_nimble_peripheral_dispatch_queue));
+    memset(&g_nimble_peripheral_dispatch_stats, 0, sizeof(g_nimble_peripheral_dispatch_stats));
+    g_nimble_peripheral_dispatch_stop = false;
+    xEventGroupClearBits(g_nimble_peripheral_ready_event_group, NIMBLE_PERIPHERAL_DISPATCH_EXIT_BIT);
+
+    BaseType_t rc = xTaskCreatePinnedToCore(nimble_peripheral_dispatch_task, "nimble_dispatch",
+                                            dispatch->task_stack_size ? dispatch->task_stack_size : CONFIG_ESP_NIMBLE_API_DISPATCH_TASK_STACK_SIZE, NULL,
+                                            dispatch->task_priority ? dispatch->task_priority : CONFIG_ESP_NIMBLE_API_DISPATCH_TASK_PRIORITY,
+                                            &g_nimble_peripheral_dispatch_task, dispatch->pin_to_core ? dispatch->task_core : tskNO_AFFINITY);
+    if (rc != pdPASS)
+    {
+        g_nimble_peripheral_dispatch_task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+/* Called once the host is stopped, so nothing is queued any more; the disconnects it caused are still delivered. */
+static void nimble_peripheral_dispatch_stop(void)
+{
+    if (!g_nimble_peripheral_dispatch_task)
+    {
+        return;
+    }
+
+    g_nimble_peripheral_dispatch_stop = true;
+    xTaskNotifyGive(g_nimble_peripheral_dispatch_task);
+    xEventGroupWaitBits(g_nimble_peripheral_ready_event_group, NIMBLE_PERIPHERAL_DISPATCH_EXIT_BIT, pdTRUE, pdFALSE, portMAX_DELAY);
+    g_nimble_peripheral_dispatch_task = NULL;
+}
+#endif
+
+/* Runs an application callback here on the host task, or queues it for the dispatch worker. */
+static void nimble_peripheral_event_deliver(nimble_peripheral_event_kind_t kind, struct ble_gap_event *event, void *arg, int conn_index)
+{
+    nimble_peripheral_event_cb_t cb = nimble_peripheral_event_cb(kind);
+    if (!cb)
+    {
+        return;
+    }
+
+#if CONFIG_ESP_NIMBLE_API_DISPATCH_QUEUE_SIZE > 0
+    if (g_nimble_peripheral_dispatch_task)
+    {
+        nimble_peripheral_dispatch_push(kind, event, arg, conn_index);
+        return;
+    }
+#endif
+    cb(event, arg, conn_index);
+}
+
+esp_err_t nimble_peripheral_link_profile_set(int conn_index, nimble_peripheral_link_profile_t profile)
+{
+    if (profile < NIMBLE_PERIPHERAL_LINK_PROFILE_DEFAULT || profile > NIMBLE_PERIPHERAL_LINK_PROFILE_LOW_POWER)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (conn_index < 0 || conn_index >= CONFIG_BT_NIMBLE_MAX_CONNECTIONS || !g_nimble_peripheral->peripheral_conn[conn_index].in_use)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    g_nimble_peripheral->peripheral_conn[conn_index].link_profile = profile;
+    return nimble_peripheral_link_apply(conn_index);
+}
+
+/* The store lists peers oldest first, so the last entry stands in for the most recent one until a bonded peer connects. */
+static void nimble_peripheral_bonds_load(void)
+{
+    nimble_peripheral_bonds_t bonds = {.loaded = true};
+    if (ble_store_util_bonded_peers(bonds.peers, &bonds.count, CONFIG_BT_NIMBLE_MAX_BONDS) != 0)
+    {
+        bonds.count = 0;
+    }
+    bonds.last = bonds.count - 1;
+
+    portENTER_CRITICAL(&g_nimble_peripheral_bonds_lock);
+    g_nimble_peripheral_bonds = bonds;
+    portEXIT_CRITICAL(&g_nimble_peripheral_bonds_lock);
+}
+
+/* Marks a bonded peer as the most recent one, adding it first if bonding just completed. */
+static void nimble_peripheral_bonds_touch(const ble_addr_t *addr)
+{
+    if (!g_nimble_peripheral_bonds.loaded)
+    {
+        nimble_peripheral_bonds_load();
+    }
+
+    portENTER_CRITICAL(&g_nimble_peripheral_bonds_lock);
+    nimble_peripheral_bonds_t *bonds = &g_nimble_peripheral_bonds;
+    int index = -1;
+    for (int i = 0; i < bonds->count; i++)
+    {
+        if (ble_addr_cmp(&bonds->peers[i], addr) == 0)
+        {
+            index = i;
+            break;
+        }
+    }
+
+    if (index < 0)
+    {
+        /* Same policy as ble_store_util_status_rr(): the oldest bond makes room. */
+        if (bonds->count == CONFIG_BT_NIMBLE_MAX_BONDS)
+        {
+            memmove(&bonds->peers[0], &bonds->peers[1], (bonds->count - 1) * sizeof(ble_addr_t));
+            bonds->count--;
+        }
+        index = bonds->count++;
+        bonds->peers[index] = *addr;
+    }
+    bonds->last = index;
+    portEXIT_CRITICAL(&g_nimble_peripheral_bonds_lock);
+}
+
+#if !MYNEWT_VAL(BLE_EXT_ADV)
+static bool nimble_peripheral_peer_connected(const ble_addr_t *addr)
+{
+    for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++)
+    {
+        nimble_peripheral_conn_t *conn = &g_nimble_peripheral->peripheral_conn[i];
+        struct ble_gap_conn_desc desc;
+        /* The slot keeps only the address value; the host has the type as well. */
+        if (conn->in_use && ble_gap_conn_find(conn->conn_handle, &desc) == 0 && ble_addr_cmp(&desc.peer_id_addr, addr) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+#endif
+
+static int nimble_peripheral_store_status_cb(struct ble_store_status_event *event, void *arg)
+{
+    /* ble_store_util_status_rr() may delete the oldest bond to make room for a new one. */
+    g_nimble_peripheral_bonds.loaded = false;
+    return ble_store_util_status_rr(event, arg);
+}
+
+static void nimble_peripheral_adv_phase_set(nimble_peripheral_adv_phase_t phase)
+{
+    if (phase == g_nimble_peripheral_adv_phase)
+    {
+        return;
+    }
+
+    g_nimble_peripheral_adv_phase = phase;
+    ESP_LOGI(ESP_NIMBLE_API_TAG, "Advertising phase %d", phase);
+    if (g_nimble_peripheral_config->nimble_peripheral_on_adv_phase_cb)
+    {
+        g_nimble_peripheral_config->nimble_peripheral_on_adv_phase_cb(phase);
+    }
+}
+
+static void nimble_peripheral_adv_burst_start(void)
+{
+    g_nimble_peripheral_adv_burst = g_nimble_peripheral_config->adv_schedule.fast_duration_ms > 0;
+    g_nimble_peripheral_reconnect_stage = NIMBLE_PERIPHERAL_RECONNECT_DIRECTED;
+}
+
+static void nimble_peripheral_advertise(void);
+static bool nimble_peripheral_adv_limit_apply(void);
+#if MYNEWT_VAL(BLE_EXT_ADV)
+static void nimble_peripheral_ext_advertise(void);
+static void nimble_peripheral_ext_adv_setup(void);
+static esp_err_t nimble_peripheral_ext_adv_load(uint8_t instance, const uint8_t *data, uint16_t len, bool scan_response);
+#endif
+
+static int nimble_peripheral_gap_event_cb(struct ble_gap_event *event, void *arg)
+{
+    int rc = 0;
+    esp_err_t err;
+    uint16_t conn_handle;
+    int conn_index;
+
+    switch (event->type)
+    {
+    case BLE_GAP_EVENT_CONNECT:
+        conn_handle = event->connect.conn_handle;
+        if (event->connect.status == 0)
+        {
+            struct ble_gap_conn_desc desc;
+            rc = ble_gap_conn_find(conn_handle, &desc);
+            if (rc != 0)
+            {
+                ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to find connection descriptor (handle %d)", conn_handle);
+                break;
+            }
+
+            conn_index = nimble_peripheral_conn_alloc();
+            if (conn_index < 0)
+            {
+                ESP_LOGW(ESP_NIMBLE_API_TAG, "Maximum connections reached; cannot register connection handle %d", conn_handle);
+                break;
+            }
+
+            /* Built aside and published in one write section, so readers never see a half-initialized slot. */
+            nimble_peripheral_conn_t new_conn = {0};
+            new_conn.in_use = true;
+            new_conn.generation = g_nimble_peripheral->peripheral_conn[conn_index].generation + 1;
+            new_conn.conn_handle = event->connect.conn_handle;
+            new_conn.mtu = ble_att_mtu(conn_handle);
+            if (new_conn.mtu < BLE_ATT_MTU_DFLT)
+            {
+                new_conn.mtu = BLE_ATT_MTU_DFLT;
+            }
+            new_conn.link_profile = g_nimble_peripheral_config->link_profile;
+            new_conn.tx_phy = BLE_GAP_LE_PHY_1M;
+            new_conn.rx_phy = BLE_GAP_LE_PHY_1M;
+            new_conn.max_tx_octets = 27;
+            new_conn.max_rx_octets = 27;
+            new_conn.conn_itvl = desc.conn_itvl;
+            new_conn.conn_latency = desc.conn_latency;
+            new_conn.supervision_timeout = desc.supervision_timeout;
+            memcpy(new_conn.conn_addr_val, desc.peer_id_addr.val, sizeof(new_conn.conn_addr_val));
+            sprintf(new_conn.conn_addr_str, "%02X:%02X:%02X:%02X:%02X:%02X", desc.peer_id_addr.val[5], desc.peer_id_addr.val[4], desc.peer_id_addr.val[3], desc.peer_id_addr.val[2], desc.peer_id_addr.val[1], desc.peer_id_addr.val[0]);
+            memset(&g_nimble_peripheral->metrics.conn[conn_index], 0, sizeof(nimble_peripheral_conn_metrics_t));
+#if CONFIG_ESP_NIMBLE_API_RX_RING_SIZE > 0
+            __atomic_store_n(&g_nimble_peripheral_rx_ring[conn_index].tail, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&g_nimble_peripheral_rx_ring[conn_index].head, 0, __ATOMIC_RELEASE);
+#endif
+
+            nimble_peripheral_state_write_begin();
+            g_nimble_peripheral->peripheral_conn[conn_index] = new_conn;
+            nimble_peripheral_subscribers_clear(conn_index);
+            nimble_peripheral_conn_map_insert(conn_handle, conn_index);
+            g_nimble_peripheral->peripheral_conn_active_mask |= (nimble_peripheral_conn_mask_t)1 << conn_index;
+            g_nimble_peripheral->peripheral_conn_active_count++;
+            nimble_peripheral_state_write_end();
+
+            nimble_peripheral_event_deliver(NIMBLE_PERIPHERAL_EVENT_CONNECT, event, arg, conn_index);
+
+            nimble_peripheral_link_apply(conn_index);
+
+            /* The reconnect sequence restarts on sync and disconnect only, so other centrals do not wait out a directed round. */
+            if (desc.sec_state.bonded)
+            {
+                nimble_peripheral_bonds_touch(&desc.peer_id_addr);
+            }
+#if !MYNEWT_VAL(BLE_EXT_ADV)
+            /* Legacy advertising stops on connect; keep accepting centrals in the current phase. */
+            nimble_peripheral_advertise();
+#else
+            /* Extended sets restart on ADV_COMPLETE; only the other connectable sets need stopping here. */
+            nimble_peripheral_adv_limit_apply();
+#endif
+        }
+        else
+        {
+            nimble_peripheral_advertise();
+        }
+        break;
+    case BLE_GAP_EVENT_DISCONNECT:
+        conn_handle = event->disconnect.conn.conn_handle;
+        conn_index = nimble_peripheral_conn_find(conn_handle);
+        if (conn_index < 0)
+        {
+            ESP_LOGW(ESP_NIMBLE_API_TAG, "Disconnect event for unknown connection: Handle=%d", conn_handle);
+            break;
+        }
+
+        /* Once in_use is cleared no producer can queue for the slot, so the flushes below leave it empty. */
+        nimble_peripheral_state_write_begin();
+        nimble_peripheral_conn_map_remove(conn_handle);
+        nimble_peripheral_subscribers_clear(conn_index);
+        g_nimble_peripheral->peripheral_conn[conn_index].in_use = false;
+        g_nimble_peripheral->peripheral_conn_active_mask &= ~((nimble_peripheral_conn_mask_t)1 << conn_index);
+        g_nimble_peripheral->peripheral_conn_active_count--;
+        nimble_peripheral_state_write_end();
+#if CONFIG_ESP_NIMBLE_API_METRICS
+        int reason = event->disconnect.reason - BLE_HS_ERR_HCI_BASE;
+        g_nimble_peripheral->metrics.conn[conn_index].disconnect_reason = event->disconnect.reason;
+        NIMBLE_PERIPHERAL_METRIC_ADD(g_nimble_peripheral->metrics.disconnect_reasons[reason >= 0 && reason < METRICS_DISCONNECT_REASONS - 1 ? reason : METRICS_DISCONNECT_REASONS - 1], 1);
+#endif
+        nimble_peripheral_stream_finish(conn_index, ESP_ERR_INVALID_STATE);
+        nimble_peripheral_tx_queue_flush(conn_index);
+        nimble_peripheral_indicate_queue_flush(conn_index);
+#if MYNEWT_VAL(BLE_L2CAP_COC_MAX_NUM) > 0
+        /* NimBLE frees the channel with the connection, possibly without a COC_DISCONNECTED event. */
+        nimble_peripheral_coc_close(conn_index);
+#endif
+
+        nimble_peripheral_event_deliver(NIMBLE_PERIPHERAL_EVENT_DISCONNECT, event, arg, conn_index);
+
+        nimble_peripheral_adv_burst_start();
+        nimble_peripheral_advertise();
+        break;
+    case BLE_GAP_EVENT_CONN_UPDATE:
+        conn_index = nimble_peripheral_conn_find(event->conn_update.conn_handle);
+        if (conn_index < 0)
+        {
+            break;
+        }
+
+        nimble_peripheral_conn_t *updated_conn = &g_nimble_peripheral->peripheral_conn[conn_index];
+        if (event->conn_update.status != 0)
+        {
+            ESP_LOGW(ESP_NIMBLE_API_TAG, "Connection parameter update rejected; conn_handle=%d status=%d", updated_conn->conn_handle, event->conn_update.status);
+            if (updated_conn->link_profile != NIMBLE_PERIPHERAL_LINK_PROFILE_DEFAULT && updated_conn->link_retries < LINK_PROFILE_MAX_RETRIES)
+            {
+                updated_conn->link_retries++;
+                nimble_peripheral_link_update_params(conn_index);
+            }
+            break;
+        }
+
+        struct ble_gap_conn_desc updated_desc;
+        if (ble_gap_conn_find(updated_conn->conn_handle, &updated_desc) == 0)
+        {
+            updated_conn->conn_itvl = updated_desc.conn_itvl;
+            updated_conn->conn_latency = updated_desc.conn_latency;
+            updated_conn->supervision_timeout = updated_desc.supervision_timeout;
+            ESP_LOGI(ESP_NIMBLE_API_TAG, "Connection updated; conn_handle=%d itvl=%d latency=%d timeout=%d", updated_conn->conn_handle, updated_desc.conn_itvl, updated_desc.conn_latency, updated_desc.supervision_timeout);
+        }
+        nimble_peripheral_event_deliver(NIMBLE_PERIPHERAL_EVENT_LINK_UPDATE, event, arg, conn_index);
+        break;
+    case BLE_GAP_EVENT_PHY_UPDATE_COMPLETE:
+        conn_index = nimble_peripheral_conn_find(event->phy_updated.conn_handle);
+        if (conn_index < 0)
+        {
+            break;
+        }
+
+        if (event->phy_updated.status == 0)
+        {
+            g_nimble_peripheral->peripheral_conn[conn_index].tx_phy = event->phy_updated.tx_phy;
+            g_nimble_peripheral->peripheral_conn[conn_index].rx_phy = event->phy_updated.rx_phy;
+            ESP_LOGI(ESP_NIMBLE_API_TAG, "PHY updated; conn_handle=%d tx_phy=%d rx_phy=%d", event->phy_updated.conn_handle, event->phy_updated.tx_phy, event->phy_updated.rx_phy);
+        }
+        nimble_peripheral_event_deliver(NIMBLE_PERIPHERAL_EVENT_LINK_UPDATE, event, arg, conn_index);
+        break;
+#ifdef BLE_GAP_EVENT_DATA_LEN_CHG
+    case BLE_GAP_EVENT_DATA_LEN_CHG:
+        conn_index = nimble_peripheral_conn_find(event->data_len_chg.conn_handle);
+        if (conn_index < 0)
+        {
+            break;
+        }
+
+        g_nimble_peripheral->peripheral_conn[conn_index].max_tx_octets = event->data_len_chg.max_tx_octets;
+        g_nimble_peripheral->peripheral_conn[conn_index].max_rx_octets = event->data_len_chg.max_rx_octets;
+        ESP_LOGI(ESP_NIMBLE_API_TAG, "Data length changed; conn_handle=%d max_tx_octets=%d max_rx_octets=%d", event->data_len_chg.conn_handle, event->data_len_chg.max_tx_octets, event->data_len_chg.max_rx_octets);
+        nimble_peripheral_event_deliver(NIMBLE_PERIPHERAL_EVENT_LINK_UPDATE, event, arg, conn_index);
+        break;
+#endif
+    case BLE_GAP_EVENT_ADV_COMPLETE:
+#if MYNEWT_VAL(BLE_EXT_ADV)
+        if (event->adv_complete.reason != 0 && event->adv_complete.instance < EXT_ADV_MAX_SETS)
+        {
+            /* Duration or event limit reached: keep the set stopped until it is started again. */
+            g_nimble_peripheral_ext_adv[event->adv_complete.instance].enabled = false;
+        }
+#endif
+        if (event->adv_complete.reason == BLE_HS_ETIMEOUT)
+        {
+            if (g_nimble_peripheral_config->fast_reconnect && g_nimble_peripheral_reconnect_stage < NIMBLE_PERIPHERAL_RECONNECT_OPEN)
+            {
+                g_nimble_peripheral_reconnect_stage++;
+            }
+            else
+            {
+                g_nimble_peripheral_adv_burst = false;
+            }
+        }
+        ESP_LOGI(ESP_NIMBLE_API_TAG, "Advertise complete; reason=%d, readvertising...", event->adv_complete.reason);
+        nimble_peripheral_advertise();
+        break;
+    case BLE_GAP_EVENT_ENC_CHANGE:
+        if (event->enc_change.status == 0)
+        {
+            struct ble_gap_conn_desc desc;
+            if (ble_gap_conn_find(event->enc_change.conn_handle, &desc) == 0 && desc.sec_state.bonded)
+            {
+                nimble_peripheral_bonds_touch(&desc.peer_id_addr);
+            }
+        }
+        break;
+    case BLE_GAP_EVENT_NOTIFY_TX:
+        if ((event->notify_tx.status != 0) && (event->notify_tx.status != BLE_HS_EDONE))
+        {
+            NIMBLE_PERIPHERAL_TRACE("Notify event; conn_handle=%d attr_handle=%d status=%d is_indication=%d", event->notify_tx.conn_handle, event->notify_tx.attr_handle, event->notify_tx.status, event->notify_tx.indication);
+        }
+
+        conn_index = nimble_peripheral_conn_find(event->notify_tx.conn_handle);
+        if (conn_index < 0)
+        {
+            break;
+        }
+
+        if (!event->notify_tx.indication)
+        {
+            nimble_peripheral_tx_complete(conn_index);
+        }
+        else if (event->notify_tx.status != 0)
+        {
+            /* Status 0 only means the indication went out; the confirmation arrives as BLE_HS_EDONE. */
+            switch (event->notify_tx.status)
+            {
+            case BLE_HS_EDONE:
+                nimble_peripheral_indicate_complete(conn_index, ESP_OK);
+                break;
+            case BLE_HS_ETIMEOUT:
+                nimble_peripheral_indicate_complete(conn_index, ESP_ERR_TIMEOUT);
+                break;
+            default:
+                nimble_peripheral_indicate_complete(conn_index, ESP_FAIL);
+                break;
+            }
+            ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &g_nimble_peripheral_tx_event);
+        }
+        break;
+    case BLE_GAP_EVENT_SUBSCRIBE:
+        conn_handle = event->subscribe.conn_handle;
+        conn_index = nimble_peripheral_conn_find(conn_handle);
+        if (conn_index < 0)
+        {
+            ESP_LOGE(ESP_NIMBLE_API_TAG, "Subscribe event connection handle %d not found", conn_handle);
+            break;
+        }
+
+        nimble_peripheral_conn_t *conn = &g_nimble_peripheral->peripheral_conn[conn_index];
+        nimble_peripheral_state_write_begin();
+        nimble_peripheral_subscribers_t *subscribers = nimble_peripheral_subscribers_find(event->subscribe.attr_handle, event->subscribe.cur_notify || event->subscribe.cur_indicate);
+        nimble_peripheral_state_write_end();
+
+        if (event->subscribe.prev_notify != event->subscribe.cur_notify)
+        {
+            if (event->subscribe.cur_notify)
+            {
+                if (!subscribers)
+                {
+                    ESP_LOGW(ESP_NIMBLE_API_TAG, "Subscriber index full; cannot track notifications for attr_handle %d", event->subscribe.attr_handle);
+                }
+                else if (nimble_peripheral_subscribers_update(&subscribers->notify_conn_mask, conn_index, true))
+                {
+                    conn->notify_subscription_count++;
+                }
+
+                nimble_peripheral_event_deliver(NIMBLE_PERIPHERAL_EVENT_SUBSCRIBE_NOTIFY, event, arg, conn_index);
+            }
+            else
+            {
+                if (subscribers && nimble_peripheral_subscribers_update(&subscribers->notify_conn_mask, conn_index, false))
+                {
+                    conn->notify_subscription_count--;
+                }
+
+                nimble_peripheral_event_deliver(NIMBLE_PERIPHERAL_EVENT_UNSUBSCRIBE_NOTIFY, event, arg, conn_index);
+            }
+        }
+
+        if (event->subscribe.prev_indicate != event->subscribe.cur_indicate)
+        {
+            if (event->subscribe.cur_indicate)
+            {
+                if (!subscribers)
+                {
+                    ESP_LOGW(ESP_NIMBLE_API_TAG, "Subscriber index full; cannot track indications for attr_handle %d", event->subscribe.attr_handle);
+                }
+                else if (nimble_peripheral_subscribers_update(&subscribers->indicate_conn_mask, conn_index, true))
+                {
+                    conn->indicate_subscription_count++;
+                }
+
+                nimble_peripheral_event_deliver(NIMBLE_PERIPHERAL_EVENT_SUBSCRIBE_INDICATE, event, arg, conn_index);
+            }
+            else
+            {
+                if (subscribers && nimble_peripheral_subscribers_update(&subscribers->indicate_conn_mask, conn_index, false))
+                {
+                    conn->indicate_subscription_count--;
+                }
+
+                nimble_peripheral_event_deliver(NIMBLE_PERIPHERAL_EVENT_UNSUBSCRIBE_INDICATE, event, arg, conn_index);
+            }
+        }
+        break;
+    case BLE_GAP_EVENT_MTU:
+        ESP_LOGI(ESP_NIMBLE_API_TAG, "mtu update event; conn_handle=%d cid=%d mtu=%d", event->mtu.conn_handle, event->mtu.channel_id, event->mtu.value);
+
+        conn_index = nimble_peripheral_conn_find(event->mtu.conn_handle);
+        if (conn_index >= 0 && event->mtu.channel_id == BLE_L2CAP_CID_ATT)
+        {
+            g_nimble_peripheral->peripheral_conn[conn_index].mtu = event->mtu.value;
+        }
+        break;
+    }
+
+    return rc;
+}
+
+static void nimble_peripheral_adv_fields_fill(struct ble_hs_adv_fields *adv_fields, struct ble_hs_adv_fields *rsp_fields)
+{
+    adv_fields->flags = BLE_HS_ADV_F_DISC_GEN | BLE_HS_ADV_F_BREDR_UNSUP;
+
+    adv_fields->tx_pwr_lvl_is_present = 1;
+    adv_fields->tx_pwr_lvl = BLE_HS_ADV_TX_PWR_LVL_AUTO;
+
+    const char *name = ble_svc_gap_device_name();
+    adv_fields->name = (uint8_t *)name;
+    adv_fields->name_len = strlen(name);
+    adv_fields->name_is_complete = 1;
+
+    adv_fields->appearance_is_present = 1;
+    adv_fields->appearance = BLE_GAP_APPEARANCE_GENERIC_TAG;
+
+    adv_fields->le_role_is_present = 1;
+    adv_fields->le_role = BLE_GAP_LE_ROLE_PERIPHERAL;
+
+    if (g_nimble_peripheral_config->adv_mfg_data_len > 0)
+    {
+        adv_fields->mfg_data = g_nimble_peripheral_config->adv_mfg_data;
+        adv_fields->mfg_data_len = g_nimble_peripheral_config->adv_mfg_data_len;
+    }
+
+    if (g_nimble_peripheral_config->adv_svc_data_len > 0)
+    {
+        adv_fields->svc_data_uuid16 = g_nimble_peripheral_config->adv_svc_data;
+        adv_fields->svc_data_uuid16_len = g_nimble_peripheral_config->adv_svc_data_len;
+    }
+
+    rsp_fields->device_addr = g_nimble_peripheral->peripheral_addr_val;
+    rsp_fields->device_addr_type = g_nimble_peripheral->peripheral_addr_type;
+    rsp_fields->device_addr_is_present = 1;
+
+    rsp_fields->uri = esp_uri;
+    rsp_fields->uri_len = sizeof(esp_uri);
+}
+
+static uint8_t nimble_peripheral_adv_cache_find(uint8_t ad_type)
+{
+    uint8_t pos = 0;
+    while (pos + 1 < g_nimble_peripheral_adv_cache.adv_data_len)
+    {
+        uint8_t ad_len = g_nimble_peripheral_adv_cache.adv_data[pos];
+        if (ad_len == 0)
+        {
+            break;
+        }
+        if (g_nimble_peripheral_adv_cache.adv_data[pos + 1] == ad_type)
+        {
+            return pos + 2;
+        }
+        pos += ad_len + 1;
+    }
+
+    return 0;
+}
+
+static esp_err_t nimble_peripheral_adv_cache_build(void)
+{
+    struct ble_hs_adv_fields adv_fields = {0};
+    struct ble_hs_adv_fields rsp_fields = {0};
+
+    g_nimble_peripheral_adv_cache.valid = false;
+    nimble_peripheral_adv_fields_fill(&adv_fields, &rsp_fields);
+
+    int rc = ble_hs_adv_set_fields(&adv_fields, g_nimble_peripheral_adv_cache.adv_data, &g_nimble_peripheral_adv_cache.adv_data_len, sizeof(g_nimble_peripheral_adv_cache.adv_data));
+    if (rc != 0)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to encode advertising data, data is too large to fit into an advertisement");
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    rc = ble_hs_adv_set_fields(&rsp_fields, g_nimble_peripheral_adv_cache.rsp_data, &g_nimble_peripheral_adv_cache.rsp_data_len, sizeof(g_nimble_peripheral_adv_cache.rsp_data));
+    if (rc != 0)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to encode scan response data, data is too large to fit into a scan response");
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    g_nimble_peripheral_adv_cache.mfg_data_offset = nimble_peripheral_adv_cache_find(BLE_HS_ADV_TYPE_MFG_DATA);
+    g_nimble_peripheral_adv_cache.svc_data_offset = nimble_peripheral_adv_cache_find(BLE_HS_ADV_TYPE_SVC_DATA_UUID16);
+    g_nimble_peripheral_adv_cache.valid = true;
+
+    return ESP_OK;
+}
+
+#if !MYNEWT_VAL(BLE_EXT_ADV)
+static int nimble_peripheral_adv_cache_load(bool scan_response)
+{
+    int rc;
+    if (scan_response)
+    {
+        rc = ble_gap_adv_rsp_set_data(g_nimble_peripheral_adv_cache.rsp_data, g_nimble_peripheral_adv_cache.rsp_data_len);
+    }
+    else
+    {
+        rc = ble_gap_adv_set_data(g_nimble_peripheral_adv_cache.adv_data, g_nimble_peripheral_adv_cache.adv_data_len);
+    }
+
+    if (rc != 0)
+    {
+        switch (rc)
+        {
+        case BLE_HS_EBUSY:
+            ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to set %s, advertising is in progress", scan_response ? "scan response data" : "advertising data");
+            break;
+        default:
+            ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to set %s, error code: %d", scan_response ? "scan response data" : "advertising data", rc);
+            break;
+        }
+    }
+
+    return rc;
+}
+#endif
+
+static bool nimble_peripheral_adv_at_limit(void)
+{
+    int max_connections = CONFIG_BT_NIMBLE_MAX_CONNECTIONS;
+    uint8_t limit = g_nimble_peripheral_config->adv_schedule.max_connections;
+    if (limit > 0 && limit < max_connections)
+    {
+        max_connections = limit;
+    }
+
+    return g_nimble_peripheral->peripheral_conn_active_count >= max_connections;
+}
+
+/* Stops connectable advertising at the connection limit; the next disconnect resumes it with a new burst. */
+static bool nimble_peripheral_adv_limit_apply(void)
+{
+    if (!nimble_peripheral_adv_at_limit())
+    {
+        return false;
+    }
+
+#if MYNEWT_VAL(BLE_EXT_ADV)
+    /* Non-connectable sets are not limited by the connection count and keep running. */
+    for (uint8_t i = 0; i < EXT_ADV_MAX_SETS; i++)
+    {
+        if (g_nimble_peripheral_ext_adv[i].configured && g_nimble_peripheral_ext_adv[i].connectable && ble_gap_ext_adv_active(i))
+        {
+            ble_gap_ext_adv_stop(i);
+        }
+    }
+#else
+    if (ble_gap_adv_active())
+    {
+        ble_gap_adv_stop();
+    }
+#endif
+    nimble_peripheral_adv_phase_set(NIMBLE_PERIPHERAL_ADV_PHASE_PAUSED);
+    return true;
+}
+
+static void nimble_peripheral_advertise(void)
+{
+    if (g_nimble_peripheral_stopping)
+    {
+        return;
+    }
+
+    if (nimble_peripheral_adv_limit_apply())
+    {
+        return;
+    }
+
+#if MYNEWT_VAL(BLE_EXT_ADV)
+    nimble_peripheral_adv_phase_set(NIMBLE_PERIPHERAL_ADV_PHASE_SLOW);
+    nimble_peripheral_ext_advertise();
+#else
+    ESP_LOGI(ESP_NIMBLE_API_TAG, "Starting advertising...");
+
+    const nimble_peripheral_adv_schedule_t *schedule = &g_nimble_peripheral_config->adv_schedule;
+    struct ble_gap_adv_params adv_params = {0};
+    int rc;
+
+    /* The controller keeps the payloads across advertising restarts; they are only sent again after a host reset. */
+    if (!g_nimble_peripheral_adv_cache.valid)
+    {
+        if (nimble_peripheral_adv_cache_build() != ESP_OK)
+        {
+            return;
+        }
+
+        if (nimble_peripheral_adv_cache_load(false) != 0 || nimble_peripheral_adv_cache_load(true) != 0)
+        {
+            g_nimble_peripheral_adv_cache.valid = false;
+            return;
+        }
+    }
+
+    adv_params.conn_mode = BLE_GAP_CONN_MODE_UND;
+    adv_params.disc_mode = BLE_GAP_DISC_MODE_GEN;
+
+    /* Zero intervals leave the choice to the controller. */
+    const ble_addr_t *direct_addr = NULL;
+    int32_t duration_ms = BLE_HS_FOREVER;
+    uint16_t itvl_ms = schedule->slow_itvl_ms;
+    if (g_nimble_peripheral_adv_burst)
+    {
+        itvl_ms = schedule->fast_itvl_ms;
+        duration_ms = schedule->fast_duration_ms;
+    }
+    adv_params.itvl_min = BLE_GAP_ADV_ITVL_MS(itvl_ms);
+    adv_params.itvl_max = BLE_GAP_ADV_ITVL_MS(itvl_ms);
+
+    ble_addr_t target;
+    if (g_nimble_peripheral_config->fast_reconnect)
+    {
+        if (!g_nimble_peripheral_bonds.loaded)
+        {
+            nimble_peripheral_bonds_load();
+        }
+
+        nimble_peripheral_bonds_t *bonds = &g_nimble_peripheral_bonds;
+        if (g_nimble_peripheral_reconnect_stage == NIMBLE_PERIPHERAL_RECONNECT_DIRECTED)
+        {
+            if (bonds->last >= 0 && !nimble_peripheral_peer_connected(&bonds->peers[bonds->last]))
+            {
+                /* The controller ends high duty cycle directed advertising after 1.28 s on its own. */
+                target = bonds->peers[bonds->last];
+                direct_addr = &target;
+                adv_params.conn_mode = BLE_GAP_CONN_MODE_DIR;
+                adv_params.disc_mode = BLE_GAP_DISC_MODE_NON;
+                adv_params.high_duty_cycle = 1;
+            }
+            else
+            {
+                g_nimble_peripheral_reconnect_stage = NIMBLE_PERIPHERAL_RECONNECT_ACCEPT_LIST;
+            }
+        }
+
+        if (g_nimble_peripheral_reconnect_stage == NIMBLE_PERIPHERAL_RECONNECT_ACCEPT_LIST)
+        {
+            ble_addr_t accept_list[CONFIG_BT_NIMBLE_MAX_BONDS];
+            uint8_t accept_count = 0;
+            for (int i = 0; i < bonds->count; i++)
+            {
+                if (!nimble_peripheral_peer_connected(&bonds->peers[i]))
+                {
+                    accept_list[accept_count++] = bonds->peers[i];
+                }
+            }
+
+            if (accept_count > 0 && ble_gap_wl_set(accept_list, accept_count) == 0)
+            {
+                adv_params.filter_policy = BLE_HCI_ADV_FILT_BOTH;
+                duration_ms = CONFIG_ESP_NIMBLE_API_RECONNECT_ACCEPT_LIST_MS;
+            }
+            else
+            {
+                g_nimble_peripheral_reconnect_stage = NIMBLE_PERIPHERAL_RECONNECT_OPEN;
+            }
+        }
+    }
+
+    rc = ble_gap_adv_start(g_nimble_peripheral->peripheral_addr_type, direct_addr, duration_ms, &adv_params, nimble_peripheral_gap_event_cb, NULL);
+    if (rc != 0)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to start advertising, error code: %d", rc);
+        nimble_peripheral_adv_phase_set(NIMBLE_PERIPHERAL_ADV_PHASE_PAUSED);
+        return;
+    }
+    nimble_peripheral_adv_phase_set(g_nimble_peripheral_adv_burst ? NIMBLE_PERIPHERAL_ADV_PHASE_FAST : NIMBLE_PERIPHERAL_ADV_PHASE_SLOW);
+
+    ESP_LOGI(ESP_NIMBLE_API_TAG, "Advertising started successfully");
+#endif
+}
+
+static esp_err_t nimble_peripheral_adv_cache_patch(uint8_t offset, uint8_t reserved_len, const uint8_t *data, uint8_t len)
+{
+    if (!data || len != reserved_len)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (!g_nimble_peripheral_adv_cache.valid || offset == 0)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    memcpy(&g_nimble_peripheral_adv_cache.adv_data[offset], data, len);
+
+#if MYNEWT_VAL(BLE_EXT_ADV)
+    if (g_nimble_peripheral_config->ext_adv_set_count > 0)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return nimble_peripheral_ext_adv_load(0, g_nimble_peripheral_adv_cache.adv_data, g_nimble_peripheral_adv_cache.adv_data_len, false);
+#else
+    return nimble_peripheral_adv_cache_load(false) == 0 ? ESP_OK : ESP_FAIL;
+#endif
+}
+
+esp_err_t nimble_peripheral_adv_mfg_data_update(const uint8_t *data, uint8_t len)
+{
+    return nimble_peripheral_adv_cache_patch(g_nimble_peripheral_adv_cache.mfg_data_offset, g_nimble_peripheral_config->adv_mfg_data_len, data, len);
+}
+
+esp_err_t nimble_peripheral_adv_svc_data_update(const uint8_t *data, uint8_t len)
+{
+    return nimble_peripheral_adv_cache_patch(g_nimble_peripheral_adv_cache.svc_data_offset, g_nimble_peripheral_config->adv_svc_data_len, data, len);
+}
+
+#if MYNEWT_VAL(BLE_EXT_ADV)
+static esp_err_t nimble_peripheral_ext_adv_load(uint8_t instance, const uint8_t *data, uint16_t len, bool scan_response)
+{
+    struct os_mbuf *om = os_msys_get_pkthdr(len, 0);
+    if (!om)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (os_mbuf_append(om, data, len) != 0)
+    {
+        os_mbuf_free_chain(om);
+        return ESP_ERR_NO_MEM;
+    }
+
+    /* Both calls consume the mbuf. */
+    int rc = scan_response ? ble_gap_ext_adv_rsp_set_data(instance, om) : ble_gap_ext_adv_set_data(instance, om);
+    if (rc != 0)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to set %s for advertising instance %d, error code: %d", scan_response ? "scan response" : "advertising data", instance, rc);
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+static void nimble_peripheral_ext_adv_setup(void)
+{
+    memset(g_nimble_peripheral_ext_adv, 0, sizeof(g_nimble_peripheral_ext_adv));
+
+    if (g_nimble_peripheral_config->ext_adv_set_count > 0)
+    {
+        for (uint8_t i = 0; i < g_nimble_peripheral_config->ext_adv_set_count && i < EXT_ADV_MAX_SETS; i++)
+        {
+            if (nimble_peripheral_ext_adv_configure(i, &g_nimble_peripheral_config->ext_adv_sets[i]) == ESP_OK)
+            {
+                g_nimble_peripheral_ext_adv[i].enabled = true;
+            }
+        }
+        return;
+    }
+
+    /* Without application sets, instance 0 carries the same legacy PDUs as ble_gap_adv_start() would. */
+    if (nimble_peripheral_adv_cache_build() != ESP_OK)
+    {
+        return;
+    }
+
+    nimble_peripheral_ext_adv_set_t set = {
+        .connectable = true,
+        .scannable = true,
+        .legacy_pdu = true,
+        .primary_phy = BLE_HCI_LE_PHY_1M,
+        .secondary_phy = BLE_HCI_LE_PHY_1M,
+        .itvl_min = BLE_GAP_ADV_FAST_INTERVAL1_MIN,
+        .itvl_max = BLE_GAP_ADV_FAST_INTERVAL1_MAX,
+        .tx_power = 127,
+        .adv_data = g_nimble_peripheral_adv_cache.adv_data,
+        .adv_data_len = g_nimble_peripheral_adv_cache.adv_data_len,
+        .rsp_data = g_nimble_peripheral_adv_cache.rsp_data,
+        .rsp_data_len = g_nimble_peripheral_adv_cache.rsp_data_len,
+    };
+
+    if (nimble_peripheral_ext_adv_configure(0, &set) == ESP_OK)
+    {
+        g_nimble_peripheral_ext_adv[0].enabled = true;
+    }
+}
+
+static void nimble_peripheral_ext_advertise(void)
+{
+    for (uint8_t i = 0; i < EXT_ADV_MAX_SETS; i++)
+    {
+        nimble_peripheral_ext_adv_state_t *state = &g_nimble_peripheral_ext_adv[i];
+        if (!state->configured || !state->enabled || ble_gap_ext_adv_active(i))
+        {
+            continue;
+        }
+
+        if (state->connectable && nimble_peripheral_adv_at_limit())
+        {
+            continue;
+        }
+
+        int rc = ble_gap_ext_adv_start(i, state->duration_ms / 10, state->max_events);
+        if (rc != 0 && rc != BLE_HS_EALREADY)
+        {
+            ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to start advertising instance %d, error code: %d", i, rc);
+            continue;
+        }
+
+        ESP_LOGI(ESP_NIMBLE_API_TAG, "Advertising instance %d started", i);
+    }
+}
+#endif
+
+esp_err_t nimble_peripheral_ext_adv_configure(uint8_t instance, const nimble_peripheral_ext_adv_set_t *set)
+{
+#if MYNEWT_VAL(BLE_EXT_ADV)
+    if (instance >= EXT_ADV_MAX_SETS || !set)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint16_t max_len = set->legacy_pdu ? BLE_HS_ADV_MAX_SZ : MYNEWT_VAL(BLE_EXT_ADV_MAX_SIZE);
+    if (set->adv_data_len > max_len || set->rsp_data_len > max_len)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Advertising instance %d payload exceeds %d bytes", instance, max_len);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!set->legacy_pdu && set->connectable && set->scannable)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Extended advertising instance %d cannot be both connectable and scannable", instance);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (ble_gap_ext_adv_active(instance))
+    {
+        ble_gap_ext_adv_stop(instance);
+    }
+
+    struct ble_gap_ext_adv_params params = {0};
+    params.connectable = set->connectable;
+    params.scannable = set->scannable;
+    params.legacy_pdu = set->legacy_pdu;
+    params.own_addr_type = g_nimble_peripheral->peripheral_addr_type;
+    params.primary_phy = set->primary_phy;
+    params.secondary_phy = set->secondary_phy;
+    params.itvl_min = set->itvl_min;
+    params.itvl_max = set->itvl_max;
+    params.tx_power = set->tx_power;
+    params.sid = set->sid;
+
+    int rc = ble_gap_ext_adv_configure(instance, &params, NULL, nimble_peripheral_gap_event_cb, NULL);
+    if (rc != 0)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to configure advertising instance %d, error code: %d", instance, rc);
+        return ESP_FAIL;
+    }
+
+    nimble_peripheral_ext_adv_state_t *state = &g_nimble_peripheral_ext_adv[instance];
+    state->configured = true;
+    state->enabled = false;
+    state->connectable = set->connectable;
+    state->duration_ms = set->duration_ms;
+    state->max_events = set->max_events;
+
+    esp_err_t err = ESP_OK;
+    if (set->adv_data_len > 0)
+    {
+        err = nimble_peripheral_ext_adv_load(instance, set->adv_data, set->adv_data_len, false);
+    }
+    if (err == ESP_OK && set->rsp_data_len > 0)
+    {
+        err = nimble_peripheral_ext_adv_load(instance, set->rsp_data, set->rsp_data_len, true);
+    }
+
+    return err;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t nimble_peripheral_ext_adv_set_data(uint8_t instance, const uint8_t *data, uint16_t len, bool scan_response)
+{
+#if MYNEWT_VAL(BLE_EXT_ADV)
+    if (instance >= EXT_ADV_MAX_SETS || (!data && len > 0) || len > MYNEWT_VAL(BLE_EXT_ADV_MAX_SIZE))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!g_nimble_peripheral_ext_adv[instance].configured)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    return nimble_peripheral_ext_adv_load(instance, data, len, scan_response);
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t nimble_peripheral_ext_adv_start(uint8_t instance)
+{
+#if MYNEWT_VAL(BLE_EXT_ADV)
+    if (instance >= EXT_ADV_MAX_SETS)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    nimble_peripheral_ext_adv_state_t *state = &g_nimble_peripheral_ext_adv[instance];
+    if (!state->configured)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    state->enabled = true;
+    if (ble_gap_ext_adv_active(instance) || (state->connectable && nimble_peripheral_adv_at_limit()))
+    {
+        return ESP_OK;
+    }
+
+    int rc = ble_gap_ext_adv_start(instance, state->duration_ms / 10, state->max_events);
+    if (rc != 0 && rc != BLE_HS_EALREADY)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to start advertising instance %d, error code: %d", instance, rc);
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t nimble_peripheral_ext_adv_stop(uint8_t instance)
+{
+#if MYNEWT_VAL(BLE_EXT_ADV)
+    if (instance >= EXT_ADV_MAX_SETS)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    g_nimble_peripheral_ext_adv[instance].enabled = false;
+
+    int rc = ble_gap_ext_adv_stop(instance);
+    if (rc != 0 && rc != BLE_HS_EALREADY)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to stop advertising instance %d, error code: %d", instance, rc);
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+static void nimble_peripheral_ready_set(esp_err_t status)
+{
+    if (status == ESP_OK)
+    {
+        g_nimble_peripheral->time_to_ready_us = esp_timer_get_time() - g_nimble_peripheral_ready_start_us;
+        ESP_LOGI(ESP_NIMBLE_API_TAG, "Ready in %lld us", (long long)g_nimble_peripheral->time_to_ready_us);
+        xEventGroupSetBits(g_nimble_peripheral_ready_event_group, NIMBLE_PERIPHERAL_READY_BIT);
+    }
+    else
+    {
+        xEventGroupSetBits(g_nimble_peripheral_ready_event_group, NIMBLE_PERIPHERAL_SYNC_FAILED_BIT);
+    }
+
+    if (g_nimble_peripheral_config->nimble_peripheral_on_ready_cb)
+    {
+        g_nimble_peripheral_config->nimble_peripheral_on_ready_cb(status);
+    }
+}
+
+static void host_controller_reset_cb(int err)
+{
+    ESP_LOGI(ESP_NIMBLE_API_TAG, "Host and controller reset, error code: %d", err);
+    /* NimBLE syncs again on its own; ready is signalled once advertising is back. */
+    xEventGroupClearBits(g_nimble_peripheral_ready_event_group, NIMBLE_PERIPHERAL_READY_BIT | NIMBLE_PERIPHERAL_SYNC_FAILED_BIT);
+    g_nimble_peripheral_ready_start_us = esp_timer_get_time();
+    nimble_peripheral_adv_phase_set(NIMBLE_PERIPHERAL_ADV_PHASE_PAUSED);
+}
+
+static void host_controller_sync_cb(void)
+{
+    int rc;
+
+    if (g_nimble_peripheral_config->sm_random_address)
+    {
+        if (ble_app_set_addr() != ESP_OK)
+        {
+            nimble_peripheral_ready_set(ESP_FAIL);
+            return;
+        }
+        rc = ble_hs_util_ensure_addr(1);
+    }
+    else
+    {
+        rc = ble_hs_util_ensure_addr(0);
+    }
+    if (rc != 0)
+    {
+        switch (rc)
+        {
+        case BLE_HS_ENOADDR:
+            ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to ensure address, no available address");
+            break;
+        default:
+            ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to ensure address, error code: %d", rc);
+            break;
+        }
+        nimble_peripheral_ready_set(ESP_FAIL);
+        return;
+    }
+
+    rc = ble_hs_id_infer_auto(0, &g_nimble_peripheral->peripheral_addr_type);
+    if (rc != 0)
+    {
+        switch (rc)
+        {
+        case BLE_HS_ENOADDR:
+            ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to infer address type, no suitable address to infer");
+            break;
+        default:
+            ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to infer address type, error code: %d", rc);
+            break;
+        }
+        nimble_peripheral_ready_set(ESP_FAIL);
+        return;
+    }
+
+    rc = ble_hs_id_copy_addr(g_nimble_peripheral->peripheral_addr_type, g_nimble_peripheral->peripheral_addr_val, NULL);
+    if (rc != 0)
+    {
+        switch (rc)
+        {
+        case BLE_HS_EINVAL:
+            ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to copy address, invalid address specified");
+            break;
+        case BLE_HS_ENOADDR:
+            ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to copy address, no identity address of the requested type");
+            break;
+        default:
+            ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to copy address, error code: %d", rc);
+            break;
+        }
+        nimble_peripheral_ready_set(ESP_FAIL);
+        return;
+    }
+    ESP_LOGI(ESP_NIMBLE_API_TAG, "MAC: %02x:%02x:%02x:%02x:%02x:%02x", g_nimble_peripheral->peripheral_addr_val[5], g_nimble_peripheral->peripheral_addr_val[4], g_nimble_peripheral->peripheral_addr_val[3], g_nimble_peripheral->peripheral_addr_val[2], g_nimble_peripheral->peripheral_addr_val[1], g_nimble_peripheral->peripheral_addr_val[0]);
+
+    /* Generations survive the reset so indexes captured before it are still recognized as stale. */
+    nimble_peripheral_state_write_begin();
+    for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++)
+    {
+        uint16_t generation = g_nimble_peripheral->peripheral_conn[i].generation;
+        memset(&g_nimble_peripheral->peripheral_conn[i], 0, sizeof(nimble_peripheral_conn_t));
+        g_nimble_peripheral->peripheral_conn[i].generation = generation;
+    }
+    memset(g_nimble_peripheral->subscribers, 0, sizeof(g_nimble_peripheral->subscribers));
+    memset(g_nimble_peripheral->conn_handle_map, 0, sizeof(g_nimble_peripheral->conn_handle_map));
+    g_nimble_peripheral->peripheral_conn_active_count = 0;
+    g_nimble_peripheral->peripheral_conn_active_mask = 0;
+    nimble_peripheral_state_write_end();
+    for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++)
+    {
+        nimble_peripheral_tx_queue_flush(i);
+        nimble_peripheral_indicate_queue_flush(i);
+#if MYNEWT_VAL(BLE_L2CAP_COC_MAX_NUM) > 0
+        nimble_peripheral_coc_close(i);
+#endif
+    }
+
+    g_nimble_peripheral_adv_cache.valid = false;
+    g_nimble_peripheral_bonds.loaded = false;
+    nimble_peripheral_adv_burst_start();
+#if MYNEWT_VAL(BLE_EXT_ADV)
+    nimble_peripheral_ext_adv_setup();
+#endif
+    nimble_peripheral_advertise();
+    nimble_peripheral_ready_set(g_nimble_peripheral_adv_phase != NIMBLE_PERIPHERAL_ADV_PHASE_PAUSED ? ESP_OK : ESP_FAIL);
+}
+
+static void nimble_peripheral_host_start(struct ble_npl_event *ev)
+{
+    g_nimble_peripheral_stopping = false;
+    int rc = ble_hs_start();
+    if (rc != 0)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to restart host, error code: %d", rc);
+        nimble_peripheral_ready_set(ESP_FAIL);
+    }
+}
+
+static void nimble_peripheral_host_stopped(int status, void *arg)
+{
+    /* Started from the event queue rather than from inside the stop procedure. */
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &g_nimble_peripheral_start_event);
+}
+
+/*
+ * Releases the events and callouts init created. Runs while the NPL layer is still up,
+ * after the host stopped or before it started, so nothing re-arms them.
+ */
+static void nimble_peripheral_npl_deinit(void)
+{
+    ble_npl_callout_stop(&g_nimble_peripheral_tx_retry);
+    ble_npl_callout_deinit(&g_nimble_peripheral_tx_retry);
+    ble_npl_eventq_remove(nimble_port_get_dflt_eventq(), &g_nimble_peripheral_tx_event);
+    ble_npl_event_deinit(&g_nimble_peripheral_tx_event);
+    ble_npl_eventq_remove(nimble_port_get_dflt_eventq(), &g_nimble_peripheral_start_event);
+    ble_npl_event_deinit(&g_nimble_peripheral_start_event);
+#if CONFIG_ESP_NIMBLE_API_COALESCE_CHARACTERISTICS > 0
+    for (int i = 0; i < CONFIG_ESP_NIMBLE_API_COALESCE_CHARACTERISTICS; i++)
+    {
+        if (g_nimble_peripheral_coalescer[i].attr_handle != 0)
+        {
+            ble_npl_callout_stop(&g_nimble_peripheral_coalescer[i].deadline);
+            ble_npl_callout_deinit(&g_nimble_peripheral_coalescer[i].deadline);
+        }
+        g_nimble_peripheral_coalescer[i].attr_handle = 0;
+    }
+#endif
+}
+
+/* Undoes nimble_port_init() when init fails before the host task starts, so init can be called again. */
+static esp_err_t nimble_peripheral_init_fail(void)
+{
+    nimble_peripheral_npl_deinit();
+    nimble_port_deinit();
+    g_nimble_peripheral = NULL;
+    return ESP_FAIL;
+}
+
+static void nimble_peripheral_host_task(void *param)
+{
+    nimble_port_run();
+    nimble_port_freertos_deinit();
+}
+
+esp_err_t nimble_peripheral_init(nimble_peripheral_config_t *nimble_peripheral_config, nimble_peripheral_handle_t *nimble_peripheral)
+{
+    ESP_LOGI(ESP_NIMBLE_API_TAG, "Initializating NimBLE...");
+
+    if (!nimble_peripheral_config || !nimble_peripheral)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Invalid configuration or peripheral handle");
+        return ESP_ERR_INVALID_ARG;
+    }
+#if !CONFIG_ESP_NIMBLE_API_TX_POOL
+    if (nimble_peripheral_config->tx_pool)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "tx_pool requires CONFIG_ESP_NIMBLE_API_TX_POOL");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+#endif
+    if (nimble_peripheral_config->fast_reconnect && !nimble_peripheral_config->sm_bonding)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "fast_reconnect requires sm_bonding");
+        return ESP_ERR_INVALID_ARG;
+    }
+#if MYNEWT_VAL(BLE_EXT_ADV)
+    if (nimble_peripheral_config->fast_reconnect)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "fast_reconnect is not supported with extended advertising");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+#endif
+    if (nimble_peripheral_config->coc.psm)
+    {
+#if MYNEWT_VAL(BLE_L2CAP_COC_MAX_NUM) > 0
+        if (!nimble_peripheral_config->coc.nimble_peripheral_on_coc_data_cb)
+        {
+            ESP_LOGE(ESP_NIMBLE_API_TAG, "coc.psm requires nimble_peripheral_on_coc_data_cb");
+            return ESP_ERR_INVALID_ARG;
+        }
+#else
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "coc.psm requires CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM");
+        return ESP_ERR_NOT_SUPPORTED;
+#endif
+    }
+#if CONFIG_ESP_NIMBLE_API_DISPATCH_QUEUE_SIZE == 0
+    if (nimble_peripheral_config->dispatch.enabled)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "dispatch.enabled requires CONFIG_ESP_NIMBLE_API_DISPATCH_QUEUE_SIZE");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+#endif
+    if (g_nimble_peripheral)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Already initialized; call nimble_peripheral_deinit() first");
+        return ESP_ERR_INVALID_STATE;
+    }
+    g_nimble_peripheral_ready_start_us = esp_timer_get_time();
+    g_nimble_peripheral_config = nimble_peripheral_config;
+    g_nimble_peripheral = nimble_peripheral;
+    g_nimble_peripheral_adv_phase = NIMBLE_PERIPHERAL_ADV_PHASE_PAUSED;
+    g_nimble_peripheral->time_to_ready_us = 0;
+
+    if (g_nimble_peripheral_config->sm_random_address)
+    {
+        g_nimble_peripheral->peripheral_addr_type = BLE_OWN_ADDR_RANDOM;
+    }
+
+    esp_err_t err = nimble_port_init();
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to initialize controller and host stack, error code: %d", err);
+        g_nimble_peripheral = NULL;
+        return err;
+    }
+
+    g_nimble_peripheral_tx_pool = NULL;
+#if CONFIG_ESP_NIMBLE_API_TX_POOL
+    if (g_nimble_peripheral_config->tx_pool)
+    {
+        os_mempool_init(&g_nimble_peripheral_tx_mempool, CONFIG_ESP_NIMBLE_API_TX_POOL_BLOCKS, CONFIG_ESP_NIMBLE_API_TX_POOL_BLOCK_SIZE, g_nimble_peripheral_tx_pool_mem, "nimble_peripheral_tx");
+        os_mbuf_pool_init(&g_nimble_peripheral_tx_mbuf_pool, &g_nimble_peripheral_tx_mempool, CONFIG_ESP_NIMBLE_API_TX_POOL_BLOCK_SIZE, CONFIG_ESP_NIMBLE_API_TX_POOL_BLOCKS);
+        g_nimble_peripheral_tx_pool = &g_nimble_peripheral_tx_mbuf_pool;
+    }
+#endif
+
+    ble_npl_event_init(&g_nimble_peripheral_tx_event, nimble_peripheral_tx_pump, NULL);
+    ble_npl_callout_init(&g_nimble_peripheral_tx_retry, nimble_port_get_dflt_eventq(), nimble_peripheral_tx_pump, NULL);
+    g_nimble_peripheral_tx_event_group = xEventGroupCreateStatic(&g_nimble_peripheral_tx_event_group_buffer);
+    if (!g_nimble_peripheral_ready_event_group)
+    {
+        g_nimble_peripheral_ready_event_group = xEventGroupCreateStatic(&g_nimble_peripheral_ready_event_group_buffer);
+    }
+    xEventGroupClearBits(g_nimble_peripheral_ready_event_group, NIMBLE_PERIPHERAL_READY_BIT | NIMBLE_PERIPHERAL_SYNC_FAILED_BIT);
+    ble_npl_event_init(&g_nimble_peripheral_start_event, nimble_peripheral_host_start, NULL);
+
+    ble_hs_cfg.reset_cb = host_controller_reset_cb;
+    ble_hs_cfg.sync_cb = host_controller_sync_cb;
+    ble_hs_cfg.store_status_cb = nimble_peripheral_store_status_cb;
+
+    ble_hs_cfg.sm_io_cap = g_nimble_peripheral_config->sm_io_cap;
+
+    if (g_nimble_peripheral_config->sm_bonding)
+    {
+        ble_hs_cfg.sm_bonding = 1;
+        ble_hs_cfg.sm_our_key_dist |= BLE_SM_PAIR_KEY_DIST_ENC;
+        ble_hs_cfg.sm_their_key_dist |= BLE_SM_PAIR_KEY_DIST_ENC;
+    }
+
+    if (nimble_peripheral_config->sm_mitm)
+    {
+        ble_hs_cfg.sm_mitm = 1;
+    }
+
+    if (nimble_peripheral_config->sm_sc)
+    {
+        ble_hs_cfg.sm_sc = 1;
+    }
+    else
+    {
+        ble_hs_cfg.sm_sc = 0;
+    }
+
+    if (nimble_peripheral_config->sm_resolve_peer_address)
+    {
+        ble_hs_cfg.sm_our_key_dist |= BLE_SM_PAIR_KEY_DIST_ID;
+        ble_hs_cfg.sm_their_key_dist |= BLE_SM_PAIR_KEY_DIST_ID;
+    }
+
+    ble_svc_gap_init();
+    int rc = ble_svc_gap_device_name_set(nimble_peripheral_config->device_name);
+    if (rc != 0)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to set service gap decive name");
+        return nimble_peripheral_init_fail();
+    }
+    rc = ble_svc_gap_device_appearance_set(BLE_GAP_APPEARANCE_GENERIC_TAG);
+    if (rc != 0)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to set service gap device appearance");
+        return nimble_peripheral_init_fail();
+    }
+
+    ble_svc_gatt_init();
+    rc = ble_gatts_count_cfg(nimble_peripheral_config->ble_gatt_services);
+    if (rc != 0)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to count GATT server configuration, error code: %d", rc);
+        return nimble_peripheral_init_fail();
+    }
+    rc = ble_gatts_add_svcs(nimble_peripheral_config->ble_gatt_services);
+    if (rc != 0)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to add GATT services, error code: %d", rc);
+        return nimble_peripheral_init_fail();
+    }
+
+#if MYNEWT_VAL(BLE_L2CAP_COC_MAX_NUM) > 0
+    if (nimble_peripheral_config->coc.psm)
+    {
+        rc = ble_l2cap_create_server(nimble_peripheral_config->coc.psm, nimble_peripheral_coc_mtu(), nimble_peripheral_l2cap_event_cb, NULL);
+        if (rc != 0)
+        {
+            ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to create L2CAP CoC server, error code: %d", rc);
+            return nimble_peripheral_init_fail();
+        }
+    }
+#endif
+
+    ble_svc_ans_init();
+
+    ble_store_config_init();
+
+#if CONFIG_ESP_NIMBLE_API_DISPATCH_QUEUE_SIZE > 0
+    if (nimble_peripheral_config->dispatch.enabled && nimble_peripheral_dispatch_start() != ESP_OK)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to create the dispatch task");
+        nimble_peripheral_init_fail();
+        return ESP_ERR_NO_MEM;
+    }
+#endif
+
+    nimble_port_freertos_init(nimble_peripheral_host_task);
+
+    return err;
+}
+
+esp_err_t nimble_peripheral_wait_ready(TickType_t ticks_to_wait)
+{
+    if (!g_nimble_peripheral)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    EventBits_t bits = xEventGroupWaitBits(g_nimble_peripheral_ready_event_group, NIMBLE_PERIPHERAL_READY_BIT | NIMBLE_PERIPHERAL_SYNC_FAILED_BIT, pdFALSE, pdFALSE, ticks_to_wait);
+    if (bits & NIMBLE_PERIPHERAL_READY_BIT)
+    {
+        return ESP_OK;
+    }
+
+    return (bits & NIMBLE_PERIPHERAL_SYNC_FAILED_BIT) ? ESP_FAIL : ESP_ERR_TIMEOUT;
+}
+
+esp_err_t nimble_peripheral_restart(void)
+{
+    if (!g_nimble_peripheral || g_nimble_peripheral_stopping)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    ESP_LOGI(ESP_NIMBLE_API_TAG, "Restarting host...");
+    xEventGroupClearBits(g_nimble_peripheral_ready_event_group, NIMBLE_PERIPHERAL_READY_BIT | NIMBLE_PERIPHERAL_SYNC_FAILED_BIT);
+    g_nimble_peripheral_ready_start_us = esp_timer_get_time();
+    g_nimble_peripheral_stopping = true;
+
+    /* The controller, the registered GATT tables and the host task are kept; only the host is stopped and synced again. */
+    int rc = ble_hs_stop(&g_nimble_peripheral_stop_listener, nimble_peripheral_host_stopped, NULL);
+    if (rc == BLE_HS_EALREADY)
+    {
+        nimble_peripheral_host_stopped(0, NULL);
+    }
+    else if (rc != 0)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to stop host, error code: %d", rc);
+        g_nimble_peripheral_stopping = false;
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t nimble_peripheral_deinit(void)
+{
+    if (!g_nimble_peripheral || g_nimble_peripheral_stopping)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    ESP_LOGI(ESP_NIMBLE_API_TAG, "Deinitializing NimBLE...");
+    g_nimble_peripheral_stopping = true;
+    int rc = nimble_port_stop();
+    if (rc != 0)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to stop host, error code: %d", rc);
+        g_nimble_peripheral_stopping = false;
+        return ESP_FAIL;
+    }
+    /* Stopping the host disconnected every peer, which already emptied the per-connection queues. */
+    nimble_peripheral_npl_deinit();
+    nimble_port_deinit();
+#if CONFIG_ESP_NIMBLE_API_DISPATCH_QUEUE_SIZE > 0
+    nimble_peripheral_dispatch_stop();
+#endif
+    xEventGroupClearBits(g_nimble_peripheral_ready_event_group, NIMBLE_PERIPHERAL_READY_BIT | NIMBLE_PERIPHERAL_SYNC_FAILED_BIT);
+    nimble_peripheral_adv_phase_set(NIMBLE_PERIPHERAL_ADV_PHASE_PAUSED);
+    g_nimble_peripheral_bonds.loaded = false;
+    g_nimble_peripheral_adv_cache.valid = false;
+    g_nimble_peripheral_tx_pool = NULL;
+
+    g_nimble_peripheral = NULL;
+    g_nimble_peripheral_config = NULL;
+    g_nimble_peripheral_stopping = false;
+
+    return ESP_OK;
+}
+
+static esp_err_t nimble_peripheral_notify_send(uint16_t attr_handle, struct os_mbuf *om, TickType_t ticks_to_wait)
+{
+    if (!om)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (OS_MBUF_PKTLEN(om) > BLE_ATT_ATTR_MAX_LEN)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Notification payload too large: %d bytes", OS_MBUF_PKTLEN(om));
+        os_mbuf_free_chain(om);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint16_t generations[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+    nimble_peripheral_conn_mask_t conn_mask = g_nimble_peripheral ? nimble_peripheral_subscribers_snapshot(attr_handle, false, generations) : 0;
+    if (conn_mask == 0)
+    {
+        os_mbuf_free_chain(om);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    /* Clear before checking so a pump pass that frees space after the check still wakes us up. */
+    TickType_t start = xTaskGetTickCount();
+    while (ticks_to_wait > 0)
+    {
+        xEventGroupClearBits(g_nimble_peripheral_tx_event_group, NIMBLE_PERIPHERAL_TX_SPACE_BIT);
+        conn_mask &= nimble_peripheral_subscribers_snapshot(attr_handle, false, NULL);
+        if (nimble_peripheral_tx_has_room(conn_mask))
+        {
+            break;
+        }
+
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= ticks_to_wait)
+        {
+            break;
+        }
+        xEventGroupWaitBits(g_nimble_peripheral_tx_event_group, NIMBLE_PERIPHERAL_TX_SPACE_BIT, pdFALSE, pdFALSE, ticks_to_wait - elapsed);
+    }
+
+    if (conn_mask == 0)
+    {
+        os_mbuf_free_chain(om);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    /* Every subscriber but the last one gets a duplicate; the last one consumes om itself. */
+    esp_err_t err = ESP_OK;
+    bool queued = false;
+    while (conn_mask)
+    {
+        int conn_index = __builtin_ctz(conn_mask);
+        conn_mask &= conn_mask - 1;
+
+        if (__atomic_load_n(&g_nimble_peripheral_tx_queue[conn_index].count, __ATOMIC_RELAXED) >= CONFIG_ESP_NIMBLE_API_TX_QUEUE_WATERMARK)
+        {
+            err = ESP_ERR_TIMEOUT;
+            continue;
+        }
+
+        struct os_mbuf *txom = om;
+        if (conn_mask)
+        {
+            txom = os_mbuf_dup(om);
+            if (!txom)
+            {
+                NIMBLE_PERIPHERAL_METRIC_ADD(g_nimble_peripheral->metrics.conn[conn_index].mbuf_alloc_failures, 1);
+                ESP_LOGE(ESP_NIMBLE_API_TAG, "Memory allocation failed for notification.");
+                err = ESP_ERR_NO_MEM;
+                continue;
+            }
+        }
+
+        /* A subscriber that disconnected since the snapshot is skipped like one that was never there. */
+        esp_err_t rc = nimble_peripheral_tx_queue_push(conn_index, generations[conn_index], attr_handle, txom, 0);
+        if (rc != ESP_OK)
+        {
+            os_mbuf_free_chain(txom);
+            if (rc == ESP_ERR_TIMEOUT)
+            {
+                err = ESP_ERR_TIMEOUT;
+            }
+            continue;
+        }
+
+        if (txom == om)
+        {
+            om = NULL;
+        }
+        queued = true;
+    }
+
+    if (om)
+    {
+        os_mbuf_free_chain(om);
+    }
+
+    if (queued)
+    {
+        ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &g_nimble_peripheral_tx_event);
+    }
+
+    return err;
+}
+
+#if CONFIG_ESP_NIMBLE_API_COALESCE_CHARACTERISTICS > 0
+static nimble_peripheral_coalescer_t *nimble_peripheral_coalescer_find(uint16_t attr_handle)
+{
+    for (int i = 0; i < CONFIG_ESP_NIMBLE_API_COALESCE_CHARACTERISTICS; i++)
+    {
+        if (attr_handle != 0 && __atomic_load_n(&g_nimble_peripheral_coalescer[i].attr_handle, __ATOMIC_ACQUIRE) == attr_handle)
+        {
+            return &g_nimble_peripheral_coalescer[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Largest notification every current subscriber can receive, 0 when nobody is subscribed. */
+static uint16_t nimble_peripheral_coalescer_limit(uint16_t attr_handle)
+{
+    nimble_peripheral_conn_mask_t conn_mask = nimble_peripheral_subscribers_snapshot(attr_handle, false, NULL);
+    uint16_t mtu = UINT16_MAX;
+    for (; conn_mask; conn_mask &= conn_mask - 1)
+    {
+        uint16_t conn_mtu = __atomic_load_n(&g_nimble_peripheral->peripheral_conn[__builtin_ctz(conn_mask)].mtu, __ATOMIC_RELAXED);
+        mtu = conn_mtu < mtu ? conn_mtu : mtu;
+    }
+
+    if (mtu == UINT16_MAX)
+    {
+        return 0;
+    }
+    return (mtu - 3 < BLE_ATT_ATTR_MAX_LEN) ? mtu - 3 : BLE_ATT_ATTR_MAX_LEN;
+}
+
+/*
+ * The pending records are taken by swapping buffers under the lock and the mbuf is allocated
+ * after it, so producers on other cores never wait for the allocator and the host task stack
+ * holds no copy. Only one flush owns the spare buffer; others wait for its copy to finish.
+ * When allocation fails the records are put back in front of any appended meanwhile, as long
+ * as the result still fits the MTU.
+ */
+static esp_err_t nimble_peripheral_coalescer_flush(nimble_peripheral_coalescer_t *coalescer, TickType_t ticks_to_wait)
+{
+    uint8_t *buf = NULL;
+    uint16_t len = 0;
+
+    while (true)
+    {
+        xEventGroupClearBits(g_nimble_peripheral_tx_event_group, NIMBLE_PERIPHERAL_COALESCE_IDLE_BIT);
+        portENTER_CRITICAL(&coalescer->lock);
+        bool busy = coalescer->flushing;
+        if (!busy && coalescer->len > 0)
+        {
+            buf = coalescer->buf[coalescer->active];
+            len = coalescer->len;
+            coalescer->active ^= 1;
+            coalescer->len = 0;
+            coalescer->flushing = true;
+        }
+        portEXIT_CRITICAL(&coalescer->lock);
+
+        if (!busy)
+        {
+            break;
+        }
+        xEventGroupWaitBits(g_nimble_peripheral_tx_event_group, NIMBLE_PERIPHERAL_COALESCE_IDLE_BIT, pdFALSE, pdFALSE, portMAX_DELAY);
+    }
+
+    if (len == 0)
+    {
+        return ESP_OK;
+    }
+
+    struct os_mbuf *om = nimble_peripheral_tx_mbuf_from_flat(buf, len);
+    uint16_t limit = om ? 0 : nimble_peripheral_coalescer_limit(coalescer->attr_handle);
+    bool kept = false;
+    portENTER_CRITICAL(&coalescer->lock);
+    if (!om && coalescer->len + len <= limit)
+    {
+        memcpy(&buf[len], coalescer->buf[coalescer->active], coalescer->len);
+        coalescer->active ^= 1;
+        coalescer->len += len;
+        kept = true;
+    }
+    coalescer->flushing = false;
+    portEXIT_CRITICAL(&coalescer->lock);
+    xEventGroupSetBits(g_nimble_peripheral_tx_event_group, NIMBLE_PERIPHERAL_COALESCE_IDLE_BIT);
+
+    if (!om)
+    {
+        NIMBLE_PERIPHERAL_METRIC_ADD(g_nimble_peripheral->metrics.mbuf_alloc_failures, 1);
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Memory allocation failed for coalesced notification; records %s.", kept ? "kept" : "dropped");
+        return ESP_ERR_NO_MEM;
+    }
+
+    return nimble_peripheral_notify_send(coalescer->attr_handle, om, ticks_to_wait);
+}
+
+static void nimble_peripheral_coalescer_deadline(struct ble_npl_event *ev)
+{
+    nimble_peripheral_coalescer_flush(ble_npl_event_get_arg(ev), 0);
+}
+
+static esp_err_t nimble_peripheral_coalescer_append(nimble_peripheral_coalescer_t *coalescer, const void *data, size_t len, TickType_t ticks_to_wait)
+{
+    uint16_t limit = nimble_peripheral_coalescer_limit(coalescer->attr_handle);
+    if (limit == 0)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    if (len + 2 > limit)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Coalesced record of %d bytes exceeds the subscribers' MTU", (int)len);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    /* A record that does not fit pushes the pending ones out first; only an allocation failure keeps them. */
+    esp_err_t err = ESP_OK;
+    bool first = false;
+    bool full = false;
+    while (true)
+    {
+        bool fits;
+        portENTER_CRITICAL(&coalescer->lock);
+        fits = coalescer->len + 2 + len <= limit;
+        if (fits)
+        {
+            first = coalescer->len == 0;
+            uint8_t *buf = coalescer->buf[coalescer->active];
+            buf[coalescer->len] = (uint8_t)len;
+            buf[coalescer->len + 1] = (uint8_t)(len >> 8);
+            memcpy(&buf[coalescer->len + 2], data, len);
+            coalescer->len += 2 + len;
+            full = limit - coalescer->len < 3;
+        }
+        portEXIT_CRITICAL(&coalescer->lock);
+
+        if (fits)
+        {
+            break;
+        }
+
+        esp_err_t rc = nimble_peripheral_coalescer_flush(coalescer, ticks_to_wait);
+        if (rc == ESP_ERR_NO_MEM)
+        {
+            return rc;
+        }
+        if (rc == ESP_ERR_TIMEOUT)
+        {
+            err = rc;
+        }
+    }
+
+    if (full)
+    {
+        esp_err_t rc = nimble_peripheral_coalescer_flush(coalescer, ticks_to_wait);
+        return (rc == ESP_ERR_NOT_FOUND) ? err : rc;
+    }
+
+    if (first && coalescer->max_delay_ms > 0)
+    {
+        ble_npl_callout_reset(&coalescer->deadline, ble_npl_time_ms_to_ticks32(coalescer->max_delay_ms));
+    }
+
+    return err;
+}
+#endif
+
+esp_err_t nimble_peripheral_notify_mbuf_wait(uint16_t attr_handle, struct os_mbuf *om, TickType_t ticks_to_wait)
+{
+#if CONFIG_ESP_NIMBLE_API_COALESCE_CHARACTERISTICS > 0
+    /* Records buffered for attr_handle go out first, so the peer sees everything in call order. */
+    nimble_peripheral_coalescer_t *coalescer = om ? nimble_peripheral_coalescer_find(attr_handle) : NULL;
+    if (coalescer)
+    {
+        nimble_peripheral_coalescer_flush(coalescer, ticks_to_wait);
+    }
+#endif
+
+    return nimble_peripheral_notify_send(attr_handle, om, ticks_to_wait);
+}
+
+esp_err_t nimble_peripheral_notify_mbuf(uint16_t attr_handle, struct os_mbuf *om)
+{
+    return nimble_peripheral_notify_mbuf_wait(attr_handle, om, 0);
+}
+
+esp_err_t nimble_peripheral_notify_wait(uint16_t attr_handle, const void *data, size_t len, TickType_t ticks_to_wait)
+{
+    if (!data && len != 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (len > BLE_ATT_ATTR_MAX_LEN)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Notification payload too large: %d bytes", (int)len);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+#if CONFIG_ESP_NIMBLE_API_COALESCE_CHARACTERISTICS > 0
+    nimble_peripheral_coalescer_t *coalescer = nimble_peripheral_coalescer_find(attr_handle);
+    if (coalescer)
+    {
+        return nimble_peripheral_coalescer_append(coalescer, data, len, ticks_to_wait);
+    }
+#endif
+
+    struct os_mbuf *om = nimble_peripheral_tx_mbuf_from_flat(data, (uint16_t)len);
+    if (!om)
+    {
+        if (g_nimble_peripheral)
+        {
+            NIMBLE_PERIPHERAL_METRIC_ADD(g_nimble_peripheral->metrics.mbuf_alloc_failures, 1);
+        }
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Memory allocation failed for notification.");
+        return ESP_ERR_NO_MEM;
+    }
+
+    return nimble_peripheral_notify_send(attr_handle, om, ticks_to_wait);
+}
+
+esp_err_t nimble_peripheral_notify(uint16_t attr_handle, const void *data, size_t len)
+{
+    return nimble_peripheral_notify_wait(attr_handle, data, len, 0);
+}
+
+static bool nimble_peripheral_tx_has_room_for(int conn_index, int count)
+{
+    return __atomic_load_n(&g_nimble_peripheral_tx_queue[conn_index].count, __ATOMIC_RELAXED) + count <= CONFIG_ESP_NIMBLE_API_TX_QUEUE_WATERMARK;
+}
+
+esp_err_t nimble_peripheral_notify_batch(const nimble_peripheral_notify_entry_t *entries, size_t count, TickType_t ticks_to_wait)
+{
+    if (!entries || count == 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (count > CONFIG_ESP_NIMBLE_API_TX_QUEUE_WATERMARK)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Notification batch of %d entries exceeds the TX queue watermark", (int)count);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!entries[i].data && entries[i].len != 0)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (entries[i].len > BLE_ATT_ATTR_MAX_LEN)
+        {
+            ESP_LOGE(ESP_NIMBLE_API_TAG, "Notification payload too large: %d bytes", (int)entries[i].len);
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+
+    if (!g_nimble_peripheral)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    /* Records buffered for the entries go out first; if they cannot, the batch is not sent ahead of them. */
+    esp_err_t flush_err = ESP_OK;
+#if CONFIG_ESP_NIMBLE_API_COALESCE_CHARACTERISTICS > 0
+    for (size_t i = 0; i < count; i++)
+    {
+        nimble_peripheral_coalescer_t *coalescer = nimble_peripheral_coalescer_find(entries[i].attr_handle);
+        esp_err_t rc = coalescer ? nimble_peripheral_coalescer_flush(coalescer, ticks_to_wait) : ESP_OK;
+        if (rc == ESP_ERR_NO_MEM)
+        {
+            return rc;
+        }
+        if (rc == ESP_ERR_TIMEOUT)
+        {
+            flush_err = rc;
+        }
+    }
+#endif
+
+    /* One pass over the entries gives every subscriber its share of the batch; a slot keeps the generation it first had. */
+    nimble_peripheral_conn_mask_t entry_masks[CONFIG_ESP_NIMBLE_API_TX_QUEUE_WATERMARK];
+    nimble_peripheral_conn_mask_t conn_mask = 0;
+    uint16_t generations[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+    int conn_counts[CONFIG_BT_NIMBLE_MAX_CONNECTIONS] = {0};
+    for (size_t i = 0; i < count; i++)
+    {
+        uint16_t entry_generations[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+        entry_masks[i] = nimble_peripheral_subscribers_snapshot(entries[i].attr_handle, false, entry_generations);
+        for (nimble_peripheral_conn_mask_t mask = entry_masks[i]; mask; mask &= mask - 1)
+        {
+            int conn_index = __builtin_ctz(mask);
+            if (!(conn_mask & ((nimble_peripheral_conn_mask_t)1 << conn_index)))
+            {
+                generations[conn_index] = entry_generations[conn_index];
+            }
+            conn_counts[conn_index]++;
+        }
+        conn_mask |= entry_masks[i];
+    }
+
+    if (conn_mask == 0)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    TickType_t start = xTaskGetTickCount();
+    while (ticks_to_wait > 0)
+    {
+        xEventGroupClearBits(g_nimble_peripheral_tx_event_group, NIMBLE_PERIPHERAL_TX_SPACE_BIT);
+        bool room = true;
+        for (nimble_peripheral_conn_mask_t mask = conn_mask; mask && room; mask &= mask - 1)
+        {
+            room = nimble_peripheral_tx_has_room_for(__builtin_ctz(mask), conn_counts[__builtin_ctz(mask)]);
+        }
+        if (room)
+        {
+            break;
+        }
+
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= ticks_to_wait)
+        {
+            break;
+        }
+        xEventGroupWaitBits(g_nimble_peripheral_tx_event_group, NIMBLE_PERIPHERAL_TX_SPACE_BIT, pdFALSE, pdFALSE, ticks_to_wait - elapsed);
+    }
+
+    esp_err_t err = ESP_OK;
+    bool queued = false;
+    while (conn_mask)
+    {
+        int conn_index = __builtin_ctz(conn_mask);
+        conn_mask &= conn_mask - 1;
+
+        if (!nimble_peripheral_tx_has_room_for(conn_index, conn_counts[conn_index]))
+        {
+            err = ESP_ERR_TIMEOUT;
+            continue;
+        }
+
+        uint16_t attr_handles[CONFIG_ESP_NIMBLE_API_TX_QUEUE_WATERMARK];
+        struct os_mbuf *oms[CONFIG_ESP_NIMBLE_API_TX_QUEUE_WATERMARK];
+        int n = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (!(entry_masks[i] & ((nimble_peripheral_conn_mask_t)1 << conn_index)))
+            {
+                continue;
+            }
+            oms[n] = nimble_peripheral_tx_mbuf_from_flat(entries[i].data, (uint16_t)entries[i].len);
+            if (!oms[n])
+            {
+                break;
+            }
+            attr_handles[n++] = entries[i].attr_handle;
+        }
+
+        esp_err_t rc = ESP_ERR_NO_MEM;
+        if (n < conn_counts[conn_index])
+        {
+            NIMBLE_PERIPHERAL_METRIC_ADD(g_nimble_peripheral->metrics.conn[conn_index].mbuf_alloc_failures, 1);
+            ESP_LOGE(ESP_NIMBLE_API_TAG, "Memory allocation failed for notification batch.");
+        }
+        else
+        {
+            rc = nimble_peripheral_tx_queue_push_batch(conn_index, generations[conn_index], attr_handles, oms, n);
+        }
+
+        if (rc != ESP_OK)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                os_mbuf_free_chain(oms[i]);
+            }
+            if (rc != ESP_ERR_INVALID_STATE)
+            {
+                err = rc;
+            }
+            continue;
+        }
+        queued = true;
+    }
+
+    if (queued)
+    {
+        ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &g_nimble_peripheral_tx_event);
+    }
+
+    return (err == ESP_OK) ? flush_err : err;
+}
+
+esp_err_t nimble_peripheral_coalesce_enable(uint16_t attr_handle, uint32_t max_delay_ms)
+{
+#if CONFIG_ESP_NIMBLE_API_COALESCE_CHARACTERISTICS > 0
+    if (attr_handle == 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!g_nimble_peripheral)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    nimble_peripheral_coalescer_t *coalescer = nimble_peripheral_coalescer_find(attr_handle);
+    if (coalescer)
+    {
+        coalescer->max_delay_ms = max_delay_ms;
+        return ESP_OK;
+    }
+
+    portENTER_CRITICAL(&g_nimble_peripheral_coalescer_lock);
+    for (int i = 0; i < CONFIG_ESP_NIMBLE_API_COALESCE_CHARACTERISTICS; i++)
+    {
+        if (g_nimble_peripheral_coalescer[i].attr_handle == 0)
+        {
+            coalescer = &g_nimble_peripheral_coalescer[i];
+            /* Claimed with a handle no characteristic can have, then published once initialized. */
+            coalescer->attr_handle = UINT16_MAX;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&g_nimble_peripheral_coalescer_lock);
+
+    if (!coalescer)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    coalescer->len = 0;
+    coalescer->active = 0;
+    coalescer->flushing = false;
+    coalescer->max_delay_ms = max_delay_ms;
+    spinlock_initialize(&coalescer->lock);
+    ble_npl_callout_init(&coalescer->deadline, nimble_port_get_dflt_eventq(), nimble_peripheral_coalescer_deadline, coalescer);
+    __atomic_store_n(&coalescer->attr_handle, attr_handle, __ATOMIC_RELEASE);
+
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t nimble_peripheral_coalesce_disable(uint16_t attr_handle)
+{
+#if CONFIG_ESP_NIMBLE_API_COALESCE_CHARACTERISTICS > 0
+    nimble_peripheral_coalescer_t *coalescer = nimble_peripheral_coalescer_find(attr_handle);
+    if (!coalescer)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t err = nimble_peripheral_coalescer_flush(coalescer, 0);
+    ble_npl_callout_stop(&coalescer->deadline);
+    ble_npl_callout_deinit(&coalescer->deadline);
+    __atomic_store_n(&coalescer->attr_handle, 0, __ATOMIC_RELEASE);
+
+    return (err == ESP_ERR_NOT_FOUND) ? ESP_OK : err;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t nimble_peripheral_notify_flush(uint16_t attr_handle)
+{
+#if CONFIG_ESP_NIMBLE_API_COALESCE_CHARACTERISTICS > 0
+    nimble_peripheral_coalescer_t *coalescer = nimble_peripheral_coalescer_find(attr_handle);
+    if (!coalescer)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    return nimble_peripheral_coalescer_flush(coalescer, 0);
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t nimble_peripheral_stream_send(int conn_index, uint16_t attr_handle, const void *data, size_t len, nimble_peripheral_stream_cb_t cb, void *arg)
+{
+    if (conn_index < 0 || conn_index >= CONFIG_BT_NIMBLE_MAX_CONNECTIONS || !data || len == 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!g_nimble_peripheral || !__atomic_load_n(&g_nimble_peripheral->peripheral_conn[conn_index].in_use, __ATOMIC_RELAXED))
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    uint16_t generations[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+    nimble_peripheral_conn_mask_t conn_mask = nimble_peripheral_subscribers_snapshot(attr_handle, false, generations);
+    if (!(conn_mask & ((nimble_peripheral_conn_mask_t)1 << conn_index)))
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    nimble_peripheral_stream_t *stream = &g_nimble_peripheral_stream[conn_index];
+    esp_err_t err = ESP_OK;
+
+    portENTER_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
+    if (!nimble_peripheral_conn_matches(conn_index, generations[conn_index]) || stream->active || stream->chunks_queued > 0)
+    {
+        err = ESP_ERR_INVALID_STATE;
+    }
+    else
+    {
+        stream->data = data;
+        stream->len = len;
+        stream->queued = 0;
+        stream->sent = 0;
+        stream->attr_handle = attr_handle;
+        stream->cb = cb;
+        stream->arg = arg;
+        stream->active = true;
+    }
+    portEXIT_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
+
+    if (err == ESP_OK)
+    {
+        ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &g_nimble_peripheral_tx_event);
+    }
+
+    return err;
+}
+
+esp_err_t nimble_peripheral_indicate_mbuf(int conn_index, uint16_t attr_handle, struct os_mbuf *om, nimble_peripheral_indicate_cb_t cb, void *arg)
+{
+    if (!om)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = ESP_OK;
+    uint16_t generations[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+    if (conn_index < 0 || conn_index >= CONFIG_BT_NIMBLE_MAX_CONNECTIONS)
+    {
+        err = ESP_ERR_INVALID_ARG;
+    }
+    else if (OS_MBUF_PKTLEN(om) > BLE_ATT_ATTR_MAX_LEN)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Indication payload too large: %d bytes", OS_MBUF_PKTLEN(om));
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    else if (!g_nimble_peripheral || !__atomic_load_n(&g_nimble_peripheral->peripheral_conn[conn_index].in_use, __ATOMIC_RELAXED))
+    {
+        err = ESP_ERR_INVALID_STATE;
+    }
+    else if (!(nimble_peripheral_subscribers_snapshot(attr_handle, true, generations) & ((nimble_peripheral_conn_mask_t)1 << conn_index)))
+    {
+        err = ESP_ERR_NOT_FOUND;
+    }
+    else
+    {
+        err = nimble_peripheral_indicate_queue_push(conn_index, generations[conn_index], attr_handle, om, cb, arg);
+    }
+
+    if (err != ESP_OK)
+    {
+        os_mbuf_free_chain(om);
+        return err;
+    }
+
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &g_nimble_peripheral_tx_event);
+    return ESP_OK;
+}
+
+esp_err_t nimble_peripheral_indicate(int conn_index, uint16_t attr_handle, const void *data, size_t len, nimble_peripheral_indicate_cb_t cb, void *arg)
+{
+    if (!data && len != 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (len > BLE_ATT_ATTR_MAX_LEN)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Indication payload too large: %d bytes", (int)len);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    struct os_mbuf *om = nimble_peripheral_tx_mbuf_from_flat(data, (uint16_t)len);
+    if (!om)
+    {
+        if (g_nimble_peripheral && conn_index >= 0 && conn_index < CONFIG_BT_NIMBLE_MAX_CONNECTIONS)
+        {
+            NIMBLE_PERIPHERAL_METRIC_ADD(g_nimble_peripheral->metrics.conn[conn_index].mbuf_alloc_failures, 1);
+        }
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Memory allocation failed for indication.");
+        return ESP_ERR_NO_MEM;
+    }
+
+    return nimble_peripheral_indicate_mbuf(conn_index, attr_handle, om, cb, arg);
+}
+
+esp_err_t nimble_peripheral_indicate_all(uint16_t attr_handle, const void *data, size_t len, nimble_peripheral_indicate_cb_t cb, void *arg)
+{
+    if (!data && len != 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (len > BLE_ATT_ATTR_MAX_LEN)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Indication payload too large: %d bytes", (int)len);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint16_t generations[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+    nimble_peripheral_conn_mask_t conn_mask = g_nimble_peripheral ? nimble_peripheral_subscribers_snapshot(attr_handle, true, generations) : 0;
+    if (conn_mask == 0)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    struct os_mbuf *om = nimble_peripheral_tx_mbuf_from_flat(data, (uint16_t)len);
+    if (!om)
+    {
+        NIMBLE_PERIPHERAL_METRIC_ADD(g_nimble_peripheral->metrics.mbuf_alloc_failures, 1);
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Memory allocation failed for indication.");
+        return ESP_ERR_NO_MEM;
+    }
+
+    /* Every subscriber but the last one gets a duplicate; the last one consumes om itself. */
+    esp_err_t err = ESP_OK;
+    bool queued = false;
+    while (conn_mask)
+    {
+        int conn_index = __builtin_ctz(conn_mask);
+        conn_mask &= conn_mask - 1;
+
+        struct os_mbuf *txom = om;
+        if (conn_mask)
+        {
+            txom = os_mbuf_dup(om);
+        }
+
+        esp_err_t rc = ESP_ERR_NO_MEM;
+        if (!txom)
+        {
+            NIMBLE_PERIPHERAL_METRIC_ADD(g_nimble_peripheral->metrics.conn[conn_index].mbuf_alloc_failures, 1);
+            ESP_LOGE(ESP_NIMBLE_API_TAG, "Memory allocation failed for indication.");
+        }
+        else
+        {
+            rc = nimble_peripheral_indicate_queue_push(conn_index, generations[conn_index], attr_handle, txom, cb, arg);
+        }
+
+        if (rc != ESP_OK)
+        {
+            if (txom && txom != om)
+            {
+                os_mbuf_free_chain(txom);
+            }
+            err = (err == ESP_OK) ? rc : err;
+            continue;
+        }
+
+        if (txom == om)
+        {
+            om = NULL;
+        }
+        queued = true;
+    }
+
+    if (om)
+    {
+        os_mbuf_free_chain(om);
+    }
+
+    if (queued)
+    {
+        ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &g_nimble_peripheral_tx_event);
+    }
+    return err;
+}
+
+esp_err_t nimble_peripheral_notificate(uint16_t attr_handle, char *buffer, size_t buffer_size, const char *message)
+{
+    size_t len = strnlen(message, buffer_size);
+    if (len == buffer_size)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Message is too long or not null-terminated.");
+        return ESP_FAIL;
+    }
+
+    if (!g_nimble_peripheral || __atomic_load_n(&g_nimble_peripheral->peripheral_conn_active_count, __ATOMIC_RELAXED) == 0)
+    {
+        ESP_LOGW(ESP_NIMBLE_API_TAG, "No active BLE connections to send notifications.");
+        return ESP_FAIL;
+    }
+
+    esp_err_t err = nimble_peripheral_notify(attr_handle, message, len);
+    if (err == ESP_ERR_NOT_FOUND)
+    {
+        return ESP_OK;
+    }
+
+    return (err == ESP_OK) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t nimble_peripheral_metrics_snapshot(nimble_peripheral_metrics_t *out)
+{
+    if (!out)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!g_nimble_peripheral)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    const uint32_t *src = (const uint32_t *)&g_nimble_peripheral->metrics;
+    uint32_t *dst = (uint32_t *)out;
+    for (size_t i = 0; i < sizeof(nimble_peripheral_metrics_t) / sizeof(uint32_t); i++)
+    {
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+
+    return ESP_OK;
+}
+
+nimble_peripheral_adv_phase_t nimble_peripheral_adv_phase_get(void)
+{
+    return g_nimble_peripheral_adv_phase;
+}
+
+esp_err_t nimble_peripheral_bonded_peers(ble_addr_t *out_peers, int *out_count, int max_peers)
+{
+    if (!out_peers || !out_count || max_peers < 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!g_nimble_peripheral)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (!g_nimble_peripheral_bonds.loaded)
+    {
+        nimble_peripheral_bonds_load();
+    }
+
+    /* Most recent peer first, then the others from newest to oldest bond. */
+    portENTER_CRITICAL(&g_nimble_peripheral_bonds_lock);
+    nimble_peripheral_bonds_t *bonds = &g_nimble_peripheral_bonds;
+    int count = 0;
+    if (bonds->last >= 0 && count < max_peers)
+    {
+        out_peers[count++] = bonds->peers[bonds->last];
+    }
+    for (int i = bonds->count - 1; i >= 0 && count < max_peers; i--)
+    {
+        if (i != bonds->last)
+        {
+            out_peers[count++] = bonds->peers[i];
+        }
+    }
+    *out_count = count;
+    portEXIT_CRITICAL(&g_nimble_peripheral_bonds_lock);
+
+    return ESP_OK;
+}
+
+void nimble_peripheral_bonds_invalidate(void)
+{
+    g_nimble_peripheral_bonds.loaded = false;
+}
+
+esp_err_t nimble_peripheral_tx_pool_stats(nimble_peripheral_tx_pool_stats_t *out)
+{
+    if (!out)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!g_nimble_peripheral_tx_pool)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    struct os_mempool *mempool = g_nimble_peripheral_tx_pool->omp_pool;
+    out->blocks = mempool->mp_num_blocks;
+    out->free = __atomic_load_n(&mempool->mp_num_free, __ATOMIC_RELAXED);
+    out->high_water = mempool->mp_num_blocks - __atomic_load_n(&mempool->mp_min_free, __ATOMIC_RELAXED);
+
+    return ESP_OK;
+}
+
+esp_err_t nimble_peripheral_dispatch_stats(nimble_peripheral_dispatch_stats_t *out)
+{
+    if (!out)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+#if CONFIG_ESP_NIMBLE_API_DISPATCH_QUEUE_SIZE > 0
+    if (!g_nimble_peripheral || !g_nimble_peripheral_dispatch_task)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    out->depth = __atomic_load_n(&g_nimble_peripheral_dispatch_queue.head, __ATOMIC_ACQUIRE) - __atomic_load_n(&g_nimble_peripheral_dispatch_queue.tail, __ATOMIC_ACQUIRE);
+    out->high_water = __atomic_load_n(&g_nimble_peripheral_dispatch_stats.high_water, __ATOMIC_RELAXED);
+    out->queued = __atomic_load_n(&g_nimble_peripheral_dispatch_stats.queued, __ATOMIC_RELAXED);
+    out->delivered = __atomic_load_n(&g_nimble_peripheral_dispatch_stats.delivered, __ATOMIC_RELAXED);
+    out->dropped = __atomic_load_n(&g_nimble_peripheral_dispatch_stats.dropped, __ATOMIC_RELAXED);
+    out->coalesced = __atomic_load_n(&g_nimble_peripheral_dispatch_stats.coalesced, __ATOMIC_RELAXED);
+
+    return ESP_OK;
+#else
+    return ESP_ERR_INVALID_STATE;
+#endif
+}
+
+esp_err_t nimble_peripheral_metrics_reset(int conn_index)
+{
+    if (!g_nimble_peripheral)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    uint32_t *counters;
+    size_t count;
+    if (conn_index < 0)
+    {
+        counters = (uint32_t *)&g_nimble_peripheral->metrics;
+        count = sizeof(nimble_peripheral_metrics_t) / sizeof(uint32_t);
+    }
+    else if (conn_index < CONFIG_BT_NIMBLE_MAX_CONNECTIONS)
+    {
+        counters = (uint32_t *)&g_nimble_peripheral->metrics.conn[conn_index];
+        count = sizeof(nimble_peripheral_conn_metrics_t) / sizeof(uint32_t);
+    }
+    else
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        __atomic_store_n(&counters[i], 0, __ATOMIC_RELAXED);
+    }
+
+    return ESP_OK;
+}
+
+int nimble_peripheral_conn_find(uint16_t conn_handle)
+{
+    if (!g_nimble_peripheral)
+    {
+        return -1;
+    }
+
+    int conn_index;
+    uint32_t seq;
+    do
+    {
+        seq = nimble_peripheral_state_read_begin();
+        conn_index = -1;
+        uint32_t slot = nimble_peripheral_conn_map_home(conn_handle);
+        for (int probe = 0; probe < CONN_HANDLE_MAP_SIZE; probe++)
+        {
+            uint8_t entry = __atomic_load_n(&g_nimble_peripheral->conn_handle_map[slot], __ATOMIC_RELAXED);
+            if (entry == 0)
+            {
+                break;
+            }
+            if (__atomic_load_n(&g_nimble_peripheral->peripheral_conn[entry - 1].conn_handle, __ATOMIC_RELAXED) == conn_handle)
+            {
+                conn_index = entry - 1;
+                break;
+            }
+            slot = (slot + 1) & (CONN_HANDLE_MAP_SIZE - 1);
+        }
+    } while (nimble_peripheral_state_read_retry(seq));
+
+    return conn_index;
+}
+
+bool nimble_peripheral_conn_is_current(int conn_index, uint16_t generation)
+{
+    if (!g_nimble_peripheral || conn_index < 0 || conn_index >= CONFIG_BT_NIMBLE_MAX_CONNECTIONS)
+    {
+        return false;
+    }
+
+    return nimble_peripheral_conn_matches(conn_index, generation);
+}
+
+uint16_t nimble_peripheral_conn_generation(int conn_index)
+{
+    if (!g_nimble_peripheral || conn_index < 0 || conn_index >= CONFIG_BT_NIMBLE_MAX_CONNECTIONS)
+    {
+        return 0;
+    }
+
+    return __atomic_load_n(&g_nimble_peripheral->peripheral_conn[conn_index].generation, __ATOMIC_RELAXED);
+}
+
+bool nimble_peripheral_is_subscribed(int conn_index, uint16_t attr_handle, bool indicate)
+{
+    if (!g_nimble_peripheral || conn_index < 0 || conn_index >= CONFIG_BT_NIMBLE_MAX_CONNECTIONS)
+    {
+        return false;
+    }
+
+    nimble_peripheral_conn_mask_t conn_mask = nimble_peripheral_subscribers_snapshot(attr_handle, indicate, NULL);
+    return (conn_mask & ((nimble_peripheral_conn_mask_t)1 << conn_index)) != 0;
+}
+
+/* Reads and writes come from the host task, set_value from any task; the lock is held for one value copy at most. */
+int nimble_peripheral_attr_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    nimble_peripheral_attr_t *attr = arg;
+    if (!attr || !attr->value)
+    {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+
+    int rc = 0;
+    switch (ctxt->op)
+    {
+    case BLE_GATT_ACCESS_OP_READ_CHR:
+    case BLE_GATT_ACCESS_OP_READ_DSC:
+        /* The whole value is appended; NimBLE applies the offset of Read Blob requests itself. */
+        portENTER_CRITICAL(&attr->lock);
+        if (os_mbuf_append(ctxt->om, attr->value, attr->len) != 0)
+        {
+            rc = BLE_ATT_ERR_INSUFFICIENT_RES;
+        }
+        portEXIT_CRITICAL(&attr->lock);
+        break;
+
+    case BLE_GATT_ACCESS_OP_WRITE_CHR:
+    case BLE_GATT_ACCESS_OP_WRITE_DSC:
+    {
+        uint16_t len = OS_MBUF_PKTLEN(ctxt->om);
+        if (len > attr->max_len)
+        {
+            rc = BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+            break;
+        }
+
+        portENTER_CRITICAL(&attr->lock);
+        os_mbuf_copydata(ctxt->om, 0, len, attr->value);
+        attr->len = len;
+        portEXIT_CRITICAL(&attr->lock);
+        break;
+    }
+
+    default:
+        rc = BLE_ATT_ERR_UNLIKELY;
+        break;
+    }
+
+    return rc;
+}
+
+esp_err_t nimble_peripheral_attr_set_value(nimble_peripheral_attr_t *attr, const void *data, size_t len)
+{
+    if (!attr || !attr->value || (!data && len != 0))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (len > attr->max_len)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    bool changed;
+    portENTER_CRITICAL(&attr->lock);
+    changed = attr->len != len || memcmp(attr->value, data, len) != 0;
+    if (changed)
+    {
+        memcpy(attr->value, data, len);
+        attr->len = len;
+    }
+    portEXIT_CRITICAL(&attr->lock);
+
+    if (!changed || attr->val_handle == 0 || !g_nimble_peripheral)
+    {
+        return ESP_OK;
+    }
+
+    /* Sent from the caller's copy, so the cache lock is not held while queueing. */
+    esp_err_t err = nimble_peripheral_notify(attr->val_handle, data, len);
+    return (err == ESP_ERR_NOT_FOUND) ? ESP_OK : err;
+}
+
+esp_err_t nimble_peripheral_attr_get_value(nimble_peripheral_attr_t *attr, void *out, size_t out_size, size_t *out_len)
+{
+    if (!attr || !attr->value || !out || !out_len)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = ESP_OK;
+    portENTER_CRITICAL(&attr->lock);
+    if (attr->len > out_size)
+    {
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    else
+    {
+        memcpy(out, attr->value, attr->len);
+        *out_len = attr->len;
+    }
+    portEXIT_CRITICAL(&attr->lock);
+
+    return err;
+}
+
+esp_err_t nus_process_rx_data(struct os_mbuf *om, char *buffer, size_t buffer_size)
+{
+    if (!om || !buffer || buffer_size == 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    size_t buf_len = OS_MBUF_PKTLEN(om);
+    if (buf_len == 0 || buf_len >= buffer_size)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    int rc = os_mbuf_copydata(om, 0, buf_len, buffer);
+    if (rc != 0)
+    {
+        return ESP_FAIL;
+    }
+    buffer[buf_len] = '\0';
+
+    return ESP_OK;
+}
+
+esp_err_t nus_process_rx_segments(const struct os_mbuf *om, nus_rx_segment_cb_t cb, void *arg)
+{
+    if (!om || !cb)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (; om != NULL; om = SLIST_NEXT(om, om_next))
+    {
+        if (om->om_len > 0 && cb(om->om_data, om->om_len, arg) != 0)
+        {
+            return ESP_ERR_NOT_FINISHED;
+        }
+    }
+
+    return ESP_OK;
+}
+
+#if CONFIG_ESP_NIMBLE_API_RX_RING_SIZE > 0
+static nimble_peripheral_rx_ring_t *nimble_peripheral_rx_ring_get(int conn_index)
+{
+    if (conn_index < 0 || conn_index >= CONFIG_BT_NIMBLE_MAX_CONNECTIONS)
+    {
+        return NULL;
+    }
 
-    adv_fields.tx_pwr_lvl_is_present = 1;
-    adv_fields.tx_pwr_lvl = BLE_HS_ADV_TX_PWR_LVL_AUTO;
+    return &g_nimble_peripheral_rx_ring[conn_index];
+}
 
-    const char *name = ble_svc_gap_device_name();
-    adv_fields.name = (uint8_t *)name;
-    adv_fields.name_len = strlen(name);
-    adv_fields.name_is_complete = 1;
+static void nimble_peripheral_rx_ring_copy_out(const nimble_peripheral_rx_ring_t *ring, uint32_t pos, uint8_t *dst, size_t len)
+{
+    uint32_t offset = pos & (CONFIG_ESP_NIMBLE_API_RX_RING_SIZE - 1);
+    size_t first = CONFIG_ESP_NIMBLE_API_RX_RING_SIZE - offset;
+    if (first > len)
+    {
+        first = len;
+    }
 
-    adv_fields.appearance_is_present = 1;
-    adv_fields.appearance = BLE_GAP_APPEARANCE_GENERIC_TAG;
+    memcpy(dst, &ring->data[offset], first);
+    memcpy(dst + first, &ring->data[0], len - first);
+}
 
-    adv_fields.le_role_is_present = 1;
-    adv_fields.le_role = BLE_GAP_LE_ROLE_PERIPHERAL;
+static uint8_t nimble_peripheral_rx_ring_byte(const nimble_peripheral_rx_ring_t *ring, uint32_t pos)
+{
+    return ring->data[pos & (CONFIG_ESP_NIMBLE_API_RX_RING_SIZE - 1)];
+}
+#endif
 
-    int rc = ble_gap_adv_set_fields(&adv_fields);
-    if (rc != 0)
+esp_err_t nimble_peripheral_rx_push(uint16_t conn_handle, const struct os_mbuf *om)
+{
+#if CONFIG_ESP_NIMBLE_API_RX_RING_SIZE > 0
+    if (!om)
     {
-        switch (rc)
-        {
-        case BLE_HS_EBUSY:
-            ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to set advertising data, advertising is in progress");
-            break;
-        case BLE_HS_EMSGSIZE:
-            ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to set advertising data, data is too large to fit into an advertisement");
-            break;
-        default:
-            ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to set advertising data, error code: %d", rc);
-            break;
-        }
-        return;
+        return ESP_ERR_INVALID_ARG;
     }
 
-    rsp_fields.device_addr = g_nimble_peripheral->peripheral_addr_val;
-    rsp_fields.device_addr_type = g_nimble_peripheral->peripheral_addr_type;
-    rsp_fields.device_addr_is_present = 1;
+    int conn_index = nimble_peripheral_conn_find(conn_handle);
+    if (conn_index < 0)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
 
-    rsp_fields.uri = esp_uri;
-    rsp_fields.uri_len = sizeof(esp_uri);
+    nimble_peripheral_rx_ring_t *ring = &g_nimble_peripheral_rx_ring[conn_index];
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint16_t len = OS_MBUF_PKTLEN(om);
+    if (len > CONFIG_ESP_NIMBLE_API_RX_RING_SIZE - (head - tail))
+    {
+        return ESP_ERR_NO_MEM;
+    }
 
-    rc = ble_gap_adv_rsp_set_fields(&rsp_fields);
-    if (rc != 0)
+    for (; om != NULL; om = SLIST_NEXT(om, om_next))
     {
-        switch (rc)
+        uint32_t offset = head & (CONFIG_ESP_NIMBLE_API_RX_RING_SIZE - 1);
+        size_t first = CONFIG_ESP_NIMBLE_API_RX_RING_SIZE - offset;
+        if (first > om->om_len)
         {
-        case BLE_HS_EBUSY:
-            ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to set scan response data, advertising is in progress");
-            break;
-        case BLE_HS_EMSGSIZE:
-            ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to set scan response data, data is too large to fit into a scan response");
-            break;
-        default:
-            ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to set scan response data, error code: %d", rc);
-            break;
+            first = om->om_len;
         }
-        return;
-    }
 
-    adv_params.conn_mode = BLE_GAP_CONN_MODE_UND;
-    adv_params.disc_mode = BLE_GAP_DISC_MODE_GEN;
+        memcpy(&ring->data[offset], om->om_data, first);
+        memcpy(&ring->data[0], om->om_data + first, om->om_len - first);
+        head += om->om_len;
+    }
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+    NIMBLE_PERIPHERAL_METRIC_ADD(g_nimble_peripheral->metrics.conn[conn_index].rx_pdus, 1);
+    NIMBLE_PERIPHERAL_METRIC_ADD(g_nimble_peripheral->metrics.conn[conn_index].rx_bytes, len);
 
-    rc = ble_gap_adv_start(g_nimble_peripheral->peripheral_addr_type, NULL, BLE_HS_FOREVER, &adv_params, nimble_peripheral_gap_event_cb, NULL);
-    if (rc != 0)
+    TaskHandle_t waiter = __atomic_load_n(&ring->waiter, __ATOMIC_ACQUIRE);
+    if (waiter)
     {
-        ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to start advertising, error code: %d", rc);
-        return;
+        xTaskNotifyGive(waiter);
     }
 
-    ESP_LOGI(ESP_NIMBLE_API_TAG, "Advertising started successfully");
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
 }
 
-static void nimble_peripheral_ext_advertise(void)
+size_t nimble_peripheral_rx_available(int conn_index)
 {
-    // struct ble_gap_ext_adv_params params;
-    // struct os_mbuf *data;
-    // uint8_t instance = 0;
-    // int rc;
-
-    // /* First check if any instance is already active */
-    // if (ble_gap_ext_adv_active(instance))
-    // {
-    //     return;
-    // }
+#if CONFIG_ESP_NIMBLE_API_RX_RING_SIZE > 0
+    nimble_peripheral_rx_ring_t *ring = nimble_peripheral_rx_ring_get(conn_index);
+    if (!ring)
+    {
+        return 0;
+    }
 
-    // /* use defaults for non-set params */
-    // memset(&params, 0, sizeof(params));
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - ring->tail;
+#else
+    return 0;
+#endif
+}
 
-    // /* enable connectable advertising */
-    // params.connectable = 1;
+size_t nimble_peripheral_rx_peek(int conn_index, void *buffer, size_t len)
+{
+#if CONFIG_ESP_NIMBLE_API_RX_RING_SIZE > 0
+    size_t available = nimble_peripheral_rx_available(conn_index);
+    if (len > available)
+    {
+        len = available;
+    }
 
-    // /* advertise using random addr */
-    // params.own_addr_type = BLE_OWN_ADDR_PUBLIC;
+    if (len > 0)
+    {
+        nimble_peripheral_rx_ring_copy_out(&g_nimble_peripheral_rx_ring[conn_index], g_nimble_peripheral_rx_ring[conn_index].tail, buffer, len);
+    }
 
-    // params.primary_phy = BLE_HCI_LE_PHY_1M;
-    // params.secondary_phy = BLE_HCI_LE_PHY_2M;
-    // // params.tx_power = 127;
-    // params.sid = 1;
+    return len;
+#else
+    return 0;
+#endif
+}
 
-    // params.itvl_min = BLE_GAP_ADV_FAST_INTERVAL1_MIN;
-    // params.itvl_max = BLE_GAP_ADV_FAST_INTERVAL1_MIN;
+size_t nimble_peripheral_rx_consume(int conn_index, size_t len)
+{
+#if CONFIG_ESP_NIMBLE_API_RX_RING_SIZE > 0
+    size_t available = nimble_peripheral_rx_available(conn_index);
+    if (len > available)
+    {
+        len = available;
+    }
 
-    // /* configure instance 0 */
-    // rc = ble_gap_ext_adv_configure(instance, &params, NULL,
-    //                                bleprph_gap_event, NULL);
-    // assert(rc == 0);
+    if (len > 0)
+    {
+        nimble_peripheral_rx_ring_t *ring = &g_nimble_peripheral_rx_ring[conn_index];
+        __atomic_store_n(&ring->tail, ring->tail + len, __ATOMIC_RELEASE);
+    }
 
-    // /* in this case only scan response is allowed */
+    return len;
+#else
+    return 0;
+#endif
+}
 
-    // /* get mbuf for scan rsp data */
-    // data = os_msys_get_pkthdr(sizeof(ext_adv_pattern_1), 0);
-    // assert(data);
+size_t nimble_peripheral_rx_read(int conn_index, void *buffer, size_t len)
+{
+    len = nimble_peripheral_rx_peek(conn_index, buffer, len);
+    return nimble_peripheral_rx_consume(conn_index, len);
+}
 
-    // /* fill mbuf with scan rsp data */
-    // rc = os_mbuf_append(data, ext_adv_pattern_1, sizeof(ext_adv_pattern_1));
-    // assert(rc == 0);
+esp_err_t nimble_peripheral_rx_read_until(int conn_index, uint8_t delimiter, void *buffer, size_t buffer_size, size_t *out_len)
+{
+#if CONFIG_ESP_NIMBLE_API_RX_RING_SIZE > 0
+    size_t available = nimble_peripheral_rx_available(conn_index);
+    if (available == 0)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
 
-    // rc = ble_gap_ext_adv_set_data(instance, data);
-    // assert(rc == 0);
+    nimble_peripheral_rx_ring_t *ring = &g_nimble_peripheral_rx_ring[conn_index];
+    for (size_t i = 0; i < available; i++)
+    {
+        if (nimble_peripheral_rx_ring_byte(ring, ring->tail + i) == delimiter)
+        {
+            size_t record_len = i + 1;
+            if (record_len > buffer_size)
+            {
+                return ESP_ERR_INVALID_SIZE;
+            }
 
-    // /* start advertising */
-    // rc = ble_gap_ext_adv_start(instance, 0, 0);
-    // assert(rc == 0);
-}
+            nimble_peripheral_rx_read(conn_index, buffer, record_len);
+            if (out_len)
+            {
+                *out_len = record_len;
+            }
+            return ESP_OK;
+        }
+    }
 
-static void host_controller_reset_cb(int err)
-{
-    ESP_LOGI(ESP_NIMBLE_API_TAG, "Host and controller reset, error code: %d", err);
+    /* A full ring without a delimiter can never complete the record; incoming data is being dropped. */
+    return (available == CONFIG_ESP_NIMBLE_API_RX_RING_SIZE) ? ESP_ERR_INVALID_SIZE : ESP_ERR_NOT_FOUND;
+#else
+    return ESP_ERR_NOT_FOUND;
+#endif
 }
 
-static void host_controller_sync_cb(void)
+esp_err_t nimble_peripheral_rx_read_frame(int conn_index, void *buffer, size_t buffer_size, size_t *out_len)
 {
-    int rc;
-
-    if (g_nimble_peripheral_config->sm_random_address)
+    uint8_t header[2];
+    if (nimble_peripheral_rx_peek(conn_index, header, sizeof(header)) < sizeof(header))
     {
-        ESP_ERROR_CHECK(ble_app_set_addr());
-        rc = ble_hs_util_ensure_addr(1);
+        return ESP_ERR_NOT_FOUND;
     }
-    else
+
+    size_t frame_len = header[0] | (header[1] << 8);
+#if CONFIG_ESP_NIMBLE_API_RX_RING_SIZE > 0
+    /* The frame can never be complete in the ring; the caller has to resynchronise. */
+    if (sizeof(header) + frame_len > CONFIG_ESP_NIMBLE_API_RX_RING_SIZE)
     {
-        rc = ble_hs_util_ensure_addr(0);
+        return ESP_ERR_INVALID_SIZE;
     }
-    if (rc != 0)
+#endif
+    if (nimble_peripheral_rx_available(conn_index) < sizeof(header) + frame_len)
     {
-        switch (rc)
-        {
-        case BLE_HS_ENOADDR:
-            ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to ensure address, no available address");
-            break;
-        default:
-            ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to ensure address, error code: %d", rc);
-            break;
-        }
-        abort();
+        return ESP_ERR_NOT_FOUND;
     }
 
-    rc = ble_hs_id_infer_auto(0, &g_nimble_peripheral->peripheral_addr_type);
-    if (rc != 0)
+    if (frame_len > buffer_size)
     {
-        switch (rc)
-        {
-        case BLE_HS_ENOADDR:
-            ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to infer address type, no suitable address to infer");
-            break;
-        default:
-            ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to infer address type, error code: %d", rc);
-            break;
-        }
-        abort();
+        return ESP_ERR_INVALID_SIZE;
     }
 
-    rc = ble_hs_id_copy_addr(g_nimble_peripheral->peripheral_addr_type, g_nimble_peripheral->peripheral_addr_val, NULL);
-    if (rc != 0)
+    nimble_peripheral_rx_consume(conn_index, sizeof(header));
+    nimble_peripheral_rx_read(conn_index, buffer, frame_len);
+    if (out_len)
     {
-        switch (rc)
-        {
-        case BLE_HS_EINVAL:
-            ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to copy address, invalid address specified");
-            break;
-        case BLE_HS_ENOADDR:
-            ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to copy address, no identity address of the requested type");
-            break;
-        default:
-            ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to copy address, error code: %d", rc);
-            break;
-        }
-        abort();
+        *out_len = frame_len;
     }
-    ESP_LOGI(ESP_NIMBLE_API_TAG, "MAC: %02x:%02x:%02x:%02x:%02x:%02x", g_nimble_peripheral->peripheral_addr_val[5], g_nimble_peripheral->peripheral_addr_val[4], g_nimble_peripheral->peripheral_addr_val[3], g_nimble_peripheral->peripheral_addr_val[2], g_nimble_peripheral->peripheral_addr_val[1], g_nimble_peripheral->peripheral_addr_val[0]);
-
-    memset(g_nimble_peripheral->peripheral_conn, 0, sizeof(g_nimble_peripheral->peripheral_conn));
-    g_nimble_peripheral->peripheral_conn_active_count = 0;
 
-    nimble_peripheral_advertise();
+    return ESP_OK;
 }
 
-static void nimble_peripheral_host_task(void *param)
+size_t nimble_peripheral_rx_wait(int conn_index, TickType_t ticks_to_wait)
 {
-    nimble_port_run();
-    nimble_port_freertos_deinit();
+#if CONFIG_ESP_NIMBLE_API_RX_RING_SIZE > 0
+    nimble_peripheral_rx_ring_t *ring = nimble_peripheral_rx_ring_get(conn_index);
+    if (!ring)
+    {
+        return 0;
+    }
+
+    /* Publish the waiter before checking, so a push racing with the check still notifies us. */
+    __atomic_store_n(&ring->waiter, xTaskGetCurrentTaskHandle(), __ATOMIC_RELEASE);
+    size_t available = nimble_peripheral_rx_available(conn_index);
+    if (available == 0)
+    {
+        ulTaskNotifyTake(pdTRUE, ticks_to_wait);
+        available = nimble_peripheral_rx_available(conn_index);
+    }
+    __atomic_store_n(&ring->waiter, NULL, __ATOMIC_RELEASE);
+
+    return available;
+#else
+    return 0;
+#endif
 }
 
-esp_err_t nimble_peripheral_init(nimble_peripheral_config_t *nimble_peripheral_config, nimble_peripheral_handle_t *nimble_peripheral)
+#if MYNEWT_VAL(BLE_L2CAP_COC_MAX_NUM) > 0
+static esp_err_t nimble_peripheral_coc_push(int conn_index, struct os_mbuf *sdu)
 {
-    ESP_LOGI(ESP_NIMBLE_API_TAG, "Initializating NimBLE...");
+    nimble_peripheral_coc_t *coc = &g_nimble_peripheral_coc[conn_index];
+    esp_err_t err = ESP_OK;
 
-    if (!nimble_peripheral_config || !nimble_peripheral)
+    portENTER_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
+    if (!coc->chan)
     {
-        ESP_LOGE(ESP_NIMBLE_API_TAG, "Invalid configuration or peripheral handle");
-        return ESP_ERR_INVALID_ARG;
+        err = ESP_ERR_INVALID_STATE;
     }
-    g_nimble_peripheral_config = nimble_peripheral_config;
-    g_nimble_peripheral = nimble_peripheral;
-
-    if (g_nimble_peripheral_config->sm_random_address)
+    else if (OS_MBUF_PKTLEN(sdu) > g_nimble_peripheral->peripheral_conn[conn_index].coc_mtu)
     {
-        g_nimble_peripheral->peripheral_addr_type = BLE_OWN_ADDR_RANDOM;
+        err = ESP_ERR_INVALID_SIZE;
     }
-
-    esp_err_t err = nimble_port_init();
-    if (err != ESP_OK)
+    else if (coc->tx_count >= CONFIG_ESP_NIMBLE_API_COC_TX_QUEUE_DEPTH)
     {
-        ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to initialize controller and host stack, error code: %d", err);
-        return err;
+        err = ESP_ERR_TIMEOUT;
+    }
+    else
+    {
+        coc->tx[(coc->tx_head + coc->tx_count) % CONFIG_ESP_NIMBLE_API_COC_TX_QUEUE_DEPTH] = sdu;
+        __atomic_store_n(&coc->tx_count, coc->tx_count + 1, __ATOMIC_RELAXED);
     }
+    portEXIT_CRITICAL(&g_nimble_peripheral_conn_lock[conn_index]);
 
-    ble_hs_cfg.reset_cb = host_controller_reset_cb;
-    ble_hs_cfg.sync_cb = host_controller_sync_cb;
-    ble_hs_cfg.store_status_cb = ble_store_util_status_rr;
+    if (err == ESP_OK)
+    {
+        ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &g_nimble_peripheral_tx_event);
+    }
 
-    ble_hs_cfg.sm_io_cap = g_nimble_peripheral_config->sm_io_cap;
+    return err;
+}
+#endif
 
-    if (g_nimble_peripheral_config->sm_bonding)
+esp_err_t nimble_peripheral_coc_send_mbuf(int conn_index, struct os_mbuf *sdu)
+{
+#if MYNEWT_VAL(BLE_L2CAP_COC_MAX_NUM) > 0
+    if (!sdu)
     {
-        ble_hs_cfg.sm_bonding = 1;
-        ble_hs_cfg.sm_our_key_dist |= BLE_SM_PAIR_KEY_DIST_ENC;
-        ble_hs_cfg.sm_their_key_dist |= BLE_SM_PAIR_KEY_DIST_ENC;
+        return ESP_ERR_INVALID_ARG;
     }
 
-    if (nimble_peripheral_config->sm_mitm)
+    esp_err_t err = ESP_OK;
+    if (conn_index < 0 || conn_index >= CONFIG_BT_NIMBLE_MAX_CONNECTIONS)
     {
-        ble_hs_cfg.sm_mitm = 1;
+        err = ESP_ERR_INVALID_ARG;
     }
-
-    if (nimble_peripheral_config->sm_sc)
+    else if (!g_nimble_peripheral)
     {
-        ble_hs_cfg.sm_sc = 1;
+        err = ESP_ERR_INVALID_STATE;
+    }
+    else if (OS_MBUF_PKTLEN(sdu) == 0)
+    {
+        err = ESP_ERR_INVALID_SIZE;
     }
     else
     {
-        ble_hs_cfg.sm_sc = 0;
+        err = nimble_peripheral_coc_push(conn_index, sdu);
     }
 
-    if (nimble_peripheral_config->sm_resolve_peer_address)
+    if (err != ESP_OK)
     {
-        ble_hs_cfg.sm_our_key_dist |= BLE_SM_PAIR_KEY_DIST_ID;
-        ble_hs_cfg.sm_their_key_dist |= BLE_SM_PAIR_KEY_DIST_ID;
+        os_mbuf_free_chain(sdu);
     }
 
-    ble_svc_gap_init();
-    int rc = ble_svc_gap_device_name_set(nimble_peripheral_config->device_name);
-    if (rc != 0)
+    return err;
+#else
+    if (sdu)
     {
-        ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to set service gap decive name");
-        return ESP_FAIL;
+        os_mbuf_free_chain(sdu);
     }
-    rc = ble_svc_gap_device_appearance_set(BLE_GAP_APPEARANCE_GENERIC_TAG);
-    if (rc != 0)
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t nimble_peripheral_coc_send(int conn_index, const void *data, size_t len, TickType_t ticks_to_wait, size_t *out_sent)
+{
+#if MYNEWT_VAL(BLE_L2CAP_COC_MAX_NUM) > 0
+    size_t sent = 0;
+    if (out_sent)
     {
-        ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to set service gap device appearance");
-        return ESP_FAIL;
+        *out_sent = 0;
     }
 
-    ble_svc_gatt_init();
-    rc = ble_gatts_count_cfg(nimble_peripheral_config->ble_gatt_services);
-    if (rc != 0)
+    if (conn_index < 0 || conn_index >= CONFIG_BT_NIMBLE_MAX_CONNECTIONS || !data || len == 0)
     {
-        ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to count GATT server configuration, error code: %d", rc);
-        return ESP_FAIL;
+        return ESP_ERR_INVALID_ARG;
     }
-    rc = ble_gatts_add_svcs(nimble_peripheral_config->ble_gatt_services);
-    if (rc != 0)
+
+    if (!g_nimble_peripheral)
     {
-        ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to add GATT services, error code: %d", rc);
-        return ESP_FAIL;
+        return ESP_ERR_INVALID_STATE;
     }
 
-    ble_svc_ans_init();
+    nimble_peripheral_coc_t *coc = &g_nimble_peripheral_coc[conn_index];
+    esp_err_t err = ESP_OK;
+    TickType_t start = xTaskGetTickCount();
+    while (sent < len)
+    {
+        /* Clear before checking so a pump pass that frees space after the check still wakes us up. */
+        xEventGroupClearBits(g_nimble_peripheral_tx_event_group, NIMBLE_PERIPHERAL_TX_SPACE_BIT);
+        uint16_t sdu_max = __atomic_load_n(&g_nimble_peripheral->peripheral_conn[conn_index].coc_mtu, __ATOMIC_RELAXED);
+        if (!__atomic_load_n(&coc->chan, __ATOMIC_RELAXED) || sdu_max == 0)
+        {
+            err = ESP_ERR_INVALID_STATE;
+            break;
+        }
 
-    ble_store_config_init();
+        if (__atomic_load_n(&coc->tx_count, __ATOMIC_RELAXED) >= CONFIG_ESP_NIMBLE_API_COC_TX_QUEUE_DEPTH)
+        {
+            TickType_t elapsed = xTaskGetTickCount() - start;
+            if (elapsed >= ticks_to_wait)
+            {
+                err = ESP_ERR_TIMEOUT;
+                break;
+            }
+            xEventGroupWaitBits(g_nimble_peripheral_tx_event_group, NIMBLE_PERIPHERAL_TX_SPACE_BIT, pdFALSE, pdFALSE, ticks_to_wait - elapsed);
+            continue;
+        }
 
-    nimble_port_freertos_init(nimble_peripheral_host_task);
+        size_t remaining = len - sent;
+        uint16_t sdu_len = remaining < sdu_max ? remaining : sdu_max;
+        struct os_mbuf *sdu = nimble_peripheral_tx_mbuf_from_flat((const uint8_t *)data + sent, sdu_len);
+        if (!sdu)
+        {
+            NIMBLE_PERIPHERAL_METRIC_ADD(g_nimble_peripheral->metrics.conn[conn_index].mbuf_alloc_failures, 1);
+            err = ESP_ERR_NO_MEM;
+            break;
+        }
+
+        err = nimble_peripheral_coc_push(conn_index, sdu);
+        if (err == ESP_ERR_TIMEOUT)
+        {
+            /* Another producer took the last slot; wait for the next one. */
+            os_mbuf_free_chain(sdu);
+            err = ESP_OK;
+            continue;
+        }
+        if (err != ESP_OK)
+        {
+            /* The channel closed or reopened with a smaller MTU since the check. */
+            os_mbuf_free_chain(sdu);
+            err = ESP_ERR_INVALID_STATE;
+            break;
+        }
+        sent += sdu_len;
+        if (out_sent)
+        {
+            *out_sent = sent;
+        }
+    }
 
     return err;
+#else
+    if (out_sent)
+    {
+        *out_sent = 0;
+    }
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
 }
 
-esp_err_t nimble_peripheral_notificate(uint16_t attr_handle, char *buffer, size_t buffer_size, const char *message)
+esp_err_t nimble_peripheral_coc_rx_release(int conn_index, struct os_mbuf *sdu)
 {
-    size_t len = strnlen(message, buffer_size);
-    if (len == buffer_size)
+#if MYNEWT_VAL(BLE_L2CAP_COC_MAX_NUM) > 0
+    if (conn_index < 0 || conn_index >= CONFIG_BT_NIMBLE_MAX_CONNECTIONS || !sdu)
     {
-        ESP_LOGE(ESP_NIMBLE_API_TAG, "Message is too long or not null-terminated.");
-        return ESP_FAIL;
+        return ESP_ERR_INVALID_ARG;
     }
 
-    if (!g_nimble_peripheral || g_nimble_peripheral->peripheral_conn_active_count == 0)
+    os_mbuf_free_chain(sdu);
+
+    /* A release after the channel was reopened finds the count already reset. */
+    uint8_t held = __atomic_load_n(&g_nimble_peripheral_coc[conn_index].rx_held, __ATOMIC_RELAXED);
+    while (held > 0 && !__atomic_compare_exchange_n(&g_nimble_peripheral_coc[conn_index].rx_held, &held, held - 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
     {
-        ESP_LOGW(ESP_NIMBLE_API_TAG, "No active BLE connections to send notifications.");
-        return ESP_FAIL;
     }
 
-    for (int i = 0; i < g_nimble_peripheral->peripheral_conn_active_count; i++)
+    if (g_nimble_peripheral)
     {
-        nimble_peripheral_conn_t *conn = &g_nimble_peripheral->peripheral_conn[i];
-
-        for (int j = 0; j < conn->notify_subscription_count; j++)
-        {
-            if (conn->notify_subscriptions[j] == attr_handle)
-            {
-                struct os_mbuf *om = ble_hs_mbuf_from_flat((uint8_t *)message, len);
-                if (!om)
-                {
-                    ESP_LOGE(ESP_NIMBLE_API_TAG, "Memory allocation failed for notification.");
-                    return ESP_FAIL;
-                }
-
-                int rc = ble_gatts_notify_custom(conn->conn_handle, attr_handle, om);
-                if (rc != 0)
-                {
-                    ESP_LOGE(ESP_NIMBLE_API_TAG, "Notification failed: conn_handle=%d, attr_handle=%d, error=%d", conn->conn_handle, attr_handle, rc);
-                    return ESP_FAIL;
-                }
-
-                ESP_LOGI(ESP_NIMBLE_API_TAG, "Notification sent: conn_handle=%d, attr_handle=%d", conn->conn_handle, attr_handle);
-            }
-        }
+        ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &g_nimble_peripheral_tx_event);
     }
 
     return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
 }
 
-esp_err_t nus_process_rx_data(struct os_mbuf *om, char *buffer, size_t buffer_size)
+esp_err_t nimble_peripheral_coc_disconnect(int conn_index)
 {
-    if (!om || !buffer || buffer_size == 0)
+#if MYNEWT_VAL(BLE_L2CAP_COC_MAX_NUM) > 0
+    if (conn_index < 0 || conn_index >= CONFIG_BT_NIMBLE_MAX_CONNECTIONS)
     {
         return ESP_ERR_INVALID_ARG;
     }
 
-    int buf_len = om->om_len;
-    if (buf_len == 0 || buf_len >= buffer_size)
+    struct ble_l2cap_chan *chan = __atomic_load_n(&g_nimble_peripheral_coc[conn_index].chan, __ATOMIC_RELAXED);
+    if (!g_nimble_peripheral || !chan)
     {
-        return ESP_ERR_INVALID_SIZE;
+        return ESP_ERR_INVALID_STATE;
     }
 
-    int rc = os_mbuf_copydata(om, 0, buf_len, buffer);
+    int rc = ble_l2cap_disconnect(chan);
     if (rc != 0)
     {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to disconnect CoC channel, error code: %d", rc);
         return ESP_FAIL;
     }
-    buffer[buf_len] = '\0';
 
     return ESP_OK;
-}
\ No newline at end of file
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
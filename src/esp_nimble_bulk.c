@@ -0,0 +1,412 @@
+#include <esp_nimble_bulk.h>
+#include <esp_rom_crc.h>
+
+#define NIMBLE_BULK_STAT_ADD(counter, n) __atomic_fetch_add(&g_nimble_bulk_stats.counter, (n), __ATOMIC_RELAXED)
+
+typedef struct
+{
+    bool active;       /* A transfer is running, or was interrupted and can be resumed */
+    uint32_t transfer_id;
+    uint32_t total_len;
+    uint32_t received; /* Next offset expected on the data characteristic */
+    uint32_t verified; /* End of the last block that passed its CRC */
+    uint32_t crc;      /* Running CRC of the bytes between verified and received */
+    int owner_index;
+    uint16_t owner_generation;
+    uint8_t chunks_since_ack;
+    bool nak_sent;     /* One NAK per gap, later chunks of the same gap are dropped quietly */
+} nimble_bulk_session_t;
+
+static nimble_bulk_config_t g_nimble_bulk_config;
+static nimble_bulk_stats_t g_nimble_bulk_stats;
+/* Only touched from the host task once the host runs. */
+static nimble_bulk_session_t g_nimble_bulk_session;
+static uint16_t g_nimble_bulk_control_handle;
+static uint16_t g_nimble_bulk_data_handle;
+
+static int nimble_bulk_control_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int nimble_bulk_data_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg);
+
+const ble_uuid128_t nimble_bulk_svc_uuid = BLE_UUID128_INIT(0x58, 0x0e, 0xb4, 0xa7, 0x61, 0x2c, 0x3d, 0x9f, 0x0e, 0x4b, 0x2c, 0x7a, 0x01, 0x00, 0x1e, 0x5a);
+static const ble_uuid128_t nimble_bulk_control_uuid = BLE_UUID128_INIT(0x58, 0x0e, 0xb4, 0xa7, 0x61, 0x2c, 0x3d, 0x9f, 0x0e, 0x4b, 0x2c, 0x7a, 0x02, 0x00, 0x1e, 0x5a);
+static const ble_uuid128_t nimble_bulk_data_uuid = BLE_UUID128_INIT(0x58, 0x0e, 0xb4, 0xa7, 0x61, 0x2c, 0x3d, 0x9f, 0x0e, 0x4b, 0x2c, 0x7a, 0x03, 0x00, 0x1e, 0x5a);
+
+const struct ble_gatt_chr_def nimble_bulk_characteristics[] = {
+    {
+        .uuid = &nimble_bulk_control_uuid.u,
+        .access_cb = nimble_bulk_control_access,
+        .flags = BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP | BLE_GATT_CHR_F_NOTIFY,
+        .val_handle = &g_nimble_bulk_control_handle,
+    },
+    {
+        .uuid = &nimble_bulk_data_uuid.u,
+        .access_cb = nimble_bulk_data_access,
+        .flags = BLE_GATT_CHR_F_WRITE_NO_RSP,
+        .val_handle = &g_nimble_bulk_data_handle,
+    },
+    {0},
+};
+
+static uint32_t nimble_bulk_get_le32(const uint8_t *src)
+{
+    return src[0] | (src[1] << 8) | (src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+static void nimble_bulk_put_le32(uint8_t *dst, uint32_t value)
+{
+    dst[0] = value;
+    dst[1] = value >> 8;
+    dst[2] = value >> 16;
+    dst[3] = value >> 24;
+}
+
+/* Control notifications go to the requesting connection only; a lost one is recovered by the next ACK or a repeated BLOCK_END. */
+static void nimble_bulk_notify(uint16_t conn_handle, const uint8_t *data, uint16_t len)
+{
+    struct os_mbuf *om = ble_hs_mbuf_from_flat(data, len);
+    if (!om)
+    {
+        ESP_LOGW(ESP_NIMBLE_API_TAG, "Bulk control notification dropped, no mbuf; opcode=0x%02x", data[0]);
+        return;
+    }
+
+    int rc = ble_gatts_notify_custom(conn_handle, g_nimble_bulk_control_handle, om);
+    if (rc != 0)
+    {
+        ESP_LOGW(ESP_NIMBLE_API_TAG, "Bulk control notification failed; opcode=0x%02x rc=%d", data[0], rc);
+    }
+}
+
+static void nimble_bulk_send_start_rsp(uint16_t conn_handle, nimble_bulk_status_t status, uint32_t offset)
+{
+    uint8_t rsp[10] = {NIMBLE_BULK_OP_START_RSP, status};
+    nimble_bulk_put_le32(&rsp[2], offset);
+    rsp[6] = g_nimble_bulk_config.block_size;
+    rsp[7] = g_nimble_bulk_config.block_size >> 8;
+    rsp[8] = g_nimble_bulk_config.window;
+    rsp[9] = g_nimble_bulk_config.ack_every;
+    nimble_bulk_notify(conn_handle, rsp, sizeof(rsp));
+}
+
+static void nimble_bulk_send_ack(uint16_t conn_handle)
+{
+    uint8_t ack[9] = {NIMBLE_BULK_OP_ACK};
+    nimble_bulk_put_le32(&ack[1], g_nimble_bulk_session.received);
+    nimble_bulk_put_le32(&ack[5], g_nimble_bulk_session.verified);
+    nimble_bulk_notify(conn_handle, ack, sizeof(ack));
+    g_nimble_bulk_session.chunks_since_ack = 0;
+}
+
+static void nimble_bulk_send_nak(uint16_t conn_handle)
+{
+    uint8_t nak[5] = {NIMBLE_BULK_OP_NAK};
+    nimble_bulk_put_le32(&nak[1], g_nimble_bulk_session.received);
+    nimble_bulk_notify(conn_handle, nak, sizeof(nak));
+    g_nimble_bulk_session.nak_sent = true;
+    g_nimble_bulk_session.chunks_since_ack = 0;
+}
+
+/* Ends the transfer for good; it can no longer be resumed. */
+static void nimble_bulk_finish(uint16_t conn_handle, nimble_bulk_status_t status, esp_err_t err)
+{
+    uint8_t done[2] = {NIMBLE_BULK_OP_DONE, status};
+    nimble_bulk_notify(conn_handle, done, sizeof(done));
+
+    uint32_t transfer_id = g_nimble_bulk_session.transfer_id;
+    memset(&g_nimble_bulk_session, 0, sizeof(g_nimble_bulk_session));
+    if (err == ESP_OK)
+    {
+        NIMBLE_BULK_STAT_ADD(completed, 1);
+    }
+    if (g_nimble_bulk_config.nimble_bulk_on_end_cb)
+    {
+        g_nimble_bulk_config.nimble_bulk_on_end_cb(transfer_id, err, g_nimble_bulk_config.arg);
+    }
+}
+
+static uint32_t nimble_bulk_block_end(void)
+{
+    uint32_t remaining = g_nimble_bulk_session.total_len - g_nimble_bulk_session.verified;
+    return g_nimble_bulk_session.verified + (remaining < g_nimble_bulk_config.block_size ? remaining : g_nimble_bulk_config.block_size);
+}
+
+static bool nimble_bulk_is_owner(int conn_index)
+{
+    return g_nimble_bulk_session.active && conn_index >= 0 && conn_index == g_nimble_bulk_session.owner_index &&
+           nimble_peripheral_conn_is_current(conn_index, g_nimble_bulk_session.owner_generation);
+}
+
+/* Rewinds to the last verified block; the client resends from there. */
+static void nimble_bulk_rewind(void)
+{
+    g_nimble_bulk_session.received = g_nimble_bulk_session.verified;
+    g_nimble_bulk_session.crc = 0;
+}
+
+static void nimble_bulk_start(uint16_t conn_handle, int conn_index, uint32_t transfer_id, uint32_t total_len)
+{
+    nimble_bulk_session_t *session = &g_nimble_bulk_session;
+    if (session->active && !nimble_bulk_is_owner(conn_index) && nimble_peripheral_conn_is_current(session->owner_index, session->owner_generation))
+    {
+        nimble_bulk_send_start_rsp(conn_handle, NIMBLE_BULK_STATUS_BUSY, 0);
+        return;
+    }
+    if (total_len == 0 || conn_index < 0)
+    {
+        nimble_bulk_send_start_rsp(conn_handle, NIMBLE_BULK_STATUS_REJECTED, 0);
+        return;
+    }
+
+    bool resume = session->active && session->transfer_id == transfer_id && session->total_len == total_len;
+    if (session->active && !resume)
+    {
+        ESP_LOGI(ESP_NIMBLE_API_TAG, "Bulk transfer replaced; transfer_id=0x%08lx verified=%lu", (unsigned long)session->transfer_id, (unsigned long)session->verified);
+        uint32_t replaced_id = session->transfer_id;
+        memset(session, 0, sizeof(*session));
+        if (g_nimble_bulk_config.nimble_bulk_on_end_cb)
+        {
+            g_nimble_bulk_config.nimble_bulk_on_end_cb(replaced_id, ESP_ERR_INVALID_STATE, g_nimble_bulk_config.arg);
+        }
+    }
+
+    uint32_t offset = resume ? session->verified : 0;
+    if (g_nimble_bulk_config.nimble_bulk_on_begin_cb &&
+        g_nimble_bulk_config.nimble_bulk_on_begin_cb(conn_index, transfer_id, total_len, offset, g_nimble_bulk_config.arg) != ESP_OK)
+    {
+        nimble_bulk_send_start_rsp(conn_handle, NIMBLE_BULK_STATUS_REJECTED, 0);
+        return;
+    }
+
+    session->active = true;
+    session->transfer_id = transfer_id;
+    session->total_len = total_len;
+    session->verified = offset;
+    session->owner_index = conn_index;
+    session->owner_generation = nimble_peripheral_conn_generation(conn_index);
+    session->chunks_since_ack = 0;
+    session->nak_sent = false;
+    nimble_bulk_rewind();
+    if (resume)
+    {
+        NIMBLE_BULK_STAT_ADD(resumes, 1);
+    }
+    else
+    {
+        NIMBLE_BULK_STAT_ADD(transfers, 1);
+    }
+
+    nimble_bulk_send_start_rsp(conn_handle, NIMBLE_BULK_STATUS_OK, offset);
+}
+
+static void nimble_bulk_block_end_received(uint16_t conn_handle, uint32_t crc)
+{
+    nimble_bulk_session_t *session = &g_nimble_bulk_session;
+    if (session->received == session->verified)
+    {
+        /* Nothing new since the last verified block: a repeated BLOCK_END after a lost ACK. */
+        nimble_bulk_send_ack(conn_handle);
+        return;
+    }
+    if (session->received != nimble_bulk_block_end())
+    {
+        nimble_bulk_send_nak(conn_handle);
+        return;
+    }
+    if (crc != session->crc)
+    {
+        NIMBLE_BULK_STAT_ADD(crc_errors, 1);
+        ESP_LOGW(ESP_NIMBLE_API_TAG, "Bulk block CRC mismatch; offset=%lu", (unsigned long)session->verified);
+        nimble_bulk_rewind();
+        nimble_bulk_send_nak(conn_handle);
+        return;
+    }
+
+    uint32_t block_offset = session->verified;
+    session->verified = session->received;
+    session->crc = 0;
+    if (g_nimble_bulk_config.nimble_bulk_on_block_cb)
+    {
+        esp_err_t err = g_nimble_bulk_config.nimble_bulk_on_block_cb(block_offset, session->verified - block_offset, g_nimble_bulk_config.arg);
+        if (err != ESP_OK)
+        {
+            nimble_bulk_finish(conn_handle, NIMBLE_BULK_STATUS_SINK, err);
+            return;
+        }
+    }
+
+    nimble_bulk_send_ack(conn_handle);
+    if (session->verified == session->total_len)
+    {
+        nimble_bulk_finish(conn_handle, NIMBLE_BULK_STATUS_OK, ESP_OK);
+    }
+}
+
+static int nimble_bulk_control_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    if (ctxt->op != BLE_GATT_ACCESS_OP_WRITE_CHR)
+    {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+
+    uint8_t request[9];
+    uint16_t len = OS_MBUF_PKTLEN(ctxt->om);
+    if (len == 0 || len > sizeof(request) || os_mbuf_copydata(ctxt->om, 0, len, request) != 0)
+    {
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+
+    int conn_index = nimble_peripheral_conn_find(conn_handle);
+    switch (request[0])
+    {
+    case NIMBLE_BULK_OP_START:
+        if (len != 9)
+        {
+            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        }
+        if (!g_nimble_bulk_config.nimble_bulk_on_data_cb)
+        {
+            return BLE_ATT_ERR_WRITE_NOT_PERMITTED;
+        }
+        nimble_bulk_start(conn_handle, conn_index, nimble_bulk_get_le32(&request[1]), nimble_bulk_get_le32(&request[5]));
+        return 0;
+    case NIMBLE_BULK_OP_BLOCK_END:
+        if (len != 5)
+        {
+            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        }
+        if (!nimble_bulk_is_owner(conn_index))
+        {
+            return BLE_ATT_ERR_WRITE_NOT_PERMITTED;
+        }
+        nimble_bulk_block_end_received(conn_handle, nimble_bulk_get_le32(&request[1]));
+        return 0;
+    case NIMBLE_BULK_OP_ABORT:
+        if (!nimble_bulk_is_owner(conn_index))
+        {
+            return BLE_ATT_ERR_WRITE_NOT_PERMITTED;
+        }
+        nimble_bulk_finish(conn_handle, NIMBLE_BULK_STATUS_ABORTED, ESP_ERR_INVALID_STATE);
+        return 0;
+    default:
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+}
+
+/* Called for every chunk, so the payload is handed to the sink segment by segment without copying. */
+static int nimble_bulk_data_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    if (ctxt->op != BLE_GATT_ACCESS_OP_WRITE_CHR)
+    {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+
+    nimble_bulk_session_t *session = &g_nimble_bulk_session;
+    uint8_t header[BULK_HEADER_LEN];
+    uint16_t len = OS_MBUF_PKTLEN(ctxt->om);
+    if (len <= BULK_HEADER_LEN || os_mbuf_copydata(ctxt->om, 0, BULK_HEADER_LEN, header) != 0)
+    {
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+    if (!nimble_bulk_is_owner(nimble_peripheral_conn_find(conn_handle)))
+    {
+        return BLE_ATT_ERR_WRITE_NOT_PERMITTED;
+    }
+
+    uint32_t offset = nimble_bulk_get_le32(header);
+    uint32_t payload_len = len - BULK_HEADER_LEN;
+    if (offset != session->received)
+    {
+        NIMBLE_BULK_STAT_ADD(out_of_order, 1);
+        if (!session->nak_sent)
+        {
+            nimble_bulk_send_nak(conn_handle);
+        }
+        return 0;
+    }
+    if (payload_len > nimble_bulk_block_end() - offset)
+    {
+        ESP_LOGW(ESP_NIMBLE_API_TAG, "Bulk chunk crosses a block boundary; offset=%lu len=%lu", (unsigned long)offset, (unsigned long)payload_len);
+        nimble_bulk_finish(conn_handle, NIMBLE_BULK_STATUS_PROTOCOL, ESP_ERR_INVALID_SIZE);
+        return 0;
+    }
+
+    uint16_t skip = BULK_HEADER_LEN;
+    for (const struct os_mbuf *om = ctxt->om; om != NULL; om = SLIST_NEXT(om, om_next))
+    {
+        if (om->om_len <= skip)
+        {
+            skip -= om->om_len;
+            continue;
+        }
+
+        const uint8_t *data = om->om_data + skip;
+        size_t data_len = om->om_len - skip;
+        skip = 0;
+        esp_err_t err = g_nimble_bulk_config.nimble_bulk_on_data_cb(session->received, data, data_len, g_nimble_bulk_config.arg);
+        if (err != ESP_OK)
+        {
+            nimble_bulk_finish(conn_handle, NIMBLE_BULK_STATUS_SINK, err);
+            return 0;
+        }
+        session->crc = esp_rom_crc32_le(session->crc, data, data_len);
+        session->received += data_len;
+    }
+
+    NIMBLE_BULK_STAT_ADD(bytes, payload_len);
+    session->nak_sent = false;
+    if (++session->chunks_since_ack >= g_nimble_bulk_config.ack_every)
+    {
+        nimble_bulk_send_ack(conn_handle);
+    }
+
+    return 0;
+}
+
+esp_err_t nimble_bulk_register(const nimble_bulk_config_t *config)
+{
+    if (!config || !config->nimble_bulk_on_data_cb)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    nimble_bulk_config_t resolved = *config;
+    if (resolved.block_size == 0)
+    {
+        resolved.block_size = BULK_DEFAULT_BLOCK_SIZE;
+    }
+    if (resolved.window == 0)
+    {
+        resolved.window = BULK_DEFAULT_WINDOW;
+    }
+    if (resolved.ack_every == 0)
+    {
+        resolved.ack_every = resolved.window > 1 ? resolved.window / 2 : 1;
+    }
+    if (resolved.ack_every > resolved.window)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    g_nimble_bulk_config = resolved;
+    memset(&g_nimble_bulk_session, 0, sizeof(g_nimble_bulk_session));
+    memset(&g_nimble_bulk_stats, 0, sizeof(g_nimble_bulk_stats));
+
+    return ESP_OK;
+}
+
+esp_err_t nimble_bulk_stats(nimble_bulk_stats_t *out)
+{
+    if (!out)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    out->transfers = __atomic_load_n(&g_nimble_bulk_stats.transfers, __ATOMIC_RELAXED);
+    out->resumes = __atomic_load_n(&g_nimble_bulk_stats.resumes, __ATOMIC_RELAXED);
+    out->completed = __atomic_load_n(&g_nimble_bulk_stats.completed, __ATOMIC_RELAXED);
+    out->bytes = __atomic_load_n(&g_nimble_bulk_stats.bytes, __ATOMIC_RELAXED);
+    out->crc_errors = __atomic_load_n(&g_nimble_bulk_stats.crc_errors, __ATOMIC_RELAXED);
+    out->out_of_order = __atomic_load_n(&g_nimble_bulk_stats.out_of_order, __ATOMIC_RELAXED);
+
+    return ESP_OK;
+}
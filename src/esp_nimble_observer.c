@@ -0,0 +1,423 @@
+#include <esp_nimble_observer.h>
+
+#define NIMBLE_OBSERVER_STAT_ADD(counter) __atomic_fetch_add(&g_nimble_observer_stats.counter, 1, __ATOMIC_RELAXED)
+
+typedef struct
+{
+    ble_addr_t addr;
+    uint8_t kinds;      /* Bit 0: advertising payload delivered, bit 1: scan response delivered; 0 when free */
+    uint16_t digest[2]; /* Those payloads */
+    TickType_t seen[2]; /* Tick of those deliveries */
+} nimble_observer_entry_t;
+
+static nimble_observer_config_t g_nimble_observer_config;
+static nimble_observer_stats_t g_nimble_observer_stats;
+static volatile bool g_nimble_observer_scanning = false;
+#if CONFIG_ESP_NIMBLE_API_OBSERVER_CACHE_SIZE > 0
+/* Only touched from the host task while scanning. */
+static nimble_observer_entry_t g_nimble_observer_cache[CONFIG_ESP_NIMBLE_API_OBSERVER_CACHE_SIZE];
+#endif
+
+esp_err_t nimble_observer_parse(const uint8_t *data, uint8_t len, nimble_observer_report_t *out)
+{
+    if (!out || (!data && len != 0))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    out->tx_power = BLE_HS_ADV_TX_PWR_LVL_AUTO;
+    out->flags = 0;
+    out->uuid16_count = 0;
+    out->has_uuid128 = false;
+    out->has_mfg_data = false;
+    out->mfg_data = NULL;
+    out->mfg_data_len = 0;
+    out->svc_data = NULL;
+    out->svc_data_len = 0;
+    out->name = NULL;
+    out->name_len = 0;
+    out->data = data;
+    out->data_len = len;
+
+    /* One pass over the AD structures: a length byte, a type byte, then length - 1 bytes of value. */
+    uint8_t offset = 0;
+    while (offset < len)
+    {
+        uint8_t field_len = data[offset];
+        if (field_len == 0)
+        {
+            break;
+        }
+        if (offset + 1 + field_len > len)
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        uint8_t type = data[offset + 1];
+        const uint8_t *value = &data[offset + 2];
+        uint8_t value_len = field_len - 1;
+        switch (type)
+        {
+        case BLE_HS_ADV_TYPE_FLAGS:
+            if (value_len >= 1)
+            {
+                out->flags = value[0];
+            }
+            break;
+        case BLE_HS_ADV_TYPE_INCOMP_UUIDS16:
+        case BLE_HS_ADV_TYPE_COMP_UUIDS16:
+            for (uint8_t i = 0; i + 1 < value_len && out->uuid16_count < OBSERVER_MAX_UUIDS16; i += 2)
+            {
+                out->uuids16[out->uuid16_count++] = value[i] | (value[i + 1] << 8);
+            }
+            break;
+        case BLE_HS_ADV_TYPE_INCOMP_UUIDS128:
+        case BLE_HS_ADV_TYPE_COMP_UUIDS128:
+            if (!out->has_uuid128 && value_len >= 16)
+            {
+                memcpy(out->uuid128, value, 16);
+                out->has_uuid128 = true;
+            }
+            break;
+        case BLE_HS_ADV_TYPE_INCOMP_NAME:
+        case BLE_HS_ADV_TYPE_COMP_NAME:
+            out->name = value;
+            out->name_len = value_len;
+            break;
+        case BLE_HS_ADV_TYPE_TX_PWR_LVL:
+            if (value_len >= 1)
+            {
+                out->tx_power = (int8_t)value[0];
+            }
+            break;
+        case BLE_HS_ADV_TYPE_SVC_DATA_UUID16:
+            if (value_len >= 2)
+            {
+                out->svc_data_uuid16 = value[0] | (value[1] << 8);
+                out->svc_data = value + 2;
+                out->svc_data_len = value_len - 2;
+            }
+            break;
+        case BLE_HS_ADV_TYPE_MFG_DATA:
+            if (value_len >= 2)
+            {
+                out->has_mfg_data = true;
+                out->company_id = value[0] | (value[1] << 8);
+                out->mfg_data = value + 2;
+                out->mfg_data_len = value_len - 2;
+            }
+            break;
+        default:
+            break;
+        }
+        offset += 1 + field_len;
+    }
+
+    return ESP_OK;
+}
+
+static bool nimble_observer_uuid_match(const nimble_observer_report_t *report, const ble_uuid_any_t *uuid)
+{
+    switch (uuid->u.type)
+    {
+    case BLE_UUID_TYPE_16:
+        if (report->svc_data && report->svc_data_uuid16 == uuid->u16.value)
+        {
+            return true;
+        }
+        for (uint8_t i = 0; i < report->uuid16_count; i++)
+        {
+            if (report->uuids16[i] == uuid->u16.value)
+            {
+                return true;
+            }
+        }
+        return false;
+    case BLE_UUID_TYPE_128:
+        return report->has_uuid128 && memcmp(report->uuid128, uuid->u128.value, 16) == 0;
+    default:
+        return false;
+    }
+}
+
+static bool nimble_observer_filter_match(const nimble_observer_filter_t *filter, const nimble_observer_report_t *report)
+{
+    if (filter->uuids)
+    {
+        bool match = false;
+        for (uint8_t i = 0; i < filter->uuid_count && !match; i++)
+        {
+            match = nimble_observer_uuid_match(report, &filter->uuids[i]);
+        }
+        if (!match)
+        {
+            return false;
+        }
+    }
+
+    if (filter->company_ids)
+    {
+        if (!report->has_mfg_data)
+        {
+            return false;
+        }
+
+        bool match = false;
+        for (uint8_t i = 0; i < filter->company_id_count && !match; i++)
+        {
+            match = filter->company_ids[i] == report->company_id;
+        }
+        if (!match)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* FNV-1a; the 16-bit payload digest only has to catch changes, not resist collisions. */
+static uint32_t nimble_observer_hash(const uint8_t *data, size_t len, uint32_t hash)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/* Time since the last delivery of either payload; entries never delivered are infinitely old. */
+static TickType_t nimble_observer_entry_age(const nimble_observer_entry_t *entry, TickType_t now)
+{
+    TickType_t age = portMAX_DELAY;
+    for (int kind = 0; kind < 2; kind++)
+    {
+        if ((entry->kinds & (1 << kind)) && now - entry->seen[kind] < age)
+        {
+            age = now - entry->seen[kind];
+        }
+    }
+    return age;
+}
+
+/* Returns true if the report repeats what was delivered for this address within the TTL, otherwise records it. */
+static bool nimble_observer_duplicate(const nimble_observer_report_t *report)
+{
+#if CONFIG_ESP_NIMBLE_API_OBSERVER_CACHE_SIZE > 0
+    TickType_t ttl = pdMS_TO_TICKS(g_nimble_observer_config.dedup_ttl_ms);
+    if (ttl == 0)
+    {
+        return false;
+    }
+
+    TickType_t now = xTaskGetTickCount();
+    int kind = report->event_type == BLE_HCI_ADV_RPT_EVTYPE_SCAN_RSP;
+    uint16_t digest = (uint16_t)nimble_observer_hash(report->data, report->data_len, 2166136261u);
+    uint32_t home = nimble_observer_hash(report->addr.val, sizeof(report->addr.val), 2166136261u ^ report->addr.type);
+
+    /* Bounded linear probe: the whole window is searched, so no tombstones are needed when entries are replaced. */
+    nimble_observer_entry_t *free_entry = NULL;
+    nimble_observer_entry_t *oldest = NULL;
+    TickType_t oldest_age = 0;
+    for (int i = 0; i < OBSERVER_PROBE_LIMIT; i++)
+    {
+        nimble_observer_entry_t *entry = &g_nimble_observer_cache[(home + i) & (CONFIG_ESP_NIMBLE_API_OBSERVER_CACHE_SIZE - 1)];
+        if (entry->kinds && ble_addr_cmp(&entry->addr, &report->addr) == 0)
+        {
+            if ((entry->kinds & (1 << kind)) && entry->digest[kind] == digest && now - entry->seen[kind] < ttl)
+            {
+                return true;
+            }
+            entry->kinds |= 1 << kind;
+            entry->digest[kind] = digest;
+            entry->seen[kind] = now;
+            return false;
+        }
+
+        TickType_t age = nimble_observer_entry_age(entry, now);
+        if (age >= ttl)
+        {
+            if (!free_entry)
+            {
+                free_entry = entry;
+            }
+        }
+        else if (!oldest || age > oldest_age)
+        {
+            oldest = entry;
+            oldest_age = age;
+        }
+    }
+
+    if (!free_entry)
+    {
+        NIMBLE_OBSERVER_STAT_ADD(evictions);
+        free_entry = oldest;
+    }
+
+    free_entry->addr = report->addr;
+    free_entry->kinds = 1 << kind;
+    free_entry->digest[kind] = digest;
+    free_entry->seen[kind] = now;
+#endif
+    return false;
+}
+
+static void nimble_observer_process(nimble_observer_report_t *report)
+{
+    NIMBLE_OBSERVER_STAT_ADD(reports);
+
+    /* Cheapest checks first: RSSI needs no parsing, the dedup lookup runs only for reports that pass the filters. */
+    const nimble_observer_filter_t *filter = &g_nimble_observer_config.filter;
+    if (filter->rssi_min != 0 && report->rssi < filter->rssi_min)
+    {
+        NIMBLE_OBSERVER_STAT_ADD(filtered);
+        return;
+    }
+
+    if (nimble_observer_parse(report->data, report->data_len, report) != ESP_OK)
+    {
+        NIMBLE_OBSERVER_STAT_ADD(malformed);
+        return;
+    }
+
+    if (!nimble_observer_filter_match(filter, report))
+    {
+        NIMBLE_OBSERVER_STAT_ADD(filtered);
+        return;
+    }
+
+    if (nimble_observer_duplicate(report))
+    {
+        NIMBLE_OBSERVER_STAT_ADD(duplicates);
+        return;
+    }
+
+    NIMBLE_OBSERVER_STAT_ADD(delivered);
+    g_nimble_observer_config.nimble_observer_on_report_cb(report, g_nimble_observer_config.arg);
+}
+
+#if MYNEWT_VAL(BLE_ROLE_OBSERVER)
+static int nimble_observer_gap_event_cb(struct ble_gap_event *event, void *arg)
+{
+    nimble_observer_report_t report;
+
+    switch (event->type)
+    {
+    case BLE_GAP_EVENT_DISC:
+        report.addr = event->disc.addr;
+        report.rssi = event->disc.rssi;
+        report.event_type = event->disc.event_type;
+        report.data = event->disc.data;
+        report.data_len = event->disc.length_data;
+        nimble_observer_process(&report);
+        break;
+#if MYNEWT_VAL(BLE_EXT_ADV)
+    case BLE_GAP_EVENT_EXT_DISC:
+        /* Only legacy PDUs fit the 31-byte report; extended ones are left to ble_gap_ext_disc() users. */
+        if (!(event->ext_disc.props & BLE_HCI_ADV_LEGACY_MASK))
+        {
+            break;
+        }
+        report.addr = event->ext_disc.addr;
+        report.rssi = event->ext_disc.rssi;
+        report.event_type = event->ext_disc.legacy_event_type;
+        report.data = event->ext_disc.data;
+        report.data_len = event->ext_disc.length_data;
+        nimble_observer_process(&report);
+        break;
+#endif
+    case BLE_GAP_EVENT_DISC_COMPLETE:
+        ESP_LOGI(ESP_NIMBLE_API_TAG, "Scan complete; reason=%d", event->disc_complete.reason);
+        g_nimble_observer_scanning = false;
+        break;
+    default:
+        break;
+    }
+
+    return 0;
+}
+#endif
+
+esp_err_t nimble_observer_start(const nimble_observer_config_t *config, int32_t duration_ms)
+{
+#if MYNEWT_VAL(BLE_ROLE_OBSERVER)
+    if (!config || !config->nimble_observer_on_report_cb)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (g_nimble_observer_scanning)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    uint8_t own_addr_type;
+    int rc = ble_hs_id_infer_auto(0, &own_addr_type);
+    if (rc != 0)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to infer address type for scanning, error code: %d", rc);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    g_nimble_observer_config = *config;
+    memset(&g_nimble_observer_stats, 0, sizeof(g_nimble_observer_stats));
+#if CONFIG_ESP_NIMBLE_API_OBSERVER_CACHE_SIZE > 0
+    memset(g_nimble_observer_cache, 0, sizeof(g_nimble_observer_cache));
+#endif
+
+    struct ble_gap_disc_params disc_params = {0};
+    disc_params.itvl = BLE_GAP_SCAN_ITVL_MS(config->itvl_ms);
+    disc_params.window = BLE_GAP_SCAN_ITVL_MS(config->window_ms);
+    disc_params.filter_policy = BLE_HCI_SCAN_FILT_NO_WL;
+    disc_params.passive = !config->active;
+    disc_params.filter_duplicates = 0;
+
+    g_nimble_observer_scanning = true;
+    rc = ble_gap_disc(own_addr_type, duration_ms, &disc_params, nimble_observer_gap_event_cb, NULL);
+    if (rc != 0)
+    {
+        ESP_LOGE(ESP_NIMBLE_API_TAG, "Failed to start scanning, error code: %d", rc);
+        g_nimble_observer_scanning = false;
+        return rc == BLE_HS_EALREADY || rc == BLE_HS_EBUSY ? ESP_ERR_INVALID_STATE : ESP_FAIL;
+    }
+
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t nimble_observer_stop(void)
+{
+#if MYNEWT_VAL(BLE_ROLE_OBSERVER)
+    if (!g_nimble_observer_scanning)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    /* ble_gap_disc_cancel() does not raise DISC_COMPLETE. */
+    g_nimble_observer_scanning = false;
+    int rc = ble_gap_disc_cancel();
+    return rc == 0 || rc == BLE_HS_EALREADY ? ESP_OK : ESP_FAIL;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t nimble_observer_stats(nimble_observer_stats_t *out)
+{
+    if (!out)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    out->reports = __atomic_load_n(&g_nimble_observer_stats.reports, __ATOMIC_RELAXED);
+    out->malformed = __atomic_load_n(&g_nimble_observer_stats.malformed, __ATOMIC_RELAXED);
+    out->filtered = __atomic_load_n(&g_nimble_observer_stats.filtered, __ATOMIC_RELAXED);
+    out->duplicates = __atomic_load_n(&g_nimble_observer_stats.duplicates, __ATOMIC_RELAXED);
+    out->delivered = __atomic_load_n(&g_nimble_observer_stats.delivered, __ATOMIC_RELAXED);
+    out->evictions = __atomic_load_n(&g_nimble_observer_stats.evictions, __ATOMIC_RELAXED);
+
+    return ESP_OK;
+}
@@ -0,0 +1,141 @@
+/* Fan-out benchmark: cost of GAP connect/subscribe handling and of nimble_peripheral_notify() for N connections
+ * each subscribed to M characteristics, plus mbuf allocations per PDU handed to the host.
+ *
+ * usage: bench_fanout [iterations] [max mbuf allocations per PDU]
+ * The second argument turns the run into a regression check that fails when the send path allocates more. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "esp_nimble_api.h"
+#include "mock_nimble.h"
+#include "mock_script.h"
+
+#define BENCH_ATTR_BASE 0x100
+#define BENCH_PAYLOAD_LEN 20
+
+typedef struct
+{
+    double connect_ns;
+    double subscribe_ns;
+    double notify_ns;
+    double pdu_ns;
+    double allocs_per_pdu;
+    uint32_t pdus;
+} bench_result_t;
+
+static nimble_peripheral_handle_t g_bench_handle;
+static struct ble_gatt_svc_def g_bench_services[] = {{0}};
+static nimble_peripheral_config_t g_bench_config = {.device_name = "bench", .ble_gatt_services = g_bench_services};
+
+static uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static int bench_run(int conns, int attrs, int iterations, bench_result_t *result)
+{
+    static const uint8_t payload[BENCH_PAYLOAD_LEN];
+
+    uint64_t start = bench_now_ns();
+    for (int c = 0; c < conns; c++)
+    {
+        mock_script_connect(c + 1);
+    }
+    result->connect_ns = (double)(bench_now_ns() - start) / conns;
+
+    start = bench_now_ns();
+    for (int c = 0; c < conns; c++)
+    {
+        for (int a = 0; a < attrs; a++)
+        {
+            mock_script_subscribe(c + 1, BENCH_ATTR_BASE + a, true, false);
+        }
+    }
+    result->subscribe_ns = (double)(bench_now_ns() - start) / (conns * attrs);
+
+    uint32_t allocs = mock_nimble.mbuf_allocs;
+    uint32_t sent = mock_nimble.sent_count;
+    start = bench_now_ns();
+    for (int i = 0; i < iterations; i++)
+    {
+        for (int a = 0; a < attrs; a++)
+        {
+            if (nimble_peripheral_notify(BENCH_ATTR_BASE + a, payload, sizeof(payload)) != ESP_OK)
+            {
+                printf("notify failed at iteration %d\n", i);
+                return -1;
+            }
+            mock_nimble_run_events();
+        }
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    result->pdus = mock_nimble.sent_count - sent;
+    result->notify_ns = (double)elapsed / ((double)iterations * attrs);
+    result->pdu_ns = result->pdus ? (double)elapsed / result->pdus : 0;
+    result->allocs_per_pdu = result->pdus ? (double)(mock_nimble.mbuf_allocs - allocs) / result->pdus : 0;
+
+    for (int c = 0; c < conns; c++)
+    {
+        mock_script_disconnect(c + 1, 0);
+    }
+    mock_nimble_run_events();
+
+    if (result->pdus != (uint32_t)iterations * attrs * conns)
+    {
+        printf("expected %d PDUs, host saw %u\n", iterations * attrs * conns, result->pdus);
+        return -1;
+    }
+    if (mock_nimble.mbuf_live != 0)
+    {
+        printf("%u mbufs leaked\n", mock_nimble.mbuf_live);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static const int conn_counts[] = {1, 2, 4, CONFIG_BT_NIMBLE_MAX_CONNECTIONS};
+    static const int attr_counts[] = {1, 4, MAX_SUBSCRIBED_ATTRS};
+
+    int iterations = argc > 1 ? atoi(argv[1]) : 2000;
+    double max_allocs = argc > 2 ? atof(argv[2]) : 0;
+    int status = 0;
+
+    esp_log_level_set("*", ESP_LOG_NONE);
+    mock_nimble_reset();
+    if (nimble_peripheral_init(&g_bench_config, &g_bench_handle) != ESP_OK)
+    {
+        printf("init failed\n");
+        return 1;
+    }
+    mock_nimble_sync();
+
+    printf("%d iterations, %d byte payload\n", iterations, BENCH_PAYLOAD_LEN);
+    printf("%5s %5s %12s %12s %12s %12s %12s\n", "conns", "attrs", "connect ns", "subscribe ns", "notify ns", "ns/PDU", "allocs/PDU");
+    for (size_t i = 0; i < sizeof(conn_counts) / sizeof(conn_counts[0]); i++)
+    {
+        if (i > 0 && conn_counts[i] <= conn_counts[i - 1])
+        {
+            continue;
+        }
+        for (size_t j = 0; j < sizeof(attr_counts) / sizeof(attr_counts[0]); j++)
+        {
+            bench_result_t result;
+            if (bench_run(conn_counts[i], attr_counts[j], iterations, &result) != 0)
+            {
+                return 1;
+            }
+            printf("%5d %5d %12.0f %12.0f %12.0f %12.0f %12.2f\n", conn_counts[i], attr_counts[j], result.connect_ns,
+                   result.subscribe_ns, result.notify_ns, result.pdu_ns, result.allocs_per_pdu);
+            if (max_allocs > 0 && result.allocs_per_pdu > max_allocs)
+            {
+                printf("allocations per PDU %.2f exceed the %.2f budget\n", result.allocs_per_pdu, max_allocs);
+                status = 1;
+            }
+        }
+    }
+    return status;
+}
@@ -0,0 +1,1287 @@
+/* Single-threaded stand-in for the NimBLE host, the NPL event queue and the FreeRTOS/ESP-IDF pieces the
+ * component uses. GATT sends are recorded in mock_nimble.sent and NOTIFY_TX is raised synchronously unless
+ * mock_nimble.defer_notify_tx is set, in which case mock_nimble_complete_tx() releases it. */
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "mock_nimble.h"
+#include "mock_script.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nimble/nimble_port.h"
+#include "nimble/nimble_port_freertos.h"
+#include "services/gap/ble_svc_gap.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+
+mock_nimble_t mock_nimble;
+esp_log_level_t mock_log_level = ESP_LOG_INFO;
+struct ble_hs_cfg ble_hs_cfg;
+
+static void mock_nimble_reset_deferred(void);
+static void mock_nimble_coc_conn_broken(uint16_t conn_handle);
+
+static struct ble_gap_conn_desc mock_conns[16];
+static int mock_conn_count;
+static ble_gap_event_fn *mock_gap_cb;
+static void *mock_gap_arg;
+static struct os_mempool msys_mempool = {.mp_block_size = 292, .mp_num_blocks = 64, .mp_num_free = 64, .mp_min_free = 64};
+static struct os_mbuf_pool msys_pool = {.omp_databuf_len = 256, .omp_pool = &msys_mempool};
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    static char buf[16];
+    snprintf(buf, sizeof(buf), "0x%x", code);
+    return buf;
+}
+
+void mock_nimble_reset(void)
+{
+    mock_nimble_coc_conn_broken(BLE_HS_CONN_HANDLE_NONE);
+    memset(&mock_nimble, 0, sizeof(mock_nimble));
+    mock_conn_count = 0;
+    mock_nimble_reset_deferred();
+}
+
+void mock_nimble_add_conn(uint16_t conn_handle, uint8_t addr_last)
+{
+    struct ble_gap_conn_desc *desc = &mock_conns[mock_conn_count++];
+    memset(desc, 0, sizeof(*desc));
+    desc->conn_handle = conn_handle;
+    desc->peer_id_addr.val[0] = addr_last;
+    desc->conn_itvl = 24;
+    desc->supervision_timeout = 400;
+}
+
+void mock_nimble_set_bonded(uint16_t conn_handle)
+{
+    for (int i = 0; i < mock_conn_count; i++)
+    {
+        if (mock_conns[i].conn_handle == conn_handle)
+        {
+            mock_conns[i].sec_state.encrypted = 1;
+            mock_conns[i].sec_state.bonded = 1;
+        }
+    }
+}
+
+void mock_nimble_remove_conn(uint16_t conn_handle)
+{
+    mock_nimble_coc_conn_broken(conn_handle);
+    for (int i = 0; i < mock_conn_count; i++)
+    {
+        if (mock_conns[i].conn_handle == conn_handle)
+        {
+            mock_conns[i] = mock_conns[--mock_conn_count];
+            return;
+        }
+    }
+}
+
+ble_gap_event_fn *mock_nimble_gap_cb(void)
+{
+    return mock_gap_cb;
+}
+
+int mock_nimble_gap_event(struct ble_gap_event *event)
+{
+    return mock_gap_cb(event, mock_gap_arg);
+}
+
+/* mbufs */
+int os_mempool_init(struct os_mempool *mp, uint16_t blocks, uint32_t block_size, void *membuf, const char *name)
+{
+    mp->mp_block_size = block_size;
+    mp->mp_num_blocks = blocks;
+    mp->mp_num_free = blocks;
+    mp->mp_min_free = blocks;
+    mp->name = name;
+    return 0;
+}
+
+int os_mbuf_pool_init(struct os_mbuf_pool *omp, struct os_mempool *mp, uint16_t buf_len, uint16_t nbufs)
+{
+    omp->omp_pool = mp;
+    omp->omp_databuf_len = buf_len - sizeof(struct os_mbuf);
+    return 0;
+}
+
+struct os_mbuf *os_mbuf_get(struct os_mbuf_pool *omp, uint16_t leadingspace)
+{
+    if (omp->omp_pool->mp_num_free == 0)
+    {
+        return NULL;
+    }
+    omp->omp_pool->mp_num_free--;
+    if (omp->omp_pool->mp_num_free < omp->omp_pool->mp_min_free)
+    {
+        omp->omp_pool->mp_min_free = omp->omp_pool->mp_num_free;
+    }
+    struct os_mbuf *om = calloc(1, sizeof(struct os_mbuf) + omp->omp_databuf_len);
+    om->om_omp = omp;
+    om->om_data = om->om_databuf + leadingspace;
+    mock_nimble.mbuf_allocs++;
+    mock_nimble.mbuf_live++;
+    return om;
+}
+
+struct os_mbuf *os_mbuf_get_pkthdr(struct os_mbuf_pool *omp, uint8_t user_pkthdr_len)
+{
+    uint16_t pkthdr_len = sizeof(struct os_mbuf_pkthdr) + user_pkthdr_len;
+    struct os_mbuf *om = os_mbuf_get(omp, 0);
+    if (om)
+    {
+        om->om_pkthdr_len = pkthdr_len;
+        om->om_data = om->om_databuf + pkthdr_len;
+        OS_MBUF_PKTHDR(om)->omp_len = 0;
+    }
+    return om;
+}
+
+struct os_mbuf *os_msys_get_pkthdr(uint16_t dsize, uint16_t user_hdr_len)
+{
+    return os_mbuf_get_pkthdr(&msys_pool, user_hdr_len);
+}
+
+int os_msys_num_free(void)
+{
+    return msys_mempool.mp_num_free;
+}
+
+int os_mbuf_free(struct os_mbuf *mb)
+{
+    mb->om_omp->omp_pool->mp_num_free++;
+    mock_nimble.mbuf_frees++;
+    mock_nimble.mbuf_live--;
+    free(mb);
+    return 0;
+}
+
+int os_mbuf_free_chain(struct os_mbuf *om)
+{
+    while (om)
+    {
+        struct os_mbuf *next = SLIST_NEXT(om, om_next);
+        os_mbuf_free(om);
+        om = next;
+    }
+    return 0;
+}
+
+int os_mbuf_append(struct os_mbuf *om, const void *data, uint16_t len)
+{
+    struct os_mbuf *last = om;
+    const uint8_t *src = data;
+    while (SLIST_NEXT(last, om_next))
+    {
+        last = SLIST_NEXT(last, om_next);
+    }
+    while (len > 0)
+    {
+        uint16_t space = OS_MBUF_TRAILINGSPACE(last);
+        if (space == 0)
+        {
+            struct os_mbuf *next = os_mbuf_get(om->om_omp, 0);
+            if (!next)
+            {
+                return BLE_HS_ENOMEM;
+            }
+            SLIST_NEXT(last, om_next) = next;
+            last = next;
+            continue;
+        }
+        uint16_t n = len < space ? len : space;
+        memcpy(last->om_data + last->om_len, src, n);
+        last->om_len += n;
+        src += n;
+        len -= n;
+        if (OS_MBUF_IS_PKTHDR(om))
+        {
+            OS_MBUF_PKTHDR(om)->omp_len += n;
+        }
+    }
+    return 0;
+}
+
+struct os_mbuf *os_mbuf_off(const struct os_mbuf *om, int off, uint16_t *out_off)
+{
+    while (om)
+    {
+        if (off < om->om_len || (off == om->om_len && !SLIST_NEXT(om, om_next)))
+        {
+            *out_off = off;
+            return (struct os_mbuf *)om;
+        }
+        off -= om->om_len;
+        om = SLIST_NEXT(om, om_next);
+    }
+    return NULL;
+}
+
+int os_mbuf_copydata(const struct os_mbuf *m, int off, int len, void *dst)
+{
+    uint8_t *out = dst;
+    while (m && off >= m->om_len)
+    {
+        off -= m->om_len;
+        m = SLIST_NEXT(m, om_next);
+    }
+    while (len > 0 && m)
+    {
+        int n = m->om_len - off;
+        if (n > len)
+        {
+            n = len;
+        }
+        memcpy(out, m->om_data + off, n);
+        out += n;
+        len -= n;
+        off = 0;
+        m = SLIST_NEXT(m, om_next);
+    }
+    return len > 0 ? -1 : 0;
+}
+
+int os_mbuf_appendfrom(struct os_mbuf *dst, const struct os_mbuf *src, uint16_t src_off, uint16_t len)
+{
+    uint8_t tmp[1024];
+    if (len > sizeof(tmp) || os_mbuf_copydata(src, src_off, len, tmp) != 0)
+    {
+        return BLE_HS_EINVAL;
+    }
+    return os_mbuf_append(dst, tmp, len);
+}
+
+struct os_mbuf *os_mbuf_dup(struct os_mbuf *om)
+{
+    struct os_mbuf *copy = os_mbuf_get_pkthdr(om->om_omp, om->om_pkthdr_len - sizeof(struct os_mbuf_pkthdr));
+    if (!copy)
+    {
+        return NULL;
+    }
+    copy->om_data += OS_MBUF_LEADINGSPACE(om);
+    for (const struct os_mbuf *cur = om; cur; cur = SLIST_NEXT(cur, om_next))
+    {
+        if (os_mbuf_append(copy, cur->om_data, cur->om_len) != 0)
+        {
+            os_mbuf_free_chain(copy);
+            return NULL;
+        }
+    }
+    return copy;
+}
+
+void os_mbuf_adj(struct os_mbuf *mp, int req_len)
+{
+    int len = req_len;
+    struct os_mbuf *m = mp;
+    while (m && len > 0)
+    {
+        int n = m->om_len < len ? m->om_len : len;
+        m->om_len -= n;
+        m->om_data += n;
+        len -= n;
+        m = SLIST_NEXT(m, om_next);
+    }
+    if (OS_MBUF_IS_PKTHDR(mp))
+    {
+        OS_MBUF_PKTHDR(mp)->omp_len -= req_len - len;
+    }
+}
+
+int os_mbuf_cmpf(const struct os_mbuf *om, int off, const void *data, int len)
+{
+    uint8_t tmp[1024];
+    if (len > (int)sizeof(tmp) || os_mbuf_copydata(om, off, len, tmp) != 0)
+    {
+        return INT32_MAX;
+    }
+    return memcmp(tmp, data, len);
+}
+
+void os_mbuf_concat(struct os_mbuf *first, struct os_mbuf *second)
+{
+    struct os_mbuf *last = first;
+    while (SLIST_NEXT(last, om_next))
+    {
+        last = SLIST_NEXT(last, om_next);
+    }
+    SLIST_NEXT(last, om_next) = second;
+    if (OS_MBUF_IS_PKTHDR(first))
+    {
+        uint16_t add = 0;
+        for (struct os_mbuf *m = second; m; m = SLIST_NEXT(m, om_next))
+        {
+            add += m->om_len;
+        }
+        OS_MBUF_PKTHDR(first)->omp_len += add;
+    }
+}
+
+struct os_mbuf *ble_hs_mbuf_att_pkt(void)
+{
+    struct os_mbuf *om = os_msys_get_pkthdr(0, 0);
+    if (om)
+    {
+        om->om_data += BLE_HCI_DATA_HDR_SZ + BLE_L2CAP_HDR_SZ + 5;
+    }
+    return om;
+}
+
+struct os_mbuf *ble_hs_mbuf_from_flat(const void *buf, uint16_t len)
+{
+    struct os_mbuf *om = ble_hs_mbuf_att_pkt();
+    if (om && os_mbuf_append(om, buf, len) != 0)
+    {
+        os_mbuf_free_chain(om);
+        return NULL;
+    }
+    return om;
+}
+
+int ble_hs_mbuf_to_flat(const struct os_mbuf *om, void *flat, uint16_t max_len, uint16_t *out_copy_len)
+{
+    uint16_t len = OS_MBUF_PKTLEN(om) < max_len ? OS_MBUF_PKTLEN(om) : max_len;
+    os_mbuf_copydata(om, 0, len, flat);
+    if (out_copy_len)
+    {
+        *out_copy_len = len;
+    }
+    return len < OS_MBUF_PKTLEN(om) ? BLE_HS_EMSGSIZE : 0;
+}
+
+/* GATT */
+static struct
+{
+    int status;
+    uint16_t conn_handle;
+    uint16_t attr_handle;
+    bool indication;
+} mock_deferred_tx[MOCK_MAX_SENT];
+static int mock_deferred_tx_count;
+
+static void mock_notify_tx_event_now(int status, uint16_t conn_handle, uint16_t attr_handle, bool indication)
+{
+    if (!mock_gap_cb)
+    {
+        return;
+    }
+    struct ble_gap_event event = {.type = BLE_GAP_EVENT_NOTIFY_TX};
+    event.notify_tx.status = status;
+    event.notify_tx.conn_handle = conn_handle;
+    event.notify_tx.attr_handle = attr_handle;
+    event.notify_tx.indication = indication;
+    mock_gap_cb(&event, mock_gap_arg);
+}
+
+static void mock_notify_tx_event(int status, uint16_t conn_handle, uint16_t attr_handle, bool indication)
+{
+    if (mock_nimble.defer_notify_tx && mock_deferred_tx_count < MOCK_MAX_SENT)
+    {
+        mock_deferred_tx[mock_deferred_tx_count].status = status;
+        mock_deferred_tx[mock_deferred_tx_count].conn_handle = conn_handle;
+        mock_deferred_tx[mock_deferred_tx_count].attr_handle = attr_handle;
+        mock_deferred_tx[mock_deferred_tx_count].indication = indication;
+        mock_deferred_tx_count++;
+        return;
+    }
+    mock_notify_tx_event_now(status, conn_handle, attr_handle, indication);
+}
+
+static void mock_nimble_reset_deferred(void)
+{
+    mock_deferred_tx_count = 0;
+}
+
+int mock_nimble_complete_tx(int max)
+{
+    int done = 0;
+    while (mock_deferred_tx_count > 0 && done < max)
+    {
+        int status = mock_deferred_tx[0].status;
+        uint16_t conn_handle = mock_deferred_tx[0].conn_handle;
+        uint16_t attr_handle = mock_deferred_tx[0].attr_handle;
+        bool indication = mock_deferred_tx[0].indication;
+        memmove(&mock_deferred_tx[0], &mock_deferred_tx[1], sizeof(mock_deferred_tx[0]) * (mock_deferred_tx_count - 1));
+        mock_deferred_tx_count--;
+        mock_notify_tx_event_now(status, conn_handle, attr_handle, indication);
+        done++;
+    }
+    return done;
+}
+
+static int mock_record(uint16_t conn_handle, uint16_t attr_handle, struct os_mbuf *om, bool indication)
+{
+    mock_nimble.notify_calls++;
+    if (mock_nimble.notify_rc != 0)
+    {
+        int rc = mock_nimble.notify_rc;
+        os_mbuf_free_chain(om);
+        mock_notify_tx_event(rc, conn_handle, attr_handle, indication);
+        return rc;
+    }
+    if (mock_nimble.sent_count < MOCK_MAX_SENT)
+    {
+        mock_sent_t *sent = &mock_nimble.sent[mock_nimble.sent_count];
+        sent->conn_handle = conn_handle;
+        sent->attr_handle = attr_handle;
+        sent->indication = indication;
+        sent->len = OS_MBUF_PKTLEN(om);
+        os_mbuf_copydata(om, 0, sent->len, sent->data);
+    }
+    mock_nimble.sent_count++;
+    os_mbuf_free_chain(om);
+    mock_notify_tx_event(0, conn_handle, attr_handle, indication);
+    return 0;
+}
+
+int ble_gatts_notify_custom(uint16_t conn_handle, uint16_t att_handle, struct os_mbuf *om)
+{
+    return mock_record(conn_handle, att_handle, om, false);
+}
+
+/* Like the host, one PDU for all values but one BLE_GAP_EVENT_NOTIFY_TX per handle; each value is recorded as sent. */
+int ble_gatts_notify_multiple_custom(uint16_t conn_handle, size_t chr_count, struct ble_gatt_notif *tuples)
+{
+    uint32_t notify_calls = mock_nimble.notify_calls;
+    int rc = 0;
+    for (size_t i = 0; i < chr_count; i++)
+    {
+        int tuple_rc = mock_record(conn_handle, tuples[i].handle, tuples[i].value, false);
+        rc = rc ? rc : tuple_rc;
+    }
+    mock_nimble.notify_calls = notify_calls + 1;
+    mock_nimble.notify_multiple_calls++;
+    return rc;
+}
+
+int ble_gatts_peer_cl_sup_feat_get(uint16_t conn_handle, uint8_t *out_supported_feat, uint8_t len)
+{
+    if (!out_supported_feat || len == 0)
+    {
+        return BLE_HS_EINVAL;
+    }
+    memset(out_supported_feat, 0, len);
+    out_supported_feat[0] = mock_nimble.peer_cl_sup_feat[conn_handle % 8];
+    return 0;
+}
+
+int ble_gatts_indicate_custom(uint16_t conn_handle, uint16_t chr_val_handle, struct os_mbuf *txom)
+{
+    return mock_record(conn_handle, chr_val_handle, txom, true);
+}
+
+int ble_gatts_count_cfg(const struct ble_gatt_svc_def *defs) { return 0; }
+int ble_gatts_add_svcs(const struct ble_gatt_svc_def *svcs) { return 0; }
+uint16_t ble_att_mtu(uint16_t conn_handle) { return BLE_ATT_MTU_DFLT; }
+
+/* GAP */
+int ble_gap_conn_find(uint16_t handle, struct ble_gap_conn_desc *out_desc)
+{
+    for (int i = 0; i < mock_conn_count; i++)
+    {
+        if (mock_conns[i].conn_handle == handle)
+        {
+            if (out_desc)
+            {
+                *out_desc = mock_conns[i];
+            }
+            return 0;
+        }
+    }
+    return BLE_HS_ENOTCONN;
+}
+
+int ble_gap_adv_start(uint8_t own_addr_type, const ble_addr_t *direct_addr, int32_t duration_ms, const struct ble_gap_adv_params *adv_params, ble_gap_event_fn *cb, void *cb_arg)
+{
+    mock_gap_cb = cb;
+    mock_gap_arg = cb_arg;
+    mock_nimble.adv_start_calls++;
+    mock_nimble.adv_active = true;
+    mock_nimble.last_adv.directed = direct_addr != NULL;
+    mock_nimble.last_adv.direct_addr = direct_addr ? *direct_addr : (ble_addr_t){0};
+    mock_nimble.last_adv.duration_ms = duration_ms;
+    mock_nimble.last_adv.params = *adv_params;
+    return 0;
+}
+static ble_gap_event_fn *mock_disc_cb;
+static void *mock_disc_arg;
+int ble_gap_disc(uint8_t own_addr_type, int32_t duration_ms, const struct ble_gap_disc_params *disc_params, ble_gap_event_fn *cb, void *cb_arg)
+{
+    if (mock_nimble.disc_active)
+    {
+        return BLE_HS_EALREADY;
+    }
+    mock_disc_cb = cb;
+    mock_disc_arg = cb_arg;
+    mock_nimble.disc_active = true;
+    mock_nimble.disc_params = *disc_params;
+    return 0;
+}
+int ble_gap_disc_cancel(void)
+{
+    if (!mock_nimble.disc_active)
+    {
+        return BLE_HS_EALREADY;
+    }
+    mock_nimble.disc_active = false;
+    return 0;
+}
+int ble_gap_disc_active(void) { return mock_nimble.disc_active; }
+int mock_nimble_disc_report(const ble_addr_t *addr, int8_t rssi, uint8_t event_type, const uint8_t *data, uint8_t len)
+{
+    struct ble_gap_event event = {.type = BLE_GAP_EVENT_DISC};
+    event.disc.addr = *addr;
+    event.disc.rssi = rssi;
+    event.disc.event_type = event_type;
+    event.disc.data = data;
+    event.disc.length_data = len;
+    return mock_disc_cb(&event, mock_disc_arg);
+}
+/* L2CAP: one CoC channel per connection, with peer credits counted in whole SDUs. */
+struct ble_l2cap_chan
+{
+    bool open;
+    uint16_t conn_handle;
+    uint16_t peer_mtu;
+    struct os_mbuf *rx_sdu;
+    struct os_mbuf *tx_sdu; /* Stalled SDU waiting for credits */
+};
+static struct ble_l2cap_chan mock_chans[4];
+static ble_l2cap_event_fn *mock_l2cap_cb;
+static void *mock_l2cap_arg;
+
+static struct ble_l2cap_chan *mock_chan_find(uint16_t conn_handle)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        if (mock_chans[i].open && mock_chans[i].conn_handle == conn_handle)
+        {
+            return &mock_chans[i];
+        }
+    }
+    return NULL;
+}
+static void mock_chan_free(struct ble_l2cap_chan *chan)
+{
+    if (chan->rx_sdu)
+    {
+        os_mbuf_free_chain(chan->rx_sdu);
+    }
+    if (chan->tx_sdu)
+    {
+        os_mbuf_free_chain(chan->tx_sdu);
+    }
+    memset(chan, 0, sizeof(*chan));
+}
+/* Like NimBLE, channels go away with their connection without an L2CAP event; NONE drops all of them. */
+static void mock_nimble_coc_conn_broken(uint16_t conn_handle)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        if (mock_chans[i].open && (conn_handle == BLE_HS_CONN_HANDLE_NONE || mock_chans[i].conn_handle == conn_handle))
+        {
+            mock_chan_free(&mock_chans[i]);
+        }
+    }
+}
+int ble_l2cap_create_server(uint16_t psm, uint16_t mtu, ble_l2cap_event_fn *cb, void *cb_arg)
+{
+    mock_nimble.coc_psm = psm;
+    mock_nimble.coc_mtu = mtu;
+    mock_l2cap_cb = cb;
+    mock_l2cap_arg = cb_arg;
+    return 0;
+}
+bool mock_nimble_coc_open(uint16_t conn_handle) { return mock_chan_find(conn_handle) != NULL; }
+int mock_nimble_coc_connect(uint16_t conn_handle, uint16_t peer_mtu)
+{
+    struct ble_l2cap_chan *chan = NULL;
+    for (int i = 0; i < 4 && !chan; i++)
+    {
+        chan = mock_chans[i].open ? NULL : &mock_chans[i];
+    }
+    chan->open = true;
+    chan->conn_handle = conn_handle;
+    chan->peer_mtu = peer_mtu;
+
+    struct ble_l2cap_event event = {.type = BLE_L2CAP_EVENT_COC_ACCEPT};
+    event.accept.conn_handle = conn_handle;
+    event.accept.peer_sdu_size = peer_mtu;
+    event.accept.chan = chan;
+    int rc = mock_l2cap_cb(&event, mock_l2cap_arg);
+    if (rc != 0 || !chan->rx_sdu)
+    {
+        mock_chan_free(chan);
+        return rc ? rc : BLE_HS_ENOMEM;
+    }
+
+    event = (struct ble_l2cap_event){.type = BLE_L2CAP_EVENT_COC_CONNECTED};
+    event.connect.conn_handle = conn_handle;
+    event.connect.chan = chan;
+    mock_l2cap_cb(&event, mock_l2cap_arg);
+    return 0;
+}
+/* Fails with BLE_HS_ESTALLED when no receive buffer is posted, i.e. the peer has no credits. */
+int mock_nimble_coc_receive(uint16_t conn_handle, const void *data, uint16_t len)
+{
+    struct ble_l2cap_chan *chan = mock_chan_find(conn_handle);
+    if (!chan)
+    {
+        return BLE_HS_ENOTCONN;
+    }
+    if (!chan->rx_sdu)
+    {
+        return BLE_HS_ESTALLED;
+    }
+    struct os_mbuf *sdu = chan->rx_sdu;
+    chan->rx_sdu = NULL;
+    os_mbuf_append(sdu, data, len);
+
+    struct ble_l2cap_event event = {.type = BLE_L2CAP_EVENT_COC_DATA_RECEIVED};
+    event.receive.conn_handle = conn_handle;
+    event.receive.chan = chan;
+    event.receive.sdu_rx = sdu;
+    mock_l2cap_cb(&event, mock_l2cap_arg);
+    return 0;
+}
+void mock_nimble_coc_credits(uint16_t conn_handle, int sdus)
+{
+    struct ble_l2cap_chan *chan = mock_chan_find(conn_handle);
+    mock_nimble.coc_tx_credits += sdus;
+    if (chan && chan->tx_sdu && mock_nimble.coc_tx_credits > 0)
+    {
+        mock_nimble.coc_tx_credits--;
+        os_mbuf_free_chain(chan->tx_sdu);
+        chan->tx_sdu = NULL;
+
+        struct ble_l2cap_event event = {.type = BLE_L2CAP_EVENT_COC_TX_UNSTALLED};
+        event.tx_unstalled.conn_handle = conn_handle;
+        event.tx_unstalled.chan = chan;
+        mock_l2cap_cb(&event, mock_l2cap_arg);
+    }
+}
+int ble_l2cap_send(struct ble_l2cap_chan *chan, struct os_mbuf *sdu_tx)
+{
+    if (OS_MBUF_PKTLEN(sdu_tx) > chan->peer_mtu)
+    {
+        return BLE_HS_EBADDATA;
+    }
+    if (chan->tx_sdu)
+    {
+        return BLE_HS_EBUSY;
+    }
+    uint16_t len = OS_MBUF_PKTLEN(sdu_tx);
+    if (mock_nimble.coc_tx_len + len <= sizeof(mock_nimble.coc_tx))
+    {
+        os_mbuf_copydata(sdu_tx, 0, len, &mock_nimble.coc_tx[mock_nimble.coc_tx_len]);
+        mock_nimble.coc_tx_len += len;
+    }
+    mock_nimble.coc_sdus_sent++;
+    if (mock_nimble.coc_tx_credits <= 0)
+    {
+        chan->tx_sdu = sdu_tx;
+        return BLE_HS_ESTALLED;
+    }
+    mock_nimble.coc_tx_credits--;
+    os_mbuf_free_chain(sdu_tx);
+    return 0;
+}
+int ble_l2cap_recv_ready(struct ble_l2cap_chan *chan, struct os_mbuf *sdu_rx)
+{
+    if (chan->rx_sdu)
+    {
+        return BLE_HS_EBUSY;
+    }
+    mock_nimble.coc_recv_ready_calls++;
+    chan->rx_sdu = sdu_rx;
+    return 0;
+}
+int ble_l2cap_disconnect(struct ble_l2cap_chan *chan)
+{
+    struct ble_l2cap_event event = {.type = BLE_L2CAP_EVENT_COC_DISCONNECTED};
+    event.disconnect.conn_handle = chan->conn_handle;
+    event.disconnect.chan = chan;
+    mock_l2cap_cb(&event, mock_l2cap_arg);
+    mock_chan_free(chan);
+    return 0;
+}
+int ble_l2cap_get_chan_info(struct ble_l2cap_chan *chan, struct ble_l2cap_chan_info *chan_info)
+{
+    memset(chan_info, 0, sizeof(*chan_info));
+    chan_info->psm = mock_nimble.coc_psm;
+    chan_info->our_coc_mtu = mock_nimble.coc_mtu;
+    chan_info->peer_coc_mtu = chan->peer_mtu;
+    return 0;
+}
+int ble_gap_wl_set(const ble_addr_t *addrs, uint8_t white_list_count)
+{
+    if (white_list_count > 8)
+    {
+        return BLE_HS_ENOMEM;
+    }
+    memcpy(mock_nimble.accept_list, addrs, white_list_count * sizeof(ble_addr_t));
+    mock_nimble.accept_list_count = white_list_count;
+    return 0;
+}
+int ble_gap_adv_stop(void)
+{
+    if (!mock_nimble.adv_active)
+    {
+        return BLE_HS_EALREADY;
+    }
+    mock_nimble.adv_active = false;
+    return 0;
+}
+int ble_gap_adv_active(void) { return mock_nimble.adv_active; }
+int ble_gap_adv_set_fields(const struct ble_hs_adv_fields *f) { mock_nimble.adv_set_fields_calls++; return 0; }
+int ble_gap_adv_rsp_set_fields(const struct ble_hs_adv_fields *f) { mock_nimble.adv_set_fields_calls++; return 0; }
+
+/* Host */
+int ble_store_util_status_rr(struct ble_store_status_event *event, void *arg) { return 0; }
+int ble_store_util_bonded_peers(ble_addr_t *out_peer_id_addrs, int *out_num_peers, int max_peers)
+{
+    mock_nimble.bond_reads++;
+    *out_num_peers = mock_nimble.bond_count < max_peers ? mock_nimble.bond_count : max_peers;
+    memcpy(out_peer_id_addrs, mock_nimble.bonds, *out_num_peers * sizeof(ble_addr_t));
+    return 0;
+}
+int ble_hs_id_gen_rnd(int nrpa, ble_addr_t *out_addr) { return 0; }
+int ble_hs_id_set_rnd(const uint8_t *rnd_addr) { return 0; }
+int ble_hs_id_infer_auto(int privacy, uint8_t *out_addr_type) { *out_addr_type = 0; return 0; }
+int ble_hs_id_copy_addr(uint8_t id_addr_type, uint8_t *out_id_addr, int *out_is_nrpa) { memset(out_id_addr, 0xAA, 6); return 0; }
+int ble_hs_util_ensure_addr(int prefer_random) { return mock_nimble.ensure_addr_rc; }
+
+/* Stopping the host terminates every connection before the stop completes. */
+static void mock_nimble_disconnect_all(void)
+{
+    while (mock_conn_count > 0)
+    {
+        mock_script_disconnect(mock_conns[0].conn_handle, BLE_HS_HCI_ERR(BLE_ERR_CONN_TERM_LOCAL));
+    }
+}
+int ble_hs_start(void)
+{
+    mock_nimble.hs_starts++;
+    return 0;
+}
+int ble_hs_stop(struct ble_hs_stop_listener *listener, ble_hs_stop_fn *fn, void *arg)
+{
+    mock_nimble.hs_stops++;
+    mock_nimble_disconnect_all();
+    fn(0, arg);
+    return 0;
+}
+void ble_svc_gap_init(void) {}
+const char *ble_svc_gap_device_name(void) { return "mock"; }
+int ble_svc_gap_device_name_set(const char *name) { return 0; }
+int ble_svc_gap_device_appearance_set(uint16_t appearance) { return 0; }
+void ble_svc_gatt_init(void) {}
+void ble_svc_ans_init(void) {}
+void ble_store_config_init(void) {}
+esp_err_t nimble_port_init(void)
+{
+    mock_nimble.port_inits++;
+    return 0;
+}
+int nimble_port_deinit(void)
+{
+    mock_nimble.port_inits--;
+    return 0;
+}
+void nimble_port_run(void) {}
+int nimble_port_stop(void)
+{
+    mock_nimble_disconnect_all();
+    return 0;
+}
+
+static void (*mock_host_task)(void *);
+void nimble_port_freertos_init(TaskFunction_t_ host_task_fn) { mock_host_task = host_task_fn; }
+void nimble_port_freertos_deinit(void) {}
+void mock_nimble_sync(void) { ble_hs_cfg.sync_cb(); }
+
+/* NPL */
+#define MOCK_EVQ_LEN 64
+static struct ble_npl_event *mock_evq[MOCK_EVQ_LEN];
+static int mock_evq_head, mock_evq_count;
+static struct ble_npl_eventq mock_dflt_evq;
+static struct ble_npl_callout *mock_callouts[32];
+static int mock_callout_count;
+static ble_npl_time_t mock_now;
+
+/* On the target the NPL objects live in memory that nimble_port_deinit() frees. */
+static void mock_npl_check(void)
+{
+    if (mock_nimble.port_inits <= 0)
+    {
+        mock_nimble.npl_calls_unported++;
+    }
+}
+
+struct ble_npl_eventq *nimble_port_get_dflt_eventq(void) { return &mock_dflt_evq; }
+static void mock_npl_event_set(struct ble_npl_event *ev, ble_npl_event_fn *fn, void *arg)
+{
+    ev->queued = false;
+    ev->fn = fn;
+    ev->arg = arg;
+}
+void ble_npl_event_init(struct ble_npl_event *ev, ble_npl_event_fn *fn, void *arg)
+{
+    mock_npl_check();
+    mock_nimble.npl_live++;
+    mock_npl_event_set(ev, fn, arg);
+}
+void ble_npl_event_deinit(struct ble_npl_event *ev)
+{
+    mock_npl_check();
+    mock_nimble.npl_live--;
+}
+void *ble_npl_event_get_arg(struct ble_npl_event *ev) { return ev->arg; }
+void ble_npl_eventq_put(struct ble_npl_eventq *evq, struct ble_npl_event *ev)
+{
+    mock_npl_check();
+    if (ev->queued || mock_evq_count == MOCK_EVQ_LEN)
+    {
+        return;
+    }
+    ev->queued = true;
+    mock_evq[(mock_evq_head + mock_evq_count++) % MOCK_EVQ_LEN] = ev;
+}
+void ble_npl_eventq_remove(struct ble_npl_eventq *evq, struct ble_npl_event *ev)
+{
+    mock_npl_check();
+    for (int i = 0; i < mock_evq_count; i++)
+    {
+        int idx = (mock_evq_head + i) % MOCK_EVQ_LEN;
+        if (mock_evq[idx] == ev)
+        {
+            for (int j = i; j < mock_evq_count - 1; j++)
+            {
+                mock_evq[(mock_evq_head + j) % MOCK_EVQ_LEN] = mock_evq[(mock_evq_head + j + 1) % MOCK_EVQ_LEN];
+            }
+            mock_evq_count--;
+            ev->queued = false;
+            return;
+        }
+    }
+}
+int mock_nimble_run_events(void)
+{
+    int ran = 0;
+    while (mock_evq_count > 0)
+    {
+        struct ble_npl_event *ev = mock_evq[mock_evq_head];
+        mock_evq_head = (mock_evq_head + 1) % MOCK_EVQ_LEN;
+        mock_evq_count--;
+        ev->queued = false;
+        ev->fn(ev);
+        ran++;
+    }
+    return ran;
+}
+void ble_npl_callout_init(struct ble_npl_callout *co, struct ble_npl_eventq *evq, ble_npl_event_fn *ev_cb, void *ev_arg)
+{
+    mock_npl_check();
+    mock_nimble.npl_live++;
+    memset(co, 0, sizeof(*co));
+    mock_npl_event_set(&co->ev, ev_cb, ev_arg);
+    for (int i = 0; i < mock_callout_count; i++)
+    {
+        if (mock_callouts[i] == co)
+        {
+            return;
+        }
+    }
+    mock_callouts[mock_callout_count++] = co;
+}
+void ble_npl_callout_deinit(struct ble_npl_callout *co)
+{
+    mock_npl_check();
+    mock_nimble.npl_live--;
+    for (int i = 0; i < mock_callout_count; i++)
+    {
+        if (mock_callouts[i] == co)
+        {
+            mock_callouts[i] = mock_callouts[--mock_callout_count];
+            break;
+        }
+    }
+}
+int ble_npl_callout_reset(struct ble_npl_callout *co, ble_npl_time_t ticks)
+{
+    mock_npl_check();
+    co->active = true;
+    co->expiry = mock_now + ticks;
+    return 0;
+}
+void ble_npl_callout_stop(struct ble_npl_callout *co)
+{
+    mock_npl_check();
+    co->active = false;
+}
+bool ble_npl_callout_is_active(struct ble_npl_callout *co) { return co->active; }
+int ble_npl_time_ms_to_ticks(uint32_t ms, ble_npl_time_t *out_ticks)
+{
+    *out_ticks = ms;
+    return 0;
+}
+ble_npl_time_t ble_npl_time_ms_to_ticks32(uint32_t ms) { return ms; }
+ble_npl_time_t ble_npl_time_get(void) { return mock_now; }
+void mock_nimble_advance(uint32_t ms)
+{
+    for (uint32_t t = 0; t < ms; t++)
+    {
+        mock_now++;
+        for (int i = 0; i < mock_callout_count; i++)
+        {
+            struct ble_npl_callout *co = mock_callouts[i];
+            if (co->active && (int32_t)(mock_now - co->expiry) >= 0)
+            {
+                co->active = false;
+                ble_npl_eventq_put(&mock_dflt_evq, &co->ev);
+            }
+        }
+        mock_nimble_run_events();
+    }
+}
+
+/* FreeRTOS */
+TickType_t xTaskGetTickCount(void) { return mock_now; }
+void vTaskDelay(TickType_t ticks) { mock_nimble_advance(ticks); }
+EventGroupHandle_t xEventGroupCreate(void) { return calloc(1, sizeof(struct mock_event_group)); }
+EventGroupHandle_t xEventGroupCreateStatic(StaticEventGroup_t *buffer)
+{
+    buffer->bits = 0;
+    return buffer;
+}
+void vEventGroupDelete(EventGroupHandle_t group) {}
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) { return __atomic_or_fetch(&group->bits, bits, __ATOMIC_SEQ_CST); }
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) { return __atomic_fetch_and(&group->bits, ~bits, __ATOMIC_SEQ_CST); }
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) { return __atomic_load_n(&group->bits, __ATOMIC_SEQ_CST); }
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit, BaseType_t wait_all, TickType_t ticks)
+{
+    /* Single-threaded host: run the simulated host task until the bits show up or the timeout elapses. */
+    for (TickType_t t = 0;; t++)
+    {
+        mock_nimble_run_events();
+        EventBits_t cur = xEventGroupGetBits(group);
+        bool ok = wait_all ? ((cur & bits) == bits) : ((cur & bits) != 0);
+        if (ok || t >= ticks)
+        {
+            if (ok && clear_on_exit)
+            {
+                xEventGroupClearBits(group, bits);
+            }
+            return cur;
+        }
+        mock_nimble_advance(1);
+        if (t % 64 == 63)
+        {
+            sched_yield();
+        }
+    }
+}
+
+/* Tasks created by the component run on real threads with a blocking notification count; the test's main thread keeps the old counter. */
+typedef struct
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notify_count;
+    TaskFunction_t fn;
+    void *arg;
+} mock_task_t;
+
+static __thread mock_task_t *mock_current_task;
+static uint32_t mock_task_notify_count;
+
+static void *mock_task_main(void *param)
+{
+    mock_current_task = param;
+    mock_current_task->fn(mock_current_task->arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack, void *arg, UBaseType_t prio, TaskHandle_t *out, BaseType_t core)
+{
+    mock_task_t *task = calloc(1, sizeof(*task));
+    if (!task)
+    {
+        return pdFAIL;
+    }
+    pthread_mutex_init(&task->lock, NULL);
+    pthread_cond_init(&task->cond, NULL);
+    task->fn = fn;
+    task->arg = arg;
+    mock_nimble.task_creates++;
+    mock_nimble.task_priority = prio;
+    mock_nimble.task_stack = stack;
+    mock_nimble.task_core = core;
+    if (out)
+    {
+        *out = task;
+    }
+    if (pthread_create(&task->thread, NULL, mock_task_main, task) != 0)
+    {
+        pthread_cond_destroy(&task->cond);
+        pthread_mutex_destroy(&task->lock);
+        free(task);
+        return pdFAIL;
+    }
+    pthread_detach(task->thread);
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t handle)
+{
+    mock_task_t *task = handle ? handle : mock_current_task;
+    if (!task || task != mock_current_task)
+    {
+        return;
+    }
+    pthread_cond_destroy(&task->cond);
+    pthread_mutex_destroy(&task->lock);
+    free(task);
+    mock_current_task = NULL;
+    pthread_exit(NULL);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) { return mock_current_task ? (TaskHandle_t)mock_current_task : (TaskHandle_t)&mock_task_notify_count; }
+BaseType_t xTaskNotifyGive(TaskHandle_t handle)
+{
+    if (handle == (TaskHandle_t)&mock_task_notify_count || !handle)
+    {
+        mock_task_notify_count++;
+        return pdTRUE;
+    }
+    mock_task_t *task = handle;
+    pthread_mutex_lock(&task->lock);
+    task->notify_count++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return pdTRUE;
+}
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    mock_task_t *task = mock_current_task;
+    if (!task)
+    {
+        uint32_t count = mock_task_notify_count;
+        if (clear_on_exit)
+        {
+            mock_task_notify_count = 0;
+        }
+        else if (count)
+        {
+            mock_task_notify_count--;
+        }
+        return count;
+    }
+
+    /* One tick is a millisecond of wall time here, since the simulated clock belongs to the main thread. */
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    if (ticks != portMAX_DELAY)
+    {
+        deadline.tv_sec += ticks / 1000;
+        deadline.tv_nsec += (long)(ticks % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+    pthread_mutex_lock(&task->lock);
+    while (task->notify_count == 0 && ticks > 0)
+    {
+        if (ticks == portMAX_DELAY)
+        {
+            pthread_cond_wait(&task->cond, &task->lock);
+        }
+        else if (pthread_cond_timedwait(&task->cond, &task->lock, &deadline) != 0)
+        {
+            break;
+        }
+    }
+    uint32_t count = task->notify_count;
+    if (clear_on_exit)
+    {
+        task->notify_count = 0;
+    }
+    else if (count)
+    {
+        task->notify_count--;
+    }
+    pthread_mutex_unlock(&task->lock);
+    return count;
+}
+
+int ble_gap_update_params(uint16_t conn_handle, const struct ble_gap_upd_params *params)
+{
+    mock_nimble.conn_update_requests++;
+    mock_nimble.last_upd_params = *params;
+    return 0;
+}
+int ble_gap_set_prefered_le_phy(uint16_t conn_handle, uint8_t tx_phys_mask, uint8_t rx_phys_mask, uint16_t phy_opts)
+{
+    mock_nimble.phy_requests++;
+    return 0;
+}
+int ble_gap_set_data_len(uint16_t conn_handle, uint16_t tx_octets, uint16_t tx_time)
+{
+    mock_nimble.data_len_requests++;
+    return 0;
+}
+
+/* Advertising */
+static int mock_ad_put(uint8_t *dst, uint8_t *len, uint8_t max, uint8_t type, const void *data, uint8_t data_len)
+{
+    if (*len + 2 + data_len > max)
+    {
+        return BLE_HS_EMSGSIZE;
+    }
+    dst[*len] = data_len + 1;
+    dst[*len + 1] = type;
+    memcpy(dst + *len + 2, data, data_len);
+    *len += 2 + data_len;
+    return 0;
+}
+
+int ble_hs_adv_set_fields(const struct ble_hs_adv_fields *f, uint8_t *dst, uint8_t *dst_len, uint8_t max_len)
+{
+    uint8_t len = 0;
+    int rc = 0;
+    if (f->flags)
+    {
+        rc |= mock_ad_put(dst, &len, max_len, 0x01, &f->flags, 1);
+    }
+    if (f->name)
+    {
+        rc |= mock_ad_put(dst, &len, max_len, f->name_is_complete ? 0x09 : 0x08, f->name, f->name_len);
+    }
+    if (f->tx_pwr_lvl_is_present)
+    {
+        int8_t power = f->tx_pwr_lvl == BLE_HS_ADV_TX_PWR_LVL_AUTO ? 0 : f->tx_pwr_lvl;
+        rc |= mock_ad_put(dst, &len, max_len, 0x0a, &power, 1);
+    }
+    if (f->svc_data_uuid16)
+    {
+        rc |= mock_ad_put(dst, &len, max_len, 0x16, f->svc_data_uuid16, f->svc_data_uuid16_len);
+    }
+    if (f->appearance_is_present)
+    {
+        rc |= mock_ad_put(dst, &len, max_len, 0x19, &f->appearance, 2);
+    }
+    if (f->device_addr_is_present)
+    {
+        uint8_t addr[7];
+        memcpy(addr, f->device_addr, 6);
+        addr[6] = f->device_addr_type;
+        rc |= mock_ad_put(dst, &len, max_len, 0x1b, addr, 7);
+    }
+    if (f->le_role_is_present)
+    {
+        rc |= mock_ad_put(dst, &len, max_len, 0x1c, &f->le_role, 1);
+    }
+    if (f->uri)
+    {
+        rc |= mock_ad_put(dst, &len, max_len, 0x24, f->uri, f->uri_len);
+    }
+    if (f->mfg_data)
+    {
+        rc |= mock_ad_put(dst, &len, max_len, 0xff, f->mfg_data, f->mfg_data_len);
+    }
+    if (rc)
+    {
+        return BLE_HS_EMSGSIZE;
+    }
+    *dst_len = len;
+    return 0;
+}
+
+int ble_hs_adv_set_fields_mbuf(const struct ble_hs_adv_fields *f, struct os_mbuf *om)
+{
+    uint8_t buf[255];
+    uint8_t len;
+    int rc = ble_hs_adv_set_fields(f, buf, &len, sizeof(buf));
+    return rc ? rc : os_mbuf_append(om, buf, len);
+}
+
+int ble_gap_adv_set_data(const uint8_t *data, int data_len)
+{
+    mock_nimble.adv_set_data_calls++;
+    memcpy(mock_nimble.adv_data, data, data_len);
+    mock_nimble.adv_data_len = data_len;
+    return 0;
+}
+int ble_gap_adv_rsp_set_data(const uint8_t *data, int data_len) { mock_nimble.adv_set_data_calls++; return 0; }
+
+int ble_gap_ext_adv_configure(uint8_t instance, const struct ble_gap_ext_adv_params *params, int8_t *selected_tx_power, ble_gap_event_fn *cb, void *cb_arg)
+{
+    if (instance > MYNEWT_VAL(BLE_MULTI_ADV_INSTANCES))
+    {
+        return BLE_HS_EINVAL;
+    }
+    if (mock_nimble.ext_adv[instance].active)
+    {
+        return BLE_HS_EBUSY;
+    }
+    mock_nimble.ext_adv[instance].configured = true;
+    mock_nimble.ext_adv[instance].params = *params;
+    mock_gap_cb = cb;
+    mock_gap_arg = cb_arg;
+    return 0;
+}
+int ble_gap_ext_adv_set_data(uint8_t instance, struct os_mbuf *data)
+{
+    mock_nimble.ext_adv[instance].data_len = OS_MBUF_PKTLEN(data);
+    if (OS_MBUF_PKTLEN(data) <= sizeof(mock_nimble.adv_data))
+    {
+        os_mbuf_copydata(data, 0, OS_MBUF_PKTLEN(data), mock_nimble.adv_data);
+        mock_nimble.adv_data_len = OS_MBUF_PKTLEN(data);
+    }
+    mock_nimble.adv_set_data_calls++;
+    os_mbuf_free_chain(data);
+    return 0;
+}
+int ble_gap_ext_adv_rsp_set_data(uint8_t instance, struct os_mbuf *data)
+{
+    mock_nimble.ext_adv[instance].rsp_len = OS_MBUF_PKTLEN(data);
+    os_mbuf_free_chain(data);
+    return 0;
+}
+int ble_gap_ext_adv_start(uint8_t instance, int duration, int max_events)
+{
+    if (!mock_nimble.ext_adv[instance].configured)
+    {
+        return BLE_HS_EINVAL;
+    }
+    if (mock_nimble.ext_adv[instance].active)
+    {
+        return BLE_HS_EALREADY;
+    }
+    mock_nimble.ext_adv[instance].active = true;
+    mock_nimble.ext_adv[instance].starts++;
+    mock_nimble.adv_start_calls++;
+    return 0;
+}
+int ble_gap_ext_adv_stop(uint8_t instance)
+{
+    if (!mock_nimble.ext_adv[instance].active)
+    {
+        return BLE_HS_EALREADY;
+    }
+    mock_nimble.ext_adv[instance].active = false;
+    return 0;
+}
+int ble_gap_ext_adv_remove(uint8_t instance) { mock_nimble.ext_adv[instance].configured = false; return 0; }
+int ble_gap_ext_adv_active(uint8_t instance) { return mock_nimble.ext_adv[instance].active; }
+
+/* ESP timer: the simulated clock advances one millisecond per NPL tick. */
+int64_t esp_timer_get_time(void)
+{
+    return (int64_t)mock_now * 1000;
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include "host/ble_hs.h"
+
+#define MOCK_MAX_SENT 256
+
+typedef struct
+{
+    uint16_t conn_handle;
+    uint16_t attr_handle;
+    uint16_t len;
+    uint8_t data[BLE_ATT_ATTR_MAX_LEN];
+    bool indication;
+} mock_sent_t;
+
+typedef struct
+{
+    uint32_t mbuf_allocs;
+    uint32_t mbuf_frees;
+    uint32_t mbuf_live;
+    uint32_t notify_calls;
+    uint32_t notify_multiple_calls;
+    uint8_t peer_cl_sup_feat[8]; /* Client Supported Features byte 0 of each peer, by conn_handle % 8 */
+    uint32_t sent_count;
+    int notify_rc;
+    bool defer_notify_tx;
+    uint32_t phy_requests;
+    uint32_t data_len_requests;
+    uint32_t conn_update_requests;
+    struct ble_gap_upd_params last_upd_params;
+    uint32_t adv_set_fields_calls;
+    uint32_t adv_set_data_calls;
+    uint32_t adv_start_calls;
+    bool adv_active;
+    struct
+    {
+        bool directed;
+        ble_addr_t direct_addr;
+        int32_t duration_ms;
+        struct ble_gap_adv_params params;
+    } last_adv;
+    ble_addr_t accept_list[8];
+    uint8_t accept_list_count;
+    ble_addr_t bonds[8];
+    int bond_count;
+    uint32_t bond_reads;
+    int ensure_addr_rc;
+    int port_inits;
+    int npl_live;                /* Events and callouts initialised and not yet deinitialised */
+    uint32_t npl_calls_unported; /* NPL calls made while nimble_port_init() was not in effect */
+    uint32_t hs_starts;
+    uint32_t hs_stops;
+    bool disc_active;
+    struct ble_gap_disc_params disc_params;
+    uint16_t coc_psm;
+    uint16_t coc_mtu;
+    int coc_tx_credits; /* SDUs the peer accepts before ble_l2cap_send() stalls */
+    uint32_t coc_sdus_sent;
+    uint32_t coc_recv_ready_calls;
+    uint32_t coc_tx_len;
+    uint8_t coc_tx[4096];
+    uint32_t task_creates;
+    uint32_t task_priority;
+    uint32_t task_stack;
+    int task_core;
+    uint8_t adv_data[MYNEWT_VAL_BLE_EXT_ADV_MAX_SIZE];
+    uint16_t adv_data_len;
+    struct
+    {
+        bool configured;
+        bool active;
+        struct ble_gap_ext_adv_params params;
+        uint16_t data_len;
+        uint16_t rsp_len;
+        uint32_t starts;
+    } ext_adv[8];
+    mock_sent_t sent[MOCK_MAX_SENT];
+} mock_nimble_t;
+
+extern mock_nimble_t mock_nimble;
+
+void mock_nimble_reset(void);
+void mock_nimble_add_conn(uint16_t conn_handle, uint8_t addr_last);
+void mock_nimble_remove_conn(uint16_t conn_handle);
+void mock_nimble_set_bonded(uint16_t conn_handle);
+int mock_nimble_disc_report(const ble_addr_t *addr, int8_t rssi, uint8_t event_type, const uint8_t *data, uint8_t len);
+int mock_nimble_coc_connect(uint16_t conn_handle, uint16_t peer_mtu);
+int mock_nimble_coc_receive(uint16_t conn_handle, const void *data, uint16_t len);
+void mock_nimble_coc_credits(uint16_t conn_handle, int sdus);
+bool mock_nimble_coc_open(uint16_t conn_handle);
+ble_gap_event_fn *mock_nimble_gap_cb(void);
+int mock_nimble_gap_event(struct ble_gap_event *event);
+void mock_nimble_sync(void);
+int mock_nimble_run_events(void);
+void mock_nimble_advance(uint32_t ms);
+int mock_nimble_complete_tx(int max);
@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_nimble_api.h"
+#include "mock_nimble.h"
+#include "mock_script.h"
+
+#define MOCK_SCRIPT_MAX_ARGS 4
+#define MOCK_SCRIPT_MAX_LINE 128
+#define MOCK_SCRIPT_MAX_CCCDS 256
+
+/* CCCD values as last written by each peer, so subscribe events carry the real previous state. */
+typedef struct
+{
+    uint16_t conn_handle;
+    uint16_t attr_handle;
+    bool notify;
+    bool indicate;
+} mock_script_cccd_t;
+
+static mock_script_cccd_t mock_script_cccds[MOCK_SCRIPT_MAX_CCCDS];
+static int mock_script_cccd_count;
+
+static mock_script_cccd_t *mock_script_cccd(uint16_t conn_handle, uint16_t attr_handle)
+{
+    for (int i = 0; i < mock_script_cccd_count; i++)
+    {
+        if (mock_script_cccds[i].conn_handle == conn_handle && mock_script_cccds[i].attr_handle == attr_handle)
+        {
+            return &mock_script_cccds[i];
+        }
+    }
+    if (mock_script_cccd_count == MOCK_SCRIPT_MAX_CCCDS)
+    {
+        return NULL;
+    }
+    mock_script_cccd_t *cccd = &mock_script_cccds[mock_script_cccd_count++];
+    cccd->conn_handle = conn_handle;
+    cccd->attr_handle = attr_handle;
+    cccd->notify = false;
+    cccd->indicate = false;
+    return cccd;
+}
+
+void mock_script_connect(uint16_t conn_handle)
+{
+    /* Legacy advertising ends when a central connects. */
+    mock_nimble_add_conn(conn_handle, (uint8_t)conn_handle);
+    mock_nimble.adv_active = false;
+    struct ble_gap_event event = {.type = BLE_GAP_EVENT_CONNECT};
+    event.connect.conn_handle = conn_handle;
+    mock_nimble_gap_event(&event);
+}
+
+void mock_script_disconnect(uint16_t conn_handle, int reason)
+{
+    struct ble_gap_event event = {.type = BLE_GAP_EVENT_DISCONNECT};
+    event.disconnect.conn.conn_handle = conn_handle;
+    event.disconnect.reason = reason;
+    for (int i = 0; i < mock_script_cccd_count;)
+    {
+        if (mock_script_cccds[i].conn_handle == conn_handle)
+        {
+            mock_script_cccds[i] = mock_script_cccds[--mock_script_cccd_count];
+        }
+        else
+        {
+            i++;
+        }
+    }
+    mock_nimble_remove_conn(conn_handle);
+    mock_nimble_gap_event(&event);
+}
+
+void mock_script_subscribe(uint16_t conn_handle, uint16_t attr_handle, bool notify, bool indicate)
+{
+    struct ble_gap_event event = {.type = BLE_GAP_EVENT_SUBSCRIBE};
+    event.subscribe.conn_handle = conn_handle;
+    event.subscribe.attr_handle = attr_handle;
+    event.subscribe.cur_notify = notify;
+    event.subscribe.cur_indicate = indicate;
+    mock_script_cccd_t *cccd = mock_script_cccd(conn_handle, attr_handle);
+    if (cccd)
+    {
+        event.subscribe.prev_notify = cccd->notify;
+        event.subscribe.prev_indicate = cccd->indicate;
+        cccd->notify = notify;
+        cccd->indicate = indicate;
+    }
+    mock_nimble_gap_event(&event);
+}
+
+void mock_script_mtu(uint16_t conn_handle, uint16_t mtu)
+{
+    struct ble_gap_event event = {.type = BLE_GAP_EVENT_MTU};
+    event.mtu.conn_handle = conn_handle;
+    event.mtu.channel_id = BLE_L2CAP_CID_ATT;
+    event.mtu.value = mtu;
+    mock_nimble_gap_event(&event);
+}
+
+static int mock_script_conn_count(void)
+{
+    int count = 0;
+    for (uint16_t conn_handle = 0; conn_handle < CONN_HANDLE_MAP_SIZE; conn_handle++)
+    {
+        if (ble_gap_conn_find(conn_handle, NULL) == 0)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+static long mock_script_expect_value(const char *what, bool *ok)
+{
+    *ok = true;
+    if (strcmp(what, "sent") == 0)
+    {
+        return mock_nimble.sent_count;
+    }
+    if (strcmp(what, "live") == 0)
+    {
+        return mock_nimble.mbuf_live;
+    }
+    if (strcmp(what, "allocs") == 0)
+    {
+        return mock_nimble.mbuf_allocs;
+    }
+    if (strcmp(what, "conns") == 0)
+    {
+        return mock_script_conn_count();
+    }
+    *ok = false;
+    return 0;
+}
+
+static int mock_script_line(char *argv[], int argc)
+{
+    static uint8_t payload[BLE_ATT_ATTR_MAX_LEN];
+    long arg[MOCK_SCRIPT_MAX_ARGS] = {0};
+    for (int i = 1; i < argc; i++)
+    {
+        arg[i] = strtol(argv[i], NULL, 0);
+    }
+
+    if (strcmp(argv[0], "connect") == 0 && argc == 2)
+    {
+        mock_script_connect(arg[1]);
+    }
+    else if (strcmp(argv[0], "disconnect") == 0 && argc >= 2)
+    {
+        mock_script_disconnect(arg[1], arg[2]);
+    }
+    else if (strcmp(argv[0], "subscribe") == 0 && argc == 4)
+    {
+        mock_script_subscribe(arg[1], arg[2], strcmp(argv[3], "notify") == 0, strcmp(argv[3], "indicate") == 0);
+    }
+    else if (strcmp(argv[0], "mtu") == 0 && argc == 3)
+    {
+        mock_script_mtu(arg[1], arg[2]);
+    }
+    else if (strcmp(argv[0], "notify") == 0 && argc >= 3)
+    {
+        if (arg[2] > (long)sizeof(payload))
+        {
+            printf("payload of %ld bytes is too large\n", arg[2]);
+            return -1;
+        }
+        for (long i = 0; i < arg[2]; i++)
+        {
+            payload[i] = (uint8_t)i;
+        }
+        esp_err_t err = nimble_peripheral_notify(arg[1], payload, arg[2]);
+        if (err != (argc == 4 ? arg[3] : ESP_OK))
+        {
+            printf("notify returned 0x%x\n", err);
+            return -1;
+        }
+    }
+    else if (strcmp(argv[0], "run") == 0 && argc == 1)
+    {
+        mock_nimble_run_events();
+    }
+    else if (strcmp(argv[0], "advance") == 0 && argc == 2)
+    {
+        mock_nimble_advance(arg[1]);
+    }
+    else if (strcmp(argv[0], "defer") == 0 && argc == 2)
+    {
+        mock_nimble.defer_notify_tx = strcmp(argv[1], "on") == 0;
+    }
+    else if (strcmp(argv[0], "complete") == 0 && argc == 2)
+    {
+        mock_nimble_complete_tx(arg[1]);
+    }
+    else if (strcmp(argv[0], "rc") == 0 && argc == 2)
+    {
+        mock_nimble.notify_rc = arg[1];
+    }
+    else if (strcmp(argv[0], "expect") == 0 && argc == 3)
+    {
+        bool ok;
+        long value = mock_script_expect_value(argv[1], &ok);
+        if (!ok)
+        {
+            printf("unknown counter '%s'\n", argv[1]);
+            return -1;
+        }
+        if (value != arg[2])
+        {
+            printf("expected %s == %ld, got %ld\n", argv[1], arg[2], value);
+            return -1;
+        }
+    }
+    else
+    {
+        printf("unknown command '%s' with %d arguments\n", argv[0], argc - 1);
+        return -1;
+    }
+    return 0;
+}
+
+int mock_script_run(const char *script)
+{
+    int line_number = 0;
+    while (*script)
+    {
+        char line[MOCK_SCRIPT_MAX_LINE];
+        size_t len = strcspn(script, "\n");
+        line_number++;
+        if (len >= sizeof(line))
+        {
+            printf("script line %d: too long\n", line_number);
+            return line_number;
+        }
+        memcpy(line, script, len);
+        line[len] = '\0';
+        script += len + (script[len] == '\n');
+
+        char *comment = strchr(line, '#');
+        if (comment)
+        {
+            *comment = '\0';
+        }
+
+        char *argv[MOCK_SCRIPT_MAX_ARGS];
+        int argc = 0;
+        for (char *token = strtok(line, " \t"); token; token = strtok(NULL, " \t"))
+        {
+            if (argc == MOCK_SCRIPT_MAX_ARGS)
+            {
+                printf("script line %d: too many arguments\n", line_number);
+                return line_number;
+            }
+            argv[argc++] = token;
+        }
+        if (argc == 0)
+        {
+            continue;
+        }
+        if (mock_script_line(argv, argc) != 0)
+        {
+            printf("script line %d: '%s' failed\n", line_number, argv[0]);
+            return line_number;
+        }
+    }
+    return 0;
+}
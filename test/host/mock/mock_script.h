@@ -0,0 +1,22 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+/* GAP event helpers shared by the tests and the benchmarks. */
+void mock_script_connect(uint16_t conn_handle);
+void mock_script_disconnect(uint16_t conn_handle, int reason);
+void mock_script_subscribe(uint16_t conn_handle, uint16_t attr_handle, bool notify, bool indicate);
+void mock_script_mtu(uint16_t conn_handle, uint16_t mtu);
+
+/* Runs a newline separated event script, one command per line, '#' starts a comment:
+ *
+ *   connect <conn_handle>                      disconnect <conn_handle> [reason]
+ *   subscribe <conn_handle> <attr> notify|indicate|off
+ *   mtu <conn_handle> <mtu>                    notify <attr> <len> [expected esp_err_t]
+ *   run                                        advance <ms>
+ *   defer on|off                               complete <count>
+ *   rc <ble_hs error returned by sends>
+ *   expect sent|live|allocs|conns <value>
+ *
+ * Returns 0 on success, otherwise the failing line number after printing the reason. */
+int mock_script_run(const char *script);
@@ -0,0 +1,37 @@
+#pragma once
+#include <stdio.h>
+#include "sdkconfig.h"
+
+/* Host stand-in for esp_log: printf with a single runtime level so benchmarks can mute the component. */
+typedef enum
+{
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+extern esp_log_level_t mock_log_level;
+
+static inline void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    (void)tag;
+    mock_log_level = level;
+}
+
+#define ESP_LOG_LEVEL_PRINT(level, letter, tag, fmt, ...)            \
+    do                                                               \
+    {                                                                \
+        if (mock_log_level >= (level))                               \
+        {                                                            \
+            printf(letter " %s: " fmt "\n", tag, ##__VA_ARGS__);     \
+        }                                                            \
+    } while (0)
+
+#define ESP_LOGE(tag, fmt, ...) ESP_LOG_LEVEL_PRINT(ESP_LOG_ERROR, "E", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) ESP_LOG_LEVEL_PRINT(ESP_LOG_WARN, "W", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) ESP_LOG_LEVEL_PRINT(ESP_LOG_INFO, "I", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) ESP_LOG_LEVEL_PRINT(ESP_LOG_DEBUG, "D", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGV(tag, fmt, ...) ESP_LOG_LEVEL_PRINT(ESP_LOG_VERBOSE, "V", tag, fmt, ##__VA_ARGS__)
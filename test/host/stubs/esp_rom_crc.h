@@ -0,0 +1,17 @@
+#pragma once
+#include <stdint.h>
+
+/* Bitwise CRC-32 (IEEE), same results as the ROM routine: crc is the previous result, 0 to start. */
+static inline uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len)
+{
+    crc = ~crc;
+    while (len--)
+    {
+        crc ^= *buf++;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xedb88320u & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
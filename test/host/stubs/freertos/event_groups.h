@@ -0,0 +1,15 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+typedef uint32_t EventBits_t;
+typedef struct mock_event_group *EventGroupHandle_t;
+typedef struct mock_event_group
+{
+    EventBits_t bits;
+} StaticEventGroup_t;
+EventGroupHandle_t xEventGroupCreate(void);
+EventGroupHandle_t xEventGroupCreateStatic(StaticEventGroup_t *buffer);
+void vEventGroupDelete(EventGroupHandle_t group);
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group);
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit, BaseType_t wait_all, TickType_t ticks);
@@ -0,0 +1,11 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+TickType_t xTaskGetTickCount(void);
+void vTaskDelay(TickType_t ticks);
+void vTaskDelete(TaskHandle_t task);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack, void *arg, UBaseType_t prio, TaskHandle_t *out, BaseType_t core);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
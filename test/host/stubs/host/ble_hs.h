@@ -0,0 +1,705 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include "sdkconfig.h"
+#include "os/os_mbuf.h"
+#include "nimble/nimble_npl.h"
+
+#define MYNEWT_VAL(x) MYNEWT_VAL_##x
+#ifndef MYNEWT_VAL_BLE_EXT_ADV
+#define MYNEWT_VAL_BLE_EXT_ADV 0
+#endif
+#ifndef MYNEWT_VAL_BLE_MULTI_ADV_INSTANCES
+#define MYNEWT_VAL_BLE_MULTI_ADV_INSTANCES 0
+#endif
+#ifndef MYNEWT_VAL_BLE_EXT_ADV_MAX_SIZE
+#define MYNEWT_VAL_BLE_EXT_ADV_MAX_SIZE 31
+#endif
+#ifndef MYNEWT_VAL_BLE_L2CAP_COC_MAX_NUM
+#define MYNEWT_VAL_BLE_L2CAP_COC_MAX_NUM 0
+#endif
+#ifndef MYNEWT_VAL_BLE_GATT_NOTIFY_MULTIPLE
+#define MYNEWT_VAL_BLE_GATT_NOTIFY_MULTIPLE 0
+#endif
+#ifndef MYNEWT_VAL_BLE_EATT_CHAN_NUM
+#define MYNEWT_VAL_BLE_EATT_CHAN_NUM 0
+#endif
+#ifndef MYNEWT_VAL_BLE_ROLE_OBSERVER
+#define MYNEWT_VAL_BLE_ROLE_OBSERVER 1
+#endif
+
+#define BLE_HS_FOREVER INT32_MAX
+#define BLE_HS_CONN_HANDLE_NONE 0xffff
+
+#define BLE_HS_EAGAIN 1
+#define BLE_HS_EALREADY 2
+#define BLE_HS_EINVAL 3
+#define BLE_HS_EMSGSIZE 4
+#define BLE_HS_ENOENT 5
+#define BLE_HS_ENOMEM 6
+#define BLE_HS_ENOTCONN 7
+#define BLE_HS_ENOTSUP 8
+#define BLE_HS_EAPP 9
+#define BLE_HS_EBADDATA 10
+#define BLE_HS_EOS 11
+#define BLE_HS_ECONTROLLER 12
+#define BLE_HS_ETIMEOUT 13
+#define BLE_HS_EDONE 14
+#define BLE_HS_EBUSY 15
+#define BLE_HS_EREJECT 16
+#define BLE_HS_EUNKNOWN 17
+#define BLE_HS_EROLE 18
+#define BLE_HS_ETIMEOUT_HCI 19
+#define BLE_HS_ENOMEM_EVT 20
+#define BLE_HS_ENOADDR 21
+#define BLE_HS_ENOTSYNCED 22
+#define BLE_HS_EAUTHEN 23
+#define BLE_HS_EAUTHOR 24
+#define BLE_HS_EENCRYPT 25
+#define BLE_HS_EENCRYPT_KEY_SZ 26
+#define BLE_HS_ESTORE_CAP 27
+#define BLE_HS_ESTORE_FAIL 28
+#define BLE_HS_EPREEMPTED 29
+#define BLE_HS_EDISABLED 30
+#define BLE_HS_ESTALLED 31
+#define BLE_HS_ERR_ATT_BASE 0x100
+#define BLE_HS_ERR_HCI_BASE 0x200
+#define BLE_HS_HCI_ERR(x) ((x) ? BLE_HS_ERR_HCI_BASE + (x) : 0)
+
+#define BLE_ERR_REM_USER_CONN_TERM 0x13
+#define BLE_ERR_CONN_TERM_LOCAL 0x16
+#define BLE_ERR_UNSUPP_REM_FEATURE 0x1a
+#define BLE_ERR_INV_HCI_CMD_PARMS 0x12
+#define BLE_ERR_UNSUPP_LMP_LL_PARM 0x20
+#define BLE_ERR_CONN_SPVN_TMO 0x08
+
+#define BLE_ATT_ERR_INVALID_HANDLE 0x01
+#define BLE_ATT_ERR_READ_NOT_PERMITTED 0x02
+#define BLE_ATT_ERR_WRITE_NOT_PERMITTED 0x03
+#define BLE_ATT_ERR_INVALID_PDU 0x04
+#define BLE_ATT_ERR_INVALID_OFFSET 0x07
+#define BLE_ATT_ERR_ATTR_NOT_FOUND 0x0a
+#define BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN 0x0d
+#define BLE_ATT_ERR_UNLIKELY 0x0e
+#define BLE_ATT_ERR_INSUFFICIENT_RES 0x11
+#define BLE_ATT_ATTR_MAX_LEN 512
+#define BLE_ATT_MTU_DFLT 23
+#define BLE_ATT_MTU_MAX 527
+#define BLE_L2CAP_CID_ATT 4
+
+#define BLE_ADDR_PUBLIC 0x00
+#define BLE_ADDR_RANDOM 0x01
+#define BLE_OWN_ADDR_PUBLIC 0x00
+#define BLE_OWN_ADDR_RANDOM 0x01
+#define BLE_OWN_ADDR_RPA_PUBLIC_DEFAULT 0x02
+
+typedef struct
+{
+    uint8_t type;
+    uint8_t val[6];
+} ble_addr_t;
+
+static inline int ble_addr_cmp(const ble_addr_t *a, const ble_addr_t *b)
+{
+    int type_diff = a->type - b->type;
+    if (type_diff != 0)
+    {
+        return type_diff;
+    }
+    return memcmp(a->val, b->val, sizeof(a->val));
+}
+
+/* UUID */
+#define BLE_UUID_TYPE_16 16
+#define BLE_UUID_TYPE_32 32
+#define BLE_UUID_TYPE_128 128
+typedef struct
+{
+    uint8_t type;
+} ble_uuid_t;
+typedef struct
+{
+    ble_uuid_t u;
+    uint16_t value;
+} ble_uuid16_t;
+typedef struct
+{
+    ble_uuid_t u;
+    uint32_t value;
+} ble_uuid32_t;
+typedef struct
+{
+    ble_uuid_t u;
+    uint8_t value[16];
+} ble_uuid128_t;
+typedef union
+{
+    ble_uuid_t u;
+    ble_uuid16_t u16;
+    ble_uuid32_t u32;
+    ble_uuid128_t u128;
+} ble_uuid_any_t;
+#define BLE_UUID16_INIT(uuid16) {.u = {.type = BLE_UUID_TYPE_16}, .value = (uuid16)}
+#define BLE_UUID128_INIT(uuid128...) {.u = {.type = BLE_UUID_TYPE_128}, .value = {uuid128}}
+int ble_uuid_cmp(const ble_uuid_t *uuid1, const ble_uuid_t *uuid2);
+int ble_uuid_init_from_buf(ble_uuid_any_t *uuid, const void *buf, size_t len);
+
+/* HCI */
+#define BLE_HCI_DATA_HDR_SZ 4
+#define BLE_HCI_LE_PHY_1M 1
+#define BLE_HCI_LE_PHY_2M 2
+#define BLE_HCI_LE_PHY_CODED 3
+#define BLE_GAP_LE_PHY_1M_MASK 0x01
+#define BLE_GAP_LE_PHY_2M_MASK 0x02
+#define BLE_GAP_LE_PHY_CODED_MASK 0x04
+#define BLE_GAP_LE_PHY_CODED_ANY 0
+#define BLE_GAP_LE_PHY_1M 1
+#define BLE_GAP_LE_PHY_2M 2
+#define BLE_GAP_LE_PHY_CODED 3
+#define BLE_HCI_ADV_FILT_NONE 0
+#define BLE_HCI_ADV_FILT_SCAN 1
+#define BLE_HCI_ADV_FILT_CONN 2
+#define BLE_HCI_ADV_FILT_BOTH 3
+#define BLE_HCI_SCAN_FILT_NO_WL 0
+#define BLE_HCI_ADV_RPT_EVTYPE_ADV_IND 0
+#define BLE_HCI_ADV_RPT_EVTYPE_DIR_IND 1
+#define BLE_HCI_ADV_RPT_EVTYPE_SCAN_IND 2
+#define BLE_HCI_ADV_RPT_EVTYPE_NONCONN_IND 3
+#define BLE_HCI_ADV_RPT_EVTYPE_SCAN_RSP 4
+#define BLE_HCI_ADV_LEGACY_MASK (1 << 4)
+#define BLE_L2CAP_HDR_SZ 4
+
+/* Advertising data */
+#define BLE_HS_ADV_F_DISC_LTD 0x01
+#define BLE_HS_ADV_F_DISC_GEN 0x02
+#define BLE_HS_ADV_F_BREDR_UNSUP 0x04
+#define BLE_HS_ADV_TX_PWR_LVL_AUTO (-128)
+#define BLE_HS_ADV_MAX_SZ 31
+#define BLE_HS_ADV_MAX_SZ 31
+#define BLE_HS_ADV_TYPE_FLAGS 0x01
+#define BLE_HS_ADV_TYPE_INCOMP_UUIDS16 0x02
+#define BLE_HS_ADV_TYPE_COMP_UUIDS16 0x03
+#define BLE_HS_ADV_TYPE_INCOMP_UUIDS32 0x04
+#define BLE_HS_ADV_TYPE_COMP_UUIDS32 0x05
+#define BLE_HS_ADV_TYPE_INCOMP_UUIDS128 0x06
+#define BLE_HS_ADV_TYPE_COMP_UUIDS128 0x07
+#define BLE_HS_ADV_TYPE_INCOMP_NAME 0x08
+#define BLE_HS_ADV_TYPE_COMP_NAME 0x09
+#define BLE_HS_ADV_TYPE_TX_PWR_LVL 0x0a
+#define BLE_HS_ADV_TYPE_SVC_DATA_UUID16 0x16
+#define BLE_HS_ADV_TYPE_APPEARANCE 0x19
+#define BLE_HS_ADV_TYPE_SVC_DATA_UUID128 0x21
+#define BLE_HS_ADV_TYPE_MFG_DATA 0xff
+
+struct ble_hs_adv_fields
+{
+    uint8_t flags;
+    const ble_uuid16_t *uuids16;
+    uint8_t num_uuids16;
+    unsigned uuids16_is_complete : 1;
+    const ble_uuid32_t *uuids32;
+    uint8_t num_uuids32;
+    unsigned uuids32_is_complete : 1;
+    const ble_uuid128_t *uuids128;
+    uint8_t num_uuids128;
+    unsigned uuids128_is_complete : 1;
+    const uint8_t *name;
+    uint8_t name_len;
+    unsigned name_is_complete : 1;
+    int8_t tx_pwr_lvl;
+    unsigned tx_pwr_lvl_is_present : 1;
+    const uint8_t *slave_itvl_range;
+    const uint8_t *svc_data_uuid16;
+    uint8_t svc_data_uuid16_len;
+    const uint8_t *public_tgt_addr;
+    uint8_t num_public_tgt_addrs;
+    uint16_t appearance;
+    unsigned appearance_is_present : 1;
+    uint16_t adv_itvl;
+    unsigned adv_itvl_is_present : 1;
+    const uint8_t *device_addr;
+    uint8_t device_addr_type;
+    unsigned device_addr_is_present : 1;
+    const uint8_t *svc_data_uuid32;
+    uint8_t svc_data_uuid32_len;
+    const uint8_t *svc_data_uuid128;
+    uint8_t svc_data_uuid128_len;
+    const uint8_t *uri;
+    uint8_t uri_len;
+    const uint8_t *mfg_data;
+    uint8_t mfg_data_len;
+    uint8_t le_role;
+    unsigned le_role_is_present : 1;
+};
+int ble_hs_adv_set_fields(const struct ble_hs_adv_fields *adv_fields, uint8_t *dst, uint8_t *dst_len, uint8_t max_len);
+int ble_hs_adv_set_fields_mbuf(const struct ble_hs_adv_fields *adv_fields, struct os_mbuf *om);
+
+/* GAP */
+#define BLE_GAP_CONN_MODE_NON 0
+#define BLE_GAP_CONN_MODE_DIR 1
+#define BLE_GAP_CONN_MODE_UND 2
+#define BLE_GAP_DISC_MODE_NON 0
+#define BLE_GAP_DISC_MODE_LTD 1
+#define BLE_GAP_DISC_MODE_GEN 2
+#define BLE_GAP_ADV_ITVL_MS(t) ((t) * 1000 / 625)
+#define BLE_GAP_SCAN_ITVL_MS(t) ((t) * 1000 / 625)
+#define BLE_GAP_SCAN_WIN_MS(t) ((t) * 1000 / 625)
+#define BLE_GAP_CONN_ITVL_MS(t) ((t) * 1000 / 1250)
+#define BLE_GAP_SUPERVISION_TIMEOUT_MS(t) ((t) / 10)
+#define BLE_GAP_ADV_FAST_INTERVAL1_MIN BLE_GAP_ADV_ITVL_MS(30)
+#define BLE_GAP_ADV_FAST_INTERVAL1_MAX BLE_GAP_ADV_ITVL_MS(60)
+#define BLE_GAP_ADV_FAST_INTERVAL2_MIN BLE_GAP_ADV_ITVL_MS(100)
+#define BLE_GAP_ADV_FAST_INTERVAL2_MAX BLE_GAP_ADV_ITVL_MS(150)
+
+#define BLE_GAP_EVENT_CONNECT 0
+#define BLE_GAP_EVENT_DISCONNECT 1
+#define BLE_GAP_EVENT_CONN_UPDATE 3
+#define BLE_GAP_EVENT_CONN_UPDATE_REQ 4
+#define BLE_GAP_EVENT_L2CAP_UPDATE_REQ 5
+#define BLE_GAP_EVENT_TERM_FAILURE 6
+#define BLE_GAP_EVENT_DISC 7
+#define BLE_GAP_EVENT_DISC_COMPLETE 8
+#define BLE_GAP_EVENT_ADV_COMPLETE 9
+#define BLE_GAP_EVENT_ENC_CHANGE 10
+#define BLE_GAP_EVENT_PASSKEY_ACTION 11
+#define BLE_GAP_EVENT_NOTIFY_RX 12
+#define BLE_GAP_EVENT_NOTIFY_TX 13
+#define BLE_GAP_EVENT_SUBSCRIBE 14
+#define BLE_GAP_EVENT_MTU 15
+#define BLE_GAP_EVENT_IDENTITY_RESOLVED 16
+#define BLE_GAP_EVENT_REPEAT_PAIRING 17
+#define BLE_GAP_EVENT_PHY_UPDATE_COMPLETE 18
+#define BLE_GAP_EVENT_EXT_DISC 19
+#define BLE_GAP_EVENT_SCAN_REQ_RCVD 25
+#define BLE_GAP_EVENT_DATA_LEN_CHG 34
+#define BLE_GAP_EVENT_EATT 37
+
+#define BLE_GAP_REPEAT_PAIRING_RETRY 1
+#define BLE_GAP_REPEAT_PAIRING_IGNORE 2
+
+struct ble_gap_sec_state
+{
+    unsigned encrypted : 1;
+    unsigned authenticated : 1;
+    unsigned bonded : 1;
+    unsigned key_size : 5;
+};
+
+struct ble_gap_conn_desc
+{
+    struct ble_gap_sec_state sec_state;
+    ble_addr_t our_id_addr;
+    ble_addr_t peer_id_addr;
+    ble_addr_t our_ota_addr;
+    ble_addr_t peer_ota_addr;
+    uint16_t conn_handle;
+    uint16_t conn_itvl;
+    uint16_t conn_latency;
+    uint16_t supervision_timeout;
+    uint8_t role;
+    uint8_t master_clock_accuracy;
+};
+
+struct ble_gap_upd_params
+{
+    uint16_t itvl_min;
+    uint16_t itvl_max;
+    uint16_t latency;
+    uint16_t supervision_timeout;
+    uint16_t min_ce_len;
+    uint16_t max_ce_len;
+};
+
+struct ble_gap_adv_params
+{
+    uint8_t conn_mode;
+    uint8_t disc_mode;
+    uint16_t itvl_min;
+    uint16_t itvl_max;
+    uint8_t channel_map;
+    uint8_t filter_policy;
+    uint8_t high_duty_cycle : 1;
+};
+
+struct ble_gap_disc_params
+{
+    uint16_t itvl;
+    uint16_t window;
+    uint8_t filter_policy;
+    uint8_t limited : 1;
+    uint8_t passive : 1;
+    uint8_t filter_duplicates : 1;
+};
+
+struct ble_gap_ext_adv_params
+{
+    unsigned int connectable : 1;
+    unsigned int scannable : 1;
+    unsigned int directed : 1;
+    unsigned int high_duty_directed : 1;
+    unsigned int legacy_pdu : 1;
+    unsigned int anonymous : 1;
+    unsigned int include_tx_power : 1;
+    unsigned int scan_req_notif : 1;
+    uint32_t itvl_min;
+    uint32_t itvl_max;
+    uint8_t channel_map;
+    uint8_t own_addr_type;
+    ble_addr_t peer;
+    uint8_t filter_policy;
+    uint8_t primary_phy;
+    uint8_t secondary_phy;
+    int8_t tx_power;
+    uint8_t sid;
+};
+
+struct ble_gap_event
+{
+    uint8_t type;
+    union
+    {
+        struct
+        {
+            int status;
+            uint16_t conn_handle;
+        } connect;
+        struct
+        {
+            int reason;
+            struct ble_gap_conn_desc conn;
+        } disconnect;
+        struct
+        {
+            uint8_t event_type;
+            uint8_t length_data;
+            ble_addr_t addr;
+            int8_t rssi;
+            const uint8_t *data;
+            const ble_addr_t *direct_addr;
+        } disc;
+        struct
+        {
+            int reason;
+        } disc_complete;
+        struct
+        {
+            uint8_t props;
+            uint8_t data_status;
+            uint8_t legacy_event_type;
+            ble_addr_t addr;
+            int8_t rssi;
+            int8_t tx_power;
+            uint8_t sid;
+            uint8_t prim_phy;
+            uint8_t sec_phy;
+            uint8_t length_data;
+            const uint8_t *data;
+        } ext_disc;
+        struct
+        {
+            int status;
+            uint16_t conn_handle;
+        } conn_update;
+        struct
+        {
+            const struct ble_gap_upd_params *peer_params;
+            struct ble_gap_upd_params *self_params;
+            uint16_t conn_handle;
+        } conn_update_req;
+        struct
+        {
+            int reason;
+            uint16_t conn_handle;
+        } term_failure;
+        struct
+        {
+            int status;
+            uint16_t conn_handle;
+        } enc_change;
+        struct
+        {
+            struct os_mbuf *om;
+            uint16_t conn_handle;
+            uint16_t attr_handle;
+            uint8_t indication : 1;
+        } notify_rx;
+        struct
+        {
+            int status;
+            uint16_t conn_handle;
+            uint16_t attr_handle;
+            uint8_t indication : 1;
+        } notify_tx;
+        struct
+        {
+            uint16_t conn_handle;
+            uint16_t attr_handle;
+            uint8_t reason;
+            uint8_t prev_notify : 1;
+            uint8_t cur_notify : 1;
+            uint8_t prev_indicate : 1;
+            uint8_t cur_indicate : 1;
+        } subscribe;
+        struct
+        {
+            uint16_t conn_handle;
+            uint16_t channel_id;
+            uint16_t value;
+        } mtu;
+        struct
+        {
+            uint16_t conn_handle;
+        } identity_resolved;
+        struct
+        {
+            uint16_t conn_handle;
+            ble_addr_t peer_id_addr;
+        } repeat_pairing;
+        struct
+        {
+            int status;
+            uint16_t conn_handle;
+            uint8_t tx_phy;
+            uint8_t rx_phy;
+        } phy_updated;
+        struct
+        {
+            int reason;
+            uint16_t conn_handle;
+            uint8_t instance;
+            uint8_t num_ext_adv_events;
+        } adv_complete;
+        struct
+        {
+            uint16_t conn_handle;
+            uint16_t max_tx_octets;
+            uint16_t max_tx_time;
+            uint16_t max_rx_octets;
+            uint16_t max_rx_time;
+        } data_len_chg;
+        struct
+        {
+            uint16_t conn_handle;
+            uint16_t cid;
+            uint8_t status;
+        } eatt;
+    };
+};
+
+typedef int ble_gap_event_fn(struct ble_gap_event *event, void *arg);
+
+int ble_gap_conn_find(uint16_t handle, struct ble_gap_conn_desc *out_desc);
+int ble_gap_adv_start(uint8_t own_addr_type, const ble_addr_t *direct_addr, int32_t duration_ms, const struct ble_gap_adv_params *adv_params, ble_gap_event_fn *cb, void *cb_arg);
+int ble_gap_adv_stop(void);
+int ble_gap_adv_active(void);
+int ble_gap_adv_set_fields(const struct ble_hs_adv_fields *rsp_fields);
+int ble_gap_adv_rsp_set_fields(const struct ble_hs_adv_fields *rsp_fields);
+int ble_gap_adv_set_data(const uint8_t *data, int data_len);
+int ble_gap_adv_rsp_set_data(const uint8_t *data, int data_len);
+int ble_gap_ext_adv_configure(uint8_t instance, const struct ble_gap_ext_adv_params *params, int8_t *selected_tx_power, ble_gap_event_fn *cb, void *cb_arg);
+int ble_gap_ext_adv_set_data(uint8_t instance, struct os_mbuf *data);
+int ble_gap_ext_adv_rsp_set_data(uint8_t instance, struct os_mbuf *data);
+int ble_gap_ext_adv_start(uint8_t instance, int duration, int max_events);
+int ble_gap_ext_adv_stop(uint8_t instance);
+int ble_gap_ext_adv_remove(uint8_t instance);
+int ble_gap_ext_adv_active(uint8_t instance);
+int ble_gap_ext_adv_set_addr(uint8_t instance, const ble_addr_t *addr);
+int ble_gap_update_params(uint16_t conn_handle, const struct ble_gap_upd_params *params);
+int ble_gap_set_prefered_le_phy(uint16_t conn_handle, uint8_t tx_phys_mask, uint8_t rx_phys_mask, uint16_t phy_opts);
+int ble_gap_read_le_phy(uint16_t conn_handle, uint8_t *tx_phy, uint8_t *rx_phy);
+int ble_gap_set_data_len(uint16_t conn_handle, uint16_t tx_octets, uint16_t tx_time);
+int ble_gap_terminate(uint16_t conn_handle, uint8_t hci_reason);
+int ble_gap_disc(uint8_t own_addr_type, int32_t duration_ms, const struct ble_gap_disc_params *disc_params, ble_gap_event_fn *cb, void *cb_arg);
+int ble_gap_disc_cancel(void);
+int ble_gap_disc_active(void);
+int ble_gap_wl_set(const ble_addr_t *addrs, uint8_t white_list_count);
+
+/* GATT */
+#define BLE_GATT_SVC_TYPE_END 0
+#define BLE_GATT_SVC_TYPE_PRIMARY 1
+#define BLE_GATT_SVC_TYPE_SECONDARY 2
+#define BLE_GATT_CHR_F_BROADCAST 0x0001
+#define BLE_GATT_CHR_F_READ 0x0002
+#define BLE_GATT_CHR_F_WRITE_NO_RSP 0x0004
+#define BLE_GATT_CHR_F_WRITE 0x0008
+#define BLE_GATT_CHR_F_NOTIFY 0x0010
+#define BLE_GATT_CHR_F_INDICATE 0x0020
+#define BLE_GATT_ACCESS_OP_READ_CHR 0
+#define BLE_GATT_ACCESS_OP_WRITE_CHR 1
+#define BLE_GATT_ACCESS_OP_READ_DSC 2
+#define BLE_GATT_ACCESS_OP_WRITE_DSC 3
+
+struct ble_gatt_access_ctxt;
+typedef int ble_gatt_access_fn(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg);
+typedef uint16_t ble_gatt_chr_flags;
+
+struct ble_gatt_dsc_def
+{
+    const ble_uuid_t *uuid;
+    uint8_t att_flags;
+    uint8_t min_key_size;
+    ble_gatt_access_fn *access_cb;
+    void *arg;
+};
+
+struct ble_gatt_chr_def
+{
+    const ble_uuid_t *uuid;
+    ble_gatt_access_fn *access_cb;
+    void *arg;
+    struct ble_gatt_dsc_def *descriptors;
+    ble_gatt_chr_flags flags;
+    uint8_t min_key_size;
+    uint16_t *val_handle;
+};
+
+struct ble_gatt_svc_def
+{
+    uint8_t type;
+    const ble_uuid_t *uuid;
+    const struct ble_gatt_svc_def **includes;
+    const struct ble_gatt_chr_def *characteristics;
+};
+
+struct ble_gatt_access_ctxt
+{
+    uint8_t op;
+    struct os_mbuf *om;
+    union
+    {
+        const struct ble_gatt_chr_def *chr;
+        const struct ble_gatt_dsc_def *dsc;
+    };
+};
+
+struct ble_gatt_notif
+{
+    uint16_t handle;
+    struct os_mbuf *value;
+};
+
+int ble_gatts_count_cfg(const struct ble_gatt_svc_def *defs);
+int ble_gatts_add_svcs(const struct ble_gatt_svc_def *svcs);
+int ble_gatts_notify_custom(uint16_t conn_handle, uint16_t att_handle, struct os_mbuf *om);
+int ble_gatts_notify_multiple_custom(uint16_t conn_handle, size_t chr_count, struct ble_gatt_notif *tuples);
+int ble_gatts_indicate_custom(uint16_t conn_handle, uint16_t chr_val_handle, struct os_mbuf *txom);
+int ble_gatts_peer_cl_sup_feat_get(uint16_t conn_handle, uint8_t *out_supported_feat, uint8_t len);
+void ble_gatts_chr_updated(uint16_t chr_val_handle);
+uint16_t ble_att_mtu(uint16_t conn_handle);
+int ble_att_set_preferred_mtu(uint16_t mtu);
+uint16_t ble_att_preferred_mtu(void);
+
+/* Host mbufs */
+struct os_mbuf *ble_hs_mbuf_from_flat(const void *buf, uint16_t len);
+struct os_mbuf *ble_hs_mbuf_att_pkt(void);
+int ble_hs_mbuf_to_flat(const struct os_mbuf *om, void *flat, uint16_t max_len, uint16_t *out_copy_len);
+
+/* Host config / ids */
+#define BLE_SM_IO_CAP_DISP_ONLY 0x00
+#define BLE_SM_IO_CAP_DISP_YES_NO 0x01
+#define BLE_SM_IO_CAP_KEYBOARD_ONLY 0x02
+#define BLE_SM_IO_CAP_NO_IO 0x03
+#define BLE_SM_IO_CAP_KEYBOARD_DISP 0x04
+#define BLE_SM_PAIR_KEY_DIST_ENC 0x01
+#define BLE_SM_PAIR_KEY_DIST_ID 0x02
+
+struct ble_store_status_event;
+typedef void ble_hs_reset_fn(int reason);
+typedef void ble_hs_sync_fn(void);
+typedef int ble_store_status_fn(struct ble_store_status_event *event, void *arg);
+struct ble_hs_cfg
+{
+    ble_hs_reset_fn *reset_cb;
+    ble_hs_sync_fn *sync_cb;
+    ble_store_status_fn *store_status_cb;
+    void *store_status_arg;
+    uint8_t sm_io_cap;
+    unsigned sm_oob_data_flag : 1;
+    unsigned sm_bonding : 1;
+    unsigned sm_mitm : 1;
+    unsigned sm_sc : 1;
+    unsigned sm_keypress : 1;
+    uint8_t sm_our_key_dist;
+    uint8_t sm_their_key_dist;
+};
+extern struct ble_hs_cfg ble_hs_cfg;
+typedef void ble_hs_stop_fn(int status, void *arg);
+struct ble_hs_stop_listener
+{
+    ble_hs_stop_fn *fn;
+    void *arg;
+};
+int ble_hs_start(void);
+int ble_hs_stop(struct ble_hs_stop_listener *listener, ble_hs_stop_fn *fn, void *arg);
+int ble_store_util_status_rr(struct ble_store_status_event *event, void *arg);
+int ble_store_util_bonded_peers(ble_addr_t *out_peer_id_addrs, int *out_num_peers, int max_peers);
+int ble_store_util_delete_peer(const ble_addr_t *peer_id_addr);
+int ble_hs_id_gen_rnd(int nrpa, ble_addr_t *out_addr);
+int ble_hs_id_set_rnd(const uint8_t *rnd_addr);
+int ble_hs_id_infer_auto(int privacy, uint8_t *out_addr_type);
+int ble_hs_id_copy_addr(uint8_t id_addr_type, uint8_t *out_id_addr, int *out_is_nrpa);
+int ble_hs_synced(void);
+void ble_hs_sched_reset(int reason);
+int ble_hs_util_ensure_addr(int prefer_random);
+
+/* L2CAP */
+#define BLE_L2CAP_EVENT_COC_CONNECTED 0
+#define BLE_L2CAP_EVENT_COC_DISCONNECTED 1
+#define BLE_L2CAP_EVENT_COC_ACCEPT 2
+#define BLE_L2CAP_EVENT_COC_DATA_RECEIVED 3
+#define BLE_L2CAP_EVENT_COC_TX_UNSTALLED 4
+struct ble_l2cap_chan;
+struct ble_l2cap_chan_info
+{
+    uint16_t scid;
+    uint16_t dcid;
+    uint16_t our_l2cap_mtu;
+    uint16_t peer_l2cap_mtu;
+    uint16_t psm;
+    uint16_t our_coc_mtu;
+    uint16_t peer_coc_mtu;
+};
+struct ble_l2cap_event
+{
+    int type;
+    union
+    {
+        struct
+        {
+            int status;
+            uint16_t conn_handle;
+            struct ble_l2cap_chan *chan;
+        } connect;
+        struct
+        {
+            uint16_t conn_handle;
+            struct ble_l2cap_chan *chan;
+        } disconnect;
+        struct
+        {
+            uint16_t conn_handle;
+            uint16_t peer_sdu_size;
+            struct ble_l2cap_chan *chan;
+        } accept;
+        struct
+        {
+            uint16_t conn_handle;
+            struct ble_l2cap_chan *chan;
+            struct os_mbuf *sdu_rx;
+        } receive;
+        struct
+        {
+            uint16_t conn_handle;
+            struct ble_l2cap_chan *chan;
+            int status;
+        } tx_unstalled;
+    };
+};
+typedef int ble_l2cap_event_fn(struct ble_l2cap_event *event, void *arg);
+int ble_l2cap_create_server(uint16_t psm, uint16_t mtu, ble_l2cap_event_fn *cb, void *cb_arg);
+int ble_l2cap_send(struct ble_l2cap_chan *chan, struct os_mbuf *sdu_tx);
+int ble_l2cap_recv_ready(struct ble_l2cap_chan *chan, struct os_mbuf *sdu_rx);
+int ble_l2cap_disconnect(struct ble_l2cap_chan *chan);
+int ble_l2cap_get_chan_info(struct ble_l2cap_chan *chan, struct ble_l2cap_chan_info *chan_info);
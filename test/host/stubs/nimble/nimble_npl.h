@@ -0,0 +1,35 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+typedef uint32_t ble_npl_time_t;
+struct ble_npl_event;
+typedef void ble_npl_event_fn(struct ble_npl_event *ev);
+struct ble_npl_event
+{
+    bool queued;
+    ble_npl_event_fn *fn;
+    void *arg;
+};
+struct ble_npl_eventq
+{
+    void *q;
+};
+struct ble_npl_callout
+{
+    struct ble_npl_event ev;
+    bool active;
+    ble_npl_time_t expiry;
+};
+void ble_npl_event_init(struct ble_npl_event *ev, ble_npl_event_fn *fn, void *arg);
+void ble_npl_event_deinit(struct ble_npl_event *ev);
+void *ble_npl_event_get_arg(struct ble_npl_event *ev);
+void ble_npl_eventq_put(struct ble_npl_eventq *evq, struct ble_npl_event *ev);
+void ble_npl_eventq_remove(struct ble_npl_eventq *evq, struct ble_npl_event *ev);
+void ble_npl_callout_init(struct ble_npl_callout *co, struct ble_npl_eventq *evq, ble_npl_event_fn *ev_cb, void *ev_arg);
+void ble_npl_callout_deinit(struct ble_npl_callout *co);
+int ble_npl_callout_reset(struct ble_npl_callout *co, ble_npl_time_t ticks);
+void ble_npl_callout_stop(struct ble_npl_callout *co);
+bool ble_npl_callout_is_active(struct ble_npl_callout *co);
+int ble_npl_time_ms_to_ticks(uint32_t ms, ble_npl_time_t *out_ticks);
+ble_npl_time_t ble_npl_time_ms_to_ticks32(uint32_t ms);
+ble_npl_time_t ble_npl_time_get(void);
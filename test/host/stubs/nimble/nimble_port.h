@@ -0,0 +1,8 @@
+#pragma once
+#include "esp_err.h"
+#include "host/ble_hs.h"
+esp_err_t nimble_port_init(void);
+int nimble_port_deinit(void);
+void nimble_port_run(void);
+int nimble_port_stop(void);
+struct ble_npl_eventq *nimble_port_get_dflt_eventq(void);
@@ -0,0 +1,5 @@
+#pragma once
+#include "host/ble_hs.h"
+typedef void TaskFunction_t_(void *);
+void nimble_port_freertos_init(TaskFunction_t_ host_task_fn);
+void nimble_port_freertos_deinit(void);
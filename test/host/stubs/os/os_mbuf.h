@@ -0,0 +1,73 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "os/queue.h"
+
+struct os_mempool
+{
+    uint32_t mp_block_size;
+    uint16_t mp_num_blocks;
+    uint16_t mp_num_free;
+    uint16_t mp_min_free;
+    uint8_t mp_flags;
+    uintptr_t mp_membuf_addr;
+    const char *name;
+};
+
+#define OS_MEMPOOL_SIZE(n, blksize) ((((blksize) + 3) / 4) * (n))
+typedef uint32_t os_membuf_t;
+#define OS_MEMPOOL_BYTES(n, blksize) (sizeof(os_membuf_t) * OS_MEMPOOL_SIZE((n), (blksize)))
+
+struct os_mbuf_pool
+{
+    uint16_t omp_databuf_len;
+    struct os_mempool *omp_pool;
+};
+
+struct os_mbuf_pkthdr
+{
+    uint16_t omp_len;
+    uint16_t omp_flags;
+    STAILQ_ENTRY(os_mbuf_pkthdr) omp_next;
+};
+
+struct os_mbuf
+{
+    uint8_t *om_data;
+    uint8_t om_flags;
+    uint8_t om_pkthdr_len;
+    uint16_t om_len;
+    struct os_mbuf_pool *om_omp;
+    SLIST_ENTRY(os_mbuf) om_next;
+    uint8_t om_databuf[0];
+};
+
+#define OS_MBUF_IS_PKTHDR(__om) ((__om)->om_pkthdr_len >= sizeof(struct os_mbuf_pkthdr))
+#define OS_MBUF_PKTHDR(__om) ((struct os_mbuf_pkthdr *)(void *)((uint8_t *)&(__om)->om_data + sizeof(struct os_mbuf)))
+#define OS_MBUF_PKTHDR_TO_MBUF(__hdr) ((struct os_mbuf *)(void *)((uint8_t *)(__hdr) - sizeof(struct os_mbuf)))
+#define OS_MBUF_PKTLEN(__om) (OS_MBUF_PKTHDR(__om)->omp_len)
+#define OS_MBUF_DATA(__om, __type) (__type)((__om)->om_data)
+#define OS_MBUF_USRHDR(om) (void *)((uint8_t *)om + sizeof(struct os_mbuf) + sizeof(struct os_mbuf_pkthdr))
+#define OS_MBUF_USRHDR_LEN(om) ((om)->om_pkthdr_len - sizeof(struct os_mbuf_pkthdr))
+#define OS_MBUF_LEADINGSPACE(__om) ((uint16_t)((__om)->om_data - &(__om)->om_databuf[0] - (__om)->om_pkthdr_len))
+#define OS_MBUF_TRAILINGSPACE(__om) ((uint16_t)((__om)->om_omp->omp_databuf_len - ((__om)->om_data - &(__om)->om_databuf[0]) - (__om)->om_len))
+
+int os_mempool_init(struct os_mempool *mp, uint16_t blocks, uint32_t block_size, void *membuf, const char *name);
+int os_mbuf_pool_init(struct os_mbuf_pool *omp, struct os_mempool *mp, uint16_t buf_len, uint16_t nbufs);
+struct os_mbuf *os_mbuf_get(struct os_mbuf_pool *omp, uint16_t leadingspace);
+struct os_mbuf *os_mbuf_get_pkthdr(struct os_mbuf_pool *omp, uint8_t pkthdr_len);
+struct os_mbuf *os_msys_get_pkthdr(uint16_t dsize, uint16_t user_hdr_len);
+int os_msys_num_free(void);
+int os_mbuf_free(struct os_mbuf *mb);
+int os_mbuf_free_chain(struct os_mbuf *om);
+struct os_mbuf *os_mbuf_dup(struct os_mbuf *om);
+int os_mbuf_copydata(const struct os_mbuf *m, int off, int len, void *dst);
+int os_mbuf_append(struct os_mbuf *om, const void *data, uint16_t len);
+int os_mbuf_appendfrom(struct os_mbuf *dst, const struct os_mbuf *src, uint16_t src_off, uint16_t len);
+void os_mbuf_adj(struct os_mbuf *mp, int req_len);
+int os_mbuf_cmpf(const struct os_mbuf *om, int off, const void *data, int len);
+struct os_mbuf *os_mbuf_off(const struct os_mbuf *om, int off, uint16_t *out_off);
+void os_mbuf_concat(struct os_mbuf *first, struct os_mbuf *second);
+void *os_mbuf_extend(struct os_mbuf *om, uint16_t len);
+struct os_mbuf *os_mbuf_prepend(struct os_mbuf *om, int len);
+struct os_mbuf *os_mbuf_pullup(struct os_mbuf *om, uint16_t len);
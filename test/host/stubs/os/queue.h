@@ -0,0 +1,9 @@
+#pragma once
+#define SLIST_HEAD(name, type) struct name { struct type *slh_first; }
+#define SLIST_ENTRY(type) struct { struct type *sle_next; }
+#define SLIST_NEXT(elm, field) ((elm)->field.sle_next)
+#define SLIST_FIRST(head) ((head)->slh_first)
+#define STAILQ_HEAD(name, type) struct name { struct type *stqh_first; struct type **stqh_last; }
+#define STAILQ_ENTRY(type) struct { struct type *stqe_next; }
+#define STAILQ_NEXT(elm, field) ((elm)->field.stqe_next)
+#define STAILQ_FIRST(head) ((head)->stqh_first)
@@ -0,0 +1,59 @@
+#pragma once
+
+/* Host build configuration. Every option can be overridden with -D from test/host/CMakeLists.txt. */
+#ifndef CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+#define CONFIG_BT_NIMBLE_MAX_CONNECTIONS 3
+#endif
+#ifndef CONFIG_BT_NIMBLE_MAX_BONDS
+#define CONFIG_BT_NIMBLE_MAX_BONDS 3
+#endif
+#ifndef CONFIG_ESP_NIMBLE_API_TX_QUEUE_DEPTH
+#define CONFIG_ESP_NIMBLE_API_TX_QUEUE_DEPTH 16
+#endif
+#ifndef CONFIG_ESP_NIMBLE_API_TX_QUEUE_WATERMARK
+#define CONFIG_ESP_NIMBLE_API_TX_QUEUE_WATERMARK 12
+#endif
+#ifndef CONFIG_ESP_NIMBLE_API_TX_CREDITS
+#define CONFIG_ESP_NIMBLE_API_TX_CREDITS 4
+#endif
+#ifndef CONFIG_ESP_NIMBLE_API_TX_MSYS_RESERVE
+#define CONFIG_ESP_NIMBLE_API_TX_MSYS_RESERVE 4
+#endif
+#ifndef CONFIG_ESP_NIMBLE_API_RX_RING_SIZE
+#define CONFIG_ESP_NIMBLE_API_RX_RING_SIZE 1024
+#endif
+#ifndef CONFIG_ESP_NIMBLE_API_INDICATE_QUEUE_DEPTH
+#define CONFIG_ESP_NIMBLE_API_INDICATE_QUEUE_DEPTH 8
+#endif
+#ifndef CONFIG_ESP_NIMBLE_API_COALESCE_CHARACTERISTICS
+#define CONFIG_ESP_NIMBLE_API_COALESCE_CHARACTERISTICS 2
+#endif
+#ifndef CONFIG_ESP_NIMBLE_API_TX_POOL
+#define CONFIG_ESP_NIMBLE_API_TX_POOL 1
+#define CONFIG_ESP_NIMBLE_API_TX_POOL_BLOCKS 8
+#define CONFIG_ESP_NIMBLE_API_TX_POOL_BLOCK_SIZE 292
+#endif
+#ifndef CONFIG_ESP_NIMBLE_API_METRICS
+#define CONFIG_ESP_NIMBLE_API_METRICS 1
+#endif
+#ifndef CONFIG_ESP_NIMBLE_API_RECONNECT_ACCEPT_LIST_MS
+#define CONFIG_ESP_NIMBLE_API_RECONNECT_ACCEPT_LIST_MS 10000
+#endif
+#ifndef CONFIG_ESP_NIMBLE_API_OBSERVER_CACHE_SIZE
+#define CONFIG_ESP_NIMBLE_API_OBSERVER_CACHE_SIZE 16
+#endif
+#ifndef CONFIG_ESP_NIMBLE_API_COC_TX_QUEUE_DEPTH
+#define CONFIG_ESP_NIMBLE_API_COC_TX_QUEUE_DEPTH 4
+#endif
+#ifndef CONFIG_ESP_NIMBLE_API_COC_RX_HELD
+#define CONFIG_ESP_NIMBLE_API_COC_RX_HELD 2
+#endif
+#ifndef CONFIG_ESP_NIMBLE_API_DISPATCH_QUEUE_SIZE
+#define CONFIG_ESP_NIMBLE_API_DISPATCH_QUEUE_SIZE 8
+#endif
+#ifndef CONFIG_ESP_NIMBLE_API_DISPATCH_TASK_PRIORITY
+#define CONFIG_ESP_NIMBLE_API_DISPATCH_TASK_PRIORITY 5
+#endif
+#ifndef CONFIG_ESP_NIMBLE_API_DISPATCH_TASK_STACK_SIZE
+#define CONFIG_ESP_NIMBLE_API_DISPATCH_TASK_STACK_SIZE 4096
+#endif
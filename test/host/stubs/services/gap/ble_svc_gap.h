@@ -0,0 +1,6 @@
+#pragma once
+#include "host/ble_hs.h"
+void ble_svc_gap_init(void);
+const char *ble_svc_gap_device_name(void);
+int ble_svc_gap_device_name_set(const char *name);
+int ble_svc_gap_device_appearance_set(uint16_t appearance);
@@ -0,0 +1,3 @@
+#pragma once
+#include "host/ble_hs.h"
+void ble_svc_gatt_init(void);
@@ -0,0 +1,42 @@
+#include <string.h>
+#include "test_common.h"
+
+static nimble_peripheral_handle_t handle;
+static struct ble_gatt_svc_def services[] = {{0}};
+static const uint8_t mfg_data[] = {0xe5, 0x02, 0x00, 0x00};
+static nimble_peripheral_config_t config = {
+    .device_name = "host-test",
+    .ble_gatt_services = services,
+    .adv_mfg_data = mfg_data,
+    .adv_mfg_data_len = sizeof(mfg_data),
+};
+
+int main(void)
+{
+    mock_nimble_reset();
+    TEST_CHECK(nimble_peripheral_init(&config, &handle) == ESP_OK);
+    TEST_CHECK(nimble_peripheral_adv_mfg_data_update(mfg_data, sizeof(mfg_data)) == ESP_ERR_INVALID_STATE);
+
+    /* The payload is encoded once on sync and loaded as raw bytes. */
+    mock_nimble_sync();
+    TEST_CHECK(mock_nimble.adv_set_data_calls == 2 && mock_nimble.adv_start_calls == 1);
+    TEST_CHECK(mock_nimble.adv_set_fields_calls == 0);
+
+    /* Restarting after a connect or disconnect reuses the loaded payload. */
+    TEST_SCRIPT("connect 1\n"
+                "disconnect 1\n");
+    TEST_CHECK(mock_nimble.adv_set_data_calls == 2 && mock_nimble.adv_start_calls == 3);
+
+    /* Dynamic fields are patched in place and must keep their length. */
+    uint8_t value[] = {0xe5, 0x02, 0x12, 0x34};
+    TEST_CHECK(nimble_peripheral_adv_mfg_data_update(value, 3) == ESP_ERR_INVALID_SIZE);
+    TEST_CHECK(nimble_peripheral_adv_svc_data_update(value, 0) == ESP_ERR_INVALID_STATE);
+    TEST_CHECK(nimble_peripheral_adv_mfg_data_update(value, sizeof(value)) == ESP_OK);
+    TEST_CHECK(mock_nimble.adv_set_data_calls == 3);
+
+    int len = mock_nimble.adv_data_len;
+    TEST_CHECK(mock_nimble.adv_data[len - 6] == sizeof(value) + 1 && mock_nimble.adv_data[len - 5] == 0xff);
+    TEST_CHECK(memcmp(&mock_nimble.adv_data[len - 4], value, sizeof(value)) == 0);
+
+    return test_pass("test_adv_cache");
+}
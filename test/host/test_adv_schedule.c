@@ -0,0 +1,52 @@
+#include "test_common.h"
+
+static nimble_peripheral_handle_t handle;
+static struct ble_gatt_svc_def services[] = {{0}};
+static nimble_peripheral_adv_phase_t phases[8];
+static int phase_count;
+
+static void on_adv_phase(nimble_peripheral_adv_phase_t phase)
+{
+    phases[phase_count++] = phase;
+}
+
+static nimble_peripheral_config_t config = {
+    .device_name = "host-test",
+    .ble_gatt_services = services,
+    .adv_schedule = {.fast_itvl_ms = 30, .fast_duration_ms = 30000, .slow_itvl_ms = 1000, .max_connections = 2},
+    .nimble_peripheral_on_adv_phase_cb = on_adv_phase,
+};
+
+int main(void)
+{
+    test_start(&config, &handle);
+
+    /* Fast burst after sync, bounded by the controller so ADV_COMPLETE marks its end. */
+    TEST_CHECK(nimble_peripheral_adv_phase_get() == NIMBLE_PERIPHERAL_ADV_PHASE_FAST);
+    TEST_CHECK(mock_nimble.last_adv.params.itvl_min == BLE_GAP_ADV_ITVL_MS(30) && mock_nimble.last_adv.duration_ms == 30000);
+
+    struct ble_gap_event timeout = {.type = BLE_GAP_EVENT_ADV_COMPLETE};
+    timeout.adv_complete.reason = BLE_HS_ETIMEOUT;
+    mock_nimble_gap_event(&timeout);
+    TEST_CHECK(nimble_peripheral_adv_phase_get() == NIMBLE_PERIPHERAL_ADV_PHASE_SLOW);
+    TEST_CHECK(mock_nimble.last_adv.params.itvl_min == BLE_GAP_ADV_ITVL_MS(1000) && mock_nimble.last_adv.duration_ms == BLE_HS_FOREVER);
+
+    /* A connection below the limit keeps advertising in the same phase. */
+    uint32_t starts = mock_nimble.adv_start_calls;
+    TEST_SCRIPT("connect 1\n");
+    TEST_CHECK(mock_nimble.adv_active && mock_nimble.adv_start_calls == starts + 1);
+    TEST_CHECK(mock_nimble.last_adv.params.itvl_min == BLE_GAP_ADV_ITVL_MS(1000));
+
+    /* At the limit advertising pauses, and a disconnect resumes it with a new burst. */
+    TEST_SCRIPT("connect 2\n");
+    TEST_CHECK(!mock_nimble.adv_active && mock_nimble.adv_start_calls == starts + 1);
+    TEST_CHECK(nimble_peripheral_adv_phase_get() == NIMBLE_PERIPHERAL_ADV_PHASE_PAUSED);
+    TEST_SCRIPT("disconnect 2\n");
+    TEST_CHECK(mock_nimble.adv_active && mock_nimble.last_adv.params.itvl_min == BLE_GAP_ADV_ITVL_MS(30));
+
+    TEST_CHECK(phase_count == 4);
+    TEST_CHECK(phases[0] == NIMBLE_PERIPHERAL_ADV_PHASE_FAST && phases[1] == NIMBLE_PERIPHERAL_ADV_PHASE_SLOW);
+    TEST_CHECK(phases[2] == NIMBLE_PERIPHERAL_ADV_PHASE_PAUSED && phases[3] == NIMBLE_PERIPHERAL_ADV_PHASE_FAST);
+
+    return test_pass("test_adv_schedule");
+}
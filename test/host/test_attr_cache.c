@@ -0,0 +1,76 @@
+#include <string.h>
+#include "test_common.h"
+
+static uint8_t storage[400];
+static nimble_peripheral_attr_t attr = NIMBLE_PERIPHERAL_ATTR_INIT(storage, 0);
+static const struct ble_gatt_chr_def characteristics[] = {
+    {.access_cb = nimble_peripheral_attr_access, .arg = &attr, .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_NOTIFY, .val_handle = &attr.val_handle},
+    {0},
+};
+static struct ble_gatt_svc_def services[] = {{.type = BLE_GATT_SVC_TYPE_PRIMARY, .characteristics = characteristics}, {0}};
+static nimble_peripheral_handle_t handle;
+static nimble_peripheral_config_t config = {.device_name = "host-test", .ble_gatt_services = services};
+
+static int attr_request(uint8_t op, struct os_mbuf *om)
+{
+    struct ble_gatt_access_ctxt ctxt = {.op = op, .om = om, .chr = &characteristics[0]};
+    return nimble_peripheral_attr_access(1, attr.val_handle, &ctxt, &attr);
+}
+
+int main(void)
+{
+    uint8_t value[300];
+    for (size_t i = 0; i < sizeof(value); i++)
+    {
+        value[i] = (uint8_t)i;
+    }
+
+    test_start(&config, &handle);
+    attr.val_handle = 10;
+
+    /* No subscriber yet: the cache is updated and nothing is sent. */
+    TEST_CHECK(nimble_peripheral_attr_set_value(&attr, "abc", 3) == ESP_OK);
+    TEST_SCRIPT("connect 1\n"
+                "subscribe 1 10 notify\n");
+
+    /* An unchanged value is not sent again. */
+    TEST_CHECK(nimble_peripheral_attr_set_value(&attr, "abc", 3) == ESP_OK);
+    TEST_CHECK(nimble_peripheral_attr_set_value(&attr, "abd", 3) == ESP_OK);
+    TEST_CHECK(nimble_peripheral_attr_set_value(&attr, "abd", 3) == ESP_OK);
+    TEST_CHECK(nimble_peripheral_attr_set_value(&attr, "ab", 2) == ESP_OK);
+    mock_nimble_run_events();
+    TEST_CHECK(mock_nimble.sent_count == 2 && memcmp(mock_nimble.sent[0].data, "abd", 3) == 0 && mock_nimble.sent[1].len == 2);
+    TEST_CHECK(nimble_peripheral_attr_set_value(&attr, value, sizeof(storage) + 1) == ESP_ERR_INVALID_SIZE);
+
+    /* Reads span several mbufs without an application callback. */
+    TEST_CHECK(nimble_peripheral_attr_set_value(&attr, value, sizeof(value)) == ESP_OK);
+    struct os_mbuf *om = os_msys_get_pkthdr(0, 0);
+    TEST_CHECK(attr_request(BLE_GATT_ACCESS_OP_READ_CHR, om) == 0);
+    TEST_CHECK(OS_MBUF_PKTLEN(om) == sizeof(value) && SLIST_NEXT(om, om_next) != NULL);
+    TEST_CHECK(os_mbuf_cmpf(om, 0, value, sizeof(value)) == 0);
+    os_mbuf_free_chain(om);
+
+    /* Writes replace the cached value without notifying. */
+    uint8_t out[sizeof(storage)];
+    size_t out_len;
+    om = ble_hs_mbuf_from_flat("hello", 5);
+    TEST_CHECK(attr_request(BLE_GATT_ACCESS_OP_WRITE_CHR, om) == 0);
+    os_mbuf_free_chain(om);
+    TEST_CHECK(nimble_peripheral_attr_get_value(&attr, out, sizeof(out), &out_len) == ESP_OK);
+    TEST_CHECK(out_len == 5 && memcmp(out, "hello", 5) == 0);
+    TEST_CHECK(nimble_peripheral_attr_get_value(&attr, out, 4, &out_len) == ESP_ERR_INVALID_SIZE);
+
+    om = os_msys_get_pkthdr(0, 0);
+    for (int i = 0; i < 2; i++)
+    {
+        TEST_CHECK(os_mbuf_append(om, value, sizeof(value)) == 0);
+    }
+    TEST_CHECK(attr_request(BLE_GATT_ACCESS_OP_WRITE_CHR, om) == BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN);
+    os_mbuf_free_chain(om);
+
+    TEST_SCRIPT("run\n"
+                "expect sent 3\n"
+                "expect live 0\n");
+
+    return test_pass("test_attr_cache");
+}
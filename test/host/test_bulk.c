@@ -0,0 +1,210 @@
+#include <string.h>
+#include "test_common.h"
+#include "esp_nimble_bulk.h"
+#include "esp_rom_crc.h"
+
+#define CONTROL_HANDLE 30
+#define DATA_HANDLE 32
+#define TOTAL_LEN 1200
+
+static nimble_peripheral_handle_t handle;
+static struct ble_gatt_svc_def services[] = {NIMBLE_BULK_SERVICE, {0}};
+static nimble_peripheral_config_t config = {.device_name = "host-test", .ble_gatt_services = services};
+static uint8_t source[TOTAL_LEN];
+static uint8_t image[TOTAL_LEN];
+static int data_calls;
+static int blocks_verified;
+static uint32_t begin_offset;
+static uint32_t ended_id;
+static esp_err_t ended_status;
+static esp_err_t sink_status = ESP_OK;
+
+static esp_err_t on_begin(int conn_index, uint32_t transfer_id, uint32_t total_len, uint32_t offset, void *arg)
+{
+    begin_offset = offset;
+    return total_len <= TOTAL_LEN ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+static esp_err_t on_data(uint32_t offset, const uint8_t *data, size_t len, void *arg)
+{
+    memcpy(&image[offset], data, len);
+    data_calls++;
+    return sink_status;
+}
+
+static esp_err_t on_block(uint32_t offset, uint32_t len, void *arg)
+{
+    blocks_verified++;
+    return ESP_OK;
+}
+
+static void on_end(uint32_t transfer_id, esp_err_t status, void *arg)
+{
+    ended_id = transfer_id;
+    ended_status = status;
+}
+
+static int write_chr(int chr, uint16_t conn_handle, const uint8_t *data, uint16_t len)
+{
+    struct os_mbuf *om = ble_hs_mbuf_from_flat(data, len);
+    struct ble_gatt_access_ctxt ctxt = {.op = BLE_GATT_ACCESS_OP_WRITE_CHR, .om = om, .chr = &nimble_bulk_characteristics[chr]};
+    int rc = nimble_bulk_characteristics[chr].access_cb(conn_handle, *nimble_bulk_characteristics[chr].val_handle, &ctxt, NULL);
+    os_mbuf_free_chain(om);
+    return rc;
+}
+
+static int start(uint16_t conn_handle, uint32_t transfer_id, uint32_t total_len)
+{
+    uint8_t request[9] = {NIMBLE_BULK_OP_START};
+    memcpy(&request[1], &transfer_id, 4);
+    memcpy(&request[5], &total_len, 4);
+    return write_chr(0, conn_handle, request, sizeof(request));
+}
+
+static int block_end(uint16_t conn_handle, uint32_t offset, uint32_t len)
+{
+    uint8_t request[5] = {NIMBLE_BULK_OP_BLOCK_END};
+    uint32_t crc = esp_rom_crc32_le(0, &source[offset], len);
+    memcpy(&request[1], &crc, 4);
+    return write_chr(0, conn_handle, request, sizeof(request));
+}
+
+static int chunk(uint16_t conn_handle, uint32_t offset, uint16_t len)
+{
+    uint8_t pdu[BULK_HEADER_LEN + 300];
+    memcpy(pdu, &offset, 4);
+    memcpy(&pdu[BULK_HEADER_LEN], &source[offset], len);
+    return write_chr(1, conn_handle, pdu, BULK_HEADER_LEN + len);
+}
+
+static const mock_sent_t *last_sent(void)
+{
+    return &mock_nimble.sent[mock_nimble.sent_count - 1];
+}
+
+static uint32_t sent_u32(const mock_sent_t *sent, int at)
+{
+    uint32_t value;
+    memcpy(&value, &sent->data[at], 4);
+    return value;
+}
+
+static bool last_is_ack(uint32_t received, uint32_t verified)
+{
+    const mock_sent_t *sent = last_sent();
+    return sent->attr_handle == CONTROL_HANDLE && sent->data[0] == NIMBLE_BULK_OP_ACK && sent_u32(sent, 1) == received && sent_u32(sent, 5) == verified;
+}
+
+static bool last_is_nak(uint32_t offset)
+{
+    const mock_sent_t *sent = last_sent();
+    return sent->data[0] == NIMBLE_BULK_OP_NAK && sent_u32(sent, 1) == offset;
+}
+
+static bool last_is(uint8_t op, uint8_t status)
+{
+    return last_sent()->data[0] == op && last_sent()->data[1] == status;
+}
+
+int main(void)
+{
+    for (size_t i = 0; i < sizeof(source); i++)
+    {
+        source[i] = (uint8_t)(i * 7 + 3);
+    }
+
+    nimble_bulk_config_t bulk = {.block_size = 512, .window = 4, .ack_every = 5};
+    TEST_CHECK(nimble_bulk_register(&bulk) == ESP_ERR_INVALID_ARG);
+    bulk.ack_every = 0;
+    TEST_CHECK(nimble_bulk_register(&bulk) == ESP_ERR_INVALID_ARG);
+    bulk.nimble_bulk_on_begin_cb = on_begin;
+    bulk.nimble_bulk_on_data_cb = on_data;
+    bulk.nimble_bulk_on_block_cb = on_block;
+    bulk.nimble_bulk_on_end_cb = on_end;
+    TEST_CHECK(nimble_bulk_register(&bulk) == ESP_OK);
+
+    test_start(&config, &handle);
+    *nimble_bulk_characteristics[0].val_handle = CONTROL_HANDLE;
+    *nimble_bulk_characteristics[1].val_handle = DATA_HANDLE;
+    TEST_SCRIPT("connect 1\n"
+                "connect 2\n");
+
+    /* Chunks are only taken from the connection that started the transfer. */
+    TEST_CHECK(chunk(1, 0, 128) == BLE_ATT_ERR_WRITE_NOT_PERMITTED);
+    TEST_CHECK(start(1, 7, TOTAL_LEN) == 0);
+    const mock_sent_t *rsp = last_sent();
+    TEST_CHECK(rsp->conn_handle == 1 && rsp->len == 10 && rsp->data[0] == NIMBLE_BULK_OP_START_RSP && rsp->data[1] == NIMBLE_BULK_STATUS_OK);
+    TEST_CHECK(sent_u32(rsp, 2) == 0 && rsp->data[6] == 0x00 && rsp->data[7] == 0x02 && rsp->data[8] == 4 && rsp->data[9] == 2);
+    TEST_CHECK(start(2, 8, TOTAL_LEN) == 0 && last_is(NIMBLE_BULK_OP_START_RSP, NIMBLE_BULK_STATUS_BUSY));
+    TEST_CHECK(chunk(2, 0, 128) == BLE_ATT_ERR_WRITE_NOT_PERMITTED);
+
+    /* Every second chunk is acknowledged, and the block once its CRC matches. */
+    uint32_t sent_before = mock_nimble.sent_count;
+    for (uint32_t offset = 0; offset < 512; offset += 128)
+    {
+        TEST_CHECK(chunk(1, offset, 128) == 0);
+    }
+    TEST_CHECK(mock_nimble.sent_count == sent_before + 2 && last_is_ack(512, 0));
+    TEST_CHECK(block_end(1, 0, 512) == 0 && last_is_ack(512, 512) && blocks_verified == 1);
+
+    /* A gap gets one NAK, the rest of the gap is dropped quietly. */
+    sent_before = mock_nimble.sent_count;
+    TEST_CHECK(chunk(1, 640, 128) == 0 && last_is_nak(512));
+    TEST_CHECK(chunk(1, 768, 128) == 0 && mock_nimble.sent_count == sent_before + 1);
+
+    /* A chunk spanning two mbuf segments reaches the sink as two calls without a copy. */
+    int calls_before = data_calls;
+    TEST_CHECK(chunk(1, 512, 300) == 0 && chunk(1, 812, 212) == 0);
+    TEST_CHECK(data_calls >= calls_before + 3 && memcmp(&image[512], &source[512], 512) == 0);
+
+    /* A CRC mismatch rewinds to the block start. */
+    source[600] ^= 0xff;
+    TEST_CHECK(block_end(1, 512, 512) == 0 && last_is_nak(512) && blocks_verified == 1);
+    source[600] ^= 0xff;
+    TEST_CHECK(chunk(1, 512, 300) == 0 && chunk(1, 812, 212) == 0);
+    TEST_CHECK(block_end(1, 512, 512) == 0 && last_is_ack(1024, 1024) && blocks_verified == 2);
+    TEST_CHECK(block_end(1, 512, 512) == 0 && last_is_ack(1024, 1024) && blocks_verified == 2);
+
+    /* After a disconnect the transfer resumes from the last verified block on any connection. */
+    TEST_CHECK(chunk(1, 1024, 100) == 0);
+    TEST_SCRIPT("disconnect 1\n"
+                "run\n"
+                "connect 3\n");
+    TEST_CHECK(start(3, 7, TOTAL_LEN) == 0 && last_is(NIMBLE_BULK_OP_START_RSP, NIMBLE_BULK_STATUS_OK));
+    TEST_CHECK(sent_u32(last_sent(), 2) == 1024 && begin_offset == 1024);
+    TEST_CHECK(chunk(3, 1124, 76) == 0 && last_is_nak(1024));
+    TEST_CHECK(chunk(3, 1024, 176) == 0 && block_end(3, 1024, 176) == 0);
+    TEST_CHECK(last_is(NIMBLE_BULK_OP_DONE, NIMBLE_BULK_STATUS_OK) && ended_id == 7 && ended_status == ESP_OK);
+    TEST_CHECK(memcmp(image, source, TOTAL_LEN) == 0 && blocks_verified == 3);
+
+    /* Chunks may not cross a block boundary. */
+    TEST_CHECK(start(2, 8, TOTAL_LEN) == 0 && begin_offset == 0);
+    TEST_CHECK(chunk(2, 0, 256) == 0 && chunk(2, 256, 257) == 0);
+    TEST_CHECK(last_is(NIMBLE_BULK_OP_DONE, NIMBLE_BULK_STATUS_PROTOCOL) && ended_id == 8 && ended_status == ESP_ERR_INVALID_SIZE);
+
+    /* Sink errors, a different transfer and ABORT all end the running one. */
+    TEST_CHECK(start(2, 9, TOTAL_LEN) == 0);
+    sink_status = ESP_ERR_INVALID_STATE;
+    TEST_CHECK(chunk(2, 0, 128) == 0 && last_is(NIMBLE_BULK_OP_DONE, NIMBLE_BULK_STATUS_SINK) && ended_id == 9);
+    sink_status = ESP_OK;
+    TEST_CHECK(start(2, 10, TOTAL_LEN) == 0 && start(2, 11, TOTAL_LEN) == 0);
+    TEST_CHECK(ended_id == 10 && ended_status == ESP_ERR_INVALID_STATE);
+    TEST_CHECK(start(3, 12, TOTAL_LEN + 1) == 0 && last_is(NIMBLE_BULK_OP_START_RSP, NIMBLE_BULK_STATUS_BUSY));
+    uint8_t abort_op = NIMBLE_BULK_OP_ABORT;
+    TEST_CHECK(write_chr(0, 3, &abort_op, 1) == BLE_ATT_ERR_WRITE_NOT_PERMITTED);
+    TEST_CHECK(write_chr(0, 2, &abort_op, 1) == 0 && last_is(NIMBLE_BULK_OP_DONE, NIMBLE_BULK_STATUS_ABORTED) && ended_id == 11);
+    TEST_CHECK(start(3, 12, TOTAL_LEN + 1) == 0 && last_is(NIMBLE_BULK_OP_START_RSP, NIMBLE_BULK_STATUS_REJECTED));
+
+    nimble_bulk_stats_t stats;
+    TEST_CHECK(nimble_bulk_stats(&stats) == ESP_OK);
+    TEST_CHECK(stats.transfers == 5 && stats.resumes == 1 && stats.completed == 1);
+    TEST_CHECK(stats.crc_errors == 1 && stats.out_of_order == 3);
+    TEST_CHECK(stats.bytes == 512 + 2 * 512 + 100 + 176 + 256);
+
+    TEST_SCRIPT("disconnect 2\n"
+                "disconnect 3\n"
+                "run\n"
+                "expect live 0\n");
+
+    return test_pass("test_bulk");
+}
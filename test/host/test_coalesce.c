@@ -0,0 +1,71 @@
+#include <string.h>
+#include "test_common.h"
+
+static nimble_peripheral_handle_t handle;
+static struct ble_gatt_svc_def services[] = {{0}};
+static nimble_peripheral_config_t config = {.device_name = "host-test", .ble_gatt_services = services};
+
+int main(void)
+{
+    uint8_t sample[12];
+    memset(sample, 0xab, sizeof(sample));
+
+    test_start(&config, &handle);
+    TEST_SCRIPT("connect 1\n"
+                "subscribe 1 10 notify\n"
+                "mtu 1 50\n");
+    TEST_CHECK(nimble_peripheral_notify_flush(10) == ESP_ERR_INVALID_STATE);
+    TEST_CHECK(nimble_peripheral_coalesce_enable(10, 20) == ESP_OK);
+
+    /* Three 14-byte records fit in a 47-byte PDU; the fourth pushes them out. */
+    for (int i = 0; i < 3; i++)
+    {
+        TEST_CHECK(nimble_peripheral_notify(10, sample, sizeof(sample)) == ESP_OK);
+    }
+    mock_nimble_run_events();
+    TEST_CHECK(mock_nimble.sent_count == 0);
+    TEST_CHECK(nimble_peripheral_notify(10, sample, sizeof(sample)) == ESP_OK);
+    mock_nimble_run_events();
+    TEST_CHECK(mock_nimble.sent_count == 1 && mock_nimble.sent[0].len == 42);
+    TEST_CHECK(mock_nimble.sent[0].data[0] == 12 && mock_nimble.sent[0].data[1] == 0 && mock_nimble.sent[0].data[14] == 12);
+
+    /* The deadline runs from the first record in the buffer. */
+    TEST_SCRIPT("advance 19\n"
+                "expect sent 1\n"
+                "advance 1\n"
+                "expect sent 2\n");
+    TEST_CHECK(mock_nimble.sent[1].len == 14);
+
+    TEST_CHECK(nimble_peripheral_notificate(10, NULL, 8, "hello") == ESP_OK);
+    TEST_CHECK(nimble_peripheral_notify_flush(10) == ESP_OK);
+    mock_nimble_run_events();
+    TEST_CHECK(mock_nimble.sent_count == 3 && mock_nimble.sent[2].len == 7 && memcmp(&mock_nimble.sent[2].data[2], "hello", 5) == 0);
+    TEST_CHECK(nimble_peripheral_notify_flush(10) == ESP_OK);
+
+    /* A record that cannot fit even on its own is refused. */
+    uint8_t large[46] = {0};
+    TEST_CHECK(nimble_peripheral_notify(10, large, sizeof(large)) == ESP_ERR_INVALID_SIZE);
+
+    /* An mbuf sent directly goes out after the records buffered before it. */
+    TEST_CHECK(nimble_peripheral_notify(10, sample, 4) == ESP_OK);
+    TEST_CHECK(nimble_peripheral_notify_mbuf(10, ble_hs_mbuf_from_flat(large, 30)) == ESP_OK);
+    mock_nimble_run_events();
+    TEST_CHECK(mock_nimble.sent_count == 5 && mock_nimble.sent[3].len == 6 && mock_nimble.sent[4].len == 30);
+
+    /* Disabling flushes what is pending and restores one PDU per call. */
+    TEST_CHECK(nimble_peripheral_notify(10, sample, 4) == ESP_OK);
+    TEST_CHECK(nimble_peripheral_coalesce_disable(10) == ESP_OK);
+    TEST_CHECK(nimble_peripheral_notify(10, sample, 4) == ESP_OK);
+    mock_nimble_run_events();
+    TEST_CHECK(mock_nimble.sent_count == 7 && mock_nimble.sent[5].len == 6 && mock_nimble.sent[6].len == 4);
+    TEST_CHECK(nimble_peripheral_coalesce_disable(10) == ESP_ERR_INVALID_STATE);
+
+    TEST_CHECK(nimble_peripheral_coalesce_enable(10, 0) == ESP_OK);
+    TEST_SCRIPT("subscribe 1 10 off\n");
+    TEST_CHECK(nimble_peripheral_notify(10, sample, 4) == ESP_ERR_NOT_FOUND);
+    TEST_CHECK(nimble_peripheral_coalesce_enable(11, 0) == ESP_OK);
+    TEST_CHECK(nimble_peripheral_coalesce_enable(12, 0) == ESP_ERR_NO_MEM);
+    TEST_SCRIPT("expect live 0\n");
+
+    return test_pass("test_coalesce");
+}
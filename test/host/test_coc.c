@@ -0,0 +1,109 @@
+#include <string.h>
+#include "test_common.h"
+
+static nimble_peripheral_handle_t handle;
+static struct ble_gatt_svc_def services[] = {{0}};
+static struct os_mbuf *held[4];
+static int held_count;
+static int coc_connects;
+static int coc_disconnects;
+
+static void on_coc_connect(int conn_index, uint16_t peer_mtu, void *arg)
+{
+    coc_connects++;
+}
+
+static void on_coc_disconnect(int conn_index, void *arg)
+{
+    coc_disconnects++;
+}
+
+static void on_coc_data(int conn_index, struct os_mbuf *sdu, void *arg)
+{
+    held[held_count++] = sdu;
+}
+
+static nimble_peripheral_config_t config = {
+    .device_name = "host-test",
+    .ble_gatt_services = services,
+    .coc = {
+        .psm = 0x80,
+        .nimble_peripheral_on_coc_connect_cb = on_coc_connect,
+        .nimble_peripheral_on_coc_disconnect_cb = on_coc_disconnect,
+        .nimble_peripheral_on_coc_data_cb = on_coc_data,
+    },
+};
+
+int main(void)
+{
+    uint8_t data[600];
+    for (size_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = (uint8_t)i;
+    }
+
+    test_start(&config, &handle);
+    TEST_CHECK(mock_nimble.coc_psm == 0x80 && mock_nimble.coc_mtu == COC_DEFAULT_MTU);
+
+    /* The channel lives in the GATT connection's slot, one per connection. */
+    TEST_SCRIPT("connect 1\n");
+    TEST_CHECK(nimble_peripheral_coc_send(0, data, 10, 0, NULL) == ESP_ERR_INVALID_STATE);
+    TEST_CHECK(mock_nimble_coc_connect(1, 100) == 0);
+    TEST_CHECK(coc_connects == 1 && handle.peripheral_conn[0].coc_mtu == 100);
+    TEST_CHECK(mock_nimble_coc_connect(1, 100) == BLE_HS_ENOMEM);
+
+    /* Large buffers are cut into SDUs of the peer's MTU and wait for credits. */
+    size_t sent;
+    TEST_CHECK(nimble_peripheral_coc_send(0, data, 250, 0, &sent) == ESP_OK && sent == 250);
+    mock_nimble_run_events();
+    TEST_CHECK(mock_nimble.coc_sdus_sent == 1);
+    mock_nimble_coc_credits(1, 3);
+    mock_nimble_run_events();
+    TEST_CHECK(mock_nimble.coc_sdus_sent == 3 && mock_nimble.coc_tx_len == 250 && memcmp(mock_nimble.coc_tx, data, 250) == 0);
+    TEST_CHECK(handle.metrics.conn[0].tx_pdus == 3 && handle.metrics.conn[0].tx_bytes == 250);
+
+    /* A stalled channel fills its queue, then producers time out. */
+    for (int i = 0; i < CONFIG_ESP_NIMBLE_API_COC_TX_QUEUE_DEPTH + 1; i++)
+    {
+        TEST_CHECK(nimble_peripheral_coc_send_mbuf(0, ble_hs_mbuf_from_flat(data, 20)) == ESP_OK);
+        mock_nimble_run_events();
+    }
+    TEST_CHECK(nimble_peripheral_coc_send_mbuf(0, ble_hs_mbuf_from_flat(data, 20)) == ESP_ERR_TIMEOUT);
+    TEST_CHECK(nimble_peripheral_coc_send(0, data, 20, 5, &sent) == ESP_ERR_TIMEOUT && sent == 0);
+    TEST_CHECK(nimble_peripheral_coc_send_mbuf(0, ble_hs_mbuf_from_flat(data, 101)) == ESP_ERR_INVALID_SIZE);
+
+    /* Received SDUs are handed over as they are; credits stop while the application holds too many. */
+    TEST_CHECK(mock_nimble_coc_receive(1, "abc", 3) == 0);
+    TEST_CHECK(mock_nimble_coc_receive(1, data, 300) == 0);
+    TEST_CHECK(held_count == CONFIG_ESP_NIMBLE_API_COC_RX_HELD && OS_MBUF_PKTLEN(held[1]) == 300 && os_mbuf_cmpf(held[0], 0, "abc", 3) == 0);
+    TEST_CHECK(mock_nimble_coc_receive(1, "d", 1) == BLE_HS_ESTALLED);
+    TEST_CHECK(nimble_peripheral_coc_rx_release(0, held[0]) == ESP_OK);
+    mock_nimble_run_events();
+    TEST_CHECK(mock_nimble_coc_receive(1, "d", 1) == 0 && held_count == 3);
+    TEST_CHECK(handle.metrics.conn[0].rx_pdus == 3 && handle.metrics.conn[0].rx_bytes == 304);
+
+    /* Closing the channel keeps the connection and drops what was still queued. */
+    TEST_CHECK(nimble_peripheral_coc_disconnect(0) == ESP_OK);
+    TEST_CHECK(coc_disconnects == 1 && handle.peripheral_conn[0].coc_mtu == 0 && handle.peripheral_conn[0].in_use);
+    TEST_CHECK(nimble_peripheral_coc_disconnect(0) == ESP_ERR_INVALID_STATE);
+    TEST_CHECK(nimble_peripheral_coc_send_mbuf(0, ble_hs_mbuf_from_flat(data, 20)) == ESP_ERR_INVALID_STATE);
+    for (int i = 1; i < held_count; i++)
+    {
+        TEST_CHECK(nimble_peripheral_coc_rx_release(0, held[i]) == ESP_OK);
+    }
+
+    /* A dropped connection takes its channel along. */
+    TEST_CHECK(mock_nimble_coc_connect(1, 100) == 0 && coc_connects == 2);
+    TEST_CHECK(nimble_peripheral_coc_send(0, data, 200, 0, NULL) == ESP_OK);
+    TEST_SCRIPT("disconnect 1\n"
+                "run\n");
+    TEST_CHECK(coc_disconnects == 2 && handle.peripheral_conn[0].coc_mtu == 0);
+    TEST_SCRIPT("expect live 0\n");
+
+    /* SDUs are never mixed into the GATT receive ring, so the data callback is required. */
+    TEST_CHECK(nimble_peripheral_deinit() == ESP_OK);
+    config.coc.nimble_peripheral_on_coc_data_cb = NULL;
+    TEST_CHECK(nimble_peripheral_init(&config, &handle) == ESP_ERR_INVALID_ARG);
+
+    return test_pass("test_coc");
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include "esp_nimble_api.h"
+#include "mock_nimble.h"
+#include "mock_script.h"
+
+#define TEST_CHECK(expr)                                                          \
+    do                                                                            \
+    {                                                                             \
+        if (!(expr))                                                              \
+        {                                                                         \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr);       \
+            exit(1);                                                              \
+        }                                                                         \
+    } while (0)
+
+#define TEST_SCRIPT(script) TEST_CHECK(mock_script_run(script) == 0)
+
+/* Brings the component up against the mock host and runs the sync callback, which starts advertising. */
+static inline void test_start(nimble_peripheral_config_t *config, nimble_peripheral_handle_t *handle)
+{
+    mock_nimble_reset();
+    TEST_CHECK(nimble_peripheral_init(config, handle) == ESP_OK);
+    mock_nimble_sync();
+}
+
+static inline int test_pass(const char *name)
+{
+    printf("%s: PASS\n", name);
+    return 0;
+}
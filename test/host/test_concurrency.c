@@ -0,0 +1,85 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include "test_common.h"
+#include "esp_log.h"
+
+#define READER_THREADS 3
+#define CHURN_ROUNDS 20000
+
+static nimble_peripheral_handle_t handle;
+static struct ble_gatt_svc_def services[] = {{0}};
+static nimble_peripheral_config_t config = {.device_name = "host-test", .ble_gatt_services = services};
+static atomic_bool churning = true;
+static atomic_uint lookups;
+static int stable_index;
+
+/* Handle 129 stays connected in its slot while the host task keeps moving colliding handles around it. */
+static void *reader(void *arg)
+{
+    while (atomic_load(&churning))
+    {
+        TEST_CHECK(nimble_peripheral_conn_find(129) == stable_index);
+        TEST_CHECK(nimble_peripheral_is_subscribed(stable_index, 10, false));
+        TEST_CHECK(nimble_peripheral_conn_find(2) == -1);
+        atomic_fetch_add(&lookups, 1);
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    esp_log_level_set("*", ESP_LOG_WARN);
+    test_start(&config, &handle);
+
+    /* A notification queued before the peer unsubscribes is dropped by the host task, not sent. */
+    TEST_SCRIPT("connect 1\n"
+                "subscribe 1 10 notify\n"
+                "notify 10 4\n"
+                "subscribe 1 10 off\n"
+                "run\n"
+                "expect sent 0\n"
+                "expect live 0\n");
+
+    /* A slot index captured before a disconnect no longer matches once the slot is reused. */
+    int conn_index = nimble_peripheral_conn_find(1);
+    uint16_t generation = handle.peripheral_conn[conn_index].generation;
+    TEST_SCRIPT("disconnect 1\n"
+                "connect 2\n"
+                "connect 3\n"
+                "connect 1\n"
+                "disconnect 2\n"
+                "disconnect 3\n");
+    TEST_CHECK(nimble_peripheral_conn_find(1) == conn_index);
+    TEST_CHECK(!nimble_peripheral_conn_is_current(conn_index, generation));
+    TEST_CHECK(nimble_peripheral_conn_is_current(conn_index, handle.peripheral_conn[conn_index].generation));
+
+    /* 129 probes past 1 in the handle map, so every disconnect of 1 shifts it back to its home slot. */
+    TEST_SCRIPT("connect 129\n"
+                "subscribe 129 10 notify\n");
+    stable_index = nimble_peripheral_conn_find(129);
+    TEST_CHECK(stable_index >= 0);
+
+    pthread_t threads[READER_THREADS];
+    for (int i = 0; i < READER_THREADS; i++)
+    {
+        TEST_CHECK(pthread_create(&threads[i], NULL, reader, NULL) == 0);
+    }
+
+    for (int i = 0; i < CHURN_ROUNDS; i++)
+    {
+        TEST_SCRIPT("disconnect 1\n"
+                    "connect 65\n"
+                    "disconnect 65\n"
+                    "connect 1\n");
+    }
+
+    atomic_store(&churning, false);
+    for (int i = 0; i < READER_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    TEST_CHECK(atomic_load(&lookups) > 0);
+    TEST_CHECK(nimble_peripheral_conn_find(129) == stable_index && nimble_peripheral_conn_find(1) >= 0);
+
+    return test_pass("test_concurrency");
+}
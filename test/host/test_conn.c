@@ -0,0 +1,44 @@
+#include "test_common.h"
+
+static nimble_peripheral_handle_t handle;
+static struct ble_gatt_svc_def services[] = {{0}};
+static nimble_peripheral_config_t config = {.device_name = "host-test", .ble_gatt_services = services};
+
+int main(void)
+{
+    test_start(&config, &handle);
+
+    /* Handles that collide modulo the map size still resolve to their own slot. */
+    TEST_SCRIPT("connect 1\n"
+                "connect 65\n"
+                "connect 129\n");
+    TEST_CHECK(nimble_peripheral_conn_find(1) == 0);
+    TEST_CHECK(nimble_peripheral_conn_find(65) == 1);
+    TEST_CHECK(nimble_peripheral_conn_find(129) == 2);
+
+    TEST_SCRIPT("subscribe 1 10 notify\n"
+                "subscribe 129 10 notify\n"
+                "notify 10 4\n"
+                "run\n"
+                "expect sent 2\n"
+                "expect allocs 2\n");
+    TEST_CHECK(mock_nimble.sent[0].len == 4 && mock_nimble.sent[1].conn_handle == 129);
+
+    TEST_SCRIPT("disconnect 1\n"
+                "notify 10 4\n"
+                "run\n"
+                "expect sent 3\n");
+    TEST_CHECK(nimble_peripheral_conn_find(1) == -1);
+    TEST_CHECK(nimble_peripheral_conn_find(65) == 1 && nimble_peripheral_conn_find(129) == 2);
+    TEST_CHECK(mock_nimble.sent[2].conn_handle == 129);
+
+    /* A reused slot bumps its generation and starts without subscriptions. */
+    TEST_SCRIPT("connect 2\n");
+    TEST_CHECK(nimble_peripheral_conn_find(2) == 0);
+    TEST_CHECK(handle.peripheral_conn[0].generation == 2);
+    TEST_SCRIPT("subscribe 129 10 off\n"
+                "notify 10 4 0x105\n"
+                "expect live 0\n");
+
+    return test_pass("test_conn");
+}
@@ -0,0 +1,158 @@
+#include <pthread.h>
+#include <unistd.h>
+#include "test_common.h"
+
+#define KIND_CONNECT 1
+#define KIND_DISCONNECT 2
+#define KIND_SUBSCRIBE_NOTIFY 3
+#define KIND_UNSUBSCRIBE_NOTIFY 4
+#define KIND_SUBSCRIBE_INDICATE 5
+
+static nimble_peripheral_handle_t handle;
+static struct ble_gatt_svc_def services[] = {{0}};
+static int gate_open;
+static int delivered_count;
+static int delivered_kind[64];
+static uint16_t delivered_attr[64];
+static pthread_t host_thread;
+static int wrong_thread;
+
+static void record(int kind, uint16_t attr_handle)
+{
+    if (pthread_equal(pthread_self(), host_thread))
+    {
+        __atomic_store_n(&wrong_thread, 1, __ATOMIC_RELAXED);
+    }
+    int at = __atomic_load_n(&delivered_count, __ATOMIC_RELAXED);
+    delivered_kind[at] = kind;
+    delivered_attr[at] = attr_handle;
+    __atomic_store_n(&delivered_count, at + 1, __ATOMIC_RELEASE);
+}
+
+/* Stands in for a slow NVS write: the worker stalls here until the test opens the gate. */
+static void on_connect(struct ble_gap_event *event, void *arg, int conn_index)
+{
+    while (!__atomic_load_n(&gate_open, __ATOMIC_ACQUIRE))
+    {
+        usleep(100);
+    }
+    record(KIND_CONNECT, event->connect.conn_handle);
+}
+
+static void on_disconnect(struct ble_gap_event *event, void *arg, int conn_index)
+{
+    record(KIND_DISCONNECT, event->disconnect.conn.conn_handle);
+}
+
+static void on_subscribe_notify(struct ble_gap_event *event, void *arg, int conn_index)
+{
+    record(KIND_SUBSCRIBE_NOTIFY, event->subscribe.attr_handle);
+}
+
+static void on_unsubscribe_notify(struct ble_gap_event *event, void *arg, int conn_index)
+{
+    record(KIND_UNSUBSCRIBE_NOTIFY, event->subscribe.attr_handle);
+}
+
+static void on_subscribe_indicate(struct ble_gap_event *event, void *arg, int conn_index)
+{
+    record(KIND_SUBSCRIBE_INDICATE, event->subscribe.attr_handle);
+}
+
+static nimble_peripheral_config_t config = {
+    .device_name = "host-test",
+    .ble_gatt_services = services,
+    .nimble_peripheral_on_connect_cb = on_connect,
+    .nimble_peripheral_on_disconnect_cb = on_disconnect,
+    .nimble_peripheral_on_subscribe_notify_cb = on_subscribe_notify,
+    .nimble_peripheral_on_unsubscribe_notify_cb = on_unsubscribe_notify,
+    .nimble_peripheral_on_subscribe_indicate_cb = on_subscribe_indicate,
+    .dispatch = {.enabled = true, .task_priority = 7, .pin_to_core = true, .task_core = 1},
+};
+
+static void wait_drained(nimble_peripheral_dispatch_stats_t *stats)
+{
+    for (int i = 0; i < 20000; i++)
+    {
+        TEST_CHECK(nimble_peripheral_dispatch_stats(stats) == ESP_OK);
+        if (stats->depth == 0)
+        {
+            return;
+        }
+        usleep(100);
+    }
+    TEST_CHECK(!"dispatch queue not drained");
+}
+
+int main(void)
+{
+    host_thread = pthread_self();
+    nimble_peripheral_dispatch_stats_t stats;
+    TEST_CHECK(nimble_peripheral_dispatch_stats(NULL) == ESP_ERR_INVALID_ARG);
+    TEST_CHECK(nimble_peripheral_dispatch_stats(&stats) == ESP_ERR_INVALID_STATE);
+
+    test_start(&config, &handle);
+    TEST_CHECK(mock_nimble.task_creates == 1 && mock_nimble.task_priority == 7 && mock_nimble.task_core == 1);
+    TEST_CHECK(mock_nimble.task_stack == CONFIG_ESP_NIMBLE_API_DISPATCH_TASK_STACK_SIZE);
+
+    /* The host keeps going while the worker is stuck in the connect callback. */
+    TEST_SCRIPT("connect 1\n"
+                "subscribe 1 10 notify\n"
+                "subscribe 1 10 none\n"
+                "subscribe 1 10 indicate\n");
+    for (uint16_t attr = 11; attr <= 20; attr++)
+    {
+        mock_script_subscribe(1, attr, true, false);
+    }
+    TEST_CHECK(nimble_peripheral_is_subscribed(0, 20, false));
+
+    /* The notify flap on 10 cancelled out; the cancelled record holds its slot until drained. */
+    TEST_CHECK(nimble_peripheral_dispatch_stats(&stats) == ESP_OK);
+    TEST_CHECK(stats.coalesced == 1 && stats.depth == CONFIG_ESP_NIMBLE_API_DISPATCH_QUEUE_SIZE);
+    TEST_CHECK(stats.dropped == 10 - (CONFIG_ESP_NIMBLE_API_DISPATCH_QUEUE_SIZE - 3));
+    TEST_CHECK(__atomic_load_n(&delivered_count, __ATOMIC_ACQUIRE) == 0);
+
+    __atomic_store_n(&gate_open, 1, __ATOMIC_RELEASE);
+    wait_drained(&stats);
+    int expected = 2 + CONFIG_ESP_NIMBLE_API_DISPATCH_QUEUE_SIZE - 3;
+    TEST_CHECK(__atomic_load_n(&delivered_count, __ATOMIC_ACQUIRE) == expected && !wrong_thread);
+    TEST_CHECK(delivered_kind[0] == KIND_CONNECT && delivered_attr[0] == 1);
+    TEST_CHECK(delivered_kind[1] == KIND_SUBSCRIBE_INDICATE && delivered_attr[1] == 10);
+    for (int i = 2; i < expected; i++)
+    {
+        TEST_CHECK(delivered_kind[i] == KIND_SUBSCRIBE_NOTIFY && delivered_attr[i] == 11 + i - 2);
+    }
+    TEST_CHECK(stats.queued == (uint32_t)expected + 1 && stats.delivered == (uint32_t)expected);
+    TEST_CHECK(stats.high_water == CONFIG_ESP_NIMBLE_API_DISPATCH_QUEUE_SIZE);
+
+    /* A flap is not folded across a reconnect of the slot. */
+    __atomic_store_n(&gate_open, 0, __ATOMIC_RELEASE);
+    TEST_SCRIPT("connect 2\n"
+                "subscribe 1 30 notify\n"
+                "disconnect 1\n"
+                "run\n"
+                "connect 3\n"
+                "connect 4\n");
+    TEST_CHECK(nimble_peripheral_conn_find(4) == 0);
+    struct ble_gap_event unsubscribe = {.type = BLE_GAP_EVENT_SUBSCRIBE};
+    unsubscribe.subscribe.conn_handle = 4;
+    unsubscribe.subscribe.attr_handle = 30;
+    unsubscribe.subscribe.prev_notify = 1;
+    mock_nimble_gap_event(&unsubscribe);
+    __atomic_store_n(&gate_open, 1, __ATOMIC_RELEASE);
+    wait_drained(&stats);
+    TEST_CHECK(stats.coalesced == 1 && __atomic_load_n(&delivered_count, __ATOMIC_ACQUIRE) == expected + 6);
+    TEST_CHECK(delivered_kind[expected] == KIND_CONNECT && delivered_attr[expected] == 2);
+    TEST_CHECK(delivered_kind[expected + 1] == KIND_SUBSCRIBE_NOTIFY && delivered_kind[expected + 2] == KIND_DISCONNECT);
+    TEST_CHECK(delivered_kind[expected + 4] == KIND_CONNECT && delivered_attr[expected + 4] == 4);
+    TEST_CHECK(delivered_kind[expected + 5] == KIND_UNSUBSCRIBE_NOTIFY && delivered_attr[expected + 5] == 30);
+
+    /* Deinit delivers the disconnects of the host stop before the worker exits. */
+    int before = __atomic_load_n(&delivered_count, __ATOMIC_ACQUIRE);
+    TEST_CHECK(nimble_peripheral_deinit() == ESP_OK);
+    TEST_CHECK(__atomic_load_n(&delivered_count, __ATOMIC_ACQUIRE) == before + 3);
+    TEST_CHECK(delivered_kind[before] == KIND_DISCONNECT && delivered_kind[before + 2] == KIND_DISCONNECT);
+    TEST_CHECK(nimble_peripheral_dispatch_stats(&stats) == ESP_ERR_INVALID_STATE);
+
+    return test_pass("test_dispatch");
+}
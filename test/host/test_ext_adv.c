@@ -0,0 +1,127 @@
+#include <string.h>
+#include "test_common.h"
+
+static nimble_peripheral_handle_t handle;
+static struct ble_gatt_svc_def services[] = {{0}};
+static const uint8_t payload[200] = {199, 0xff};
+static const nimble_peripheral_ext_adv_set_t sets[] = {
+    {
+        .connectable = true,
+        .primary_phy = BLE_HCI_LE_PHY_1M,
+        .secondary_phy = BLE_HCI_LE_PHY_2M,
+        .itvl_min = 32,
+        .itvl_max = 48,
+        .tx_power = 127,
+        .adv_data = payload,
+        .adv_data_len = sizeof(payload),
+    },
+    {
+        .primary_phy = BLE_HCI_LE_PHY_CODED,
+        .secondary_phy = BLE_HCI_LE_PHY_CODED,
+        .itvl_min = 1600,
+        .itvl_max = 1600,
+        .tx_power = 127,
+        .sid = 1,
+        .adv_data = payload,
+        .adv_data_len = 20,
+    },
+};
+static nimble_peripheral_config_t config = {
+    .device_name = "host-test",
+    .ble_gatt_services = services,
+    .ext_adv_sets = sets,
+    .ext_adv_set_count = 2,
+};
+
+static void adv_complete(uint8_t instance, int reason)
+{
+    struct ble_gap_event event = {.type = BLE_GAP_EVENT_ADV_COMPLETE};
+    event.adv_complete.instance = instance;
+    event.adv_complete.reason = reason;
+    mock_nimble.ext_adv[instance].active = false;
+    mock_nimble_gap_event(&event);
+}
+
+int main(void)
+{
+    /* The bonded reconnect sequence drives legacy advertising only. */
+    nimble_peripheral_config_t reconnect_config = config;
+    reconnect_config.sm_bonding = true;
+    reconnect_config.fast_reconnect = true;
+    mock_nimble_reset();
+    TEST_CHECK(nimble_peripheral_init(&reconnect_config, &handle) == ESP_ERR_NOT_SUPPORTED);
+
+    test_start(&config, &handle);
+    TEST_CHECK(mock_nimble.ext_adv[0].active && mock_nimble.ext_adv[1].active && !mock_nimble.ext_adv[2].configured);
+    TEST_CHECK(mock_nimble.ext_adv[0].data_len == sizeof(payload) && mock_nimble.ext_adv[0].params.secondary_phy == BLE_HCI_LE_PHY_2M);
+    TEST_CHECK(mock_nimble.ext_adv[1].params.primary_phy == BLE_HCI_LE_PHY_CODED && !mock_nimble.ext_adv[1].params.connectable);
+
+    /* The connectable set restarts after each connection until the slots run out. */
+    for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++)
+    {
+        mock_nimble.ext_adv[0].active = false;
+        mock_script_connect(i + 1);
+        adv_complete(0, 0);
+    }
+    TEST_CHECK(!mock_nimble.ext_adv[0].active && mock_nimble.ext_adv[1].active);
+    TEST_CHECK(mock_nimble.ext_adv[0].starts == CONFIG_BT_NIMBLE_MAX_CONNECTIONS);
+    mock_script_disconnect(2, 0);
+    TEST_CHECK(mock_nimble.ext_adv[0].active);
+
+    /* A finite runtime set stays down once its duration expires. */
+    nimble_peripheral_ext_adv_set_t runtime_set = {
+        .scannable = true,
+        .primary_phy = BLE_HCI_LE_PHY_1M,
+        .secondary_phy = BLE_HCI_LE_PHY_1M,
+        .itvl_min = 160,
+        .itvl_max = 160,
+        .duration_ms = 1000,
+        .rsp_data = payload,
+        .rsp_data_len = 10,
+    };
+    TEST_CHECK(nimble_peripheral_ext_adv_configure(2, &runtime_set) == ESP_OK);
+    TEST_CHECK(nimble_peripheral_ext_adv_start(2) == ESP_OK && mock_nimble.ext_adv[2].active);
+    adv_complete(2, BLE_HS_ETIMEOUT);
+    TEST_CHECK(!mock_nimble.ext_adv[2].active);
+
+    TEST_CHECK(nimble_peripheral_ext_adv_set_data(1, payload, 50, false) == ESP_OK && mock_nimble.ext_adv[1].data_len == 50);
+    TEST_CHECK(nimble_peripheral_ext_adv_stop(1) == ESP_OK && !mock_nimble.ext_adv[1].active);
+    TEST_CHECK(nimble_peripheral_ext_adv_configure(EXT_ADV_MAX_SETS, &runtime_set) == ESP_ERR_INVALID_ARG);
+    runtime_set.connectable = true;
+    TEST_CHECK(nimble_peripheral_ext_adv_configure(2, &runtime_set) == ESP_ERR_INVALID_ARG);
+
+    /* With max_connections = 1 the first central stops every connectable set; beacons keep running. */
+    TEST_SCRIPT("disconnect 1\n"
+                "disconnect 3\n"
+                "run\n");
+    runtime_set.scannable = false;
+    runtime_set.duration_ms = 0;
+    runtime_set.rsp_data = NULL;
+    runtime_set.rsp_data_len = 0;
+    runtime_set.adv_data = payload;
+    runtime_set.adv_data_len = 20;
+    TEST_CHECK(nimble_peripheral_ext_adv_configure(2, &runtime_set) == ESP_OK);
+    TEST_CHECK(nimble_peripheral_ext_adv_start(1) == ESP_OK && nimble_peripheral_ext_adv_start(2) == ESP_OK);
+    TEST_CHECK(mock_nimble.ext_adv[0].active && mock_nimble.ext_adv[1].active && mock_nimble.ext_adv[2].active);
+    config.adv_schedule.max_connections = 1;
+    mock_nimble.ext_adv[0].active = false;
+    mock_script_connect(5);
+    TEST_CHECK(!mock_nimble.ext_adv[2].active && mock_nimble.ext_adv[1].active);
+    TEST_CHECK(nimble_peripheral_adv_phase_get() == NIMBLE_PERIPHERAL_ADV_PHASE_PAUSED);
+    adv_complete(0, 0);
+    TEST_CHECK(nimble_peripheral_ext_adv_start(2) == ESP_OK);
+    TEST_CHECK(!mock_nimble.ext_adv[0].active && !mock_nimble.ext_adv[2].active);
+    mock_script_disconnect(5, 0);
+    TEST_CHECK(mock_nimble.ext_adv[0].active && mock_nimble.ext_adv[2].active);
+    TEST_CHECK(nimble_peripheral_adv_phase_get() == NIMBLE_PERIPHERAL_ADV_PHASE_SLOW);
+    config.adv_schedule.max_connections = 0;
+
+    /* Without configured sets a legacy PDU set is built from the advertising cache. */
+    config.ext_adv_set_count = 0;
+    memset(mock_nimble.ext_adv, 0, sizeof(mock_nimble.ext_adv));
+    mock_nimble_sync();
+    TEST_CHECK(mock_nimble.ext_adv[0].active && mock_nimble.ext_adv[0].params.legacy_pdu);
+    TEST_CHECK(mock_nimble.ext_adv[0].data_len > 0 && mock_nimble.ext_adv[0].rsp_len > 0);
+
+    return test_pass("test_ext_adv");
+}
@@ -0,0 +1,99 @@
+#include "test_common.h"
+
+enum
+{
+    RESULT_CONFIRMED,
+    RESULT_TIMEOUT,
+    RESULT_DROPPED,
+    RESULT_FAILED,
+    RESULT_COUNT
+};
+
+static nimble_peripheral_handle_t handle;
+static struct ble_gatt_svc_def services[] = {{0}};
+static nimble_peripheral_config_t config = {.device_name = "host-test", .ble_gatt_services = services};
+static int results[CONFIG_BT_NIMBLE_MAX_CONNECTIONS][RESULT_COUNT];
+
+static void indicate_cb(int conn_index, uint16_t attr_handle, esp_err_t status, void *arg)
+{
+    switch (status)
+    {
+    case ESP_OK:
+        results[conn_index][RESULT_CONFIRMED]++;
+        break;
+    case ESP_ERR_TIMEOUT:
+        results[conn_index][RESULT_TIMEOUT]++;
+        break;
+    case ESP_ERR_INVALID_STATE:
+        results[conn_index][RESULT_DROPPED]++;
+        break;
+    default:
+        results[conn_index][RESULT_FAILED]++;
+        break;
+    }
+}
+
+static void confirm(uint16_t conn_handle, int status)
+{
+    struct ble_gap_event event = {.type = BLE_GAP_EVENT_NOTIFY_TX};
+    event.notify_tx.conn_handle = conn_handle;
+    event.notify_tx.attr_handle = 10;
+    event.notify_tx.indication = 1;
+    event.notify_tx.status = status;
+    mock_nimble_gap_event(&event);
+    mock_nimble_run_events();
+}
+
+int main(void)
+{
+    uint8_t value = 1;
+
+    test_start(&config, &handle);
+    TEST_SCRIPT("connect 1\n"
+                "connect 2\n"
+                "subscribe 1 10 indicate\n"
+                "subscribe 2 10 indicate\n");
+
+    TEST_CHECK(nimble_peripheral_indicate(0, 11, &value, 1, indicate_cb, NULL) == ESP_ERR_NOT_FOUND);
+    for (int i = 0; i < 3; i++)
+    {
+        TEST_CHECK(nimble_peripheral_indicate_all(10, &value, 1, indicate_cb, NULL) == ESP_OK);
+    }
+    mock_nimble_run_events();
+
+    /* One indication in flight per connection, the next goes out on confirmation. */
+    TEST_CHECK(mock_nimble.sent_count == 2 && mock_nimble.sent[0].indication && mock_nimble.sent[1].conn_handle == 2);
+    confirm(2, BLE_HS_EDONE);
+    TEST_CHECK(mock_nimble.sent_count == 3 && results[1][RESULT_CONFIRMED] == 1 && mock_nimble.sent[2].conn_handle == 2);
+    confirm(2, BLE_HS_EDONE);
+    confirm(2, BLE_HS_EDONE);
+    TEST_CHECK(results[1][RESULT_CONFIRMED] == 3 && mock_nimble.sent_count == 4);
+
+    confirm(1, BLE_HS_ETIMEOUT);
+    TEST_CHECK(results[0][RESULT_TIMEOUT] == 1 && mock_nimble.sent_count == 5);
+    mock_nimble.notify_rc = BLE_HS_ENOMEM;
+    confirm(1, BLE_HS_EDONE);
+    TEST_CHECK(results[0][RESULT_CONFIRMED] == 1 && results[0][RESULT_FAILED] == 1);
+    mock_nimble.notify_rc = 0;
+
+    for (int i = 0; i < CONFIG_ESP_NIMBLE_API_INDICATE_QUEUE_DEPTH; i++)
+    {
+        TEST_CHECK(nimble_peripheral_indicate(0, 10, &value, 1, indicate_cb, NULL) == ESP_OK);
+    }
+    TEST_CHECK(nimble_peripheral_indicate(0, 10, &value, 1, indicate_cb, NULL) == ESP_ERR_NO_MEM);
+    mock_nimble_run_events();
+
+    /* A full queue on one subscriber is reported without holding back the others. */
+    TEST_CHECK(nimble_peripheral_indicate_all(10, &value, 1, indicate_cb, NULL) == ESP_ERR_NO_MEM);
+    mock_nimble_run_events();
+    TEST_CHECK(mock_nimble.sent[mock_nimble.sent_count - 1].conn_handle == 2);
+    confirm(2, BLE_HS_EDONE);
+    TEST_CHECK(results[1][RESULT_CONFIRMED] == 4);
+
+    /* Disconnecting completes everything still queued. */
+    TEST_SCRIPT("disconnect 1\n"
+                "expect live 0\n");
+    TEST_CHECK(results[0][RESULT_DROPPED] == CONFIG_ESP_NIMBLE_API_INDICATE_QUEUE_DEPTH);
+
+    return test_pass("test_indicate");
+}
@@ -0,0 +1,88 @@
+#include "test_common.h"
+
+static nimble_peripheral_handle_t handle;
+static struct ble_gatt_svc_def services[] = {{0}};
+static esp_err_t ready_status[4];
+static int ready_count;
+static int disconnects;
+
+static void on_ready(esp_err_t status)
+{
+    ready_status[ready_count++] = status;
+}
+
+static void on_disconnect(struct ble_gap_event *event, void *arg, int conn_index)
+{
+    disconnects++;
+}
+
+static nimble_peripheral_config_t config = {
+    .device_name = "host-test",
+    .ble_gatt_services = services,
+    .nimble_peripheral_on_ready_cb = on_ready,
+    .nimble_peripheral_on_disconnect_cb = on_disconnect,
+};
+
+int main(void)
+{
+    /* An address failure during sync is reported instead of aborting. */
+    mock_nimble_reset();
+    mock_nimble.ensure_addr_rc = BLE_HS_ENOADDR;
+    TEST_CHECK(nimble_peripheral_init(&config, &handle) == ESP_OK);
+    TEST_CHECK(nimble_peripheral_init(&config, &handle) == ESP_ERR_INVALID_STATE);
+    TEST_CHECK(nimble_peripheral_wait_ready(0) == ESP_ERR_TIMEOUT);
+    mock_nimble_sync();
+    TEST_CHECK(nimble_peripheral_wait_ready(0) == ESP_FAIL);
+    TEST_CHECK(ready_count == 1 && ready_status[0] == ESP_FAIL && mock_nimble.adv_start_calls == 0);
+
+    /* Restart syncs the same host again, without touching the port or the GATT tables. */
+    mock_nimble.ensure_addr_rc = 0;
+    TEST_CHECK(nimble_peripheral_restart() == ESP_OK);
+    TEST_CHECK(nimble_peripheral_wait_ready(0) == ESP_ERR_TIMEOUT);
+    TEST_CHECK(mock_nimble.hs_stops == 1 && mock_nimble.hs_starts == 1);
+    mock_nimble_advance(5);
+    mock_nimble_sync();
+    TEST_CHECK(nimble_peripheral_wait_ready(0) == ESP_OK);
+    TEST_CHECK(ready_count == 2 && ready_status[1] == ESP_OK && handle.time_to_ready_us == 5000);
+    TEST_CHECK(mock_nimble.adv_start_calls == 1 && mock_nimble.port_inits == 1);
+
+    /* Peers are disconnected through the usual callbacks, and advertising waits for the new sync. */
+    TEST_SCRIPT("connect 1\n"
+                "connect 2\n"
+                "subscribe 1 10 notify\n");
+    uint32_t starts = mock_nimble.adv_start_calls;
+    TEST_CHECK(nimble_peripheral_coalesce_enable(10, 20) == ESP_OK);
+    TEST_CHECK(nimble_peripheral_restart() == ESP_OK);
+    TEST_CHECK(disconnects == 2 && handle.peripheral_conn_active_count == 0);
+    TEST_CHECK(mock_nimble.adv_start_calls == starts);
+    mock_nimble_run_events();
+    TEST_CHECK(mock_nimble.hs_starts == 2);
+    mock_nimble_sync();
+    TEST_CHECK(nimble_peripheral_wait_ready(0) == ESP_OK && mock_nimble.adv_start_calls == starts + 1);
+    TEST_CHECK(nimble_peripheral_notify_flush(10) == ESP_OK);
+
+    /* Deinit releases the stack and the coalescers; init can then run again. */
+    TEST_SCRIPT("connect 3\n");
+    TEST_CHECK(nimble_peripheral_deinit() == ESP_OK);
+    TEST_CHECK(disconnects == 3 && mock_nimble.port_inits == 0);
+    TEST_CHECK(mock_nimble.npl_live == 0 && mock_nimble.npl_calls_unported == 0);
+    TEST_CHECK(nimble_peripheral_deinit() == ESP_ERR_INVALID_STATE);
+    TEST_CHECK(nimble_peripheral_restart() == ESP_ERR_INVALID_STATE);
+    TEST_CHECK(nimble_peripheral_wait_ready(0) == ESP_ERR_INVALID_STATE);
+
+    TEST_CHECK(nimble_peripheral_init(&config, &handle) == ESP_OK);
+    TEST_CHECK(nimble_peripheral_wait_ready(0) == ESP_ERR_TIMEOUT);
+    mock_nimble_sync();
+    TEST_CHECK(nimble_peripheral_wait_ready(0) == ESP_OK && ready_count == 4);
+    TEST_CHECK(nimble_peripheral_notify_flush(10) == ESP_ERR_INVALID_STATE);
+
+    /* A second cycle leaves no events or callouts behind and makes no NPL call once the port is gone. */
+    TEST_CHECK(nimble_peripheral_coalesce_enable(10, 20) == ESP_OK);
+    TEST_CHECK(nimble_peripheral_coalesce_disable(10) == ESP_OK);
+    TEST_CHECK(nimble_peripheral_coalesce_enable(11, 20) == ESP_OK);
+    TEST_CHECK(nimble_peripheral_deinit() == ESP_OK);
+    TEST_CHECK(mock_nimble.npl_live == 0 && mock_nimble.npl_calls_unported == 0);
+    TEST_SCRIPT("expect live 0\n");
+
+    return test_pass("test_lifecycle");
+}
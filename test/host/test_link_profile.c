@@ -0,0 +1,59 @@
+#include "test_common.h"
+
+static nimble_peripheral_handle_t handle;
+static struct ble_gatt_svc_def services[] = {{0}};
+static int link_updates;
+
+static void link_update_cb(struct ble_gap_event *event, void *arg, int conn_index)
+{
+    link_updates++;
+}
+
+static nimble_peripheral_config_t config = {
+    .device_name = "host-test",
+    .ble_gatt_services = services,
+    .link_profile = NIMBLE_PERIPHERAL_LINK_PROFILE_THROUGHPUT,
+    .nimble_peripheral_on_link_update_cb = link_update_cb,
+};
+
+int main(void)
+{
+    test_start(&config, &handle);
+    TEST_SCRIPT("connect 1\n");
+    TEST_CHECK(mock_nimble.phy_requests == 1 && mock_nimble.data_len_requests == 1);
+    TEST_CHECK(mock_nimble.conn_update_requests == 1 && mock_nimble.last_upd_params.itvl_max == 12);
+
+    /* Rejected parameters are retried with a relaxed interval a bounded number of times. */
+    struct ble_gap_event update = {.type = BLE_GAP_EVENT_CONN_UPDATE};
+    update.conn_update.conn_handle = 1;
+    update.conn_update.status = BLE_HS_HCI_ERR(BLE_ERR_UNSUPP_LMP_LL_PARM);
+    for (int i = 0; i < LINK_PROFILE_MAX_RETRIES + 2; i++)
+    {
+        mock_nimble_gap_event(&update);
+    }
+    TEST_CHECK(mock_nimble.conn_update_requests == 1 + LINK_PROFILE_MAX_RETRIES);
+    TEST_CHECK(mock_nimble.last_upd_params.itvl_max == 96);
+    update.conn_update.status = 0;
+    mock_nimble_gap_event(&update);
+
+    struct ble_gap_event phy = {.type = BLE_GAP_EVENT_PHY_UPDATE_COMPLETE};
+    phy.phy_updated.conn_handle = 1;
+    phy.phy_updated.tx_phy = BLE_GAP_LE_PHY_2M;
+    phy.phy_updated.rx_phy = BLE_GAP_LE_PHY_2M;
+    mock_nimble_gap_event(&phy);
+
+    struct ble_gap_event data_len = {.type = BLE_GAP_EVENT_DATA_LEN_CHG};
+    data_len.data_len_chg.conn_handle = 1;
+    data_len.data_len_chg.max_tx_octets = 251;
+    data_len.data_len_chg.max_rx_octets = 251;
+    mock_nimble_gap_event(&data_len);
+
+    TEST_CHECK(link_updates == 3);
+    TEST_CHECK(handle.peripheral_conn[0].tx_phy == BLE_GAP_LE_PHY_2M && handle.peripheral_conn[0].max_tx_octets == 251);
+
+    TEST_CHECK(nimble_peripheral_link_profile_set(0, NIMBLE_PERIPHERAL_LINK_PROFILE_LOW_POWER) == ESP_OK);
+    TEST_CHECK(mock_nimble.last_upd_params.latency == 4 && mock_nimble.last_upd_params.itvl_max == 160);
+    TEST_CHECK(nimble_peripheral_link_profile_set(1, NIMBLE_PERIPHERAL_LINK_PROFILE_LOW_POWER) == ESP_ERR_INVALID_STATE);
+
+    return test_pass("test_link_profile");
+}
@@ -0,0 +1,52 @@
+#include "test_common.h"
+
+static nimble_peripheral_handle_t handle;
+static struct ble_gatt_svc_def services[] = {{0}};
+static nimble_peripheral_config_t config = {.device_name = "host-test", .ble_gatt_services = services};
+
+int main(void)
+{
+    nimble_peripheral_metrics_t metrics;
+    uint8_t data[20] = {0};
+
+    test_start(&config, &handle);
+
+    /* Three notifications complete 3 ms after being queued, then one is refused by the host. */
+    TEST_SCRIPT("connect 1\n"
+                "subscribe 1 10 notify\n"
+                "defer on\n"
+                "notify 10 20\n"
+                "notify 10 20\n"
+                "notify 10 20\n"
+                "run\n"
+                "advance 3\n"
+                "complete 3\n"
+                "run\n"
+                "rc 6\n"
+                "notify 10 20\n"
+                "run\n"
+                "complete 5\n");
+    TEST_CHECK(nimble_peripheral_metrics_snapshot(&metrics) == ESP_OK);
+    TEST_CHECK(metrics.conn[0].tx_pdus == 3 && metrics.conn[0].tx_bytes == 3 * sizeof(data));
+    TEST_CHECK(metrics.conn[0].notify_errors[BLE_HS_ENOMEM] == 1);
+    TEST_CHECK(metrics.conn[0].latency_hist[2] == 3 && metrics.conn[0].latency_max_us == 3000);
+
+    struct os_mbuf *om = ble_hs_mbuf_from_flat(data, 5);
+    TEST_CHECK(nimble_peripheral_rx_push(1, om) == ESP_OK);
+    os_mbuf_free_chain(om);
+    TEST_CHECK(nimble_peripheral_metrics_snapshot(&metrics) == ESP_OK);
+    TEST_CHECK(metrics.conn[0].rx_bytes == 5 && metrics.conn[0].rx_pdus == 1);
+
+    TEST_SCRIPT("disconnect 1 0x213\n");
+    nimble_peripheral_metrics_snapshot(&metrics);
+    TEST_CHECK(metrics.disconnect_reasons[0x13] == 1 && metrics.conn[0].disconnect_reason == BLE_HS_HCI_ERR(0x13));
+
+    TEST_CHECK(nimble_peripheral_metrics_reset(0) == ESP_OK);
+    nimble_peripheral_metrics_snapshot(&metrics);
+    TEST_CHECK(metrics.conn[0].tx_pdus == 0 && metrics.disconnect_reasons[0x13] == 1);
+    TEST_CHECK(nimble_peripheral_metrics_reset(-1) == ESP_OK);
+    nimble_peripheral_metrics_snapshot(&metrics);
+    TEST_CHECK(metrics.disconnect_reasons[0x13] == 0);
+
+    return test_pass("test_metrics");
+}
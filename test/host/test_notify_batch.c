@@ -0,0 +1,110 @@
+#include <string.h>
+#include "test_common.h"
+
+static nimble_peripheral_handle_t handle;
+static struct ble_gatt_svc_def services[] = {{0}};
+static nimble_peripheral_config_t config = {.device_name = "host-test", .ble_gatt_services = services};
+static uint8_t payload[6][30];
+
+static void batch(nimble_peripheral_notify_entry_t *entries, int count, uint16_t first_handle, size_t len)
+{
+    for (int i = 0; i < count; i++)
+    {
+        entries[i] = (nimble_peripheral_notify_entry_t){.attr_handle = first_handle + i, .data = payload[i], .len = len};
+    }
+}
+
+/* The values sent to conn_handle since index from, in order, must be the given handles. */
+static bool sent_handles(uint32_t from, uint16_t conn_handle, const uint16_t *handles, int count)
+{
+    int n = 0;
+    for (uint32_t i = from; i < mock_nimble.sent_count; i++)
+    {
+        const mock_sent_t *sent = &mock_nimble.sent[i];
+        if (sent->conn_handle != conn_handle)
+        {
+            continue;
+        }
+        if (n == count || sent->attr_handle != handles[n] || memcmp(sent->data, payload[handles[n] - 10], sent->len) != 0)
+        {
+            return false;
+        }
+        n++;
+    }
+    return n == count;
+}
+
+int main(void)
+{
+    for (int i = 0; i < 6; i++)
+    {
+        memset(payload[i], 'a' + i, sizeof(payload[i]));
+    }
+
+    test_start(&config, &handle);
+    TEST_SCRIPT("connect 1\n"
+                "connect 2\n"
+                "subscribe 1 10 notify\n"
+                "subscribe 1 11 notify\n"
+                "subscribe 1 12 notify\n"
+                "subscribe 1 13 notify\n"
+                "subscribe 1 14 notify\n"
+                "subscribe 2 10 notify\n"
+                "subscribe 2 11 notify\n"
+                "mtu 1 100\n");
+    mock_nimble.peer_cl_sup_feat[1] = 0x04;
+
+    nimble_peripheral_notify_entry_t entries[CONFIG_ESP_NIMBLE_API_TX_QUEUE_WATERMARK + 1];
+    batch(entries, 6, 10, 8);
+    TEST_CHECK(nimble_peripheral_notify_batch(NULL, 1, 0) == ESP_ERR_INVALID_ARG);
+    TEST_CHECK(nimble_peripheral_notify_batch(entries, 0, 0) == ESP_ERR_INVALID_ARG);
+    TEST_CHECK(nimble_peripheral_notify_batch(entries, CONFIG_ESP_NIMBLE_API_TX_QUEUE_WATERMARK + 1, 0) == ESP_ERR_INVALID_SIZE);
+    TEST_CHECK(nimble_peripheral_notify_batch(&entries[5], 1, 0) == ESP_ERR_NOT_FOUND);
+
+    /* A peer announcing support gets packed PDUs, up to its TX credits; the other one gets single notifications. */
+    nimble_peripheral_metrics_t metrics;
+    uint32_t sent_before = mock_nimble.sent_count;
+    TEST_CHECK(nimble_peripheral_notify_batch(entries, 6, 0) == ESP_OK);
+    TEST_SCRIPT("run\n");
+    TEST_CHECK(mock_nimble.notify_multiple_calls == 1 && mock_nimble.notify_calls == 4);
+    TEST_CHECK(sent_handles(sent_before, 1, (const uint16_t[]){10, 11, 12, 13, 14}, 5));
+    TEST_CHECK(sent_handles(sent_before, 2, (const uint16_t[]){10, 11}, 2));
+    TEST_CHECK(nimble_peripheral_metrics_snapshot(&metrics) == ESP_OK);
+    TEST_CHECK(metrics.conn[0].tx_pdus == 2 && metrics.conn[0].tx_bytes == 5 * 8);
+    TEST_CHECK(metrics.conn[1].tx_pdus == 2 && metrics.conn[1].tx_bytes == 2 * 8);
+
+    /* A PDU holds as many values as fit in the MTU: 1 + 2 * (4 + 30) of 100 bytes. */
+    sent_before = mock_nimble.sent_count;
+    batch(entries, 3, 10, 30);
+    TEST_CHECK(nimble_peripheral_notify_batch(entries, 3, 0) == ESP_OK);
+    TEST_SCRIPT("run\n");
+    TEST_CHECK(mock_nimble.notify_multiple_calls == 2 && mock_nimble.notify_calls == 8);
+    TEST_CHECK(sent_handles(sent_before, 1, (const uint16_t[]){10, 11, 12}, 3));
+
+    /* A subscriber without room for its whole share gets none of it; the others are not held back. */
+    TEST_SCRIPT("subscribe 2 16 notify\n"
+                "defer on\n");
+    for (int i = 0; i < CONFIG_ESP_NIMBLE_API_TX_CREDITS + CONFIG_ESP_NIMBLE_API_TX_QUEUE_WATERMARK - 1; i++)
+    {
+        TEST_CHECK(nimble_peripheral_notify(16, payload[0], 4) == ESP_OK);
+        mock_nimble_run_events();
+    }
+    sent_before = mock_nimble.sent_count;
+    batch(entries, 2, 10, 8);
+    TEST_CHECK(nimble_peripheral_notify_batch(entries, 2, 0) == ESP_ERR_TIMEOUT);
+    TEST_SCRIPT("run\n");
+    TEST_CHECK(mock_nimble.notify_multiple_calls == 3);
+    TEST_CHECK(sent_handles(sent_before, 1, (const uint16_t[]){10, 11}, 2) && sent_handles(sent_before, 2, NULL, 0));
+
+    TEST_SCRIPT("defer off\n"
+                "complete 64\n"
+                "run\n"
+                "complete 64\n"
+                "run\n"
+                "disconnect 1\n"
+                "disconnect 2\n"
+                "run\n"
+                "expect live 0\n");
+
+    return test_pass("test_notify_batch");
+}
@@ -0,0 +1,114 @@
+#include <string.h>
+#include "test_common.h"
+#include "esp_nimble_observer.h"
+
+static nimble_peripheral_handle_t handle;
+static struct ble_gatt_svc_def services[] = {{0}};
+static nimble_peripheral_config_t config = {.device_name = "host-test", .ble_gatt_services = services};
+static nimble_observer_report_t last;
+static int delivered;
+
+static void on_report(const nimble_observer_report_t *report, void *arg)
+{
+    last = *report;
+    delivered++;
+}
+
+static const uint16_t company_ids[] = {0x02e5};
+static const ble_uuid_any_t uuids[] = {{.u16 = BLE_UUID16_INIT(0xfeaa)}};
+static const uint8_t tag_adv[] = {
+    0x02, BLE_HS_ADV_TYPE_FLAGS, 0x06,
+    0x05, BLE_HS_ADV_TYPE_COMP_UUIDS16, 0x0f, 0x18, 0xaa, 0xfe,
+    0x04, BLE_HS_ADV_TYPE_COMP_NAME, 't', 'a', 'g',
+    0x02, BLE_HS_ADV_TYPE_TX_PWR_LVL, 0xf4,
+    0x05, BLE_HS_ADV_TYPE_MFG_DATA, 0xe5, 0x02, 0x01, 0x02,
+};
+
+static void report(uint8_t addr_last, int8_t rssi, uint8_t event_type, const uint8_t *data, uint8_t len)
+{
+    ble_addr_t addr = {.type = BLE_ADDR_PUBLIC, .val = {addr_last, 0x11, 0x22, 0x33, 0x44, 0x55}};
+    mock_nimble_disc_report(&addr, rssi, event_type, data, len);
+}
+
+int main(void)
+{
+    test_start(&config, &handle);
+
+    /* Decoding points into the report instead of copying it. */
+    nimble_observer_report_t parsed;
+    TEST_CHECK(nimble_observer_parse(tag_adv, sizeof(tag_adv), &parsed) == ESP_OK);
+    TEST_CHECK(parsed.flags == 0x06 && parsed.uuid16_count == 2 && parsed.uuids16[1] == 0xfeaa && parsed.tx_power == -12);
+    TEST_CHECK(parsed.name_len == 3 && memcmp(parsed.name, "tag", 3) == 0 && parsed.name >= tag_adv && parsed.name < tag_adv + sizeof(tag_adv));
+    TEST_CHECK(parsed.has_mfg_data && parsed.company_id == 0x02e5 && parsed.mfg_data_len == 2 && parsed.mfg_data[1] == 0x02);
+    TEST_CHECK(!parsed.has_uuid128 && parsed.svc_data == NULL);
+    const uint8_t truncated[] = {0x05, BLE_HS_ADV_TYPE_COMP_NAME, 'a'};
+    TEST_CHECK(nimble_observer_parse(truncated, sizeof(truncated), &parsed) == ESP_ERR_INVALID_SIZE);
+
+    nimble_observer_config_t observer = {
+        .active = true,
+        .dedup_ttl_ms = 1000,
+        .filter = {.rssi_min = -80, .company_ids = company_ids, .company_id_count = 1},
+        .nimble_observer_on_report_cb = on_report,
+    };
+    TEST_CHECK(nimble_observer_stop() == ESP_ERR_INVALID_STATE);
+    TEST_CHECK(nimble_observer_start(&observer, BLE_HS_FOREVER) == ESP_OK);
+    TEST_CHECK(nimble_observer_start(&observer, BLE_HS_FOREVER) == ESP_ERR_INVALID_STATE);
+    TEST_CHECK(mock_nimble.disc_active && !mock_nimble.disc_params.passive && !mock_nimble.disc_params.filter_duplicates);
+
+    /* Repeats are dropped until the payload changes or the TTL runs out. */
+    report(1, -50, BLE_HCI_ADV_RPT_EVTYPE_ADV_IND, tag_adv, sizeof(tag_adv));
+    TEST_CHECK(delivered == 1 && last.addr.val[0] == 1 && last.rssi == -50 && last.company_id == 0x02e5);
+    report(1, -52, BLE_HCI_ADV_RPT_EVTYPE_ADV_IND, tag_adv, sizeof(tag_adv));
+    TEST_CHECK(delivered == 1);
+    uint8_t changed[sizeof(tag_adv)];
+    memcpy(changed, tag_adv, sizeof(changed));
+    changed[sizeof(changed) - 1] = 0x03;
+    report(1, -50, BLE_HCI_ADV_RPT_EVTYPE_ADV_IND, changed, sizeof(changed));
+    TEST_CHECK(delivered == 2 && last.mfg_data[1] == 0x03);
+    mock_nimble_advance(999);
+    report(1, -50, BLE_HCI_ADV_RPT_EVTYPE_ADV_IND, changed, sizeof(changed));
+    TEST_CHECK(delivered == 2);
+    mock_nimble_advance(1);
+    report(1, -50, BLE_HCI_ADV_RPT_EVTYPE_ADV_IND, changed, sizeof(changed));
+    TEST_CHECK(delivered == 3);
+
+    /* Scan responses are tracked apart from the advertising payload. */
+    report(1, -50, BLE_HCI_ADV_RPT_EVTYPE_SCAN_RSP, tag_adv, sizeof(tag_adv));
+    TEST_CHECK(delivered == 4 && last.event_type == BLE_HCI_ADV_RPT_EVTYPE_SCAN_RSP);
+    report(1, -50, BLE_HCI_ADV_RPT_EVTYPE_ADV_IND, changed, sizeof(changed));
+    TEST_CHECK(delivered == 4);
+
+    /* Filters run before the cache and the callback. */
+    report(2, -90, BLE_HCI_ADV_RPT_EVTYPE_ADV_IND, tag_adv, sizeof(tag_adv));
+    report(3, -40, BLE_HCI_ADV_RPT_EVTYPE_ADV_IND, tag_adv, sizeof(tag_adv) - 6);
+    report(4, -40, BLE_HCI_ADV_RPT_EVTYPE_ADV_IND, truncated, sizeof(truncated));
+    TEST_CHECK(delivered == 4);
+
+    /* More tags than cache slots: older entries make room, every new tag still gets through. */
+    for (int i = 0; i < 4 * CONFIG_ESP_NIMBLE_API_OBSERVER_CACHE_SIZE; i++)
+    {
+        report((uint8_t)(16 + i), -60, BLE_HCI_ADV_RPT_EVTYPE_NONCONN_IND, tag_adv, sizeof(tag_adv));
+    }
+    TEST_CHECK(delivered == 4 + 4 * CONFIG_ESP_NIMBLE_API_OBSERVER_CACHE_SIZE);
+
+    nimble_observer_stats_t stats;
+    TEST_CHECK(nimble_observer_stats(&stats) == ESP_OK);
+    TEST_CHECK(stats.reports == 10 + 4 * CONFIG_ESP_NIMBLE_API_OBSERVER_CACHE_SIZE && stats.delivered == (uint32_t)delivered);
+    TEST_CHECK(stats.duplicates == 3 && stats.filtered == 2 && stats.malformed == 1);
+    TEST_CHECK(stats.evictions >= 3 * CONFIG_ESP_NIMBLE_API_OBSERVER_CACHE_SIZE);
+
+    /* Service UUIDs and service data UUIDs both satisfy a UUID filter. */
+    TEST_CHECK(nimble_observer_stop() == ESP_OK && !mock_nimble.disc_active);
+    nimble_observer_config_t by_uuid = {.filter = {.uuids = uuids, .uuid_count = 1}, .nimble_observer_on_report_cb = on_report};
+    TEST_CHECK(nimble_observer_start(&by_uuid, 10000) == ESP_OK && mock_nimble.disc_params.passive);
+    const uint8_t eddystone[] = {0x06, BLE_HS_ADV_TYPE_SVC_DATA_UUID16, 0xaa, 0xfe, 0x10, 0x00, 0x01};
+    delivered = 0;
+    report(5, -70, BLE_HCI_ADV_RPT_EVTYPE_NONCONN_IND, eddystone, sizeof(eddystone));
+    report(5, -70, BLE_HCI_ADV_RPT_EVTYPE_NONCONN_IND, eddystone, sizeof(eddystone));
+    report(6, -70, BLE_HCI_ADV_RPT_EVTYPE_NONCONN_IND, tag_adv, sizeof(tag_adv));
+    report(7, -70, BLE_HCI_ADV_RPT_EVTYPE_NONCONN_IND, truncated, 0);
+    TEST_CHECK(delivered == 3 && last.addr.val[0] == 6);
+    TEST_CHECK(nimble_observer_stats(&stats) == ESP_OK && stats.reports == 4 && stats.filtered == 1);
+
+    return test_pass("test_observer");
+}
@@ -0,0 +1,83 @@
+#include "test_common.h"
+
+static nimble_peripheral_handle_t handle;
+static struct ble_gatt_svc_def services[] = {{0}};
+static nimble_peripheral_config_t config = {.device_name = "host-test", .ble_gatt_services = services, .sm_bonding = true, .fast_reconnect = true};
+
+static void adv_timeout(void)
+{
+    struct ble_gap_event event = {.type = BLE_GAP_EVENT_ADV_COMPLETE};
+    event.adv_complete.reason = BLE_HS_ETIMEOUT;
+    mock_nimble_gap_event(&event);
+}
+
+int main(void)
+{
+    ble_addr_t peers[CONFIG_BT_NIMBLE_MAX_BONDS];
+    int count;
+
+    mock_nimble_reset();
+    mock_nimble.bonds[0].val[0] = 7;
+    mock_nimble.bonds[1].val[0] = 8;
+    mock_nimble.bond_count = 2;
+
+    nimble_peripheral_config_t unbonded = config;
+    unbonded.sm_bonding = false;
+    TEST_CHECK(nimble_peripheral_init(&unbonded, &handle) == ESP_ERR_INVALID_ARG);
+    TEST_CHECK(nimble_peripheral_init(&config, &handle) == ESP_OK);
+    mock_nimble_sync();
+
+    /* Directed to the newest bond first, then only bonded peers, then everyone. */
+    TEST_CHECK(mock_nimble.last_adv.directed && mock_nimble.last_adv.direct_addr.val[0] == 8);
+    TEST_CHECK(mock_nimble.last_adv.params.conn_mode == BLE_GAP_CONN_MODE_DIR && mock_nimble.last_adv.params.high_duty_cycle);
+    adv_timeout();
+    TEST_CHECK(!mock_nimble.last_adv.directed && mock_nimble.last_adv.params.filter_policy == BLE_HCI_ADV_FILT_BOTH);
+    TEST_CHECK(mock_nimble.last_adv.duration_ms == CONFIG_ESP_NIMBLE_API_RECONNECT_ACCEPT_LIST_MS && mock_nimble.accept_list_count == 2);
+    adv_timeout();
+    TEST_CHECK(mock_nimble.last_adv.params.filter_policy == BLE_HCI_ADV_FILT_NONE && mock_nimble.last_adv.duration_ms == BLE_HS_FOREVER);
+    adv_timeout();
+    TEST_CHECK(mock_nimble.last_adv.params.filter_policy == BLE_HCI_ADV_FILT_NONE);
+
+    /* Another central connecting does not restart the sequence; the next disconnect does. */
+    TEST_SCRIPT("connect 11\n");
+    TEST_CHECK(!mock_nimble.last_adv.directed && mock_nimble.last_adv.params.filter_policy == BLE_HCI_ADV_FILT_NONE);
+    TEST_SCRIPT("disconnect 11\n");
+    TEST_CHECK(mock_nimble.last_adv.directed && mock_nimble.last_adv.direct_addr.val[0] == 8);
+
+    /* A connected peer is left out of the next round. */
+    TEST_SCRIPT("connect 8\n");
+    mock_nimble_set_bonded(8);
+    TEST_SCRIPT("disconnect 8\n"
+                "connect 7\n");
+    mock_nimble_set_bonded(7);
+    struct ble_gap_event enc = {.type = BLE_GAP_EVENT_ENC_CHANGE};
+    enc.enc_change.conn_handle = 7;
+    mock_nimble_gap_event(&enc);
+    TEST_CHECK(mock_nimble.last_adv.directed && mock_nimble.last_adv.direct_addr.val[0] == 8);
+    adv_timeout();
+    TEST_CHECK(mock_nimble.accept_list_count == 1 && mock_nimble.accept_list[0].val[0] == 8);
+
+    /* Encryption with a new peer adds it to the list as the most recent. */
+    TEST_SCRIPT("connect 9\n");
+    mock_nimble_set_bonded(9);
+    enc.enc_change.conn_handle = 9;
+    mock_nimble_gap_event(&enc);
+    TEST_CHECK(nimble_peripheral_bonded_peers(peers, &count, CONFIG_BT_NIMBLE_MAX_BONDS) == ESP_OK);
+    TEST_CHECK(count == 3 && peers[0].val[0] == 9 && peers[1].val[0] == 8 && peers[2].val[0] == 7);
+    TEST_CHECK(mock_nimble.bond_reads == 1);
+
+    /* A full list drops the oldest bond, like the store does. */
+    TEST_SCRIPT("connect 10\n");
+    mock_nimble_set_bonded(10);
+    enc.enc_change.conn_handle = 10;
+    mock_nimble_gap_event(&enc);
+    TEST_CHECK(nimble_peripheral_bonded_peers(peers, &count, 2) == ESP_OK);
+    TEST_CHECK(count == 2 && peers[0].val[0] == 10 && peers[1].val[0] == 9);
+    TEST_CHECK(mock_nimble.bond_reads == 1);
+
+    nimble_peripheral_bonds_invalidate();
+    TEST_CHECK(nimble_peripheral_bonded_peers(peers, &count, CONFIG_BT_NIMBLE_MAX_BONDS) == ESP_OK);
+    TEST_CHECK(count == 2 && peers[0].val[0] == 8 && mock_nimble.bond_reads == 2);
+
+    return test_pass("test_reconnect");
+}
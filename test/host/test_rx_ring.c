@@ -0,0 +1,89 @@
+#include <string.h>
+#include "test_common.h"
+
+static nimble_peripheral_handle_t handle;
+static struct ble_gatt_svc_def services[] = {{0}};
+static nimble_peripheral_config_t config = {.device_name = "host-test", .ble_gatt_services = services};
+static int segments;
+
+static int segment_cb(const uint8_t *data, uint16_t len, void *arg)
+{
+    segments++;
+    return 0;
+}
+
+int main(void)
+{
+    static uint8_t line[600];
+    static char out[1024];
+    size_t len;
+
+    for (size_t i = 0; i < sizeof(line); i++)
+    {
+        line[i] = 'a' + i % 26;
+    }
+    line[299] = '\n';
+
+    test_start(&config, &handle);
+    TEST_SCRIPT("connect 1\n");
+
+    /* A chained mbuf is walked segment by segment without flattening. */
+    struct os_mbuf *om = ble_hs_mbuf_from_flat(line, sizeof(line));
+    TEST_CHECK(SLIST_NEXT(om, om_next) != NULL);
+    TEST_CHECK(nus_process_rx_data(om, out, sizeof(out)) == ESP_OK && strlen(out) == sizeof(line));
+    TEST_CHECK(nus_process_rx_segments(om, segment_cb, NULL) == ESP_OK && segments > 1);
+
+    TEST_CHECK(nimble_peripheral_rx_push(1, om) == ESP_OK);
+    TEST_CHECK(nimble_peripheral_rx_available(0) == sizeof(line));
+    TEST_CHECK(nimble_peripheral_rx_push(1, om) == ESP_ERR_NO_MEM);
+    TEST_CHECK(nimble_peripheral_rx_push(9, om) == ESP_ERR_NOT_FOUND);
+
+    TEST_CHECK(nimble_peripheral_rx_read_until(0, '\n', out, 10, &len) == ESP_ERR_INVALID_SIZE);
+    TEST_CHECK(nimble_peripheral_rx_read_until(0, '\n', out, sizeof(out), &len) == ESP_OK && len == 300);
+    TEST_CHECK(memcmp(out, line, 300) == 0);
+    TEST_CHECK(nimble_peripheral_rx_read_until(0, '\n', out, sizeof(out), &len) == ESP_ERR_NOT_FOUND);
+
+    /* The second push wraps around the end of the ring. */
+    TEST_CHECK(nimble_peripheral_rx_push(1, om) == ESP_OK);
+    TEST_CHECK(nimble_peripheral_rx_read(0, out, 1000) == 900);
+    TEST_CHECK(memcmp(out, line + 300, 300) == 0 && memcmp(out + 300, line, 600) == 0);
+    os_mbuf_free_chain(om);
+
+    uint8_t frames[] = {3, 0, 'x', 'y', 'z', 5, 0, 'a'};
+    om = ble_hs_mbuf_from_flat(frames, sizeof(frames));
+    TEST_CHECK(nimble_peripheral_rx_push(1, om) == ESP_OK);
+    os_mbuf_free_chain(om);
+    TEST_CHECK(nimble_peripheral_rx_read_frame(0, out, sizeof(out), &len) == ESP_OK);
+    TEST_CHECK(len == 3 && memcmp(out, "xyz", 3) == 0);
+    TEST_CHECK(nimble_peripheral_rx_read_frame(0, out, sizeof(out), &len) == ESP_ERR_NOT_FOUND);
+    TEST_CHECK(nimble_peripheral_rx_wait(0, 10) == 3);
+
+    /* Records that can never fit in the ring are reported instead of waited for. */
+    TEST_CHECK(nimble_peripheral_rx_read(0, out, sizeof(out)) == 3);
+    memset(out, 'a', sizeof(out));
+    om = ble_hs_mbuf_from_flat(out, CONFIG_ESP_NIMBLE_API_RX_RING_SIZE - 1);
+    TEST_CHECK(nimble_peripheral_rx_push(1, om) == ESP_OK);
+    os_mbuf_free_chain(om);
+    TEST_CHECK(nimble_peripheral_rx_read_until(0, '\n', out, sizeof(out), &len) == ESP_ERR_NOT_FOUND);
+    om = ble_hs_mbuf_from_flat(out, 1);
+    TEST_CHECK(nimble_peripheral_rx_push(1, om) == ESP_OK);
+    os_mbuf_free_chain(om);
+    TEST_CHECK(nimble_peripheral_rx_read_until(0, '\n', out, sizeof(out), &len) == ESP_ERR_INVALID_SIZE);
+    TEST_CHECK(nimble_peripheral_rx_read(0, out, sizeof(out)) == CONFIG_ESP_NIMBLE_API_RX_RING_SIZE);
+    uint8_t oversized[] = {(CONFIG_ESP_NIMBLE_API_RX_RING_SIZE - 1) & 0xff, (CONFIG_ESP_NIMBLE_API_RX_RING_SIZE - 1) >> 8};
+    om = ble_hs_mbuf_from_flat(oversized, sizeof(oversized));
+    TEST_CHECK(nimble_peripheral_rx_push(1, om) == ESP_OK);
+    os_mbuf_free_chain(om);
+    TEST_CHECK(nimble_peripheral_rx_read_frame(0, out, sizeof(out), &len) == ESP_ERR_INVALID_SIZE);
+    TEST_CHECK(nimble_peripheral_rx_read(0, out, sizeof(out)) == 2);
+
+    /* Slots are handed out round robin; the connection that lands in slot 0 again starts with an empty ring. */
+    TEST_SCRIPT("disconnect 1\n"
+                "connect 2\n"
+                "connect 3\n"
+                "connect 4\n"
+                "expect live 0\n");
+    TEST_CHECK(nimble_peripheral_conn_find(4) == 0 && nimble_peripheral_rx_available(0) == 0);
+
+    return test_pass("test_rx_ring");
+}
@@ -0,0 +1,55 @@
+#include "test_common.h"
+
+static nimble_peripheral_handle_t handle;
+static struct ble_gatt_svc_def services[] = {{0}};
+static nimble_peripheral_config_t config = {.device_name = "host-test", .ble_gatt_services = services};
+static int progress_calls;
+static esp_err_t done_status = ESP_FAIL;
+static bool done;
+
+static void stream_cb(int conn_index, size_t sent, size_t total, esp_err_t status, void *arg)
+{
+    if (status == ESP_ERR_NOT_FINISHED)
+    {
+        progress_calls++;
+        return;
+    }
+    done = true;
+    done_status = status;
+}
+
+int main(void)
+{
+    static uint8_t payload[4000];
+    for (size_t i = 0; i < sizeof(payload); i++)
+    {
+        payload[i] = (uint8_t)i;
+    }
+
+    test_start(&config, &handle);
+    TEST_SCRIPT("connect 1\n"
+                "subscribe 1 10 notify\n"
+                "mtu 1 247\n"
+                "defer on\n");
+
+    TEST_CHECK(nimble_peripheral_stream_send(0, 10, payload, sizeof(payload), stream_cb, NULL) == ESP_OK);
+    TEST_CHECK(nimble_peripheral_stream_send(0, 10, payload, sizeof(payload), stream_cb, NULL) == ESP_ERR_INVALID_STATE);
+    mock_nimble_run_events();
+    while (!done)
+    {
+        TEST_CHECK(mock_nimble_complete_tx(1) == 1);
+        mock_nimble_run_events();
+    }
+    TEST_CHECK(done_status == ESP_OK && progress_calls > 0);
+
+    /* Chunks fill the negotiated MTU minus the ATT header. */
+    TEST_CHECK(mock_nimble.sent_count == 17);
+    TEST_CHECK(mock_nimble.sent[0].len == 244 && mock_nimble.sent[16].len == sizeof(payload) - 16 * 244);
+    TEST_CHECK(mock_nimble.sent[16].data[0] == (uint8_t)(16 * 244));
+
+    TEST_SCRIPT("complete 100\n"
+                "run\n"
+                "expect live 0\n");
+
+    return test_pass("test_stream");
+}
@@ -0,0 +1,55 @@
+#include "test_common.h"
+
+static nimble_peripheral_handle_t handle;
+static struct ble_gatt_svc_def services[] = {{0}};
+static nimble_peripheral_config_t config = {.device_name = "host-test", .ble_gatt_services = services, .tx_pool = true};
+
+int main(void)
+{
+    nimble_peripheral_tx_pool_stats_t stats;
+    uint8_t payload[20] = {0};
+
+    test_start(&config, &handle);
+    TEST_CHECK(nimble_peripheral_tx_pool_stats(NULL) == ESP_ERR_INVALID_ARG);
+    TEST_CHECK(nimble_peripheral_tx_pool_stats(&stats) == ESP_OK);
+    TEST_CHECK(stats.blocks == CONFIG_ESP_NIMBLE_API_TX_POOL_BLOCKS && stats.free == stats.blocks && stats.high_water == 0);
+
+    /* Fan-out duplicates come from the same pool, msys is left alone. */
+    TEST_SCRIPT("connect 1\n"
+                "connect 2\n"
+                "subscribe 1 10 notify\n"
+                "subscribe 2 10 notify\n");
+    int msys_free = os_msys_num_free();
+    for (int i = 0; i < CONFIG_ESP_NIMBLE_API_TX_POOL_BLOCKS / 2; i++)
+    {
+        TEST_CHECK(nimble_peripheral_notify(10, payload, sizeof(payload)) == ESP_OK);
+    }
+    TEST_CHECK(os_msys_num_free() == msys_free);
+    TEST_CHECK(nimble_peripheral_tx_pool_stats(&stats) == ESP_OK && stats.free == 0);
+
+    /* An empty pool fails at once instead of falling back to msys. */
+    TEST_CHECK(nimble_peripheral_notify(10, payload, sizeof(payload)) == ESP_ERR_NO_MEM);
+    TEST_CHECK(nimble_peripheral_indicate(0, 10, payload, sizeof(payload), NULL, NULL) == ESP_ERR_NO_MEM);
+    TEST_CHECK(os_msys_num_free() == msys_free);
+    TEST_CHECK(handle.metrics.mbuf_alloc_failures == 1);
+
+    /* Coalesced records survive a failed flush, and a batch is not sent ahead of them. */
+    TEST_CHECK(nimble_peripheral_coalesce_enable(10, 0) == ESP_OK);
+    TEST_CHECK(nimble_peripheral_notify(10, payload, 4) == ESP_OK);
+    TEST_CHECK(nimble_peripheral_notify_flush(10) == ESP_ERR_NO_MEM);
+    nimble_peripheral_notify_entry_t entry = {.attr_handle = 10, .data = payload, .len = 4};
+    TEST_CHECK(nimble_peripheral_notify_batch(&entry, 1, 0) == ESP_ERR_NO_MEM);
+    TEST_CHECK(handle.metrics.mbuf_alloc_failures == 3);
+
+    TEST_SCRIPT("run\n"
+                "expect sent 8\n");
+    TEST_CHECK(nimble_peripheral_notify_flush(10) == ESP_OK);
+    TEST_SCRIPT("run\n"
+                "expect sent 10\n"
+                "expect live 0\n");
+    TEST_CHECK(mock_nimble.sent[8].len == 6 && mock_nimble.sent[9].len == 6);
+    TEST_CHECK(nimble_peripheral_tx_pool_stats(&stats) == ESP_OK);
+    TEST_CHECK(stats.free == stats.blocks && stats.high_water == CONFIG_ESP_NIMBLE_API_TX_POOL_BLOCKS);
+
+    return test_pass("test_tx_pool");
+}
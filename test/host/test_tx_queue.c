@@ -0,0 +1,51 @@
+#include "test_common.h"
+
+static nimble_peripheral_handle_t handle;
+static struct ble_gatt_svc_def services[] = {{0}};
+static nimble_peripheral_config_t config = {.device_name = "host-test", .ble_gatt_services = services};
+
+int main(void)
+{
+    test_start(&config, &handle);
+
+    /* Notifications are queued and only handed to the host by the pump event. */
+    TEST_SCRIPT("connect 1\n"
+                "connect 2\n"
+                "subscribe 1 10 notify\n"
+                "subscribe 2 10 notify\n"
+                "notify 10 3\n"
+                "expect sent 0\n"
+                "run\n"
+                "expect sent 2\n");
+
+    /* With completions held back producers stop at the watermark. */
+    mock_nimble.defer_notify_tx = true;
+    uint8_t data[3] = {0, 1, 0};
+    int accepted = 0;
+    int refused = 0;
+    for (int i = 0; i < 30; i++)
+    {
+        esp_err_t err = nimble_peripheral_notify(10, data, sizeof(data));
+        accepted += err == ESP_OK;
+        refused += err == ESP_ERR_TIMEOUT;
+    }
+    TEST_CHECK(accepted == CONFIG_ESP_NIMBLE_API_TX_QUEUE_WATERMARK && refused == 30 - accepted);
+
+    /* Each connection gets its credits, served round robin. */
+    mock_nimble_run_events();
+    TEST_CHECK(mock_nimble.sent_count == 2 + 2 * CONFIG_ESP_NIMBLE_API_TX_CREDITS);
+    TEST_CHECK(mock_nimble.sent[2].conn_handle != mock_nimble.sent[3].conn_handle);
+    mock_nimble_complete_tx(100);
+    mock_nimble_run_events();
+    TEST_CHECK(mock_nimble.sent_count == 2 + 2 * 2 * CONFIG_ESP_NIMBLE_API_TX_CREDITS);
+
+    TEST_SCRIPT("defer off\n"
+                "complete 100\n"
+                "run\n"
+                "expect sent 26\n");
+    TEST_CHECK(nimble_peripheral_notify_wait(10, data, sizeof(data), 5) == ESP_OK);
+    TEST_SCRIPT("run\n"
+                "expect live 0\n");
+
+    return test_pass("test_tx_queue");
+}